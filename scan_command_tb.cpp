@@ -7,24 +7,23 @@
 #include <cstring>
 #include "Vu765_test.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
+#include "u765_plusargs.h"
+#include "u765_sim.h"
 
 double sc_time_stamp() {
     return 0;
 }
 
-static Vu765_test *tb;
-static VerilatedVcdC *trace;
-static int tickcount;
-
-static unsigned char sdbuf[512];
-static FILE *edsk;
-static int reading;
-static int read_ptr;
+// Model, images, traces and tick counter: the whole simulation state
+static U765Sim *sim;
+static unsigned char sdbuf[512];  // last sector read by cmd_read_data
+static Checkpointer checkpoints;
+static int warm_track = -1;  // track drive A: was left on by the prologue, -1 = not done
+static int fast_mode;
 
 // Structure for tracking scan operation results
 struct ScanResult {
-    int timestamp;
+    uint64_t timestamp;
     int status0;
     int status1;
     int status2;
@@ -39,176 +38,49 @@ static std::vector<ScanResult> scan_results;
 // Buffer for test data to be compared with sector data
 static uint8_t compare_data[512];
 
-// Flags for TC and interrupts
-static bool tc_active = false;
-static bool int_out_active = false;
-static bool int_out_previous = false;
-
-// Function to read a block from the disk image
-int img_read(int sd_rd) {
-    if (!sd_rd) return 0;
-    printf("img_read: %02x lba: %d\n", sd_rd, tb->sd_lba);
-    int lba = tb->sd_lba;
-    fseek(edsk, lba << 9, SEEK_SET);
-    fread(&sdbuf, 512, 1, edsk);
-    reading = 1;
-    read_ptr = 0;
-    return 0;
-}
 
-// Basic clock cycle
+// Bus cycles of the u765 (see U765Sim)
 void tick(int c) {
-    static int sd_rd = 0;
-    static int sd_wr = 0;
-
-    tb->clk_sys = c;
-    
-    // Handle TC signal
-    tb->tc = tc_active ? 1 : 0;
-    
-    // Detect rising edges on int_out
-    int_out_previous = int_out_active;
-    int_out_active = tb->int_out;
-    
-    tb->eval();
-    trace->dump(tickcount++);
-
-    if (c) {
-        if (reading) {
-            tb->sd_ack = 1;
-            tb->sd_buff_wr = 1;
-            tb->sd_buff_dout = sdbuf[read_ptr];
-            tb->sd_buff_addr = read_ptr;
-            read_ptr++;
-            if (read_ptr == 512) reading = 0;
-        } else {
-            tb->sd_ack = 0;
-            tb->sd_buff_wr = 0;
-        }
-
-        if (sd_rd != tb->sd_rd) img_read(tb->sd_rd);
-        sd_rd = tb->sd_rd;
-        
-        // Handle SD write operations (for completeness)
-        if (tb->sd_wr && !sd_wr) {
-            printf("SD Write request to LBA %d\n", tb->sd_lba);
-            tb->sd_ack = 1; 
-        } else if (!tb->sd_wr && sd_wr) {
-            tb->sd_ack = 0;
-        }
-        sd_wr = tb->sd_wr;
-    }
+    sim->tick(c);
 }
 
 void wait(int t) {
-    for (int i=0; i<t; i++) {
-        tick(1);
-        tick(0);
-    }
+    sim->wait(t);
 }
 
 // Read the u765 status register
 int readstatus() {
-    int dout;
-
-    tb->a0 = 0;
-    tick(1);
-    tick(0);
-    tb->nRD = 0;
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    dout = tb->dout;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    
-    // Interpret status register bits
-    printf("READ STATUS = 0x%02x [ ", dout);
-    if (dout & 0x80) printf("RQM ");
-    if (dout & 0x40) printf("DIO ");
-    if (dout & 0x20) printf("EXM ");
-    if (dout & 0x10) printf("CB ");
-    if (dout & 0x08) printf("D3B ");
-    if (dout & 0x04) printf("D2B ");
-    if (dout & 0x02) printf("D1B ");
-    if (dout & 0x01) printf("D0B ");
-    printf("]\n");
-    
-    return dout;
+    return sim->readstatus();
 }
 
 // Send a byte to the u765 controller with timeout
 void sendbyte(int byte, int timeout_ms = 1000) {
-    int timeout_ticks = timeout_ms * 100; // Rough approximation
-    int counter = 0;
-    
-    // Wait for controller to be ready with timeout
-    while ((readstatus() & 0xcf) != 0x80) {
-        counter++;
-        if (counter >= timeout_ticks) {
-            printf("TIMEOUT: Controller not ready to receive byte after %d ms\n", timeout_ms);
-            printf("Last status: 0x%02x\n", readstatus());
-            return;
-        }
-        
-        // Don't check status too frequently
-        wait(10);
+    // Wait for controller to be ready with timeout, watching RQM/DIO without bus cycles
+    if (sim->wait_status(0xcf, 0x80, (uint64_t)timeout_ms * sim->cycles) < 0) {
+        printf("TIMEOUT: Controller not ready to receive byte after %d ms\n", timeout_ms);
+        printf("Last status: 0x%02x\n", sim->last_status);
+        return;
     }
     
     // Send the byte
-    tb->a0 = 1;
-    tick(1);
-    tick(0);
-    tb->nRD = 1;
-    tb->nWR = 0;
-    tb->din = byte;
-    printf("Sending byte: 0x%02x\n", byte);
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
+    if (sim->verbose) printf("Sending byte: 0x%02x\n", byte);
+    sim->buswrite(byte);
 }
 
 // Read a byte from the u765 controller with timeout
 int readbyte(int timeout_ms = 1000) {
     int byte;
-    int timeout_ticks = timeout_ms * 100; // Rough approximation
-    int counter = 0;
     
     // Wait for controller to be ready with timeout
-    while ((readstatus() & 0xcf) != 0xc0) {
-        counter++;
-        if (counter >= timeout_ticks) {
-            printf("TIMEOUT: Controller not ready to provide data after %d ms\n", timeout_ms);
-            printf("Last status: 0x%02x\n", readstatus());
-            return -1;
-        }
-        
-        // Don't check status too frequently
-        wait(10);
+    if (sim->wait_status(0xcf, 0xc0, (uint64_t)timeout_ms * sim->cycles) < 0) {
+        printf("TIMEOUT: Controller not ready to provide data after %d ms\n", timeout_ms);
+        printf("Last status: 0x%02x\n", sim->last_status);
+        return -1;
     }
     
     // Read the byte
-    tb->a0 = 1;
-    tick(1);
-    tick(0);
-    tb->nRD = 0;
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    byte = tb->dout;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    printf("READ DATA = 0x%02x\n", byte);
+    byte = sim->busread();
+    if (sim->verbose) printf("READ DATA = 0x%02x\n", byte);
     return byte;
 }
 
@@ -218,7 +90,7 @@ void read_result(const char* operation) {
     
     // Create a new scan result entry
     ScanResult result;
-    result.timestamp = tickcount;
+    result.timestamp = sim->tickcount;
     result.operation = operation;
     
     // ST0
@@ -270,13 +142,20 @@ void read_result(const char* operation) {
 
 // Set Terminal Count status
 void set_tc(bool active) {
-    tc_active = active;
+    sim->tc_active = active;
     printf("Setting TC to %s\n", active ? "ACTIVE" : "INACTIVE");
 }
 
 // Check if interrupt is active
 bool check_int_out() {
-    return int_out_active;
+    return sim->int_out_active;
+}
+
+// Wait for the interrupt of a seek or recalibrate on int_out, no bus cycles
+bool wait_interrupt() {
+    if (sim->wait_int()) return true;
+    printf("TIMEOUT: no interrupt\n");
+    return false;
 }
 
 // Acknowledge an interrupt
@@ -313,39 +192,16 @@ void cmd_read_data(int c, int h, int r, int n, int eot, int gpl, int dtl) {
     sendbyte(gpl);     // Gap length
     sendbyte(dtl);     // Data length (if N=0)
     
-    // Read data bytes
-    int status, byte;
-    int offset = 0;
-    
-    while(true) {
-        status = readstatus();
-        if ((status & 0xe0) != 0xa0) {
-            // End of read
-            break;
-        }
-        
-        tb->a0 = 1;
-        tb->nRD = 0;
-        tb->nWR = 1;
-        tick(1);
-        tick(0);
-        tick(1);
-        tick(0);
-        byte = tb->dout;
-        tb->nRD = 1;
-        tick(1);
-        tick(0);
-        
-        // Store for later comparison
-        if (offset < 512) {
-            sdbuf[offset] = byte;
+    // Read data bytes, the first 512 are kept for later comparison
+    int offset = sim->read_exec(sdbuf, sizeof(sdbuf));
+    if (sim->verbose) {
+        for (int i = 0; i < offset && i < (int)sizeof(sdbuf); i++) {
+            printf("%02x ", sdbuf[i]);
+            if (((i + 1) % 16) == 0) printf("\n");
         }
-        
-        printf("%02x ", byte);
-        offset++;
-        if ((offset % 16) == 0) printf("\n");
+        printf("\n");
     }
-    printf("\n");
+    printf("Read %d data bytes\n", offset);
     
     // Read result bytes
     read_result("READ DATA");
@@ -364,29 +220,22 @@ void cmd_scan_equal(int c, int h, int r, int n, int eot, int gpl, int stp) {
     sendbyte(stp);     // Step
     
     // AHORA: Enviar datos byte a byte para comparación
-    int status;
     int offset = 0;
     int sector_size = (n == 2) ? 512 : 128 << n;
     
     printf("Sending %d bytes for comparison...\n", sector_size);
     
     while(offset < sector_size) {
-        // Esperar a que el controlador esté listo para recibir datos
-        do {
-            status = readstatus();
-        } while ((status & 0xcf) != 0x80);
-        
-        // Enviar byte de comparación
+        // Enviar byte de comparación (sendbyte espera a que el controlador esté listo)
         sendbyte(compare_data[offset]);
         
-        printf("%02x ", compare_data[offset]);
         offset++;
-        if ((offset % 16) == 0) printf("\n");
+        if (sim->verbose) {
+            printf("%02x ", compare_data[offset - 1]);
+            if ((offset % 16) == 0) printf("\n");
+        }
     }
-    printf("\n");
-    
-    // Esperar un poco para procesar
-    wait(500);
+    if (sim->verbose) printf("\n");
     
     // Leer resultado
     cmd_sense_interrupt();
@@ -409,29 +258,22 @@ void cmd_scan_low_or_equal(int c, int h, int r, int n, int eot, int gpl, int stp
     sendbyte(stp);     // Step
     
     // AHORA: Enviar datos byte a byte para comparación
-    int status;
     int offset = 0;
     int sector_size = (n == 2) ? 512 : 128 << n;
     
     printf("Sending %d bytes for comparison...\n", sector_size);
     
     while(offset < sector_size) {
-        // Esperar a que el controlador esté listo para recibir datos
-        do {
-            status = readstatus();
-        } while ((status & 0xcf) != 0x80);
-        
-        // Enviar byte de comparación
+        // Enviar byte de comparación (sendbyte espera a que el controlador esté listo)
         sendbyte(compare_data[offset]);
         
-        printf("%02x ", compare_data[offset]);
         offset++;
-        if ((offset % 16) == 0) printf("\n");
+        if (sim->verbose) {
+            printf("%02x ", compare_data[offset - 1]);
+            if ((offset % 16) == 0) printf("\n");
+        }
     }
-    printf("\n");
-    
-    // Esperar un poco para procesar
-    wait(500);
+    if (sim->verbose) printf("\n");
     
     // Leer resultado
     read_result("SCAN EQUAL");
@@ -451,29 +293,22 @@ void cmd_scan_high_or_equal(int c, int h, int r, int n, int eot, int gpl, int st
     sendbyte(stp);     // Step
     
     // AHORA: Enviar datos byte a byte para comparación
-    int status;
     int offset = 0;
     int sector_size = (n == 2) ? 512 : 128 << n;
     
     printf("Sending %d bytes for comparison...\n", sector_size);
     
     while(offset < sector_size) {
-        // Esperar a que el controlador esté listo para recibir datos
-        do {
-            status = readstatus();
-        } while ((status & 0xcf) != 0x80);
-        
-        // Enviar byte de comparación
+        // Enviar byte de comparación (sendbyte espera a que el controlador esté listo)
         sendbyte(compare_data[offset]);
         
-        printf("%02x ", compare_data[offset]);
         offset++;
-        if ((offset % 16) == 0) printf("\n");
+        if (sim->verbose) {
+            printf("%02x ", compare_data[offset - 1]);
+            if ((offset % 16) == 0) printf("\n");
+        }
     }
-    printf("\n");
-    
-    // Esperar un poco para procesar
-    wait(500);
+    if (sim->verbose) printf("\n");
     
     // Leer resultado
     read_result("SCAN EQUAL");
@@ -482,17 +317,12 @@ void cmd_scan_high_or_equal(int c, int h, int r, int n, int eot, int gpl, int st
 }
 
 // Mount a disk image
-void mount(FILE *edsk, int dno) {
-    int fsize;
-
-    fseek(edsk, 0, SEEK_END);
-    fsize = ftell(edsk);
-    tb->img_size = fsize;
-    tb->img_mounted = 1<<dno;
-    tick(1);
-    tick(0);
-    tb->img_mounted = 0;
-    wait(1000);
+bool mount(const char *path, int dno) {
+    if (!sim->mount(path, dno)) {
+        printf("Cannot open disk image: %s\n", path);
+        return false;
+    }
+    return true;
 }
 
 // Prepare test data for SCAN comparison
@@ -572,50 +402,73 @@ void analyze_scan_results() {
     printf("ST2 bits correctly set: %s\n", correct_st2_bits ? "Yes" : "No");
 }
 
+// Harness state that goes with the model into a checkpoint
+static void save_harness(VerilatedSerialize &os) {
+    sim->save(os);
+    ckpt_put(os, warm_track);
+    ckpt_put(os, sdbuf);
+    ckpt_put(os, compare_data);
+}
+
+static bool restore_harness(VerilatedDeserialize &is) {
+    bool ok = sim->restore(is);
+    ckpt_get(is, warm_track);
+    ckpt_get(is, sdbuf);
+    ckpt_get(is, compare_data);
+    return ok;
+}
+
 // Run a complete test of all SCAN functions
 void test_scan_functions() {
     printf("\n=== TESTING uPD765 SCAN FUNCTIONS ===\n");
     
     // We'll use the initialization from main() to avoid reset issues
     
-    // First, let's explicitly specify parameters to ensure controller is configured
-    printf("\n-- Initialization: Setting controller parameters with SPECIFY command --\n");
-    sendbyte(0x03, 2000); // SPECIFY command with longer timeout
-    wait(100);
-    sendbyte(0x8F, 2000); // SRT=8, HUT=F
-    wait(100);
-    sendbyte(0x05, 2000); // HLT=5 ms, Non-DMA mode
-    wait(500);
-    
-    printf("Controller status after SPECIFY: 0x%02x\n", readstatus());
+    // Steps 1 and 2 are skipped when restoring the "mounted" or "track10" checkpoints
+    if (warm_track < 0) {
+        // First, let's explicitly specify parameters to ensure controller is configured
+        printf("\n-- Initialization: Setting controller parameters with SPECIFY command --\n");
+        sendbyte(0x03, 2000); // SPECIFY command with longer timeout
+        sendbyte(0x8F, 2000); // SRT=8, HUT=F
+        sendbyte(0x05, 2000); // HLT=5 ms, Non-DMA mode
+        // SPECIFY raises an interrupt in this core, it shows up right away
+        sim->wait_int(16);
+        
+        printf("Controller status after SPECIFY: 0x%02x\n", readstatus());
+    }
     
     // Prepare test data
     prepare_test_data();
     
-    // 1. First, recalibrate to track 0
-    printf("\n-- Step 1: Recalibrate drive --\n");
-    cmd_recalibrate();
-    wait(1000);
-    
-    // Handle interrupt
-    if (check_int_out()) {
-        cmd_sense_interrupt();
+    if (warm_track < 0) {
+        // 1. First, recalibrate to track 0
+        printf("\n-- Step 1: Recalibrate drive --\n");
+        cmd_recalibrate();
+        
+        // Handle interrupt
+        if (wait_interrupt()) {
+            cmd_sense_interrupt();
+        }
+        warm_track = 0;
+        checkpoints.save(sim->tb, "mounted");
     }
     
-    // 2. Seek to a test track (track 10)
-    printf("\n-- Step 2: Seek to track 10 --\n");
-    cmd_seek(10);
-    wait(1000);
-    
-    // Handle interrupt
-    if (check_int_out()) {
-        cmd_sense_interrupt();
+    if (warm_track != 10) {
+        // 2. Seek to a test track (track 10)
+        printf("\n-- Step 2: Seek to track 10 --\n");
+        cmd_seek(10);
+        
+        // Handle interrupt
+        if (wait_interrupt()) {
+            cmd_sense_interrupt();
+        }
+        warm_track = 10;
+        checkpoints.save(sim->tb, "track10");
     }
     
     // 3. Read sector 1 to see what's in it
     printf("\n-- Step 3: Read track 10, sector 1 to analyze content --\n");
     cmd_read_data(10, 0, 1, 2, 9, 0x2A, 0xFF);
-    wait(100);
     
     // 4. Modify our test data based on what we read
     printf("\n-- Step 4: Preparing comparison data --\n");
@@ -628,7 +481,6 @@ void test_scan_functions() {
     printf("\n-- Step 5: SCAN EQUAL with exact match --\n");
     //cmd_scan_equal(10, 0, 1, 2, 9, 0x2A, 1);
     cmd_scan_equal(0, 0, 1, 2, 5, 0x2A, 1);
-    wait(100);
     
     // 6. Test SCAN EQUAL with non-matching data
     printf("\n-- Step 6: SCAN EQUAL with non-matching data --\n");
@@ -637,7 +489,6 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i] ^ 0xFF; // Invert bits
     }
     cmd_scan_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 7. Test SCAN LOW OR EQUAL with data higher than sector
     printf("\n-- Step 7: SCAN LOW OR EQUAL with data higher than sector --\n");
@@ -646,7 +497,6 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i] + 10;
     }
     cmd_scan_low_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 8. Test SCAN LOW OR EQUAL with data equal to sector
     printf("\n-- Step 8: SCAN LOW OR EQUAL with data equal to sector --\n");
@@ -655,7 +505,6 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i];
     }
     cmd_scan_low_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 9. Test SCAN LOW OR EQUAL with data lower than sector
     printf("\n-- Step 9: SCAN LOW OR EQUAL with data lower than sector --\n");
@@ -664,13 +513,11 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i] - 10;
     }
     cmd_scan_low_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 10. Test SCAN HIGH OR EQUAL with data lower than sector
     printf("\n-- Step 10: SCAN HIGH OR EQUAL with data lower than sector --\n");
     // Keep compare data lower than sector data
     cmd_scan_high_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 11. Test SCAN HIGH OR EQUAL with data equal to sector
     printf("\n-- Step 11: SCAN HIGH OR EQUAL with data equal to sector --\n");
@@ -679,7 +526,6 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i];
     }
     cmd_scan_high_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 12. Test SCAN HIGH OR EQUAL with data higher than sector
     printf("\n-- Step 12: SCAN HIGH OR EQUAL with data higher than sector --\n");
@@ -688,7 +534,6 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i] + 10;
     }
     cmd_scan_high_or_equal(10, 0, 1, 2, 9, 0x2A, 1);
-    wait(100);
     
     // 13. Test STP parameter with value 2 (skip every other sector)
     printf("\n-- Step 13: SCAN EQUAL with STP=2 --\n");
@@ -697,91 +542,106 @@ void test_scan_functions() {
         compare_data[i] = sdbuf[i];
     }
     cmd_scan_equal(10, 0, 1, 2, 9, 0x2A, 2);
-    wait(100);
     
     // 14. Test multi-sector scan with EOT > sector
     printf("\n-- Step 14: SCAN EQUAL with multi-sector (EOT=3) --\n");
     cmd_scan_equal(10, 0, 1, 2, 3, 0x2A, 1);
-    wait(200);
     
     // Analyze the results
     analyze_scan_results();
 }
 
 int main(int argc, char **argv) {
+    Verilated::commandArgs(argc, argv);
+    std::vector<char *> args = plusargs_init(argc, argv);
+    argc = args.size();
+    argv = args.data();
+
     // Verify command line arguments
     if (argc < 2) {
-        printf("Usage: %s <disk_image.dsk> [debug_level]\n", argv[0]);
+        printf("Usage: %s <disk_image.dsk> [debug_level] [fast_mode]\n", argv[0]);
         printf("  debug_level: 0=regular test, 1=diagnostic only\n");
+        printf("  fast_mode: turbo mask, 0=accurate, 1=seek, 2=rotation, 4=head load,\n");
+        printf("             8=SD wait, 15=all\n");
+        printf("  +drive_b=image.dsk  mount a second image on drive B:\n");
+        printf("  +trace=off|full|trig  FST waveform capture (default trig, see u765_trace.h)\n");
+        printf("  +trig_state=S +trig_cmd=S +trig_int +trig_from=N +trig_to=M  triggers\n");
+        printf("  +trace_pre=N  ticks before a trigger, top level ports only, in a separate .pre.vcd;\n");
+        printf("             for the internals before an event use +trig_from/+trig_to\n");
+        printf("  +verbose  print every status poll and data byte\n");
+        printf("  +poll  wait for RQM with status register reads (old driver)\n");
+        printf("  +drv_timeout=N  cycles a wait for RQM or an interrupt gives up after\n");
+        printf("  +rec_size=N +rec_dump=N +rec_file=f +rec_exit  flight recorder (u765_recorder.h)\n");
+        printf("  +wd_ticks=N +wd_abort=0  hang watchdog\n");
+        printf("  +profile +profile_csv=f +profile_khz=N  per command latency (u765_profile.h)\n");
+        printf("  +state_profile +state_top=N  FSM state residency and transitions\n");
+        printf("  +ckpt_save=prefix +ckpt_restore=f  checkpoints after recalibrate and seek (u765_checkpoint.h)\n");
+        printf("  +lockstep +lockstep_tol=N +lockstep_fatal  check against the model (u765_lockstep.h)\n");
         return -1;
     }
 
     // Debug level (0=regular, 1=diagnostic only)
     int debug_level = (argc > 2) ? atoi(argv[2]) : 0;
+    fast_mode = (argc > 3) ? (strtol(argv[3], NULL, 0) & U765_FAST_ALL) : 0;
 
-    // Initialize disk for testing
-    edsk = fopen(argv[1], "rb");
-    if (!edsk) {
-        printf("Cannot open disk image: %s\n", argv[1]);
-        return -1;
-    }
+    // Create the model with its own context (reads the trace and recorder plusargs)
+    sim = new U765Sim("u765_scan_test.fst");
 
-    // Initialize Verilator
-    Verilated::commandArgs(argc, argv);
-    Verilated::traceEverOn(true);
-    trace = new VerilatedVcdC;
-    tickcount = 0;
-
-    // Create test bench instance
-    tb = new Vu765_test;
-    tb->trace(trace, 99);
-    trace->open("u765_scan_test.vcd");
-
-    // Initial configuration
-    printf("Resetting controller...\n");
-    tb->reset = 1;
-    tb->ce = 1;
-    tb->nWR = 1;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    wait(10);
-    tb->reset = 0;
-    wait(100);
-
-    printf("Checking initial controller status...\n");
-    int status = readstatus();
-    printf("Initial status: 0x%02x\n", status);
-    
-    // Set motor, ready and density flags
-    printf("Setting up drive parameters...\n");
-    tb->motor = 3;       // Motor on for both drives
-    tb->ready = 3;       // Both drives ready
-    tb->available = 3;   // Both drives available
-    tb->density = 3;     // Double density (CF2DD) for both drives
-    wait(100);
-    
-    status = readstatus();
-    printf("Status after setup: 0x%02x\n", status);
-
-    reading = 0;
-    printf("Mounting disk image...\n");
-    mount(edsk, 0);
-    wait(1000);
-    
-    status = readstatus();
-    printf("Status after mount: 0x%02x\n", status);
-    
-    // Check if RQM bit is active - if not, the controller might be in a bad state
-    if (!(status & 0x80)) {
-        printf("WARNING: Controller not ready (RQM bit not set)\n");
-        printf("Trying to reset again...\n");
-        tb->reset = 1;
-        wait(50);
-        tb->reset = 0;
-        wait(100);
+    checkpoints.configure();
+    checkpoints.save_harness = save_harness;
+    checkpoints.restore_harness = restore_harness;
+
+    int status;
+    if (checkpoints.restoring()) {
+        // The checkpoint already went through reset, mount, SPECIFY and positioning
+        if (!checkpoints.restore(sim->tb)) return -1;
+        if (argc > 3) sim->tb->fast = fast_mode;
+        else fast_mode = sim->tb->fast;
+        report_fast_mode(fast_mode);
+    } else {
+        // Initial configuration
+        printf("Resetting controller...\n");
+        sim->tb->reset = 1;
+        sim->tb->ce = 1;
+        sim->tb->nWR = 1;
+        sim->tb->nRD = 1;
+        sim->tb->fast = fast_mode;
+        tick(1);
+        tick(0);
+        sim->reset();
+
+        report_fast_mode(fast_mode);
+
+        printf("Checking initial controller status...\n");
         status = readstatus();
-        printf("Status after second reset: 0x%02x\n", status);
+        printf("Initial status: 0x%02x\n", status);
+    
+        // Set motor, ready and density flags
+        printf("Setting up drive parameters...\n");
+        sim->tb->motor = 3;       // Motor on for both drives
+        sim->tb->ready = 3;       // Both drives ready
+        sim->tb->available = 3;   // Both drives available
+        sim->tb->density = 3;     // Double density (CF2DD) for both drives
+    
+        status = readstatus();
+        printf("Status after setup: 0x%02x\n", status);
+
+        printf("Mounting disk image...\n");
+        if (!mount(argv[1], 0)) return -1;
+        std::string drive_b = plusarg_str("drive_b", "");
+        if (!drive_b.empty() && !mount(drive_b.c_str(), 1)) return -1;
+    
+        status = readstatus();
+        printf("Status after mount: 0x%02x\n", status);
+    
+        // Check if RQM bit is active - if not, the controller might be in a bad state
+        if (!(status & 0x80)) {
+            printf("WARNING: Controller not ready (RQM bit not set)\n");
+            printf("Trying to reset again...\n");
+            sim->reset(50);
+            status = readstatus();
+            printf("Status after second reset: 0x%02x\n", status);
+        }
     }
 
     if (debug_level == 0) {
@@ -805,16 +665,23 @@ int main(int argc, char **argv) {
             }
         }
         
-        wait(100);
+        sim->wait_int(16);  // SPECIFY raises an interrupt in this core
         status = readstatus();
         printf("Final status: 0x%02x\n", status);
     }
     
+    if (sim->watchdog.trips) printf("Watchdog: %d trip(s)\n", sim->watchdog.trips);
+    if (plusarg_flag("rec_exit")) sim->recorder.dump();
+    if (sim->profiler.enabled) sim->profiler.report();
+    if (sim->states.enabled) sim->states.report(stdout, sim->profiler.khz);
+    if (sim->images.storage.enabled) sim->images.storage.report();
+    if (sim->lockstep.enabled) {
+        sim->lockstep.verify_images(sim->images);
+        sim->lockstep.report();
+    }
+
     // Close files and free resources
-    fclose(edsk);
-    trace->close();
-    delete tb;
-    delete trace;
+    delete sim;
     
     return 0;
 }
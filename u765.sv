@@ -31,18 +31,60 @@
 // For accurate head stepping rate, set CYCLES to cycles/ms
 // 4MHz = 4000 (default).  If a faster clock is fed in, this will just speed up the simulation in line
 // SPECCY_SPEEDLOCK_HACK: auto mess-up weak sector on C0H0S2
+// fast: per-subsystem turbo knobs, each bit gives up one piece of timing accuracy
+//   bit 0 - seek: immediate seek, no head stepping (a 1 bit wide "fast" keeps its old meaning)
+//   bit 1 - rotation: no rotational latency, the requested sector is always under the head
+//   bit 2 - head load: no head load delay (HLT from SPECIFY)
+//   bit 3 - SD wait: release the SD handshake as soon as sd_ack drops
+// DMA: SPECIFY with ND=0 moves the execution phase data to the drq/dack handshake. drq asks
+// for one byte, a rd or wr cycle with dack set moves it (a0 is ignored), tc ends the transfer.
+// RQM, EXM and the per byte interrupt stay low as on the real chip.
+// TRACKINFO_CACHE_BITS: the Track-Info blocks of the last 2^n cylinders of every drive are
+// kept in the sector buffer RAM, tagged with drive/cylinder/head. A seek back to one of them
+// takes the sector count and sector info list from there instead of reading the SD card.
+// TRACK_PREFETCH: the first read on a track loads 2^TRACK_BUFFER_BITS bytes of the image,
+// starting at its Track-Info block, into a track buffer in one pass. The sectors of read
+// commands that fall in it are served from there without an SD round trip. Writes to the
+// drive drop the buffer.
+// WRITE_BACK: written sector data stays in the sector buffer, marked dirty, until the LBA
+// changes, the head changes (MT) or the FDC goes idle, so the sectors sharing an LBA go to
+// the SD card in one write. sd_writes_saved counts the SD writes merged that way.
+// img_mounted on a drive whose buffer is dirty waits for the flush, which goes to the old
+// image: the host keeps serving it until prepare of the drive drops.
+// WRITE_BACK=0 writes every sector through as soon as it is complete.
+// DRIVES: 1 to 4 drives, selected by US1/US0 of the command bytes. The per-drive ports are
+// DRIVES bits wide. The drive state is kept for 2 (DRIVES <= 2) or 4 drive numbers, the
+// ones past DRIVES never become ready.
+// RPM: disk speed. Every drive keeps the angle of its disk from the index hole, and the
+// sector under each head follows from it and from the geometry of the loaded track: sector
+// count, size, GAP#3 and data rate (250 kbps, 500 kbps for tracks that only fit at that
+// rate). A seek lands the head wherever the disk is at that moment. Needs CYCLES >= 63.
+// TRACE_LEVEL/TRACE_MASK: debug messages, see U765_TRACE. Off by default.
+
+// Debug trace of the FSM. TRACE_LEVEL 0 compiles every message out, 1 prints the command
+// level events, 2 also the ones of every FSM pass and data byte. TRACE_MASK has one bit per
+// subsystem (TR_*). It expands to a bare if, keep it inside begin/end.
+`define U765_TRACE(sub, lvl) if (TRACE_LEVEL >= (lvl) && TRACE_MASK[sub])
 
 
 module u765 #(
     parameter CYCLES = 20'd4000,
-    SPECCY_SPEEDLOCK_HACK = 0
+    SPECCY_SPEEDLOCK_HACK = 0,
+    TRACKINFO_CACHE_BITS = 2,
+    TRACK_PREFETCH = 0,
+    TRACK_BUFFER_BITS = 13,
+    WRITE_BACK = 1,
+    DRIVES = 2,
+    RPM = 300,
+    TRACE_LEVEL = 0,
+    TRACE_MASK = 8'hff
 ) (
     input  wire        clk_sys,    // sys clock
     input  wire        ce,         // chip enable
     input  wire        reset,      // reset
-    input  wire  [1:0] ready,      // disk is inserted in MiST(er)
-    input  wire  [1:0] motor,      // drive motor
-    input  wire  [1:0] available,  // drive available (fake ready signal for SENSE DRIVE command)
+    input  wire  [DRIVES-1:0] ready,      // disk is inserted in MiST(er)
+    input  wire  [DRIVES-1:0] motor,      // drive motor
+    input  wire  [DRIVES-1:0] available,  // drive available (fake ready signal for SENSE DRIVE command)
     input  wire        a0,
     input  wire        nRD,        // i/o read
     input  wire        nWR,        // i/o write
@@ -50,31 +92,47 @@ module u765 #(
     output logic [7:0] dout,       // i/o data out
 
     input  wire        tc,            // terminal count (terminate)
+    output logic       drq,           // DMA request, only when SPECIFY cleared ND
+    input  wire        dack,          // DMA acknowledge, data register access without a0
     output logic       int_out,       // Output interrupt line
-    input  wire  [1:0] density,       // CF2 = 0, CF2DD = 1
+    input  wire  [DRIVES-1:0] density,  // CF2 = 0, CF2DD = 1
     output logic       activity_led,  // Activity LED
-    input  wire        fast,          // Fast mode   
-    output wire  [ 1:0] prepare,
-    input  wire  [ 1:0] img_mounted,   // signaling that new image has been mounted
-    input  wire  [ 1:0] img_wp,        // write protect. latched at img_mounted
+    input  wire  [3:0] fast,          // Fast mode knobs (see above)
+    output wire  [DRIVES-1:0] prepare,
+    input  wire  [DRIVES-1:0] img_mounted,  // signaling that new image has been mounted
+    input  wire  [DRIVES-1:0] img_wp,       // write protect. latched at img_mounted
     input  wire  [31:0] img_size,      // size of image in bytes
     output logic [31:0] sd_lba,
-    output logic [ 1:0] sd_rd,
-    output logic [ 1:0] sd_wr,
-    input  wire  [ 1:0] sd_ack,
+    output logic [DRIVES-1:0] sd_rd,
+    output logic [DRIVES-1:0] sd_wr,
+    input  wire  [DRIVES-1:0] sd_ack,
     input  wire  [ 8:0] sd_buff_addr,
     input  wire  [ 7:0] sd_buff_dout,
     output logic [ 7:0] sd_buff_din,
     input  wire         sd_buff_wr,
 
-    output logic [7:0] old_state
+    output logic [7:0] old_state,
+    output logic [7:0] fsm_state,      // internal FSM state, for debug triggers
+    output logic [15:0] sd_writes_saved  // SD writes merged by the write-back buffer
 );
 
   //localparam OVERRUN_TIMEOUT = 26'd35000000;
   // This should equal 13 us
   localparam OVERRUN_TIMEOUT = CYCLES * 10'd100;  // 13us seconds assuming base clock of 4Mhz
-  // Sector time - We are going to fix this to 9 sectors per track for PCW
-  localparam SECTOR_TIME = ((CYCLES * 20'd200) / 20'd9) / 20'd4;  // SECTOR time for timing of disk speed.
+  // The mechanics of each drive run every cycle. They used to run on alternate cycles,
+  // the SRT step unit keeps the timing it had then
+  localparam STEP_UNIT = CYCLES * 20'd2;  // SRT counts 2 ms units, as at 250 kbps
+
+  // Disk rotation. The angle counts byte times at 500 kbps, a 250 kbps byte takes two
+  localparam ROT_CYCLES = CYCLES * 60000 / RPM;  // cycles per revolution
+  localparam TRACK_UNITS = 3750000 / RPM;  // byte times per revolution
+  localparam TRACK_PRE_BYTES = 146;  // GAP 4a, sync, index mark, GAP 1
+  localparam SECTOR_OVERHEAD = 62;  // sync, ID field, GAP 2, sync and marks of the data field
+
+  // Pitch of a track too long for a revolution, its sectors spread evenly, by sector count.
+  // A constant table, so the Track-Info load has no divider in the FSM
+  logic [15:0] spread_pitch[256];
+  initial for (int n = 0; n < 256; n++) spread_pitch[n] = n ? 16'((TRACK_UNITS - TRACK_PRE_BYTES) / n) : 16'd0;
 
   localparam UPD765_MAIN_D0B = 0;
   localparam UPD765_MAIN_D1B = 1;
@@ -89,9 +147,35 @@ module u765 #(
   localparam CF2 = 1'b0;
   localparam CF2DD = 1'b1;
 
+  // Turbo knobs on the fast input
+  localparam UPD765_FAST_SEEK = 0;
+  localparam UPD765_FAST_ROTATION = 1;
+  localparam UPD765_FAST_HEAD_LOAD = 2;
+  localparam UPD765_FAST_SD_WAIT = 3;
+
+  // Debug trace subsystems, bits of TRACE_MASK
+  localparam TR_MOUNT = 0;  // image header scan
+  localparam TR_CMD = 1;  // command bytes, setup and validation
+  localparam TR_RW = 2;  // read/write execution
+  localparam TR_SCAN = 3;  // SCAN commands
+  localparam TR_RESULT = 4;  // result phase
+  localparam TR_TRACK = 5;  // Track-Info reload, cache and prefetch
+  localparam TR_SD = 6;  // write-back flushes
+
   localparam UPD765_SD_BUFF_TRACKINFO = 1'd0;
   localparam UPD765_SD_BUFF_SECTOR = 1'd1;
 
+  // Track-Info cache slots per drive
+  localparam TI_SLOTS = 1 << TRACKINFO_CACHE_BITS;
+  localparam TI_W = TRACKINFO_CACHE_BITS ? TRACKINFO_CACHE_BITS : 1;
+
+  // drive select bits (US0, US1) and drive numbers they address
+  localparam DS_W = DRIVES > 2 ? 2 : 1;
+  localparam NDRV = 1 << DS_W;
+
+  // 512 byte LBAs in the track buffer
+  localparam TBUF_LBAS = 1 << (TRACK_BUFFER_BITS - 9);
+
   typedef enum bit [6:0] {
   COMMAND_IDLE,                  // 00 - Command processor idle state
   COMMAND_READ_TRACK,            // 01 - Read entire track
@@ -157,6 +241,14 @@ module u765 #(
   COMMAND_SCAN_READ_SECTOR,
   COMMAND_SCAN_COMPARE,
   COMMAND_SCAN_NEXT,
+  COMMAND_TRACK_PREFETCH,
+  COMMAND_TRACK_PREFETCH1,
+  COMMAND_TRACK_PREFETCH2,
+  COMMAND_RELOAD_TRACKINFO_INDEX,
+  COMMAND_RW_DATA_LOOKUP,
+  COMMAND_RW_DATA_LOOKUP1,
+  COMMAND_WB_FLUSH,
+  COMMAND_WB_FLUSH1,
   COMMAND_FAKE
 } state_t;
 
@@ -166,31 +258,111 @@ typedef enum bit [1:0] {
   PHASE_RESPONSE   // Result phase
 } phase_t;
 
+  // per-drive inputs for every drive number, the missing drives read as not there
+  wire [NDRV-1:0] drv_ready = NDRV'(ready);
+  wire [NDRV-1:0] drv_motor = NDRV'(motor);
+  wire [NDRV-1:0] drv_available = NDRV'(available);
+  wire [NDRV-1:0] drv_density = NDRV'(density);
+  wire [NDRV-1:0] drv_mounted = NDRV'(img_mounted);
+  wire [NDRV-1:0] drv_wp = NDRV'(img_wp);
+  wire [NDRV-1:0] drv_ack = NDRV'(sd_ack);
+
   // sector/trackinfo buffers
   logic [7:0] buff_data_in  /* synthesis keep */;
+  logic [7:0] sbuf_data_in, tbuf_data_in;
   logic [7:0] buff_data_out;
   logic [8:0] buff_addr;
   logic buff_wr, buff_wait;
+  reg [8:0] buff_q_addr;  //buff_addr of the byte on buff_data_in
   logic sd_buff_type;
-  logic hds, ds0;
-
-  u765_dpram sbuf (
+  logic hds;
+  logic [DS_W-1:0] ds0;  //selected drive, US1/US0
+  logic [DS_W-1:0] sd_ds;  //drive and head of the SD side of the sector buffer
+  logic sd_hds;
+  reg [TI_W-1:0] ti_slot[NDRV];  // Track-Info cache slot of the current cylinder, per drive
+  logic [TI_W-1:0] buff_slot;
+  assign buff_slot = (sd_buff_type == UPD765_SD_BUFF_TRACKINFO) ? ti_slot[ds0] : {TI_W{1'b0}};
+
+  u765_dpram #(.ADDRWIDTH(11 + DS_W + TI_W)) sbuf (
       .clock(clk_sys),
       // SD card read / write access
-      .address_a({ds0, sd_buff_type, hds, sd_buff_addr}),
+      .address_a({sd_ds, sd_buff_type, buff_slot, sd_hds, sd_buff_addr}),
       .data_a(sd_buff_dout),
-      .wren_a(sd_buff_wr & sd_ack[ds0]),
+      .wren_a(sd_buff_wr & drv_ack[sd_ds] & ~tbuf_filling),
       .q_a(sd_buff_din),
       // FDC module read write access for processor
-      .address_b({ds0, sd_buff_type, hds, buff_addr}),
+      .address_b({ds0, sd_buff_type, buff_slot, hds, buff_addr}),
       .data_b(buff_data_out),
       .wren_b(buff_wr),
-      .q_b(buff_data_in)
+      .q_b(sbuf_data_in)
   );
 
+  //track buffer: TBUF_LBAS consecutive LBAs of one drive, from tbuf_base
+  reg tbuf_valid, tbuf_filling, tbuf_sel;
+  reg [DS_W-1:0] tbuf_drive;
+  reg [22:0] tbuf_base;
+  reg [TRACK_BUFFER_BITS-9:0] tbuf_count;  //LBAs loaded
+  reg [TRACK_BUFFER_BITS-10:0] tbuf_lba;  //LBA of the buffer being read
+
+  generate
+    if (TRACK_PREFETCH) begin : track_buffer
+      u765_dpram #(.ADDRWIDTH(TRACK_BUFFER_BITS)) tbuf (
+          .clock(clk_sys),
+          // SD card fills it while prefetching
+          .address_a({tbuf_count[TRACK_BUFFER_BITS-10:0], sd_buff_addr}),
+          .data_a(sd_buff_dout),
+          .wren_a(sd_buff_wr & drv_ack[sd_ds] & tbuf_filling),
+          .q_a(),
+          // FDC reads sectors from it
+          .address_b({tbuf_lba, buff_addr}),
+          .data_b(8'd0),
+          .wren_b(1'b0),
+          .q_b(tbuf_data_in)
+      );
+    end else begin : no_track_buffer
+      assign tbuf_data_in = 8'd0;
+    end
+  endgenerate
+
+  always @(posedge clk_sys) buff_q_addr <= buff_addr;
+
+  assign buff_data_in = (tbuf_sel & sd_buff_type == UPD765_SD_BUFF_SECTOR) ? tbuf_data_in : sbuf_data_in;
+
+  //sector index of the cached tracks {drive, slot, head, position}: C, H, R, N, ST1, ST2,
+  //file offset and size of every sector. The sector map gives the position of R, with a
+  //duplicate bit on top when R is on the track more than once
+  localparam IDX_SECTORS = 32;
+  logic [95:0] sector_index[NDRV * TI_SLOTS * 2 * IDX_SECTORS];
+  reg   [ 4:0] sector_index_addr;
+  reg          sector_index_wr;
+  reg [95:0] sector_index_out, sector_index_in;
+  logic [5:0] sector_map[NDRV * TI_SLOTS * 2 * 256];
+  reg   [7:0] sector_map_addr;
+  reg         sector_map_wr;
+  reg [5:0] sector_map_out, sector_map_in;
+  reg [255:0] idx_seen;  //R values already indexed in this Track-Info pass
+
+  always @(posedge clk_sys) begin
+    if (sector_index_wr) begin
+      sector_index[{ds0, ti_slot[ds0], hds, sector_index_addr}] <= sector_index_out;
+      sector_index_in <= sector_index_out;
+    end else begin
+      sector_index_in <= sector_index[{ds0, ti_slot[ds0], hds, sector_index_addr}];
+    end
+  end
+
+  always @(posedge clk_sys) begin
+    if (sector_map_wr) begin
+      sector_map[{ds0, ti_slot[ds0], hds, sector_map_addr}] <= sector_map_out;
+      sector_map_in <= sector_map_out;
+    end else begin
+      sector_map_in <= sector_map[{ds0, ti_slot[ds0], hds, sector_map_addr}];
+    end
+  end
+
   //track offset buffer
   //single port buffer in RAM
-  logic [15:0] image_track_offsets          [1024];  //offset of tracks * 256 * 2 drives
+  logic [15:0] image_track_offsets          [NDRV * 512];  //offset of tracks * 256 * 2 sides, per drive
   reg   [ 8:0] image_track_offsets_addr = 0;
   reg          image_track_offsets_wr;
   reg [15:0] image_track_offsets_out, image_track_offsets_in;
@@ -209,27 +381,53 @@ typedef enum bit [1:0] {
   logic wr;
   assign wr = ~nWR & nRD;
   logic [7:0] i_total_sectors;
+  logic [22:0] tbuf_offset;  //LBA of i_seek_pos in the track buffer
+  logic tbuf_hit, tbuf_miss;
+  logic any_scan;  //an image header is being scanned
+  logic sense_pending;  //SENSE INTERRUPT STATUS has a drive to report
+  logic [DS_W-1:0] sense_drive;
 
   phase_t phase;
 
   reg [7:0] m_status;  //main status register
   reg [7:0] m_data;  //data register
-  reg int_state[2];  // interrupt states for both drives
+  reg [NDRV-1:0] int_state;  // interrupt state of every drive
 
   logic ndma_mode = 1'b1;
   state_t last_state;
-
-  reg   [1:0] i_scan_mode[2];  // 0=normal, 1=equal, 2=low_or_equal, 3=high_or_equal
+  state_t state;
+
+  //write-back sector buffer: LBA of the sector buffer with unwritten data
+  reg wb_dirty = 1'b0;
+  reg [DS_W-1:0] wb_drive;
+  reg wb_hds;
+  reg [22:0] wb_lba;
+  reg [3:0] wb_merged = 4'd0;  //SD writes write-through would have done since the last flush
+  initial sd_writes_saved = 16'd0;
+
+  //img_mounted pulses waiting for the flush of the old image, with what was latched
+  reg [NDRV-1:0] mount_pending = '0;
+  reg [NDRV-1:0] mount_wp;
+  reg [31:0] mount_size[NDRV];
+
+  //the flush writes out the buffer of the drive and head that own it, whatever ds0 and hds
+  //are by then
+  assign sd_ds = (state == COMMAND_WB_FLUSH1) ? wb_drive : ds0;
+  assign sd_hds = (state == COMMAND_WB_FLUSH1) ? wb_hds : hds;
+
+  reg   [1:0] i_scan_mode[NDRV];  // 0=normal, 1=equal, 2=low_or_equal, 3=high_or_equal
   reg         i_scan_match;  // Indica si se encontr?? una coincidencia durante el escaneo
   reg   [7:0] i_stp;  // Step (incremento de sectores a saltar)
 
-  reg [1:0] image_ready;
+  reg [NDRV-1:0] image_ready;
 
-  assign int_out = int_state[0] | int_state[1];
-  assign dout = a0 ? m_data : m_status;
+  assign int_out = |int_state;
+  // EXM is only visible in non-DMA mode, it still gates tc internally
+  assign dout = (a0 | dack) ? m_data : {m_status[7:6], m_status[5] & ndma_mode, m_status[4:0]};
   assign old_state = last_state;
+  assign fsm_state = state;
   assign activity_led = (phase == PHASE_EXECUTE);
-  assign prepare = image_ready;
+  assign prepare = image_ready[DRIVES-1:0];
 
 
 
@@ -240,23 +438,51 @@ typedef enum bit [1:0] {
     //prefix internal CE protected registers with i_, so it's easier to write constraints
 
     //per-drive data
-    reg [31:0] image_size[2];
-    reg [7:0] image_tracks[2];
-    reg image_sides[2];  //1 side - 0, 2 sides - 1
-    reg [1:0] image_wp;
-    reg image_trackinfo_dirty[2];
-    reg image_edsk[2];  //DSK - 0, EDSK - 1
-    reg [1:0] image_scan_state[2] ;
-    reg [1:0] image_density;
-    reg [7:0] i_current_track_sectors[2][2] /* synthesis keep */;  //number of sectors on the current track /head/drive
-    reg [7:0] i_current_sector_pos[2][2] /* synthesis keep */; //sector where the head currently positioned
-    reg [19:0] i_steptimer[2], i_rpm_timer[2][2];
-    reg [3:0] i_step_state[2];  //counting cycles_time for steptimer
-
-    reg [7:0] ncn[2];  //new cylinder number
-    reg [7:0] pcn[2];  //present cylinder number
-    reg [2:0] next_weak_sector[2];
-    reg [1:0] seek_state[2];
+    reg [31:0] image_size[NDRV];
+    reg [7:0] image_tracks[NDRV];
+    reg image_sides[NDRV];  //1 side - 0, 2 sides - 1
+    reg [NDRV-1:0] image_wp;
+    reg image_trackinfo_dirty[NDRV];
+    reg image_edsk[NDRV];  //DSK - 0, EDSK - 1
+    reg [1:0] image_scan_state[NDRV] ;
+    reg [NDRV-1:0] image_density;
+    reg [7:0] i_current_track_sectors[NDRV][2] /* synthesis keep */;  //number of sectors on the current track /head/drive
+    reg [7:0] i_current_sector_pos[NDRV][2] /* synthesis keep */; //sector where the head currently positioned
+    reg [19:0] i_steptimer[NDRV];
+    reg [19:0] i_rpm_timer[NDRV][2];  //byte times to the start of i_current_sector_pos
+    reg [15:0] i_angle[NDRV];  //disk angle from the index hole, in byte times
+    reg [31:0] i_angle_acc[NDRV];  //cycles into the current byte time, scaled by TRACK_UNITS
+    reg [15:0] i_angle_skip[NDRV][2];  //byte times the head position still has to catch up
+    reg [15:0] i_sector_pitch[NDRV][2];  //byte times from a sector to the next one
+    reg [15:0] i_track_pre[NDRV][2];  //byte times from the index hole to the first sector
+    reg rot_tick, rot_index;
+    reg [15:0] rot_adv;
+    reg [3:0] i_step_state[NDRV];  //counting cycles_time for steptimer
+    reg i_head_loaded[NDRV];
+    reg [9:0] i_unload_timer[NDRV];  //head unload delay in ms, from the last execution phase
+
+    reg [7:0] ncn[NDRV];  //new cylinder number
+    reg [7:0] pcn[NDRV];  //present cylinder number
+    reg [2:0] next_weak_sector[NDRV];
+    reg [1:0] seek_state[NDRV];
+
+    //Track-Info cache tags: cylinder, loaded heads and sector counts of every slot
+    reg [7:0] ti_cyl[NDRV][TI_SLOTS];
+    reg [1:0] ti_valid[NDRV][TI_SLOTS];
+    reg [7:0] ti_sectors[NDRV][TI_SLOTS][2];
+    reg [15:0] ti_pitch[NDRV][TI_SLOTS][2], ti_pre[NDRV][TI_SLOTS][2];
+    reg [TI_W-1:0] ti_victim[NDRV];  //next slot to replace, round robin
+    reg ti_hit;
+    reg [TI_W-1:0] ti_hit_slot;
+
+    //sector index build
+    reg [7:0] idx_k;  //position in the sector info list
+    reg [31:0] idx_pos;  //file offset of the sector
+    reg [15:0] idx_size, tmp_idx_size;
+    reg [15:0] geo_pitch, geo_pre;  //track geometry in byte times
+    reg [15:0] geo_spread;  //spread_pitch of the track being indexed
+    reg [23:0] geo_track;
+    reg [95:0] idx_entry;
 
     reg old_wr, old_rd;
     reg [ 7:0] i_track_size;
@@ -270,18 +496,24 @@ typedef enum bit [1:0] {
     reg [15:0] i_bytes_to_read;
     reg [2:0] i_substate;
     reg [2:0] r_substate;
-    reg [1:0] old_mounted;
-    reg [1:0] old_ready;
+    reg [NDRV-1:0] old_mounted;
+    reg [NDRV-1:0] old_ready;
     reg [15:0] i_track_offset;
     reg [5:0] ack;
     reg sd_busy;
     reg [19:0] i_timeout;
-    reg [7:0] i_head_timer;
+    reg [7:0] i_head_timer;  //head load delay in ms
+    reg [19:0] i_head_cycles;  //counting cycles_time for i_head_timer
+    reg [19:0] i_ms_cycles;  //counting cycles_time for the unload timers
+    reg ms_tick;
     reg i_rtrack, i_write, i_rw_deleted;
     reg [7:0] status[4];  //st0-3
-    state_t state;
     state_t i_command;
-    reg i_current_drive, i_scan_lock;
+    reg i_scan_lock;
+    reg [DS_W-1:0] i_scan_drive;  //drive whose image header is being scanned
+    reg [8:0] i_scan_track;  //image_track_offsets entry of the next track
+    reg [8:0] i_scan_next;  //next header byte to process
+    reg [DS_W-1:0] i_sense_drive;  //last drive reported by SENSE INTERRUPT STATUS
     reg   [3:0] i_srt;  //stepping rate
     reg   [3:0] i_hut;  //head unload time
     reg   [6:0] i_hlt;  //head load time
@@ -307,84 +539,115 @@ typedef enum bit [1:0] {
 
     buff_wait <= 0;
     i_total_sectors = i_current_track_sectors[ds0][hds];
+    //the sector at i_seek_pos is in the track buffer
+    tbuf_offset = i_seek_pos[31:9] - tbuf_base;
+    tbuf_hit = TRACK_PREFETCH && tbuf_valid && tbuf_drive == ds0 && tbuf_offset < tbuf_count;
+    //a read is starting on a track whose Track-Info block is not in the track buffer
+    tbuf_miss = TRACK_PREFETCH && ~i_write && image_track_offsets_in != 0 &&
+        {image_track_offsets_in[15:1], 9'd0} < image_size[ds0] &&
+        !(tbuf_valid && tbuf_drive == ds0 && image_track_offsets_in[15:1] - tbuf_base < tbuf_count);
+    any_scan = 0;
+    for (int d = 0; d < NDRV; d++) if (image_scan_state[d]) any_scan = 1;
+    //SENSE INTERRUPT STATUS polls the drives in turn, starting after the last one reported
+    sense_pending = 0;
+    sense_drive = 0;
+    for (int k = NDRV; k > 0; k--) begin
+      if (int_state[DS_W'(i_sense_drive + k)]) begin
+        sense_pending = 1;
+        sense_drive = DS_W'(i_sense_drive + k);
+      end
+    end
 
-    //new image mounted
-    for (int i = 0; i < 2; i++) begin
-      old_mounted[i] <= img_mounted[i];
-      old_ready[i]   <= ready[i];
-      if (~old_mounted[i] & img_mounted[i]) begin
-        image_wp[i] <= img_wp[i];
-        image_size[i] <= img_size;
-        image_scan_state[i] <= |img_size;  //hacky
+    //new image mounted. It takes effect once the data written to the old image is on the
+    //SD card: a dirty buffer of the drive is flushed first
+    for (int i = 0; i < NDRV; i++) begin
+      old_mounted[i] <= drv_mounted[i];
+      old_ready[i]   <= drv_ready[i];
+      if (mount_pending[i] & ~(wb_dirty & wb_drive == DS_W'(i))) begin
+        mount_pending[i] <= 0;
+        image_wp[i] <= mount_wp[i];
+        image_size[i] <= mount_size[i];
+        image_scan_state[i] <= |mount_size[i];  //hacky
         image_ready[i] <= 0;
-        image_density[i] <= (img_size > 250000) ? CF2DD : CF2;  // very hacky
+        image_density[i] <= (mount_size[i] > 250000) ? CF2DD : CF2;  // very hacky
         //int_state[i] <= 1;
         seek_state[i] <= 0;
+        i_head_loaded[i] <= 0;
         next_weak_sector[i] <= 0;
         i_current_sector_pos[i] <= '{0, 0};
+        i_angle_skip[i] <= '{0, 0};
+        for (int s = 0; s < TI_SLOTS; s++) ti_valid[i][s] <= 0;
+        if (tbuf_drive == DS_W'(i)) tbuf_valid <= 0;
+      end
+      if (~old_mounted[i] & drv_mounted[i]) begin
+        mount_pending[i] <= 1;
+        mount_size[i] <= img_size;
+        mount_wp[i] <= drv_wp[i];
       end
     end
 
 
     //Process the image file
     if (ce) begin
-      i_current_drive <= ~i_current_drive;
-      case (image_scan_state[i_current_drive])
-        0: ;  //no new image
+      //the drive holding the scan lock is served every cycle, idle drives take turns
+      case (image_scan_state[i_scan_drive])
+        0: if (~i_scan_lock) i_scan_drive <= i_scan_drive + 1'd1;  //no new image
         1:  //read the first 512 byte
-        if (~sd_busy & ~i_scan_lock & state == COMMAND_IDLE) begin
+        if (~sd_busy & ~i_scan_lock & ~wb_dirty & state == COMMAND_IDLE) begin
           sd_buff_type <= UPD765_SD_BUFF_SECTOR;
+          tbuf_sel <= 0;
           i_scan_lock <= 1;
-          ds0 <= i_current_drive;
-          sd_rd[i_current_drive] <= 1;
+          ds0 <= i_scan_drive;
+          sd_rd[i_scan_drive] <= 1;
           sd_lba <= 0;
           sd_busy <= 1;
           i_track_offset <= 16'h1;  //offset 100h
-          image_track_offsets_addr <= 0;
+          i_scan_track <= 0;
+          i_scan_next <= 0;
           buff_addr <= 0;
-          buff_wait <= 1;
-          image_scan_state[i_current_drive] <= 2;
-        end
+          image_scan_state[i_scan_drive] <= 2;
+        end else if (~i_scan_lock) i_scan_drive <= i_scan_drive + 1'd1;
         2:  //process the header - Update all the image track offsets for every track
-        if (~sd_busy & ~buff_wait) begin
-          if (buff_addr == 0) begin
-            if (buff_data_in == "E") image_edsk[i_current_drive] <= 1;
-            else if (buff_data_in == "M") image_edsk[i_current_drive] <= 0;
-            else begin
-              image_ready[i_current_drive] <= 0;
-              image_scan_state[i_current_drive] <= 0;
-              i_scan_lock <= 0;
-            end
-          end else if (buff_addr == 9'h30) image_tracks[i_current_drive] <= buff_data_in;
-          else if (buff_addr == 9'h31) image_sides[i_current_drive] <= buff_data_in[1];
-          else if (buff_addr == 9'h33) i_track_size <= buff_data_in;
-          else if (buff_addr >= 9'h34) begin
-            if (image_track_offsets_addr[8:1] != image_tracks[i_current_drive]) begin
-              image_track_offsets_wr <= 1;
-              if (image_edsk[i_current_drive]) begin
-                image_track_offsets_out <= buff_data_in ? i_track_offset : 16'd0;
-                i_track_offset <= i_track_offset + buff_data_in;
+        //buff_addr runs one byte ahead of the byte on buff_data_in (buff_q_addr), so the
+        //header streams at a byte per cycle and every track offset is written on the fly
+        if (~sd_busy) begin
+          buff_addr <= buff_addr + 1'd1;
+          image_track_offsets_wr <= 0;
+          if (buff_q_addr == i_scan_next) begin
+            i_scan_next <= i_scan_next + 1'd1;
+            if (buff_q_addr == 0) begin
+              if (buff_data_in == "E") image_edsk[i_scan_drive] <= 1;
+              else if (buff_data_in == "M") image_edsk[i_scan_drive] <= 0;
+              else begin
+                image_ready[i_scan_drive] <= 0;
+                image_scan_state[i_scan_drive] <= 0;
+                i_scan_lock <= 0;
+              end
+            end else if (buff_q_addr == 9'h30) image_tracks[i_scan_drive] <= buff_data_in;
+            else if (buff_q_addr == 9'h31) image_sides[i_scan_drive] <= buff_data_in[1];
+            else if (buff_q_addr == 9'h33) i_track_size <= buff_data_in;
+            else if (buff_q_addr >= 9'h34) begin
+              if (i_scan_track[8:1] != image_tracks[i_scan_drive]) begin
+                image_track_offsets_addr <= i_scan_track;
+                image_track_offsets_wr <= 1;
+                if (image_edsk[i_scan_drive]) begin
+                  image_track_offsets_out <= buff_data_in ? i_track_offset : 16'd0;
+                  i_track_offset <= i_track_offset + buff_data_in;
+                end else begin
+                  image_track_offsets_out <= i_track_offset;
+                  i_track_offset <= i_track_offset + i_track_size;
+                end
+                i_scan_track <= i_scan_track + { ~image_sides[i_scan_drive], image_sides[i_scan_drive] };
               end else begin
-                image_track_offsets_out <= i_track_offset;
-                i_track_offset <= i_track_offset + i_track_size;
+                `U765_TRACE(TR_MOUNT, 1) $display("*** Setting image_ready[%d]=1, tracks=%d, sides=%d", i_scan_drive,
+                         image_tracks[i_scan_drive], image_sides[i_scan_drive]);
+                image_ready[i_scan_drive] <= 1;
+                image_scan_state[i_scan_drive] <= 0;
+                image_trackinfo_dirty[i_scan_drive] <= 1;
+                i_scan_lock <= 0;
               end
-              image_scan_state[i_current_drive] <= 3;
-            end else begin
-              $display("*** Setting image_ready[%d]=1, tracks=%d, sides=%d", i_current_drive,
-                       image_tracks[i_current_drive], image_sides[i_current_drive]);
-              image_ready[i_current_drive] <= 1;
-              image_scan_state[i_current_drive] <= 0;
-              image_trackinfo_dirty[i_current_drive] <= 1;
-              i_scan_lock <= 0;
             end
           end
-          buff_addr <= buff_addr + 1'd1;
-          buff_wait <= 1;
-        end
-        3: begin
-          image_track_offsets_wr <= 0;
-          image_track_offsets_addr <= image_track_offsets_addr + { ~image_sides[i_current_drive], image_sides[i_current_drive] };
-          image_scan_state[i_current_drive] <= 2;
         end
       endcase
     end
@@ -400,88 +663,139 @@ typedef enum bit [1:0] {
       status[1] <= 0;
       status[2] <= 0;
       status[3] <= 0;
-      ncn <= '{0, 0};
-      pcn <= '{0, 0};
-      int_state <= '{0, 0};
-      seek_state <= '{0, 0};
-      image_trackinfo_dirty <= '{1, 1};
+      ncn <= '{default: 0};
+      pcn <= '{default: 0};
+      int_state <= 0;
+      seek_state <= '{default: 0};
+      image_trackinfo_dirty <= '{default: 1};
+      for (int d = 0; d < NDRV; d++) for (int s = 0; s < TI_SLOTS; s++) ti_valid[d][s] <= 0;
+      ti_victim <= '{default: 0};
+      {tbuf_valid, tbuf_filling, tbuf_sel} <= 0;
+      {sector_index_wr, sector_map_wr} <= 0;
       {ack, sd_busy} <= 0;
       sd_rd <= 0;
       sd_wr <= 0;
       sd_busy <= 0;
       image_track_offsets_wr <= 0;
       //restart "mounting" of image(s)
-      if (image_scan_state[0]) image_scan_state[0] <= 1;
-      if (image_scan_state[1]) image_scan_state[1] <= 1;
+      for (int d = 0; d < NDRV; d++) if (image_scan_state[d]) image_scan_state[d] <= 1;
       i_scan_lock <= 0;
       i_srt <= 4;
+      i_hlt <= 0;
+      i_hut <= 0;
+      i_head_loaded <= '{default: 0};
+      i_ms_cycles <= 0;
       ndma_mode <= 1'b1;
-      i_scan_mode <= {2'b00,2'b00};  // Inicializacion del modo de escaneo
+      drq <= 1'b0;
+      i_scan_mode <= '{default: 2'b00};  // Inicializacion del modo de escaneo
+      //a dirty buffer survives the reset and is flushed once idle, the count starts over
+      wb_merged <= 0;
+      sd_writes_saved <= 0;
     end else if (ce) begin
 
-      ack <= {ack[4:0], sd_ack[ds0]};
+      ack <= {ack[4:0], drv_ack[sd_ds]};
       if (ack[5:4] == 'b01) begin
         sd_rd <= 0;
         sd_wr <= 0;
       end
-      if (ack[5:4] == 'b10) sd_busy <= 0;
+      if ((fast[UPD765_FAST_SD_WAIT] ? ack[1:0] : ack[5:4]) == 'b10) sd_busy <= 0;
 
       old_wr <= wr;
       old_rd <= rd;
 
-      //seek (track stepping - step 0 = not stepping)
-      case (seek_state[i_current_drive])
-        0: ;  //no seek in progress
-        1:
-        if (pcn[i_current_drive] == ncn[i_current_drive]) begin
-          int_state[i_current_drive]  <= 1;
-          seek_state[i_current_drive] <= 0;
-          //i_current_sector <= 1'd1;
-        end else begin
-          image_trackinfo_dirty[i_current_drive] <= 1;
-          if (fast) begin
-            pcn[i_current_drive] <= ncn[i_current_drive];
+      ms_tick = !i_ms_cycles;
+      i_ms_cycles <= ms_tick ? CYCLES : i_ms_cycles - 1'd1;
+
+      //drive mechanics, every drive every cycle so seeks overlap with a transfer on the
+      //other drive: seek (track stepping - step 0 = not stepping), head unload and disk rotation
+      for (int d = 0; d < NDRV; d++) begin
+        case (seek_state[d])
+          0: ;  //no seek in progress
+          1:
+          if (pcn[d] == ncn[d]) begin
+            //a seek that ends on another drive while a command moves data or waits for its
+            //results holds its interrupt (and D0B/D1B) until the command is over
+            if (d == ds0 || phase == PHASE_COMMAND) begin
+              int_state[d]  <= 1;
+              seek_state[d] <= 0;
+            end
+            //i_current_sector <= 1'd1;
           end else begin
-            if (pcn[i_current_drive] > ncn[i_current_drive])
-              pcn[i_current_drive] <= pcn[i_current_drive] - 1'd1;
-            if (pcn[i_current_drive] < ncn[i_current_drive])
-              pcn[i_current_drive] <= pcn[i_current_drive] + 1'd1;
-            i_step_state[i_current_drive] <= i_srt;
-            i_steptimer[i_current_drive]  <= CYCLES;
-            seek_state[i_current_drive]   <= 2;
+            image_trackinfo_dirty[d] <= 1;
+            if (fast[UPD765_FAST_SEEK]) begin
+              pcn[d] <= ncn[d];
+            end else begin
+              if (pcn[d] > ncn[d]) pcn[d] <= pcn[d] - 1'd1;
+              if (pcn[d] < ncn[d]) pcn[d] <= pcn[d] + 1'd1;
+              i_step_state[d] <= i_srt;
+              i_steptimer[d]  <= STEP_UNIT;
+              seek_state[d]   <= 2;
+            end
           end
+          2:
+          if (i_steptimer[d]) begin
+            i_steptimer[d] <= i_steptimer[d] - 1'd1;
+          end else if (~&i_step_state[d]) begin
+            i_step_state[d] <= i_step_state[d] + 1'd1;
+            i_steptimer[d]  <= STEP_UNIT;
+          end else begin
+            seek_state[d] <= 1;
+          end
+        endcase
+
+        //the head lifts HUT after the execution phase (32 ms units as at 250 kbps, 0 = 16)
+        if (d == ds0 && phase == PHASE_EXECUTE) i_unload_timer[d] <= {~|i_hut, i_hut, 5'd0};
+        else if (i_head_loaded[d] & ms_tick) begin
+          if (i_unload_timer[d]) i_unload_timer[d] <= i_unload_timer[d] - 1'd1;
+          else i_head_loaded[d] <= 0;
         end
-        2:
-        if (i_steptimer[i_current_drive]) begin
-          i_steptimer[i_current_drive] <= i_steptimer[i_current_drive] - 1'd1;
-        end else if (~&i_step_state[i_current_drive]) begin
-          i_step_state[i_current_drive] <= i_step_state[i_current_drive] + 1'd1;
-          i_steptimer[i_current_drive]  <= CYCLES;
-        end else begin
-          seek_state[i_current_drive] <= 1;
-        end
-      endcase
 
-      //disk rotation
-      if (motor[i_current_drive]) begin
-        for (int i = 0; i < 2; i++) begin
-          if (i_rpm_timer[i_current_drive][i] >= SECTOR_TIME) begin
-            // i_current_sector_pos is physical sector number on track (e.g. 1,2,3,etc)
-            i_current_sector_pos[i_current_drive][i] <=
-					i_current_sector_pos[i_current_drive][i] == i_current_track_sectors[i_current_drive][i] - 1'd1 ?
-						8'd0 : i_current_sector_pos[i_current_drive][i] + 1'd1;
-            i_rpm_timer[i_current_drive][i] <= 0;
-          end else begin
-            if(state != COMMAND_RW_DATA_EXEC5 &&
-						state != COMMAND_RW_DATA_EXEC6 &&
-						state != COMMAND_RW_DATA_EXEC7)
-              i_rpm_timer[i_current_drive][i] <= i_rpm_timer[i_current_drive][i] + 1'd1;
+        if (drv_motor[d]) begin
+          //the disk turns one byte time every ROT_CYCLES/TRACK_UNITS cycles, on average.
+          //The disk of the drive moving data waits for the transfer
+          rot_tick = 0;
+          rot_index = 0;
+          if (d != ds0 || (state != COMMAND_RW_DATA_EXEC5 &&
+                           state != COMMAND_RW_DATA_EXEC6 &&
+                           state != COMMAND_RW_DATA_EXEC7)) begin
+            if (i_angle_acc[d] + TRACK_UNITS >= ROT_CYCLES) begin
+              i_angle_acc[d] <= i_angle_acc[d] + TRACK_UNITS - ROT_CYCLES;
+              rot_tick = 1;
+              rot_index = i_angle[d] == TRACK_UNITS - 1;
+              i_angle[d] <= rot_index ? 16'd0 : i_angle[d] + 1'd1;
+            end else begin
+              i_angle_acc[d] <= i_angle_acc[d] + TRACK_UNITS;
+            end
+          end
+
+          //sector under each head. After a track load the position catches up with the
+          //angle one sector per cycle
+          for (int i = 0; i < 2; i++) begin
+            rot_adv = i_angle_skip[d][i] + rot_tick;
+            if (rot_index) begin
+              //index hole: the first sector comes after the track preamble
+              i_current_sector_pos[d][i] <= 0;
+              i_rpm_timer[d][i] <= i_track_pre[d][i];
+              i_angle_skip[d][i] <= 0;
+            end else if (rot_adv <= i_rpm_timer[d][i]) begin
+              i_rpm_timer[d][i] <= i_rpm_timer[d][i] - rot_adv;
+              i_angle_skip[d][i] <= 0;
+            end else if (i_current_sector_pos[d][i] + 9'd1 < i_current_track_sectors[d][i]) begin
+              // i_current_sector_pos is physical sector number on track (e.g. 1,2,3,etc)
+              i_current_sector_pos[d][i] <= i_current_sector_pos[d][i] + 1'd1;
+              i_rpm_timer[d][i] <= i_sector_pitch[d][i] - 1'd1;
+              i_angle_skip[d][i] <= rot_adv - i_rpm_timer[d][i][15:0] - 1'd1;
+            end else begin
+              //past the last sector, nothing until the index hole
+              i_current_sector_pos[d][i] <= 0;
+              i_rpm_timer[d][i] <= '1;
+              i_angle_skip[d][i] <= 0;
+            end
           end
         end
       end
 
-      m_status[UPD765_MAIN_D0B] <= |seek_state[0];
-      m_status[UPD765_MAIN_D1B] <= |seek_state[1];
+      for (int d = 0; d < NDRV; d++) m_status[UPD765_MAIN_D0B + d] <= |seek_state[d];
       m_status[UPD765_MAIN_CB] <= state != COMMAND_IDLE;
 
       old_tc <= tc;
@@ -489,6 +803,7 @@ typedef enum bit [1:0] {
         state <= COMMAND_READ_RESULTS;  // TC caused drive to reset state
         phase <= PHASE_RESPONSE;
         m_status[UPD765_MAIN_EXM] <= 1'b0;
+        drq <= 1'b0;
         case (last_state)
           COMMAND_SCAN_EQUAL,
 				COMMAND_SCAN_LOW_OR_EQUAL,
@@ -503,6 +818,9 @@ typedef enum bit [1:0] {
         //			int_state[ds0] <= 1'b1;
         i_substate <= 0;
       end else begin
+        // drq only lives in the states that move execution phase data
+        if (state != COMMAND_RW_DATA_EXEC6 && state != COMMAND_SCAN_COMPARE) drq <= 1'b0;
+
         case (state)
 
         COMMAND_IDLE: begin
@@ -512,11 +830,15 @@ typedef enum bit [1:0] {
           //$display("Bits comando: MT=%b, SK=%b", din[7], din[5]);
         
           m_status[UPD765_MAIN_DIO] <= 0;
-          m_status[UPD765_MAIN_RQM] <= !image_scan_state[0] & !image_scan_state[1];
+          m_status[UPD765_MAIN_RQM] <= ~any_scan & ~wb_dirty;
           // reset tc
           //tc <= 1'b0;
           phase <= PHASE_COMMAND;
-          if (~old_wr & wr & a0 & !image_scan_state[0] & !image_scan_state[1]) begin
+          if (wb_dirty & ~sd_busy & ~i_scan_lock) begin
+            //deferred write of the last sector buffer
+            i_command <= COMMAND_IDLE;
+            state <= COMMAND_WB_FLUSH;
+          end else if (~old_wr & wr & a0 & ~any_scan & ~wb_dirty) begin
             i_mt <= din[7];
             //i_mfm <= din[6];
             i_sk <= din[5];
@@ -556,19 +878,19 @@ typedef enum bit [1:0] {
                 state <= COMMAND_SCAN_EQUAL;
                 last_state <= COMMAND_SCAN_EQUAL;
                 i_scan_mode[ds0] <= 2'b01;
-                $display("SCAN_EQUAL command detected, mode set to: %b", 2'b01);
+                `U765_TRACE(TR_CMD, 1) $display("SCAN_EQUAL command detected, mode set to: %b", 2'b01);
               end
               8'b000_11001: begin
                 state <= COMMAND_SCAN_LOW_OR_EQUAL;
                 last_state <= COMMAND_SCAN_LOW_OR_EQUAL;
                 i_scan_mode[ds0] <= 2'b10;
-                $display("SCAN_LOW_OR_EQUAL command detected, mode set to: %b", 2'b10);
+                `U765_TRACE(TR_CMD, 1) $display("SCAN_LOW_OR_EQUAL command detected, mode set to: %b", 2'b10);
               end
               8'b000_11101: begin
                 state <= COMMAND_SCAN_HIGH_OR_EQUAL;
                 last_state <= COMMAND_SCAN_HIGH_OR_EQUAL;
                 i_scan_mode[ds0] <= 2'b11;
-                $display("SCAN_HIGH_OR_EQUAL command detected, mode set to: %b", 2'b11);
+                `U765_TRACE(TR_CMD, 1) $display("SCAN_HIGH_OR_EQUAL command detected, mode set to: %b", 2'b11);
               end
               8'b000_00111: begin
                 state <= COMMAND_RECALIBRATE;
@@ -596,14 +918,14 @@ typedef enum bit [1:0] {
               end
             endcase
         
-            $display("COMANDO RECIBIDO: din = 0x%02x (binario: %b)", din, din);
+            `U765_TRACE(TR_CMD, 1) $display("COMANDO RECIBIDO: din = 0x%02x (binario: %b)", din, din);
         
             // Descomponer los bits
-            $display("Desglose de bits:");
-            $display("Bit 7 (MT): %b", din[7]);
-            $display("Bit 6: %b", din[6]);
-            $display("Bit 5 (SK): %b", din[5]);
-            $display("Bit 4-0: %b", din[4:0]);
+            `U765_TRACE(TR_CMD, 2) $display("Desglose de bits:");
+            `U765_TRACE(TR_CMD, 2) $display("Bit 7 (MT): %b", din[7]);
+            `U765_TRACE(TR_CMD, 2) $display("Bit 6: %b", din[6]);
+            `U765_TRACE(TR_CMD, 2) $display("Bit 5 (SK): %b", din[5]);
+            `U765_TRACE(TR_CMD, 2) $display("Bit 4-0: %b", din[4:0]);
         
           end else if (~old_rd & rd & a0) begin
             m_data <= 8'hff;
@@ -618,11 +940,11 @@ typedef enum bit [1:0] {
 
           COMMAND_SENSE_INTERRUPT_STATUS1:
           if (~old_rd & rd & a0) begin
-            if (int_state[0]) begin
-              m_data <= (ncn[0] == pcn[0] && image_ready[0]) ? 8'h20 : 8'he8;  //drive A: interrupt
-              state  <= COMMAND_SENSE_INTERRUPT_STATUS2;
-            end else if (int_state[1]) begin
-              m_data <= (ncn[1] == pcn[1] && image_ready[1]) ? 8'h21 : 8'he9;  //drive B: interrupt
+            if (sense_pending) begin
+              //seek end: normal termination, or abnormal with not ready
+              m_data <= {(ncn[sense_drive] == pcn[sense_drive] && image_ready[sense_drive]) ?
+                             6'b001000 : 6'b111010, 2'(sense_drive)};
+              i_sense_drive <= sense_drive;
               state  <= COMMAND_SENSE_INTERRUPT_STATUS2;
             end else begin
               m_data <= 8'h80;
@@ -634,22 +956,20 @@ typedef enum bit [1:0] {
           COMMAND_SENSE_INTERRUPT_STATUS2:
           if (~old_rd & rd & a0) begin
             // Devolver el PCN de la unidad que est?? reportando la interrupci??n
-            m_data <= int_state[0] ? 
-        ((image_density[0]==CF2 && density[0]==CF2DD) ? pcn[0] << 1 : pcn[0]) :  
-        ((image_density[1]==CF2 && density[1]==CF2DD) ? pcn[1] << 1 : pcn[1]);
+            m_data <= (image_density[i_sense_drive]==CF2 && drv_density[i_sense_drive]==CF2DD) ?
+                pcn[i_sense_drive] << 1 : pcn[i_sense_drive];
 
             //int_state <= '{ 0, 0 }; // Limpiar ambas interrupciones
-            int_state[int_state[0]?0 : 1] <= 0;
+            int_state[i_sense_drive] <= 0;
             state <= COMMAND_IDLE;
           end
 
           COMMAND_SENSE_DRIVE_STATUS: begin
-            int_state <= '{0, 0};
             if (~old_wr & wr & a0) begin
               state <= COMMAND_SENSE_DRIVE_STATUS_RD;
               m_status[UPD765_MAIN_DIO] <= 1;
-              ds0 <= din[0];
-              hds <= image_density[din[0]] ? din[2] : 1'b0;  // Was missing
+              ds0 <= din[DS_W-1:0];
+              hds <= image_density[din[DS_W-1:0]] ? din[2] : 1'b0;  // Was missing
             end
           end
 
@@ -657,19 +977,17 @@ typedef enum bit [1:0] {
           if (~old_rd & rd & a0) begin
             m_data <= {
               1'b0,
-              ready[ds0] & image_wp[ds0],  //write protected
-              motor[ds0] & available[ds0],  //ready - needed for controller detection
-              ready[ds0] & !pcn[ds0],  //track 0
-              ready[ds0] & image_sides[ds0],  //two sides
-              ready[ds0] & hds,  //head address
-              1'b0,  //us1
-              ds0
-            };  //us0
+              drv_ready[ds0] & image_wp[ds0],  //write protected
+              drv_motor[ds0] & drv_available[ds0],  //ready - needed for controller detection
+              drv_ready[ds0] & !pcn[ds0],  //track 0
+              drv_ready[ds0] & image_sides[ds0],  //two sides
+              drv_ready[ds0] & hds,  //head address
+              2'(ds0)
+            };  //us1, us0
             state <= COMMAND_IDLE;
           end
 
           COMMAND_SPECIFY: begin
-            int_state <= '{0, 0};
             if (~old_wr & wr & a0) begin
               i_hut <= din[3:0];
               i_srt <= din[7:4];
@@ -687,19 +1005,19 @@ typedef enum bit [1:0] {
 
           COMMAND_RECALIBRATE: begin
             if (~old_wr & wr & a0) begin
-              ds0 <= din[0];
-              int_state[din[0]] <= 0;
-              ncn[din[0]] <= 0;
-              seek_state[din[0]] <= 1;
+              ds0 <= din[DS_W-1:0];
+              int_state[din[DS_W-1:0]] <= 0;
+              ncn[din[DS_W-1:0]] <= 0;
+              seek_state[din[DS_W-1:0]] <= 1;
               state <= COMMAND_IDLE;
             end
           end
 
           COMMAND_SEEK: begin
             if (~old_wr & wr & a0) begin
-              ds0 <= din[0];
-              hds <= image_density[din[0]] ? din[2] : 1'b0;  // Was missing
-              int_state[din[0]] <= 0;
+              ds0 <= din[DS_W-1:0];
+              hds <= image_density[din[DS_W-1:0]] ? din[2] : 1'b0;  // Was missing
+              int_state[din[DS_W-1:0]] <= 0;
               state <= COMMAND_SEEK_EXEC1;
             end
           end
@@ -707,9 +1025,9 @@ typedef enum bit [1:0] {
           COMMAND_SEEK_EXEC1:
           if (~old_wr & wr & a0) begin
             // This next line is intentionally blocking
-            if (image_density[ds0] == CF2 && density[ds0] == CF2DD) begin
+            if (image_density[ds0] == CF2 && drv_density[ds0] == CF2DD) begin
               ncn[ds0] <= din >> 1;
-              if ((motor[ds0] && ready[ds0] && image_ready[ds0] && (din >> 1)<image_tracks[ds0]) || !din) begin
+              if ((drv_motor[ds0] && drv_ready[ds0] && image_ready[ds0] && (din >> 1)<image_tracks[ds0]) || !din) begin
                 seek_state[ds0] <= 1;
               end else begin
                 //Seek error
@@ -717,7 +1035,7 @@ typedef enum bit [1:0] {
               end
             end else begin
               ncn[ds0] <= din;
-              if ((motor[ds0] && ready[ds0] && image_ready[ds0] && din<image_tracks[ds0]) || !din) begin
+              if ((drv_motor[ds0] && drv_ready[ds0] && image_ready[ds0] && din<image_tracks[ds0]) || !din) begin
                 seek_state[ds0] <= 1;
               end else begin
                 //Seek error
@@ -728,37 +1046,48 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_READ_ID: begin
-            int_state <= '{0, 0};
             state <= COMMAND_READ_ID1;
           end
 
           COMMAND_READ_ID1:
           if (~old_wr & wr & a0) begin
-            ds0 <= din[0];
-            if (~motor[din[0]] | ~ready[din[0]] | ~image_ready[din[0]]) begin
+            ds0 <= din[DS_W-1:0];
+            int_state[din[DS_W-1:0]] <= 0;  //the other drives keep their seek interrupts
+            if (~drv_motor[din[DS_W-1:0]] | ~drv_ready[din[DS_W-1:0]] | ~image_ready[din[DS_W-1:0]]) begin
               status[0] <= 8'h40;
               status[1] <= 8'b101;
               status[2] <= 0;
               state <= COMMAND_READ_RESULTS;
-              int_state[din[0]] <= 1'b1;
+              int_state[din[DS_W-1:0]] <= 1'b1;
               phase <= PHASE_RESPONSE;
-            end else if (din[2] & ~image_sides[din[0]]) begin
+            end else if (din[2] & ~image_sides[din[DS_W-1:0]]) begin
               status[0] <= 8'h48;  //no side B
               status[1] <= 0;
               status[2] <= 0;
               state <= COMMAND_READ_RESULTS;
-              int_state[din[0]] <= 1'b1;
+              int_state[din[DS_W-1:0]] <= 1'b1;
               phase <= PHASE_RESPONSE;
             end else begin
-              hds <= image_density[din[0]] ? din[2] : 1'b0;
+              hds <= image_density[din[DS_W-1:0]] ? din[2] : 1'b0;
               m_status[UPD765_MAIN_RQM] <= 0;
+              i_head_timer <= {i_hlt, 1'b0};
+              i_head_cycles <= CYCLES;
               i_command <= COMMAND_READ_ID2;
               state <= COMMAND_RELOAD_TRACKINFO;
               phase <= PHASE_EXECUTE;
             end
           end
 
-          COMMAND_READ_ID2: begin
+          COMMAND_READ_ID2:
+          if (~i_head_loaded[ds0] & ~fast[UPD765_FAST_HEAD_LOAD] & |i_head_timer) begin
+            //head load delay
+            if (i_head_cycles) i_head_cycles <= i_head_cycles - 1'd1;
+            else begin
+              i_head_timer  <= i_head_timer - 1'd1;
+              i_head_cycles <= CYCLES;
+            end
+          end else begin
+            i_head_loaded[ds0] <= 1;
             image_track_offsets_addr <= {pcn[ds0], hds};
             buff_wait <= 1;
             state <= COMMAND_READ_ID_EXEC1;
@@ -781,7 +1110,7 @@ typedef enum bit [1:0] {
 
           // Actually sets the offset to sector table in track (started with TRACKINFO)
           COMMAND_READ_ID_WAIT_SECTOR:
-          if (~sd_busy & ~buff_wait & (!i_rpm_timer[ds0][hds])) begin
+          if (~sd_busy & ~buff_wait & (fast[UPD765_FAST_ROTATION] | !i_rpm_timer[ds0][hds])) begin
             sd_buff_type <= UPD765_SD_BUFF_TRACKINFO;
             // 18h = offset to list of sectors in sector table for current track
             buff_addr <= {
@@ -810,7 +1139,6 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_READ_TRACK: begin
-            int_state <= '{0, 0};
             i_command <= COMMAND_RW_DATA_EXEC;
             state <= COMMAND_SETUP;
             {i_rtrack, i_write, i_rw_deleted} <= 3'b100;
@@ -818,7 +1146,6 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_WRITE_DATA: begin
-            int_state <= '{0, 0};
             i_command <= COMMAND_RW_DATA_EXEC;
             state <= COMMAND_SETUP;
             {i_rtrack, i_write, i_rw_deleted} <= 3'b010;
@@ -826,7 +1153,6 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_WRITE_DELETED_DATA: begin
-            int_state <= '{0, 0};
             i_command <= COMMAND_RW_DATA_EXEC;
             state <= COMMAND_SETUP;
             {i_rtrack, i_write, i_rw_deleted} <= 3'b011;
@@ -834,7 +1160,6 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_READ_DATA: begin
-            int_state <= '{0, 0};
             i_command <= COMMAND_RW_DATA_EXEC;
             state <= COMMAND_SETUP;
             {i_rtrack, i_write, i_rw_deleted} <= 3'b000;
@@ -842,7 +1167,6 @@ typedef enum bit [1:0] {
           end
 
           COMMAND_READ_DELETED_DATA: begin
-            int_state <= '{0, 0};
             i_command <= COMMAND_RW_DATA_EXEC;
             state <= COMMAND_SETUP;
             {i_rtrack, i_write, i_rw_deleted} <= 3'b001;
@@ -857,7 +1181,7 @@ typedef enum bit [1:0] {
 
             // Chequear si el CPU está enviando un dato para comparar
             if (~old_wr & wr & a0) begin
-              $display("SCAN_COMPARE: SectorData=0x%02x, CPUData=0x%02x, Mode=%b", m_data, din,
+              `U765_TRACE(TR_SCAN, 2) $display("SCAN_COMPARE: SectorData=0x%02x, CPUData=0x%02x, Mode=%b", m_data, din,
                        i_scan_mode[ds0]);
 
               // Hacer la comparación apropiada según el modo de SCAN
@@ -866,11 +1190,11 @@ typedef enum bit [1:0] {
                   // Solo hay coincidencia si los datos son exactamente iguales
                   if (m_data == din) begin
                     i_scan_match <= 1;
-                    $display(
+                    `U765_TRACE(TR_SCAN, 2) $display(
                         "SCAN_EQUAL: ¡Coincidencia encontrada! SectorData=0x%02x == CPUData=0x%02x",
                         m_data, din);
                   end else begin
-                    $display("SCAN_EQUAL: Sin coincidencia. SectorData=0x%02x != CPUData=0x%02x",
+                    `U765_TRACE(TR_SCAN, 2) $display("SCAN_EQUAL: Sin coincidencia. SectorData=0x%02x != CPUData=0x%02x",
                              m_data, din);
                   end
                 end
@@ -878,11 +1202,11 @@ typedef enum bit [1:0] {
                   // Hay coincidencia si el dato del sector es menor o igual al dato del CPU
                   if (m_data <= din) begin
                     i_scan_match <= 1;
-                    $display(
+                    `U765_TRACE(TR_SCAN, 2) $display(
                         "SCAN_LOW_OR_EQUAL: ¡Coincidencia encontrada! SectorData=0x%02x <= CPUData=0x%02x",
                         m_data, din);
                   end else begin
-                    $display(
+                    `U765_TRACE(TR_SCAN, 2) $display(
                         "SCAN_LOW_OR_EQUAL: Sin coincidencia. SectorData=0x%02x > CPUData=0x%02x",
                         m_data, din);
                   end
@@ -891,11 +1215,11 @@ typedef enum bit [1:0] {
                   // Hay coincidencia si el dato del sector es mayor o igual al dato del CPU
                   if (m_data >= din) begin
                     i_scan_match <= 1;
-                    $display(
+                    `U765_TRACE(TR_SCAN, 2) $display(
                         "SCAN_HIGH_OR_EQUAL: ¡Coincidencia encontrada! SectorData=0x%02x >= CPUData=0x%02x",
                         m_data, din);
                   end else begin
-                    $display(
+                    `U765_TRACE(TR_SCAN, 2) $display(
                         "SCAN_HIGH_OR_EQUAL: Sin coincidencia. SectorData=0x%02x < CPUData=0x%02x",
                         m_data, din);
                   end
@@ -908,23 +1232,23 @@ typedef enum bit [1:0] {
 
               // Si ya encontramos una coincidencia, terminamos la operación
               if (i_scan_match) begin
-                $display("SCAN: Coincidencia encontrada, terminando operación SCAN");
+                `U765_TRACE(TR_SCAN, 1) $display("SCAN: Coincidencia encontrada, terminando operación SCAN");
                 state <= COMMAND_RW_DATA_EXEC8;
                 m_status[UPD765_MAIN_RQM] <= 0;  // Desactivar RQM mientras procesamos
               end  // Si no hay más bytes para leer en este sector, pasamos al siguiente paso
               else if (i_bytes_to_read <= 1) begin
-                $display("SCAN: Fin de datos del sector alcanzado");
+                `U765_TRACE(TR_SCAN, 1) $display("SCAN: Fin de datos del sector alcanzado");
                 state <= COMMAND_RW_DATA_EXEC8;
                 m_status[UPD765_MAIN_RQM] <= 0;  // Desactivar RQM mientras procesamos
               end  // De lo contrario, continuamos con el siguiente byte
               else begin
-                $display("SCAN: Continuando con el siguiente byte");
+                `U765_TRACE(TR_SCAN, 2) $display("SCAN: Continuando con el siguiente byte");
                 state <= COMMAND_RW_DATA_EXEC6;
                 m_status[UPD765_MAIN_RQM] <= 0;  // Necesario para correcta transición de estado
               end
             end  // Si el timeout expira, abortamos la operación
             else if (i_timeout <= 0) begin
-              $display("SCAN: Timeout mientras esperaba datos de comparación del CPU");
+              `U765_TRACE(TR_SCAN, 1) $display("SCAN: Timeout mientras esperaba datos de comparación del CPU");
               m_status[UPD765_MAIN_EXM] <= 0;
               status[0] <= 8'h40;  // Error - bit AT (Abnormal Termination)
               status[1] <= 8'h00;
@@ -942,11 +1266,14 @@ typedef enum bit [1:0] {
           // Bloque completo COMMAND_SETUP
           COMMAND_SETUP:
           if (!old_wr & wr & a0) begin
-            $display("COMMAND_SETUP: substate=%d, din=%h", i_substate, din);
+            `U765_TRACE(TR_CMD, 2) $display("COMMAND_SETUP: substate=%d, din=%h", i_substate, din);
             case (i_substate)
               0: begin
-                ds0        <= din[0];  // device
-                hds        <= image_density[din[0]] ? din[2] : 1'b0;  // head polarity
+                ds0        <= din[DS_W-1:0];  // device
+                //only the interrupt of this drive, a seek that ended on another one still
+                //has to be reported by SENSE INTERRUPT STATUS
+                int_state[din[DS_W-1:0]] <= 0;
+                hds        <= image_density[din[DS_W-1:0]] ? din[2] : 1'b0;  // head polarity
                 i_substate <= 1;
               end
               1: begin
@@ -977,7 +1304,7 @@ typedef enum bit [1:0] {
                 // Para comandos SCAN, usar el último parámetro como STP en lugar de DTL
                 if (i_scan_mode[ds0] != 2'b00) begin
                   i_stp <= din & 2'b11;  // Los 2 bits inferiores son el valor STP
-                  $display("SCAN command, using STP=%d from input=%h", din & 2'b11, din);
+                  `U765_TRACE(TR_CMD, 2) $display("SCAN command, using STP=%d from input=%h", din & 2'b11, din);
                 end else begin
                   i_dtl <= din;  // Para comandos normales, este es DTL
                 end
@@ -992,18 +1319,18 @@ typedef enum bit [1:0] {
           // Bloque completo COMMAND_RW_DATA_EXEC8
           COMMAND_RW_DATA_EXEC3:
           if (~sd_busy & ~buff_wait) begin
-            $display(
+            `U765_TRACE(TR_RW, 2) $display(
                 "COMMAND_RW_DATA_EXEC3: buff_addr=%h, i_current_sector=%d, i_total_sectors=%d, image_ready=%d",
                 buff_addr[7:0], i_current_sector, i_total_sectors, image_ready[ds0]);
-                $display("EXEC3: Checking sector %d/%d, current sector info: C=%d, H=%d, R=%d, N=%d",
+                `U765_TRACE(TR_RW, 2) $display("EXEC3: Checking sector %d/%d, current sector info: C=%d, H=%d, R=%d, N=%d",
                 i_current_sector, i_total_sectors, i_sector_c, i_sector_h, i_sector_r, i_sector_n);
             if (buff_addr[7:0] == 8'h14) begin
               if (!image_edsk[ds0]) i_sector_size <= 8'h80 << buff_data_in[2:0];
               buff_addr[7:0] <= 8'h18;  //sector info list
               buff_wait <= 1;
-              $display("Setting sector size and moving to sector info list");
+              `U765_TRACE(TR_RW, 2) $display("Setting sector size and moving to sector info list");
             end else if (i_current_sector > i_total_sectors) begin
-              $display("ERROR: Sector not found or end of track - current=%d, total=%d",
+              `U765_TRACE(TR_RW, 1) $display("ERROR: Sector not found or end of track - current=%d, total=%d",
                        i_current_sector, i_total_sectors);
               m_status[UPD765_MAIN_EXM] <= 0;
               //sector not found or end of track
@@ -1018,36 +1345,36 @@ typedef enum bit [1:0] {
               case (buff_addr[2:0])
                 0: begin
                   i_sector_c <= buff_data_in;
-                  $display("Sector C=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector C=%h", buff_data_in);
                 end
                 1: begin
                   i_sector_h <= buff_data_in;
-                  $display("Sector H=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector H=%h", buff_data_in);
                 end
                 2: begin
                   i_sector_r <= buff_data_in;
-                  $display("Sector R=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector R=%h", buff_data_in);
                 end
                 3: begin
                   i_sector_n <= buff_data_in;
-                  $display("Sector N=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector N=%h", buff_data_in);
                 end
                 4: begin
                   i_sector_st1 <= buff_data_in;
-                  $display("Sector ST1=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector ST1=%h", buff_data_in);
                 end
                 5: begin
                   i_sector_st2 <= buff_data_in;
-                  $display("Sector ST2=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector ST2=%h", buff_data_in);
                 end
                 6: begin
                   if (image_edsk[ds0]) i_sector_size[7:0] <= buff_data_in;
-                  $display("Sector size low=%h", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector size low=%h", buff_data_in);
                 end
                 7: begin
                   // start scanning of the sector IDs from the sector at the current head position
                   if (image_edsk[ds0]) i_sector_size[15:8] <= buff_data_in;
-                  $display("Sector size high=%h, moving to EXEC4", buff_data_in);
+                  `U765_TRACE(TR_RW, 2) $display("Sector size high=%h, moving to EXEC4", buff_data_in);
                   state <= COMMAND_RW_DATA_EXEC4;
                 end
               endcase
@@ -1058,11 +1385,11 @@ typedef enum bit [1:0] {
           COMMAND_RW_DATA_EXEC4:
 if ((i_rtrack && i_current_sector == i_r) ||
     (~i_rtrack && i_sector_c == i_c && i_sector_r == i_r && i_sector_h == i_h && (i_sector_n == i_n || !i_n))) begin
-  $display("EXEC4: Looking for C=%d, H=%d, R=%d, N=%d", i_c, i_h, i_r, i_n);
-  $display("EXEC4: Found C=%d, H=%d, R=%d, N=%d", i_sector_c, i_sector_h, i_sector_r, i_sector_n);
+  `U765_TRACE(TR_RW, 2) $display("EXEC4: Looking for C=%d, H=%d, R=%d, N=%d", i_c, i_h, i_r, i_n);
+  `U765_TRACE(TR_RW, 2) $display("EXEC4: Found C=%d, H=%d, R=%d, N=%d", i_sector_c, i_sector_h, i_sector_r, i_sector_n);
   //sector found in the sector info list
   if (i_sk & ~i_rtrack & (i_rw_deleted ^ i_sector_st2[6])) begin
-    $display("EXEC4 to EXEC8:");
+    `U765_TRACE(TR_RW, 2) $display("EXEC4 to EXEC8:");
     state <= COMMAND_RW_DATA_EXEC8;
   end else begin
     i_bytes_to_read <= i_n ? (8'h80 << (i_n[3] ? 4'h8 : i_n[2:0])) : i_dtl;
@@ -1072,7 +1399,7 @@ if ((i_rtrack && i_current_sector == i_r) ||
   end
 end else begin
   //try the next sector in the sectorinfo list
-  $display("EXEC4 Next Sector:");
+  `U765_TRACE(TR_RW, 2) $display("EXEC4 Next Sector:");
   if (i_sector_c == i_c) i_bc <= 0;
   i_current_sector <= i_current_sector + 1'd1;
   i_seek_pos <= i_seek_pos + i_sector_size;
@@ -1081,20 +1408,30 @@ end
 
 COMMAND_RW_DATA_EXEC6:
 if (~sd_busy & ~buff_wait) begin
-  $display("RW_DATA_EXEC6: i_bytes_to_read=%d, m_status=%h", i_bytes_to_read, m_status);
+  `U765_TRACE(TR_RW, 2) $display("RW_DATA_EXEC6: i_bytes_to_read=%d, m_status=%h", i_bytes_to_read, m_status);
 
   if (!i_bytes_to_read) begin
     //end of the current sector in buffer, so write it to SD card
+    //(write-back: leave it dirty, the next sector may share the LBA)
     if (i_write && buff_addr && i_seek_pos < image_size[ds0]) begin
-      sd_lba <= i_seek_pos[31:9];
-      sd_wr[ds0] <= 1;
-      sd_busy <= 1;
+      if (WRITE_BACK) begin
+        wb_merged <= wb_merged + 1'd1;
+      end else begin
+        sd_lba <= i_seek_pos[31:9];
+        sd_wr[ds0] <= 1;
+        sd_busy <= 1;
+      end
     end
     state <= COMMAND_RW_DATA_EXEC8;
-  end else if (~m_status[UPD765_MAIN_RQM]) begin
-    m_status[UPD765_MAIN_RQM] <= 1;
-    if (ndma_mode) int_state[ds0] <= 1'b1;
-  end else if (~i_write & ~old_rd & rd & a0) begin
+  end else if (ndma_mode ? ~m_status[UPD765_MAIN_RQM] : ~drq) begin
+    // ask for the next byte: RQM and interrupt, or DMA request
+    if (ndma_mode) begin
+      m_status[UPD765_MAIN_RQM] <= 1;
+      int_state[ds0] <= 1'b1;
+    end else begin
+      drq <= 1'b1;
+    end
+  end else if (~i_write & ~old_rd & rd & (ndma_mode ? a0 : dack)) begin
     if (&buff_addr) begin
       //sector continues on the next LBA
       state <= COMMAND_RW_DATA_EXEC5;
@@ -1103,6 +1440,7 @@ if (~sd_busy & ~buff_wait) begin
     // Operaciones de lectura normal
     m_data <= buff_data_in;
     m_status[UPD765_MAIN_RQM] <= 0;
+    drq <= 1'b0;
     if (i_sector_size) begin
       i_sector_size <= i_sector_size - 1'd1;
       buff_addr <= buff_addr + 1'd1;
@@ -1112,11 +1450,18 @@ if (~sd_busy & ~buff_wait) begin
     i_bytes_to_read <= i_bytes_to_read - 1'd1;
     i_timeout <= OVERRUN_TIMEOUT;
     if (ndma_mode) int_state[ds0] <= 1'b0;
-  end else if (i_write & ~old_wr & wr & a0) begin
+  end else if (i_write & ~old_wr & wr & (ndma_mode ? a0 : dack)) begin
     buff_wr <= 1;
     buff_data_out <= din;
+    if (WRITE_BACK && i_seek_pos < image_size[ds0]) begin
+      wb_dirty <= 1;
+      wb_drive <= ds0;
+      wb_hds <= hds;
+      wb_lba <= i_seek_pos[31:9];
+    end
     i_timeout <= OVERRUN_TIMEOUT;
     m_status[UPD765_MAIN_RQM] <= 0;
+    drq <= 1'b0;
     state <= COMMAND_RW_DATA_EXEC7;
     if (ndma_mode) int_state[ds0] <= 1'b0;
   end else begin
@@ -1126,7 +1471,7 @@ end
 
 COMMAND_RW_DATA_EXEC8:
 if (~sd_busy) begin
-  $display("RW_DATA_EXEC8: Normal Read/Write command");
+  `U765_TRACE(TR_RW, 2) $display("RW_DATA_EXEC8: Normal Read/Write command");
 
   if (~i_rtrack & ~(i_sk & (i_rw_deleted ^ i_sector_st2[6])) &
       ((i_sector_st1[5] & i_sector_st2[5]) | (i_rw_deleted ^ i_sector_st2[6]))) begin
@@ -1150,6 +1495,10 @@ if (~sd_busy) begin
     state <= COMMAND_READ_RESULTS;
     int_state[ds0] <= 1'b1;
     phase <= PHASE_RESPONSE;
+  end else if (i_mt & image_sides[ds0] & wb_dirty) begin
+    // El buffer de la otra cara es otro, vaciar el actual antes de cambiar de cabeza
+    i_command <= COMMAND_RW_DATA_EXEC8;
+    state <= COMMAND_WB_FLUSH;
   end else begin
     // Leer el siguiente sector (transferencia multi-sector)
     if (i_mt & image_sides[ds0]) begin
@@ -1172,9 +1521,9 @@ COMMAND_READ_RESULTS: begin
   reg [15:0] result_read_timeout;
   
   result_read_timeout <= result_read_timeout + 1;
-  $display("RESULTS: r_substate: %02x", r_substate);
+  `U765_TRACE(TR_RESULT, 2) $display("RESULTS: r_substate: %02x", r_substate);
   if (result_read_timeout > 1000) begin
-      $display("EMERGENCY RESET: Result reading timeout");
+      `U765_TRACE(TR_RESULT, 1) $display("EMERGENCY RESET: Result reading timeout");
       // Forzar reset completo
       state <= COMMAND_RESET;
       m_status <= 8'h80;
@@ -1195,44 +1544,44 @@ COMMAND_READ_RESULTS: begin
               
               case (r_substate)
                   0: begin
-                      m_data <= {status[0][7:3], hds, 1'b0, ds0};
+                      m_data <= {status[0][7:3], hds, 2'(ds0)};
                       r_substate <= 1;
                       int_state[ds0] <= 1'b0;
-                      $display("READ_RESULTS: ST0=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: ST0=0x%02x", m_data);
                   end
                   1: begin
                       m_data <= status[1];
                       r_substate <= 2;
-                      $display("READ_RESULTS: ST1=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: ST1=0x%02x", m_data);
                   end
                   2: begin
                       m_data <= status[2];
                       r_substate <= 3;
-                      $display("READ_RESULTS: ST2=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: ST2=0x%02x", m_data);
                   end
                   3: begin
                       m_data <= i_sector_c;
                       r_substate <= 4;
-                      $display("READ_RESULTS: C=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: C=0x%02x", m_data);
                   end
                   4: begin
                       m_data <= i_sector_h;
                       r_substate <= 5;
-                      $display("READ_RESULTS: H=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: H=0x%02x", m_data);
                   end
                   5: begin
                       m_data <= i_sector_r;
                       r_substate <= 6;
-                      $display("READ_RESULTS: R=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: R=0x%02x", m_data);
                   end
                   6: begin
                       m_data <= i_sector_n;
                       // Forzar transición completa a IDLE
                       state <= COMMAND_IDLE;
-                      m_status <= 8'h80;  // Resetear a estado inicial
+                      m_status <= {~wb_dirty, 7'h00};  // Resetear a estado inicial (tras vaciar el buffer)
                       phase <= PHASE_COMMAND;
                       r_substate <= 0;
-                      $display("READ_RESULTS: N=0x%02x", m_data);
+                      `U765_TRACE(TR_RESULT, 1) $display("READ_RESULTS: N=0x%02x", m_data);
                   end
               endcase
           end
@@ -1240,21 +1589,18 @@ COMMAND_READ_RESULTS: begin
   end
 end
           COMMAND_SCAN_EQUAL: begin
-            int_state <= '{0, 0};
             i_scan_mode[ds0] <= 2'b01;  // SCAN_EQUAL mode
             i_scan_match <= 0;     // Reset match flag
             state <= COMMAND_SETUP; // Reutilizar configuración inicial
           end
           
           COMMAND_SCAN_LOW_OR_EQUAL: begin
-            int_state <= '{0, 0};
             i_scan_mode[ds0] <= 2'b10;  // SCAN_LOW_OR_EQUAL mode
             i_scan_match <= 0;     // Reset match flag
             state <= COMMAND_SETUP; // Reutilizar configuración inicial
           end
           
           COMMAND_SCAN_HIGH_OR_EQUAL: begin
-            int_state <= '{0, 0};
             i_scan_mode[ds0] <= 2'b11;  // SCAN_HIGH_OR_EQUAL mode
             i_scan_match <= 0;     // Reset match flag
             state <= COMMAND_SETUP; // Reutilizar configuración inicial
@@ -1272,22 +1618,29 @@ end
             status[1] <= 0;
             status[2] <= 0;
             status[3] <= 0;
-            ncn <= '{0, 0};
-            pcn <= '{0, 0};
-            int_state <= '{0, 0};
-            seek_state <= '{0, 0};
-            image_trackinfo_dirty <= '{1, 1};
+            ncn <= '{default: 0};
+            pcn <= '{default: 0};
+            int_state <= 0;
+            seek_state <= '{default: 0};
+            image_trackinfo_dirty <= '{default: 1};
+            for (int d = 0; d < NDRV; d++) for (int s = 0; s < TI_SLOTS; s++) ti_valid[d][s] <= 0;
+            ti_victim <= '{default: 0};
+            {tbuf_valid, tbuf_filling, tbuf_sel} <= 0;
+            {sector_index_wr, sector_map_wr} <= 0;
             {ack, sd_busy} <= 0;
             sd_rd <= 0;
             sd_wr <= 0;
             sd_busy <= 0;
             image_track_offsets_wr <= 0;
             //restart "mounting" of image(s)
-            if (image_scan_state[0]) image_scan_state[0] <= 1;
-            if (image_scan_state[1]) image_scan_state[1] <= 1;
+            for (int d = 0; d < NDRV; d++) if (image_scan_state[d]) image_scan_state[d] <= 1;
             i_scan_lock  <= 0;
             i_srt        <= 4;
+            i_hlt        <= 0;
+            i_hut        <= 0;
+            i_head_loaded <= '{default: 0};
             ndma_mode    <= 1'b1;
+            drq          <= 1'b0;
             i_scan_mode[ds0]  <= 2'b00;  // Initialize scan mode to normal (not SCAN)
             i_scan_match <= 0;  // Initialize scan match flag
             i_stp        <= 2'b01;  // Default STP value
@@ -1295,9 +1648,20 @@ end
 
 
           // Add logs to COMMAND_RW_DATA_EXEC1
-          COMMAND_RW_DATA_EXEC1: begin
-            $display("COMMAND_RW_DATA_EXEC1: scan_mode=%b", i_scan_mode[ds0]);
+          COMMAND_RW_DATA_EXEC1:
+          if (~i_head_loaded[ds0] & ~fast[UPD765_FAST_HEAD_LOAD] & |i_head_timer) begin
+            //head load delay
+            if (i_head_cycles) i_head_cycles <= i_head_cycles - 1'd1;
+            else begin
+              i_head_timer  <= i_head_timer - 1'd1;
+              i_head_cycles <= CYCLES;
+            end
+          end else begin
+            `U765_TRACE(TR_RW, 1) $display("COMMAND_RW_DATA_EXEC1: scan_mode=%b", i_scan_mode[ds0]);
+            i_head_loaded[ds0] <= 1;
             m_status[UPD765_MAIN_DIO] <= ~i_write;
+            //the track buffer would go stale
+            if (i_write & tbuf_drive == ds0) tbuf_valid <= 0;
             if (i_rtrack) i_r <= 1;
             i_bc <= 1;
             i_scan_match <= 0;  // Initialize match for SCAN commands
@@ -1307,28 +1671,39 @@ end
             image_track_offsets_addr <= {pcn[ds0], hds};
             buff_wait <= 1;
             state <= COMMAND_RW_DATA_EXEC2;
-            $display("Moving to COMMAND_RW_DATA_EXEC2");
+            `U765_TRACE(TR_RW, 1) $display("Moving to COMMAND_RW_DATA_EXEC2");
           end
 
           // Add logs to COMMAND_RW_DATA_EXEC2
           COMMAND_RW_DATA_EXEC2: begin
-            $display("COMMAND_RW_DATA_EXEC2: sd_busy=%b, buff_wait=%b", sd_busy, buff_wait);
-
-            if (~sd_busy & ~buff_wait) begin
-              $display("Setting up track info and sector read");
+            `U765_TRACE(TR_RW, 2) $display("COMMAND_RW_DATA_EXEC2: sd_busy=%b, buff_wait=%b", sd_busy, buff_wait);
+
+            if (~sd_busy & ~buff_wait & tbuf_miss) begin
+              //prefetch the track, then come back here
+              i_command <= COMMAND_RW_DATA_EXEC2;
+              state <= COMMAND_TRACK_PREFETCH;
+            end else if (~sd_busy & ~buff_wait) begin
+              `U765_TRACE(TR_RW, 2) $display("Setting up track info and sector read");
               i_current_sector <= 1'd1;
               sd_buff_type <= UPD765_SD_BUFF_TRACKINFO;
               i_seek_pos <= {image_track_offsets_in + 1'd1, 8'd0};  //TrackInfo+256bytes
               buff_addr <= {image_track_offsets_in[0], 8'h14};  //sector size
               buff_wait <= 1;
-              state <= COMMAND_RW_DATA_EXEC3;
+              sector_map_addr <= i_r;
+              state <= ti_valid[ds0][ti_slot[ds0]][hds] ? COMMAND_RW_DATA_LOOKUP : COMMAND_RW_DATA_EXEC3;
             end
           end
 
  
           //wait for the sector needed for positioning at the head - delay only
           COMMAND_RW_DATA_WAIT_SECTOR:
-          if ((i_current_sector_pos[ds0][hds] == i_current_sector - 1'd1) && !i_rpm_timer[ds0][hds]) begin
+          if (fast[UPD765_FAST_ROTATION]) begin
+            //no rotational latency - the sector is under the head right away
+            i_current_sector_pos[ds0][hds] <= i_current_sector - 1'd1;
+            i_rpm_timer[ds0][hds] <= 0;
+            m_status[UPD765_MAIN_EXM] <= 1;
+            state <= COMMAND_RW_DATA_EXEC_WEAK;
+          end else if ((i_current_sector_pos[ds0][hds] == i_current_sector - 1'd1) && !i_rpm_timer[ds0][hds]) begin
             m_status[UPD765_MAIN_EXM] <= 1;
             state <= COMMAND_RW_DATA_EXEC_WEAK;
           end
@@ -1359,11 +1734,25 @@ end
 
           //Read the LBA for the sector into the RAM
           COMMAND_RW_DATA_EXEC5:
-          if (~sd_busy & ~buff_wait) begin
+          if (~sd_busy & ~buff_wait & wb_dirty & wb_lba != i_seek_pos[31:9]) begin
+            //another LBA is dirty in the sector buffer, write it out first
+            i_command <= COMMAND_RW_DATA_EXEC5;
+            state <= COMMAND_WB_FLUSH;
+          end else if (~sd_busy & ~buff_wait) begin
             sd_buff_type <= UPD765_SD_BUFF_SECTOR;
-            sd_rd[ds0] <= 1;
-            sd_lba <= i_seek_pos[31:9];
-            sd_busy <= 1;
+            if (wb_dirty) begin
+              //the sector buffer already holds this LBA, with newer data than the SD card
+              tbuf_sel <= 0;
+            end else if (~i_write & tbuf_hit) begin
+              //already in the track buffer
+              tbuf_sel <= 1;
+              tbuf_lba <= tbuf_offset[TRACK_BUFFER_BITS-10:0];
+            end else begin
+              tbuf_sel <= 0;
+              sd_rd[ds0] <= 1;
+              sd_lba <= i_seek_pos[31:9];
+              sd_busy <= 1;
+            end
             buff_addr <= i_seek_pos[8:0];
             buff_wait <= 1;
             state <= COMMAND_RW_DATA_EXEC6;
@@ -1381,10 +1770,15 @@ end
             if (&buff_addr) begin
               //sector continues on the next LBA
               //so write out the current before reading the next
+              //(write-back: EXEC5 flushes it, as the LBA changes)
               if (i_seek_pos < image_size[ds0]) begin
-                sd_lba <= i_seek_pos[31:9];
-                sd_wr[ds0] <= 1;
-                sd_busy <= 1;
+                if (WRITE_BACK) begin
+                  wb_merged <= wb_merged + 1'd1;
+                end else begin
+                  sd_lba <= i_seek_pos[31:9];
+                  sd_wr[ds0] <= 1;
+                  sd_busy <= 1;
+                end
               end
               state <= COMMAND_RW_DATA_EXEC5;
             end else begin
@@ -1394,8 +1788,8 @@ end
 
 
           COMMAND_SCAN_EXEC1: begin
-            $display("COMMAND_SCAN_EXEC1: Starting SCAN operation, mode=%b", i_scan_mode[ds0]);
-            $display("SCAN parameters: C=%d, H=%d, R=%d, N=%d, EOT=%d", i_c, i_h, i_r, i_n, i_eot);
+            `U765_TRACE(TR_SCAN, 1) $display("COMMAND_SCAN_EXEC1: Starting SCAN operation, mode=%b", i_scan_mode[ds0]);
+            `U765_TRACE(TR_SCAN, 1) $display("SCAN parameters: C=%d, H=%d, R=%d, N=%d, EOT=%d", i_c, i_h, i_r, i_n, i_eot);
             
             m_status[UPD765_MAIN_DIO] <= 0;
             i_bc <= 1;
@@ -1406,7 +1800,7 @@ end
             
             // Y asegurarnos de que usamos el PCN correcto
             if (pcn[ds0] != i_c) begin
-              $display("SCAN: Forcing head movement from track %d to %d", pcn[ds0], i_c);
+              `U765_TRACE(TR_SCAN, 1) $display("SCAN: Forcing head movement from track %d to %d", pcn[ds0], i_c);
               pcn[ds0] <= i_c;
             end
             
@@ -1416,8 +1810,11 @@ end
           end
           
           COMMAND_SCAN_EXEC2: begin
-            $display("COMMAND_SCAN_EXEC2: Loading track info");
-            if (~sd_busy & ~buff_wait) begin
+            `U765_TRACE(TR_SCAN, 2) $display("COMMAND_SCAN_EXEC2: Loading track info");
+            if (~sd_busy & ~buff_wait & tbuf_miss) begin
+              i_command <= COMMAND_SCAN_EXEC2;
+              state <= COMMAND_TRACK_PREFETCH;
+            end else if (~sd_busy & ~buff_wait) begin
               i_current_sector <= 1'd1;
               sd_buff_type <= UPD765_SD_BUFF_TRACKINFO;
               i_seek_pos <= {image_track_offsets_in + 1'd1, 8'd0}; //TrackInfo+256bytes
@@ -1428,23 +1825,23 @@ end
           end
           
           COMMAND_SCAN_EXEC3: begin
-            $display("COMMAND_SCAN_EXEC3: Processing sector info, buff_addr=%h, current=%d, total=%d", 
+            `U765_TRACE(TR_SCAN, 2) $display("COMMAND_SCAN_EXEC3: Processing sector info, buff_addr=%h, current=%d, total=%d", 
                      buff_addr, i_current_sector, i_total_sectors);
             
             if (~sd_busy & ~buff_wait) begin
               // Añadir más logging para diagnosticar
-              $display("SCAN_EXEC3: buff_data_in = %h at address %h", buff_data_in, buff_addr);
+              `U765_TRACE(TR_SCAN, 2) $display("SCAN_EXEC3: buff_data_in = %h at address %h", buff_data_in, buff_addr);
               
               if (buff_addr[7:0] == 8'h14) begin
                 if (!image_edsk[ds0]) begin
                   i_sector_size <= 8'h80 << buff_data_in[2:0];
-                  $display("Setting sector size from track info: %d", 8'h80 << buff_data_in[2:0]);
+                  `U765_TRACE(TR_SCAN, 2) $display("Setting sector size from track info: %d", 8'h80 << buff_data_in[2:0]);
                 end
                 buff_addr[7:0] <= 8'h18; // Sector info list
                 buff_wait <= 1;
               end else if (i_current_sector > i_total_sectors) begin
                 // Sector no encontrado o fin de pista
-                $display("Sector not found: current=%d, total=%d", i_current_sector, i_total_sectors);
+                `U765_TRACE(TR_SCAN, 1) $display("Sector not found: current=%d, total=%d", i_current_sector, i_total_sectors);
                 m_status[UPD765_MAIN_EXM] <= 0;
                 status[0] <= 8'h40; // Abnormal termination
                 status[1] <= 8'h04; // Sector not found
@@ -1457,44 +1854,44 @@ end
                 case (buff_addr[2:0])
                   0: begin
                     i_sector_c <= buff_data_in;
-                    $display("Sector[%d] C=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] C=%h", i_current_sector, buff_data_in);
                   end
                   1: begin
                     i_sector_h <= buff_data_in;
-                    $display("Sector[%d] H=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] H=%h", i_current_sector, buff_data_in);
                   end
                   2: begin
                     i_sector_r <= buff_data_in;
-                    $display("Sector[%d] R=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] R=%h", i_current_sector, buff_data_in);
                   end
                   3: begin
                     i_sector_n <= buff_data_in;
-                    $display("Sector[%d] N=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] N=%h", i_current_sector, buff_data_in);
                   end
                   4: begin
                     i_sector_st1 <= buff_data_in;
-                    $display("Sector[%d] ST1=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] ST1=%h", i_current_sector, buff_data_in);
                   end
                   5: begin
                     i_sector_st2 <= buff_data_in;
-                    $display("Sector[%d] ST2=%h", i_current_sector, buff_data_in);
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] ST2=%h", i_current_sector, buff_data_in);
                   end
                   6: begin 
                     if (image_edsk[ds0]) begin
                       i_sector_size[7:0] <= buff_data_in;
-                      $display("Sector[%d] size low=%h", i_current_sector, buff_data_in);
+                      `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] size low=%h", i_current_sector, buff_data_in);
                     end
                   end
                   7: begin
                     if (image_edsk[ds0]) begin
                       i_sector_size[15:8] <= buff_data_in;
-                      $display("Sector[%d] size high=%h", i_current_sector, buff_data_in);
+                      `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] size high=%h", i_current_sector, buff_data_in);
                     end
-                    $display("Sector[%d] info complete: C=%d, H=%d, R=%d, N=%d", 
+                    `U765_TRACE(TR_SCAN, 2) $display("Sector[%d] info complete: C=%d, H=%d, R=%d, N=%d", 
                             i_current_sector, i_sector_c, i_sector_h, i_sector_r, i_sector_n);
                     
                     // Verificar la dirección del buffer para descartar problemas
-                    $display("Current buffer address: %h, seek_pos: %h", buff_addr, i_seek_pos);
+                    `U765_TRACE(TR_SCAN, 2) $display("Current buffer address: %h, seek_pos: %h", buff_addr, i_seek_pos);
                     
                     state <= COMMAND_SCAN_EXEC4;
                   end
@@ -1506,20 +1903,20 @@ end
           end
           
           COMMAND_SCAN_EXEC4: begin
-            $display("COMMAND_SCAN_EXEC4: Checking sector match");
-            $display("Looking for: C=%d, H=%d, R=%d, N=%d", i_c, i_h, i_r, i_n);
-            $display("Found: C=%d, H=%d, R=%d, N=%d", i_sector_c, i_sector_h, i_sector_r, i_sector_n);
+            `U765_TRACE(TR_SCAN, 2) $display("COMMAND_SCAN_EXEC4: Checking sector match");
+            `U765_TRACE(TR_SCAN, 2) $display("Looking for: C=%d, H=%d, R=%d, N=%d", i_c, i_h, i_r, i_n);
+            `U765_TRACE(TR_SCAN, 2) $display("Found: C=%d, H=%d, R=%d, N=%d", i_sector_c, i_sector_h, i_sector_r, i_sector_n);
             
             // Verificar si encontramos el sector correcto
             if (i_sector_c == i_c && i_sector_r == i_r && i_sector_h == i_h && (i_sector_n == i_n || !i_n)) begin
               // Sector encontrado
-              $display("Sector match found!");
+              `U765_TRACE(TR_SCAN, 2) $display("Sector match found!");
               i_bytes_to_read <= i_n ? (8'h80 << (i_n[3] ? 4'h8 : i_n[2:0])) : i_dtl;
               i_timeout <= OVERRUN_TIMEOUT;
               state <= COMMAND_SCAN_READ_SECTOR;
             end else begin
               // Probar con el siguiente sector
-              $display("Sector mismatch, trying next sector");
+              `U765_TRACE(TR_SCAN, 2) $display("Sector mismatch, trying next sector");
               if (i_sector_c == i_c) i_bc <= 0;
               i_current_sector <= i_current_sector + 1'd1;
               i_seek_pos <= i_seek_pos + i_sector_size;
@@ -1528,13 +1925,26 @@ end
           end
           
           COMMAND_SCAN_READ_SECTOR: begin
-            $display("COMMAND_SCAN_READ_SECTOR: Reading sector data");
-            if (~sd_busy & ~buff_wait) begin
-              // Leer el sector del disco
+            `U765_TRACE(TR_SCAN, 2) $display("COMMAND_SCAN_READ_SECTOR: Reading sector data");
+            if (~sd_busy & ~buff_wait & wb_dirty & wb_lba != i_seek_pos[31:9]) begin
+              // Otro LBA pendiente de escribir en el buffer de sector, vaciarlo antes
+              i_command <= COMMAND_SCAN_READ_SECTOR;
+              state <= COMMAND_WB_FLUSH;
+            end else if (~sd_busy & ~buff_wait) begin
+              // Leer el sector del disco, o del buffer de pista si ya está allí
               sd_buff_type <= UPD765_SD_BUFF_SECTOR;
-              sd_rd[ds0] <= 1;
-              sd_lba <= i_seek_pos[31:9];
-              sd_busy <= 1;
+              if (wb_dirty) begin
+                // El buffer de sector ya tiene este LBA, más nuevo que la tarjeta SD
+                tbuf_sel <= 0;
+              end else if (tbuf_hit) begin
+                tbuf_sel <= 1;
+                tbuf_lba <= tbuf_offset[TRACK_BUFFER_BITS-10:0];
+              end else begin
+                tbuf_sel <= 0;
+                sd_rd[ds0] <= 1;
+                sd_lba <= i_seek_pos[31:9];
+                sd_busy <= 1;
+              end
               buff_addr <= i_seek_pos[8:0];
               buff_wait <= 1;
               state <= COMMAND_SCAN_COMPARE;
@@ -1544,15 +1954,17 @@ end
           COMMAND_SCAN_COMPARE: begin
             if (~sd_busy & ~buff_wait) begin
               // Establecer flags para indicar que necesitamos datos
-              m_status[UPD765_MAIN_RQM] <= 1;
+              // (en modo DMA solo con drq)
+              m_status[UPD765_MAIN_RQM] <= ndma_mode;
               m_status[UPD765_MAIN_DIO] <= 0;
+              drq <= ~ndma_mode;
               
               // Generar una interrupción si estamos en modo no-DMA
               if (ndma_mode) int_state[ds0] <= 1'b1;
               
-              if (~old_wr & wr & a0) begin
+              if (~old_wr & wr & (ndma_mode ? a0 : dack)) begin
                 // El CPU ha enviado datos, procesarlos normalmente
-                $display("SCAN comparison: sector data=0x%02X, CPU data=0x%02X, mode=%b", 
+                `U765_TRACE(TR_SCAN, 2) $display("SCAN comparison: sector data=0x%02X, CPU data=0x%02X, mode=%b", 
                          buff_data_in, din, i_scan_mode[ds0]);
                 
                 // Comparación según el modo
@@ -1560,19 +1972,19 @@ end
                   2'b01: begin // SCAN_EQUAL
                     if (buff_data_in == din) begin
                       i_scan_match <= 1;
-                      $display("SCAN_EQUAL match found!");
+                      `U765_TRACE(TR_SCAN, 2) $display("SCAN_EQUAL match found!");
                     end
                   end
                   2'b10: begin // SCAN_LOW_OR_EQUAL
                     if (buff_data_in <= din) begin
                       i_scan_match <= 1;
-                      $display("SCAN_LOW_OR_EQUAL match found!");
+                      `U765_TRACE(TR_SCAN, 2) $display("SCAN_LOW_OR_EQUAL match found!");
                     end
                   end
                   2'b11: begin // SCAN_HIGH_OR_EQUAL
                     if (buff_data_in >= din) begin
                       i_scan_match <= 1;
-                      $display("SCAN_HIGH_OR_EQUAL match found!");
+                      `U765_TRACE(TR_SCAN, 2) $display("SCAN_HIGH_OR_EQUAL match found!");
                     end
                   end
                 endcase
@@ -1587,6 +1999,7 @@ end
                 
                 // Desactivar interrupción ya que hemos procesado el byte
                 if (ndma_mode) int_state[ds0] <= 1'b0;
+                drq <= 1'b0;
                 
                 // Comprobar si hemos terminado
                 if (i_scan_match || i_bytes_to_read <= 1) begin
@@ -1598,7 +2011,7 @@ end
                 end
               end else if (i_timeout == 0) begin
                 // Timeout: el CPU no envió dato para comparar
-                $display("Timeout waiting for CPU data");
+                `U765_TRACE(TR_SCAN, 1) $display("Timeout waiting for CPU data");
                 m_status[UPD765_MAIN_EXM] <= 0;
                 status[0] <= 8'h40; // Abnormal termination
                 status[1] <= 0;
@@ -1613,11 +2026,11 @@ end
           end
 
           COMMAND_SCAN_NEXT: begin
-            $display("COMMAND_SCAN_NEXT: Finalizing scan operation");
+            `U765_TRACE(TR_SCAN, 1) $display("COMMAND_SCAN_NEXT: Finalizing scan operation");
             
             // Terminar inmediatamente si hay coincidencia
             if (i_scan_match) begin
-                $display("Ending scan: Immediate match found");
+                `U765_TRACE(TR_SCAN, 1) $display("Ending scan: Immediate match found");
                 
                 // Limpiar bandera de ejecución
                 m_status[UPD765_MAIN_EXM] <= 0;
@@ -1630,15 +2043,15 @@ end
                 case (i_scan_mode[ds0])
                     2'b01: begin
                         status[2] <= 8'h10; // SCAN_EQUAL satisfecho
-                        $display("Setting ST2=0x10 for SCAN_EQUAL match");
+                        `U765_TRACE(TR_SCAN, 1) $display("Setting ST2=0x10 for SCAN_EQUAL match");
                     end
                     2'b10: begin 
                         status[2] <= 8'h08; // SCAN_LOW_OR_EQUAL satisfecho
-                        $display("Setting ST2=0x08 for SCAN_LOW_OR_EQUAL match");
+                        `U765_TRACE(TR_SCAN, 1) $display("Setting ST2=0x08 for SCAN_LOW_OR_EQUAL match");
                     end
                     2'b11: begin
                         status[2] <= 8'h08; // SCAN_HIGH_OR_EQUAL satisfecho
-                        $display("Setting ST2=0x08 for SCAN_HIGH_OR_EQUAL match");
+                        `U765_TRACE(TR_SCAN, 1) $display("Setting ST2=0x08 for SCAN_HIGH_OR_EQUAL match");
                     end
                 endcase
                 
@@ -1654,15 +2067,15 @@ end
                 case (i_stp)
                     2'b00, 2'b01: begin
                         i_r <= i_r + 1'd1; // STP=1: siguiente sector
-                        $display("STP=1, next sector: %d", i_r + 1'd1);
+                        `U765_TRACE(TR_SCAN, 1) $display("STP=1, next sector: %d", i_r + 1'd1);
                     end
                     2'b10: begin 
                         i_r <= i_r + 2'd2; // STP=2: saltar un sector
-                        $display("STP=2, next sector: %d", i_r + 2'd2);
+                        `U765_TRACE(TR_SCAN, 1) $display("STP=2, next sector: %d", i_r + 2'd2);
                     end
                     2'b11: begin
                         i_r <= i_r + 2'd3; // STP=3: saltar dos sectores
-                        $display("STP=3, next sector: %d", i_r + 2'd3);
+                        `U765_TRACE(TR_SCAN, 1) $display("STP=3, next sector: %d", i_r + 2'd3);
                     end
                 endcase
                 
@@ -1672,7 +2085,7 @@ end
             end
             // Si se alcanzó EOT sin coincidencia
             else begin
-                $display("Ending scan: No match found, reached EOT");
+                `U765_TRACE(TR_SCAN, 1) $display("Ending scan: No match found, reached EOT");
                 
                 // Limpiar bandera de ejecución
                 m_status[UPD765_MAIN_EXM] <= 0;
@@ -1691,9 +2104,9 @@ end
         end
 
           COMMAND_FORMAT_TRACK: begin
-            int_state <= '{0, 0};
             if (~old_wr & wr & a0) begin
-              ds0   <= din[0];
+              ds0   <= din[DS_W-1:0];
+              int_state[din[DS_W-1:0]] <= 0;  //the other drives keep their seek interrupts
               state <= COMMAND_FORMAT_TRACK1;
             end
           end
@@ -1763,10 +2176,10 @@ end
           COMMAND_SCAN_SETUP:
           if (!old_wr & wr & a0) begin
             i_stp <= din & 8'h03;
-            $display("SCAN-SETUP: STP value = %d", din & 8'h03);
+            `U765_TRACE(TR_CMD, 1) $display("SCAN-SETUP: STP value = %d", din & 8'h03);
 
             // Move to the execute phase with proper status checks
-            if (~motor[ds0] | ~ready[ds0] | ~image_ready[ds0]) begin
+            if (~drv_motor[ds0] | ~drv_ready[ds0] | ~image_ready[ds0]) begin
               status[0] <= 8'h40;
               status[1] <= 8'b101;
               status[2] <= 0;
@@ -1790,7 +2203,6 @@ end
 
 
           COMMAND_INVALID: begin
-            int_state <= '{0, 0};
             m_status[UPD765_MAIN_DIO] <= 1;
             //					m_status[UPD765_MAIN_RQM] <= 1;
             status[0] <= 8'h80;
@@ -1806,14 +2218,14 @@ end
 
 
           COMMAND_SETUP_VALIDATION: begin
-            $display("COMMAND_SETUP_VALIDATION: scan_mode=%b, i_command=%d", i_scan_mode[ds0],
+            `U765_TRACE(TR_CMD, 1) $display("COMMAND_SETUP_VALIDATION: scan_mode=%b, i_command=%d", i_scan_mode[ds0],
                      i_command);
-            $display("Disk conditions: motor=%b, ready=%b, image_ready=%b", motor[ds0], ready[ds0],
+            `U765_TRACE(TR_CMD, 1) $display("Disk conditions: motor=%b, ready=%b, image_ready=%b", drv_motor[ds0], drv_ready[ds0],
                      image_ready[ds0]);
           
-            if (~motor[ds0] | ~ready[ds0]) begin
-              $display("ERROR: Disk not ready - motor=%b, ready=%b, image_ready=%b", motor[ds0],
-                       ready[ds0], image_ready[ds0]);
+            if (~drv_motor[ds0] | ~drv_ready[ds0]) begin
+              `U765_TRACE(TR_CMD, 1) $display("ERROR: Disk not ready - motor=%b, ready=%b, image_ready=%b", drv_motor[ds0],
+                       drv_ready[ds0], image_ready[ds0]);
               status[0] <= 8'h40;
               status[1] <= 8'b101;
               status[2] <= 0;
@@ -1821,7 +2233,7 @@ end
               int_state[ds0] <= 1'b1;
               phase <= PHASE_RESPONSE;
             end else if (hds & ~image_sides[ds0]) begin
-              $display("ERROR: No side B available - hds=%b, image_sides=%b", hds,
+              `U765_TRACE(TR_CMD, 1) $display("ERROR: No side B available - hds=%b, image_sides=%b", hds,
                        image_sides[ds0]);
               hds <= 0;
               status[0] <= 8'h48;  //no side B
@@ -1836,10 +2248,10 @@ end
               // Redirigir a los estados específicos de SCAN si es necesario
               if (i_scan_mode[ds0] != 2'b00) begin
                 i_scan_match <= 0;  // Reset match flag
-                $display("Dirigiendo a los estados específicos de SCAN: scan_mode=%b", i_scan_mode[ds0]);
+                `U765_TRACE(TR_CMD, 1) $display("Dirigiendo a los estados específicos de SCAN: scan_mode=%b", i_scan_mode[ds0]);
                 state <= COMMAND_SCAN_EXEC1;  // Estado específico para SCAN
               end else begin
-                $display("Procediendo con el comando normal: i_command=%d", i_command);
+                `U765_TRACE(TR_CMD, 1) $display("Procediendo con el comando normal: i_command=%d", i_command);
                 state <= i_command;
               end
             end
@@ -1851,14 +2263,14 @@ end
 
           // Añadir logs al estado COMMAND_RW_DATA_EXEC
           COMMAND_RW_DATA_EXEC: begin
-            $display("COMMAND_RW_DATA_EXEC: scan_mode=%b, write=%b, wp=%b", i_scan_mode[ds0], i_write,
+            `U765_TRACE(TR_RW, 1) $display("COMMAND_RW_DATA_EXEC: scan_mode=%b, write=%b, wp=%b", i_scan_mode[ds0], i_write,
                      image_wp[ds0]);
             if (i_scan_mode[ds0] != 2'b00) begin
               i_write <= 1'b0;
             end
 
             if (i_write & image_wp[ds0]) begin
-              $display("ERROR: Disk is write protected");
+              `U765_TRACE(TR_RW, 1) $display("ERROR: Disk is write protected");
               status[0] <= 8'h40;
               status[1] <= 8'h02;  //not writeable
               status[2] <= 0;
@@ -1866,8 +2278,10 @@ end
               int_state[ds0] <= 1'b1;
               phase <= PHASE_RESPONSE;
             end else begin
-              $display("Setting up track info reload");
+              `U765_TRACE(TR_RW, 1) $display("Setting up track info reload");
               m_status[UPD765_MAIN_RQM] <= 0;
+              i_head_timer <= {i_hlt, 1'b0};
+              i_head_cycles <= CYCLES;
               i_command <= COMMAND_RW_DATA_EXEC1;
               state <= COMMAND_RELOAD_TRACKINFO;
             end
@@ -1875,24 +2289,88 @@ end
 
           // Añadir logs al COMMAND_RELOAD_TRACKINFO
           COMMAND_RELOAD_TRACKINFO: begin
-            $display("COMMAND_RELOAD_TRACKINFO: image_ready=%b, trackinfo_dirty=%b",
+            `U765_TRACE(TR_TRACK, 1) $display("COMMAND_RELOAD_TRACKINFO: image_ready=%b, trackinfo_dirty=%b",
                      image_ready[ds0], image_trackinfo_dirty[ds0]);
 
-            if (image_ready[ds0] & image_trackinfo_dirty[ds0]) begin
-              $display("Reloading track info");
+            //look for the cylinder in the Track-Info cache, every head of the image loaded
+            ti_hit = 0;
+            ti_hit_slot = 0;
+            for (int s = 0; s < TI_SLOTS; s++)
+              if (ti_cyl[ds0][s] == pcn[ds0] && ti_valid[ds0][s][0] &&
+                  (ti_valid[ds0][s][1] || !image_sides[ds0])) begin
+                ti_hit = 1;
+                ti_hit_slot = s[TI_W-1:0];
+              end
+
+            if (image_ready[ds0] & image_trackinfo_dirty[ds0] & ti_hit) begin
+              `U765_TRACE(TR_TRACK, 1) $display("Track info of cylinder %0d in cache slot %0d", pcn[ds0], ti_hit_slot);
+              next_weak_sector[ds0] <= 0;
+              ti_slot[ds0] <= ti_hit_slot;
+              for (int h = 0; h <= image_sides[ds0]; h++) begin
+                i_current_track_sectors[ds0][h] <= ti_sectors[ds0][ti_hit_slot][h];
+                i_sector_pitch[ds0][h] <= ti_pitch[ds0][ti_hit_slot][h];
+                i_track_pre[ds0][h] <= ti_pre[ds0][ti_hit_slot][h];
+                //same head position as after a reload
+                i_current_sector_pos[ds0][h] <= 0;
+                i_rpm_timer[ds0][h] <= ti_pre[ds0][ti_hit_slot][h];
+                i_angle_skip[ds0][h] <= i_angle[ds0];
+              end
+              image_trackinfo_dirty[ds0] <= 0;
+              state <= i_command;
+            end else if (image_ready[ds0] & image_trackinfo_dirty[ds0]) begin
+              `U765_TRACE(TR_TRACK, 1) $display("Reloading track info");
               //i_rpm_timer[ds0] <= '{ 0, 0 };
               next_weak_sector[ds0] <= 0;
+              //take over the next cache slot for this cylinder
+              ti_slot[ds0] <= ti_victim[ds0];
+              ti_victim[ds0] <= (TI_SLOTS == 1) ? 1'd0 : ti_victim[ds0] + 1'd1;
+              ti_cyl[ds0][ti_victim[ds0]] <= pcn[ds0];
+              ti_valid[ds0][ti_victim[ds0]] <= 0;
               image_track_offsets_addr <= {pcn[ds0], 1'b0};
               old_hds <= hds;
               hds <= 0;
               buff_wait <= 1;
               state <= COMMAND_RELOAD_TRACKINFO1;
             end else begin
-              $display("No need to reload track info, proceeding to i_command=%d", i_command);
+              `U765_TRACE(TR_TRACK, 1) $display("No need to reload track info, proceeding to i_command=%d", i_command);
               state <= i_command;
             end
           end
 
+          //load the track buffer, TBUF_LBAS LBAs from the Track-Info block of the
+          //current track or up to the end of the image
+          COMMAND_TRACK_PREFETCH: begin
+            `U765_TRACE(TR_TRACK, 1) $display("Prefetching track from LBA %0d", image_track_offsets_in[15:1]);
+            tbuf_valid <= 0;
+            tbuf_sel <= 0;
+            tbuf_drive <= ds0;
+            tbuf_base <= image_track_offsets_in[15:1];
+            tbuf_count <= 0;
+            tbuf_filling <= 1;
+            state <= COMMAND_TRACK_PREFETCH1;
+          end
+
+          COMMAND_TRACK_PREFETCH1:
+          if (~sd_busy) begin
+            if (tbuf_count == TBUF_LBAS || {tbuf_base + tbuf_count, 9'd0} >= image_size[ds0]) begin
+              tbuf_filling <= 0;
+              tbuf_valid <= 1;
+              state <= i_command;
+            end else begin
+              sd_rd[ds0] <= 1;
+              sd_lba <= tbuf_base + tbuf_count;
+              sd_busy <= 1;
+              state <= COMMAND_TRACK_PREFETCH2;
+            end
+          end
+
+          //the SD card writes the LBA at tbuf_count of the buffer
+          COMMAND_TRACK_PREFETCH2:
+          if (~sd_busy) begin
+            tbuf_count <= tbuf_count + 1'd1;
+            state <= COMMAND_TRACK_PREFETCH1;
+          end
+
           COMMAND_RELOAD_TRACKINFO1:
           if (~buff_wait & ~sd_busy) begin
             if (image_ready[ds0] && image_track_offsets_in) begin
@@ -1922,22 +2400,144 @@ end
           if (~sd_busy & ~buff_wait) begin
             i_current_track_sectors[ds0][hds] <= buff_data_in;
             //i_rpm_time[ds0][hds] <= buff_data_in ? TRACK_TIME/buff_data_in : cycles_time;
+            ti_sectors[ds0][ti_slot[ds0]][hds] <= buff_data_in;
+            geo_spread <= spread_pitch[buff_data_in];
+
+            //index the sector info list of this head
+            idx_k <= 0;
+            idx_seen <= 0;
+            idx_pos <= {image_track_offsets_in + 1'd1, 8'd0};  //TrackInfo+256bytes
+            buff_addr <= {image_track_offsets_in[0], 8'h14};  //sector size
+            buff_wait <= 1;
+            state <= COMMAND_RELOAD_TRACKINFO_INDEX;
+          end
 
-            //assume the head position is at the middle of a track after a seek
-            i_current_sector_pos[ds0][hds] <= buff_data_in[7:1];
+          //one pass over the sector info list: every sector goes to the sector index with
+          //its file offset, R to its position to the sector map
+          COMMAND_RELOAD_TRACKINFO_INDEX:
+          if (~buff_wait) begin
+            sector_index_wr <= 0;
+            sector_map_wr <= 0;
+            if (buff_addr[7:0] == 8'h14) begin
+              idx_size <= 8'h80 << buff_data_in[2:0];
+              buff_addr[7:0] <= 8'h16;  //GAP#3
+              buff_wait <= 1;
+            end else if (buff_addr[7:0] == 8'h16) begin
+              //track geometry in byte times: 250 kbps, or 500 kbps if it only fits at that
+              //rate. Crammed tracks get the sectors spread evenly over the revolution
+              geo_pitch = SECTOR_OVERHEAD + idx_size + buff_data_in;
+              geo_track = TRACK_PRE_BYTES + i_total_sectors * geo_pitch;
+              if (geo_track * 2 <= TRACK_UNITS) begin
+                geo_pitch = geo_pitch << 1;
+                geo_pre = TRACK_PRE_BYTES * 2;
+              end else begin
+                geo_pre = TRACK_PRE_BYTES;
+                if (i_total_sectors && geo_track > TRACK_UNITS) geo_pitch = geo_spread;
+              end
+              i_sector_pitch[ds0][hds] <= geo_pitch;
+              i_track_pre[ds0][hds] <= geo_pre;
+              ti_pitch[ds0][ti_slot[ds0]][hds] <= geo_pitch;
+              ti_pre[ds0][ti_slot[ds0]][hds] <= geo_pre;
+              //the head lands on the new track at the current angle of the disk
+              i_current_sector_pos[ds0][hds] <= 0;
+              i_rpm_timer[ds0][hds] <= geo_pre;
+              i_angle_skip[ds0][hds] <= i_angle[ds0];
+              buff_addr[7:0] <= 8'h18;  //sector info list
+              buff_wait <= 1;
+            end else if (idx_k == i_total_sectors || idx_k == IDX_SECTORS) begin
+              ti_valid[ds0][ti_slot[ds0]][hds] <= 1;
+              if (hds == image_sides[ds0]) begin
+                image_trackinfo_dirty[ds0] <= 0;
+                hds <= old_hds;
+                state <= i_command;  // Exit back to COMMAND_READ_ID2 / COMMAND_RW_DATA_EXEC1
+              end else begin  //read TrackInfo from the other head if 2 sided
+                image_track_offsets_addr <= {pcn[ds0], 1'b1};
+                hds <= 1;
+                buff_wait <= 1;
+                state <= COMMAND_RELOAD_TRACKINFO1;
+              end
+            end else begin
+              case (buff_addr[2:0])
+                0: idx_entry[95:88] <= buff_data_in;  //C
+                1: idx_entry[87:80] <= buff_data_in;  //H
+                2: idx_entry[79:72] <= buff_data_in;  //R
+                3: idx_entry[71:64] <= buff_data_in;  //N
+                4: idx_entry[63:56] <= buff_data_in;  //ST1
+                5: idx_entry[55:48] <= buff_data_in;  //ST2
+                6: if (image_edsk[ds0]) idx_size[7:0] <= buff_data_in;
+                7: begin
+                  tmp_idx_size = image_edsk[ds0] ? {buff_data_in, idx_size[7:0]} : idx_size;
+                  sector_index_addr <= idx_k[4:0];
+                  sector_index_out <= {idx_entry[95:48], idx_pos, tmp_idx_size};
+                  sector_index_wr <= 1;
+                  //the first sector with this R keeps the map, a repeat only sets the
+                  //duplicate bit so the lookup leaves R to the linear scan
+                  sector_map_addr <= idx_entry[79:72];
+                  sector_map_out <= {idx_seen[idx_entry[79:72]], idx_k[4:0]};
+                  sector_map_wr <= 1;
+                  idx_seen[idx_entry[79:72]] <= 1;
+                  idx_pos <= idx_pos + tmp_idx_size;
+                  idx_k <= idx_k + 1'd1;
+                end
+              endcase
+              buff_addr <= buff_addr + 1'd1;
+              buff_wait <= 1;
+            end
+          end
 
-            if (hds == image_sides[ds0]) begin
-              image_trackinfo_dirty[ds0] <= 0;
-              hds <= old_hds;
-              state <= i_command;  // Exit back to COMMAND_READ_ID2 / COMMAND_RW_DATA_EXEC1
-            end else begin  //read TrackInfo from the other head if 2 sided
-              image_track_offsets_addr <= {pcn[ds0], 1'b1};
-              hds <= 1;
+          //O(1) lookup of the sector in the index, R -> position -> sector info. An R the map
+          //marks as repeated, or a sector it doesn't hold (past IDX_SECTORS, other CHRN),
+          //goes through the linear scan from RW_DATA_EXEC3 that RW_DATA_EXEC2 has set up, so
+          //the first sector with a matching ID wins as before
+          COMMAND_RW_DATA_LOOKUP:
+          if (~buff_wait) begin
+            if (~i_rtrack & sector_map_in[5]) begin
+              //repeated R: the first sector with it, as the linear scan finds it
+              state <= COMMAND_RW_DATA_EXEC3;
+            end else begin
+              idx_k <= i_rtrack ? i_r - 1'd1 : {3'd0, sector_map_in[4:0]};
+              sector_index_addr <= i_rtrack ? i_r[4:0] - 1'd1 : sector_map_in[4:0];
               buff_wait <= 1;
-              state <= COMMAND_RELOAD_TRACKINFO1;
+              state <= COMMAND_RW_DATA_LOOKUP1;
+            end
+          end
+
+          COMMAND_RW_DATA_LOOKUP1:
+          if (~buff_wait) begin
+            if (idx_k < i_total_sectors && idx_k < IDX_SECTORS && (i_rtrack ||
+                (sector_index_in[95:88] == i_c && sector_index_in[87:80] == i_h &&
+                 sector_index_in[79:72] == i_r && (sector_index_in[71:64] == i_n || !i_n)))) begin
+              {i_sector_c, i_sector_h, i_sector_r, i_sector_n} <= sector_index_in[95:64];
+              {i_sector_st1, i_sector_st2} <= sector_index_in[63:48];
+              i_seek_pos <= sector_index_in[47:16];
+              i_sector_size <= sector_index_in[15:0];
+              i_current_sector <= idx_k + 1'd1;
+              state <= COMMAND_RW_DATA_EXEC4;
+            end else begin
+              state <= COMMAND_RW_DATA_EXEC3;
             end
           end
 
+          //write the dirty sector buffer to the SD card, then return to i_command
+          COMMAND_WB_FLUSH:
+          if (~sd_busy) begin
+            `U765_TRACE(TR_SD, 1) $display("Write-back flush of LBA %0d, %0d write(s) merged", wb_lba, wb_merged);
+            sd_buff_type <= UPD765_SD_BUFF_SECTOR;
+            tbuf_sel <= 0;
+            sd_lba <= wb_lba;
+            sd_wr[wb_drive] <= 1;
+            sd_busy <= 1;
+            state <= COMMAND_WB_FLUSH1;
+          end
+
+          COMMAND_WB_FLUSH1:
+          if (~sd_busy) begin
+            if (wb_merged > 1) sd_writes_saved <= sd_writes_saved + wb_merged - 1'd1;
+            wb_merged <= 0;
+            wb_dirty <= 0;
+            state <= i_command;
+          end
+
         endcase  //status
       end
     end
@@ -0,0 +1,181 @@
+// Simulation throughput benchmark for the u765 core.
+//
+// Runs fixed workloads (the scenarios of u765_scenarios.h) one after the other on a fresh
+// U765Sim each, and reports simulated cycles per second, wall time and RSS. Results are
+// saved as JSON and can be checked against a previous run. The model build variant
+// (threads, trace support) is whatever this binary was built with, see "make bench".
+//
+//   u765_bench <image.dsk> +variant=threads1 +json=bench.json +baseline=old/bench.json
+//
+// Plusargs:
+//   +workloads=a,b,...  scenarios to time (default mount,mount_ab,recal,boot,
+//                       read_track,read_track_dma,scan_equal: PIO and DMA side by side)
+//   +reps=N             runs per workload, the fastest one counts (default 3)
+//   +fast=N             fast port mask (default 0, accurate timing)
+//   +variant=name       label of the build variant in the report
+//   +json=file          save the results
+//   +baseline=file      compare with a saved run of the same variant
+//   +tolerance=P        cycles/s drop in percent that counts as a regression (default 5)
+// The trace plusargs apply as usual, so +trace=off and +trace=full time both cases, and so
+// do the +sd_* ones of u765_storage.h: with a slow SD the cycles column is the controller
+// throughput behind that storage. +workloads=script +script=f times a script or a +bus_rec
+// capture (u765_script.h), and +workloads=sweep the read of every sector of the image.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "Vu765_test.h"
+#include "verilated.h"
+#include "u765_plusargs.h"
+#include "u765_sim.h"
+#include "u765_scenarios.h"
+
+double sc_time_stamp() {
+    return 0;
+}
+
+struct BenchResult {
+    std::string workload;
+    bool ok = false;
+    uint64_t cycles = 0;  // clk_sys cycles, two ticks each
+    double wall = 0;      // seconds, fastest rep
+    double wall_mean = 0;
+    double cycles_per_s = 0;
+    long rss_kb = 0;      // peak RSS of the process after the workload
+};
+
+static long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static BenchResult run_workload(const Scenario &s, const char *image, int fast, int reps) {
+    BenchResult b;
+    b.workload = s.name;
+    b.ok = true;
+    for (int rep = 0; rep < reps; rep++) {
+        ScenarioResult r;
+        auto start = std::chrono::steady_clock::now();
+        {
+            U765Sim sim((std::string("bench.") + s.name + ".fst").c_str());
+            sim.verbose = false;
+            sim.images.verbose = false;
+            sim.watchdog.abort_on_stall = false;
+            sim.watchdog.out = NULL;
+            run_scenario(sim, s, image, fast, r);
+        }
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!r.ok) {
+            printf("  %s failed: %s\n", s.name, r.error.c_str());
+            b.ok = false;
+        }
+        if (!rep || wall < b.wall) b.wall = wall;
+        b.wall_mean += wall / reps;
+        b.cycles = r.ticks / 2;
+    }
+    b.cycles_per_s = b.wall > 0 ? b.cycles / b.wall : 0;
+    b.rss_kb = peak_rss_kb();
+    return b;
+}
+
+// One result per line, so a baseline can be read back without a JSON parser
+static bool write_json(const char *path, const std::string &variant, int fast,
+                       const std::vector<BenchResult> &results) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\n  \"variant\": \"%s\",\n  \"fast\": %d,\n  \"results\": [\n", variant.c_str(), fast);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &b = results[i];
+        fprintf(f, "    {\"workload\": \"%s\", \"ok\": %s, \"cycles\": %llu, \"wall\": %.6f, "
+                   "\"wall_mean\": %.6f, \"cycles_per_s\": %.1f, \"rss_kb\": %ld}%s\n",
+                b.workload.c_str(), b.ok ? "true" : "false", (unsigned long long)b.cycles, b.wall,
+                b.wall_mean, b.cycles_per_s, b.rss_kb, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return !fclose(f);
+}
+
+// workload -> cycles/s of a file written by write_json()
+static std::map<std::string, double> read_baseline(const char *path) {
+    std::map<std::string, double> base;
+    FILE *f = fopen(path, "r");
+    if (!f) return base;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        const char *w = strstr(line, "\"workload\": \"");
+        const char *c = strstr(line, "\"cycles_per_s\": ");
+        if (!w || !c || sscanf(w + 13, "%63[^\"]", name) != 1) continue;
+        base[name] = atof(c + 16);
+    }
+    fclose(f);
+    return base;
+}
+
+int main(int argc, char **argv) {
+    Verilated::commandArgs(argc, argv);
+    std::vector<char *> args = plusargs_init(argc, argv);
+
+    if (args.size() < 2) {
+        printf("Usage: %s <image.dsk>\n", args[0]);
+        printf("  +workloads=a,b,...  default mount,mount_ab,recal,boot,read_track,read_track_dma,scan_equal\n");
+        printf("  +reps=N  +fast=N  +variant=name  +json=file  +baseline=file  +tolerance=P\n");
+        return -1;
+    }
+    const char *image = args[1];
+    std::string variant = plusarg_str("variant", "default");
+    int reps = plusarg_int("reps", 3);
+    int fast = plusarg_int("fast", 0) & 0xf;
+    double tolerance = plusarg_int("tolerance", 5);
+    if (reps < 1) reps = 1;
+
+    std::vector<const Scenario *> workloads;
+    if (!parse_scenario_list(
+            plusarg_str("workloads", "mount,mount_ab,recal,boot,read_track,read_track_dma,scan_equal"),
+            workloads))
+        return -1;
+
+    printf("Benchmark %s, image %s, fast 0x%x, best of %d\n", variant.c_str(), image, fast, reps);
+    std::vector<BenchResult> results;
+    for (const Scenario *s : workloads) results.push_back(run_workload(*s, image, fast, reps));
+
+    std::string baseline = plusarg_str("baseline", "");
+    std::map<std::string, double> base;
+    if (!baseline.empty()) {
+        base = read_baseline(baseline.c_str());
+        if (base.empty()) printf("No results in baseline %s\n", baseline.c_str());
+    }
+
+    int failed = 0, regressions = 0;
+    printf("\n%-11s %-4s %12s %9s %9s %12s %8s %9s\n", "workload", "ok", "cycles", "wall(s)",
+           "mean(s)", "cycles/s", "RSS(MB)", "vs base");
+    for (const BenchResult &b : results) {
+        char delta[16] = "";
+        auto it = base.find(b.workload);
+        if (it != base.end() && it->second > 0) {
+            double pct = (b.cycles_per_s / it->second - 1) * 100;
+            snprintf(delta, sizeof(delta), "%+.1f%%", pct);
+            if (pct < -tolerance) regressions++;
+        }
+        printf("%-11s %-4s %12llu %9.3f %9.3f %12.0f %8.1f %9s\n", b.workload.c_str(),
+               b.ok ? "ok" : "FAIL", (unsigned long long)b.cycles, b.wall, b.wall_mean,
+               b.cycles_per_s, b.rss_kb / 1024.0, delta);
+        if (!b.ok) failed++;
+    }
+    if (!base.empty())
+        printf("%d workload(s) more than %.0f%% slower than %s\n", regressions, tolerance,
+               baseline.c_str());
+
+    std::string json = plusarg_str("json", "");
+    if (!json.empty()) {
+        if (write_json(json.c_str(), variant, fast, results)) printf("Results saved to %s\n", json.c_str());
+        else printf("Can't create %s\n", json.c_str());
+    }
+
+    return (failed || regressions) ? 1 : 0;
+}
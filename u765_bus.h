@@ -0,0 +1,100 @@
+// Host bus capture for the u765 testbenches.
+//
+// Writes every host side transaction of a U765Sim to a text file as statements of the
+// scenario language of u765_script.h, each one stamped with the clk_sys cycle it ended on:
+//
+//   @1200 insert 0 test.dsk
+//   @1480 status 0x80
+//   @1484 wr 0x07
+//   @3025 wait int
+//   @3410 rd 0x20
+//   @9000 dma_rd 0xe5 tc
+//
+// A capture is therefore a script, and replays with +script (at full speed, or keeping the
+// stamps with +script_timing). Status values are only written when they change, and a
+// change of the drive and fast inputs goes out as a pins statement before the transaction
+// that first sees it. Captures from an emulator or a logic analyser on a real machine
+// replay the same way when converted to this format; their own status polls turn into
+// waits for the status that ended each poll.
+//
+// Plusargs:
+//   +bus_rec=file  capture the host bus of the run to file
+#ifndef U765_BUS_H
+#define U765_BUS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string>
+#include "Vu765_test.h"
+#include "u765_plusargs.h"
+
+class BusCapture {
+public:
+    std::string path;  // opened on the first transaction, so a harness can still change it
+    uint64_t lines = 0;
+
+    void configure() { path = plusarg_str("bus_rec", ""); }
+
+    bool enabled() const { return !path.empty(); }
+
+    // One statement at tick, after the pins that changed since the previous one
+    void log(Vu765_test *tb, uint64_t tick, const char *fmt, ...) __attribute__((format(printf, 4, 5))) {
+        if (path.empty() || !open()) return;
+        pins(tb, tick);
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(f, "@%llu ", (unsigned long long)(tick / 2));
+        vfprintf(f, fmt, ap);
+        fputc('\n', f);
+        va_end(ap);
+        lines++;
+        last_status = -1;
+    }
+
+    // Status register seen by the host, only when it differs from the last one written
+    void status(Vu765_test *tb, uint64_t tick, int value) {
+        if (path.empty() || value == last_status) return;
+        log(tb, tick, "status 0x%02x", value);
+        last_status = value;
+    }
+
+    void close() {
+        if (f) fclose(f);
+        f = NULL;
+    }
+
+    ~BusCapture() { close(); }
+
+private:
+    FILE *f = NULL;
+    bool failed = false;
+    int last_status = -1;
+    int last_pins[5] = {-1, -1, -1, -1, -1};
+
+    bool open() {
+        if (f) return true;
+        if (failed) return false;
+        f = fopen(path.c_str(), "w");
+        if (!f) {
+            printf("Bus capture: can't create %s\n", path.c_str());
+            failed = true;
+            return false;
+        }
+        fprintf(f, "# u765 bus capture, replay with +script=%s\n", path.c_str());
+        return true;
+    }
+
+    void pins(Vu765_test *tb, uint64_t tick) {
+        int now[5] = {tb->ready, tb->motor, tb->available, tb->density, tb->fast};
+        bool changed = false;
+        for (int i = 0; i < 5; i++) changed |= now[i] != last_pins[i];
+        if (!changed) return;
+        fprintf(f, "@%llu pins ready=0x%x motor=0x%x available=0x%x density=0x%x fast=0x%x\n",
+                (unsigned long long)(tick / 2), now[0], now[1], now[2], now[3], now[4]);
+        for (int i = 0; i < 5; i++) last_pins[i] = now[i];
+        lines++;
+    }
+};
+
+#endif
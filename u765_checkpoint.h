@@ -0,0 +1,149 @@
+// Checkpoint/restore for the u765 testbenches.
+//
+// A checkpoint holds the verilated model (built with --savable) plus the harness state
+// the testbench writes through its save/restore hooks: tick counter, interrupt flags, SD
+// server and overlays. Restoring one skips the reset, mount and positioning prologue, and
+// fork_scenarios() fans several scenarios out of one warmed state without re-running it.
+//
+// Plusargs:
+//   +ckpt_save=prefix   write prefix.<point>.ckpt at every checkpoint point of the test
+//   +ckpt_restore=file  start from a checkpoint instead of running the prologue
+//   +fork_log=prefix    stdout of forked scenario i goes to prefix.<i>.log (default u765_fork)
+#ifndef U765_CHECKPOINT_H
+#define U765_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "Vu765_test.h"
+#include "verilated_save.h"
+#include "u765_plusargs.h"
+
+#define U765_CKPT_MAGIC "U765CKP1"
+
+// Plain values go into the stream as raw bytes, the checkpoint is only meant to be
+// restored by the same testbench binary
+template <class T> static inline void ckpt_put(VerilatedSerialize &os, const T &v) {
+    os.write(&v, sizeof(v));
+}
+
+template <class T> static inline void ckpt_get(VerilatedDeserialize &is, T &v) {
+    is.read(&v, sizeof(v));
+}
+
+class Checkpointer {
+public:
+    std::string save_prefix;
+    std::string restore_file;
+    void (*save_harness)(VerilatedSerialize &os) = NULL;
+    bool (*restore_harness)(VerilatedDeserialize &is) = NULL;
+
+    void configure() {
+        save_prefix = plusarg_str("ckpt_save", "");
+        restore_file = plusarg_str("ckpt_restore", "");
+    }
+
+    bool saving() const { return !save_prefix.empty(); }
+    bool restoring() const { return !restore_file.empty(); }
+
+    // Save the model and the harness as <prefix>.<point>.ckpt. No-op without +ckpt_save.
+    // Templates, so only the testbenches that checkpoint need a model built with --savable
+    template <class Model> bool save(Model *tb, const char *point) {
+        if (!saving()) return true;
+        std::string path = save_prefix + "." + point + ".ckpt";
+        VerilatedSave os;
+        os.open(path.c_str());
+        if (!os.isOpen()) {
+            printf("Checkpoint: can't create %s\n", path.c_str());
+            return false;
+        }
+        os << std::string(U765_CKPT_MAGIC) << std::string(point);
+        os << *tb;
+        if (save_harness) save_harness(os);
+        os.close();
+        printf("Checkpoint: %s saved to %s\n", point, path.c_str());
+        return true;
+    }
+
+    // Load +ckpt_restore into the model and the harness. The model must already exist
+    template <class Model> bool restore(Model *tb) {
+        FILE *f = fopen(restore_file.c_str(), "rb");
+        if (!f) {
+            printf("Checkpoint: can't open %s\n", restore_file.c_str());
+            return false;
+        }
+        fclose(f);
+
+        VerilatedRestore is;
+        is.open(restore_file.c_str());
+        if (!is.isOpen()) return false;
+        std::string magic;
+        is >> magic >> point;
+        if (magic != U765_CKPT_MAGIC) {
+            printf("Checkpoint: %s is not a u765 checkpoint\n", restore_file.c_str());
+            return false;
+        }
+        is >> *tb;
+        bool ok = !restore_harness || restore_harness(is);
+        is.close();
+        if (ok) printf("Checkpoint: restored %s from %s\n", point.c_str(), restore_file.c_str());
+        return ok;
+    }
+
+    const std::string &restored_point() const { return point; }
+
+private:
+    std::string point;
+};
+
+// Run every scenario in its own child process, all starting from the current state of the
+// model and the harness. Children inherit the whole simulation through fork(), so nothing
+// is re-simulated. Returns the number of scenarios that failed.
+template <class F> int fork_scenarios(const std::vector<int> &scenarios, F run) {
+    std::string log_prefix = plusarg_str("fork_log", "u765_fork");
+    std::vector<pid_t> pids;
+
+    fflush(NULL);  // or the children would flush the parent's pending output again
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::string log = log_prefix + "." + std::to_string(i) + ".log";
+            if (!freopen(log.c_str(), "w", stdout)) _exit(2);
+            int status = run((int)i, scenarios[i]);
+            fflush(NULL);
+            _exit(status);
+        }
+        if (pid < 0) printf("Fork: can't start scenario %zu\n", i);
+        pids.push_back(pid);
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < pids.size(); i++) {
+        int status = -1;
+        if (pids[i] > 0) waitpid(pids[i], &status, 0);
+        bool ok = pids[i] > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok) failed++;
+        printf("Fork: scenario %zu (%d) %s, log in %s.%zu.log\n", i, scenarios[i],
+               ok ? "ok" : "FAILED", log_prefix.c_str(), i);
+    }
+    return failed;
+}
+
+// Comma separated list of integers, like the +fork=0,2,2 scenario lists
+static inline std::vector<int> parse_int_list(const std::string &s) {
+    std::vector<int> list;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) end = s.size();
+        if (end > pos) list.push_back(strtol(s.substr(pos, end - pos).c_str(), NULL, 0));
+        pos = end + 1;
+    }
+    return list;
+}
+
+#endif
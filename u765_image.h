@@ -0,0 +1,395 @@
+// Disk image backend for the u765 testbenches.
+//
+// Images are mmapped read-only once and every sd_rd request is served straight from the
+// mapping, without fseek/fread or a bounce buffer. Mappings are MAP_SHARED, so simulator
+// processes working on the same image share the page cache, and inside one process every
+// user of the same path gets the same DiskImage. Writes never reach the image file, they
+// go to a copy-on-write ImageOverlay per drive. When each request is answered, and how fast,
+// is up to the StorageModel of the server (u765_storage.h), ideal unless configured.
+#ifndef U765_IMAGE_H
+#define U765_IMAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "Vu765_test.h"
+#include "u765_checkpoint.h"
+#include "u765_storage.h"
+
+// Drives the SD server answers for, enough for a core built with any DRIVES (up to 4)
+#define U765_DRIVES 4
+#define SD_BLOCK 512
+
+class DiskImage {
+public:
+    std::string path;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+
+    // Open (or reuse) the mapping of an image file. Returns NULL if it can't be mapped
+    static std::shared_ptr<DiskImage> open(const std::string &path) {
+        static std::mutex lock;
+        static std::map<std::string, std::weak_ptr<DiskImage>> cache;
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::shared_ptr<DiskImage> img = cache[path].lock();
+        if (img) return img;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+            close(fd);
+            return NULL;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return NULL;
+        madvise(p, st.st_size, MADV_WILLNEED);
+
+        img.reset(new DiskImage);
+        img->path = path;
+        img->data = (const uint8_t *)p;
+        img->size = st.st_size;
+        cache[path] = img;
+        return img;
+    }
+
+    // 512 byte block at lba. The last partial block is padded with zeros in tail,
+    // blocks past the end read as zeros
+    const uint8_t *block(uint32_t lba, uint8_t *tail) const {
+        uint64_t offs = (uint64_t)lba * SD_BLOCK;
+        if (offs + SD_BLOCK <= size) return data + offs;
+        memset(tail, 0, SD_BLOCK);
+        if (offs < size) memcpy(tail, data + offs, size - offs);
+        return tail;
+    }
+
+    ~DiskImage() {
+        if (data) munmap((void *)data, size);
+    }
+
+private:
+    DiskImage() {}
+};
+
+// Copy-on-write overlay on top of a DiskImage. Written blocks live here and shadow the
+// base image, which is never modified, so dropping the overlay resets the disk instantly.
+// Optionally every write is appended to a journal (U765_JOURNAL_MAGIC, then lba + data
+// records), which can be replayed later, and the result can be committed to a new file.
+#define U765_JOURNAL_MAGIC "U765JRN1"
+
+class ImageOverlay {
+public:
+    std::unordered_map<uint32_t, std::array<uint8_t, SD_BLOCK>> blocks;
+    uint64_t blocks_written = 0;
+
+    const uint8_t *find(uint32_t lba) const {
+        auto it = blocks.find(lba);
+        return it == blocks.end() ? NULL : it->second.data();
+    }
+
+    void write(uint32_t lba, const uint8_t *data) {
+        memcpy(blocks[lba].data(), data, SD_BLOCK);
+        blocks_written++;
+        if (journal) {
+            fwrite(&lba, sizeof(lba), 1, journal);
+            fwrite(data, SD_BLOCK, 1, journal);
+        }
+    }
+
+    // Forget every written block. The journal, if any, is left alone
+    void reset() { blocks.clear(); }
+
+    bool open_journal(const char *path) {
+        close_journal();
+        journal = fopen(path, "wb");
+        if (!journal) return false;
+        fwrite(U765_JOURNAL_MAGIC, 8, 1, journal);
+        return true;
+    }
+
+    void close_journal() {
+        if (journal) fclose(journal);
+        journal = NULL;
+    }
+
+    // Load the blocks recorded in a journal into the overlay
+    bool replay_journal(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if (!f) return false;
+        char magic[8];
+        bool ok = fread(magic, 8, 1, f) == 1 && !memcmp(magic, U765_JOURNAL_MAGIC, 8);
+        uint32_t lba;
+        uint8_t data[SD_BLOCK];
+        while (ok && fread(&lba, sizeof(lba), 1, f) == 1 && fread(data, SD_BLOCK, 1, f) == 1)
+            memcpy(blocks[lba].data(), data, SD_BLOCK);
+        fclose(f);
+        return ok;
+    }
+
+    // Write base image + overlay to path. The size of the base image is kept
+    bool commit(const DiskImage &base, const char *path) const {
+        FILE *f = fopen(path, "wb");
+        if (!f) return false;
+        bool ok = fwrite(base.data, base.size, 1, f) == 1;
+        for (auto &b : blocks) {
+            uint64_t offs = (uint64_t)b.first * SD_BLOCK;
+            if (offs >= base.size) continue;
+            size_t len = std::min<uint64_t>(SD_BLOCK, base.size - offs);
+            ok = ok && !fseek(f, offs, SEEK_SET) && fwrite(b.second.data(), len, 1, f) == 1;
+        }
+        return !fclose(f) && ok;
+    }
+
+    // Checkpoint the written blocks. The journal is not part of the state
+    void save(VerilatedSerialize &os) const {
+        ckpt_put(os, blocks_written);
+        ckpt_put(os, (uint32_t)blocks.size());
+        for (auto &b : blocks) {
+            ckpt_put(os, b.first);
+            os.write(b.second.data(), SD_BLOCK);
+        }
+    }
+
+    void restore(VerilatedDeserialize &is) {
+        uint32_t n, lba;
+        blocks.clear();
+        ckpt_get(is, blocks_written);
+        ckpt_get(is, n);
+        while (n--) {
+            ckpt_get(is, lba);
+            is.read(blocks[lba].data(), SD_BLOCK);
+        }
+    }
+
+    ~ImageOverlay() { close_journal(); }
+
+private:
+    FILE *journal = NULL;
+};
+
+// Answers the SD handshake of the core for every mounted drive. Reads come from the
+// overlay of the drive when the block was written, otherwise from the image mapping.
+// Writes (sd_wr) are pulled out of the core buffer through sd_buff_din into the overlay.
+// Requests are queued in the storage model and served when it says they are ready, sd_ack
+// staying up for the whole transfer while the bytes are paced at its byte rate. A new
+// image for a drive the core holds is served once the core takes it (prepare drops), so a
+// buffered write still reaches the old image; its written blocks are kept in retired[].
+class ImageServer {
+public:
+    std::shared_ptr<DiskImage> drive[U765_DRIVES];
+    ImageOverlay overlay[U765_DRIVES];
+    std::shared_ptr<DiskImage> pending[U765_DRIVES];  // inserted, the core still on drive[]
+    ImageOverlay retired[U765_DRIVES];  // blocks written to the image last taken out
+    StorageModel storage;
+    uint64_t blocks_read = 0;
+    bool verbose = true;
+
+    // With held, the core has the old image (prepare of the drive up) and may still flush
+    // a buffered write to it: the old image is served until prepare drops
+    void insert(int dno, std::shared_ptr<DiskImage> img, bool held = false) {
+        if (held && drive[dno]) {
+            pending[dno] = img;
+            return;
+        }
+        pending[dno].reset();
+        take(dno, img);
+    }
+
+    void eject(int dno) {
+        pending[dno].reset();
+        take(dno, NULL);
+    }
+
+    void reset_overlays() {
+        for (int i = 0; i < U765_DRIVES; i++) overlay[i].reset();
+    }
+
+    uint64_t blocks_written() const {
+        uint64_t n = 0;
+        for (int i = 0; i < U765_DRIVES; i++) n += overlay[i].blocks_written;
+        return n;
+    }
+
+    // Drive the SD side of the core. Called on the rising edge, after eval()
+    inline void clock(Vu765_test *tb) {
+        for (int i = 0; i < U765_DRIVES; i++) {
+            if (!pending[i] || (tb->prepare >> i & 1)) continue;
+            take(i, pending[i]);
+            pending[i].reset();
+        }
+        storage.tick();
+        if (byte_wait) {
+            // between two bytes of a slow transfer: ack held, nothing written
+            byte_wait--;
+            tb->sd_buff_wr = 0;
+        } else if (reading) {
+            tb->sd_ack = 1 << serving;
+            tb->sd_buff_wr = 1;
+            tb->sd_buff_dout = block[read_ptr];
+            tb->sd_buff_addr = read_ptr;
+            if (++read_ptr == SD_BLOCK) {
+                reading = false;
+                storage.complete();
+            } else {
+                byte_wait = storage.byte_cycles - 1;
+            }
+        } else if (writing) {
+            clock_write(tb);
+            if (writing) byte_wait = storage.byte_cycles - 1;
+            else storage.complete();
+        } else {
+            tb->sd_ack = 0;
+            tb->sd_buff_wr = 0;
+        }
+
+        if (sd_rd != tb->sd_rd && tb->sd_rd)
+            storage.issue(__builtin_ctz(tb->sd_rd), tb->sd_lba, false);
+        sd_rd = tb->sd_rd;
+        if (sd_wr != tb->sd_wr && tb->sd_wr)
+            storage.issue(__builtin_ctz(tb->sd_wr), tb->sd_lba, true);
+        sd_wr = tb->sd_wr;
+
+        SdRequest r;
+        if (!reading && !writing && storage.start(r)) {
+            if (r.write) start_write(r);
+            else start_read(r);
+        }
+    }
+
+    // Checkpoint the mounted images (by path), the overlays and a transfer in flight
+    void save(VerilatedSerialize &os) const {
+        for (int i = 0; i < U765_DRIVES; i++) {
+            os << (drive[i] ? drive[i]->path : std::string());
+            ckpt_put(os, (uint64_t)(drive[i] ? drive[i]->size : 0));
+            overlay[i].save(os);
+        }
+        ckpt_put(os, blocks_read);
+        ckpt_put(os, reading);
+        ckpt_put(os, writing);
+        ckpt_put(os, read_ptr);
+        ckpt_put(os, read_lba);
+        ckpt_put(os, write_ptr);
+        ckpt_put(os, write_lba);
+        ckpt_put(os, serving);
+        ckpt_put(os, sd_rd);
+        ckpt_put(os, sd_wr);
+        ckpt_put(os, byte_wait);
+        os.write(wbuf, SD_BLOCK);
+        storage.save(os);
+    }
+
+    // The images are mapped again from their paths and must not have changed size
+    bool restore(VerilatedDeserialize &is) {
+        bool ok = true;
+        for (int i = 0; i < U765_DRIVES; i++) {
+            std::string path;
+            uint64_t size;
+            is >> path;
+            ckpt_get(is, size);
+            drive[i] = path.empty() ? NULL : DiskImage::open(path);
+            if (!path.empty() && (!drive[i] || drive[i]->size != size)) {
+                printf("Checkpoint: image %s is missing or has changed\n", path.c_str());
+                ok = false;
+            }
+            overlay[i].restore(is);
+        }
+        ckpt_get(is, blocks_read);
+        ckpt_get(is, reading);
+        ckpt_get(is, writing);
+        ckpt_get(is, read_ptr);
+        ckpt_get(is, read_lba);
+        ckpt_get(is, write_ptr);
+        ckpt_get(is, write_lba);
+        ckpt_get(is, serving);
+        ckpt_get(is, sd_rd);
+        ckpt_get(is, sd_wr);
+        ckpt_get(is, byte_wait);
+        is.read(wbuf, SD_BLOCK);
+        storage.restore(is);
+        if (reading) resolve(serving, read_lba);
+        return ok;
+    }
+
+private:
+    const uint8_t *block = NULL;
+    uint8_t tail[SD_BLOCK];
+    uint8_t wbuf[SD_BLOCK];
+    bool reading = false;
+    bool writing = false;
+    int read_ptr = 0;
+    uint32_t read_lba = 0;
+    int write_ptr = 0;
+    uint32_t write_lba = 0;
+    int serving = 0;  // drive being served
+    int sd_rd = 0;
+    int sd_wr = 0;
+    uint32_t byte_wait = 0;  // cycles left before the next byte of the transfer
+
+    void take(int dno, std::shared_ptr<DiskImage> img) {
+        drive[dno] = img;
+        retired[dno].blocks.swap(overlay[dno].blocks);
+        overlay[dno].reset();
+    }
+
+    void start_read(const SdRequest &r) {
+        serving = r.drive;
+        if (verbose) printf("img_read: %02x lba: %d\n", 1 << r.drive, r.lba);
+        resolve(r.drive, r.lba);
+        blocks_read++;
+        reading = true;
+        read_ptr = 0;
+    }
+
+    // Point block at the data of lba on drive dno
+    void resolve(int dno, uint32_t lba) {
+        read_lba = lba;
+        block = overlay[dno].find(lba);
+        if (block) {
+            // written before, served from the overlay
+        } else if (drive[dno]) {
+            block = drive[dno]->block(lba, tail);
+        } else {
+            memset(tail, 0, SD_BLOCK);
+            block = tail;
+        }
+    }
+
+    void start_write(const SdRequest &r) {
+        serving = r.drive;
+        if (verbose) printf("img_write: %02x lba: %d\n", 1 << r.drive, r.lba);
+        write_lba = r.lba;
+        writing = true;
+        write_ptr = 0;
+    }
+
+    // The buffer RAM answers one clock after the address is presented, so the byte
+    // for the address set on the previous call is on sd_buff_din now
+    void clock_write(Vu765_test *tb) {
+        if (write_ptr) wbuf[write_ptr - 1] = tb->sd_buff_din;
+        if (write_ptr == SD_BLOCK) {
+            if (drive[serving]) overlay[serving].write(write_lba, wbuf);
+            writing = false;
+            tb->sd_ack = 0;
+            tb->sd_buff_wr = 0;
+            return;
+        }
+        tb->sd_ack = 1 << serving;
+        tb->sd_buff_wr = 0;
+        tb->sd_buff_addr = write_ptr++;
+    }
+};
+
+#endif
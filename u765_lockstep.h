@@ -0,0 +1,274 @@
+// Lockstep checker: the behavioral model (u765_model.h) next to the verilated core.
+//
+// U765Sim feeds every bus transaction, tc, reset pulse, mount and input pin change to a
+// U765Model and compares what the core does with what the model says it should: every
+// result and data byte the host reads, the phase (execution or result) the status register
+// shows when a byte moves, the int_out level and, at the end of the run, every block of the
+// written images. Timing is cycle-approximate, so int_out may disagree for up to +lockstep_tol
+// cycles before it counts; those skews are kept as statistics. The first divergence is
+// reported with the command and the cycle, and a dump of the flight recorder, and the
+// comparison stops there. Runs the model doesn't cover (a checkpoint restore, a scan mode
+// left behind on another drive) stop the comparison without a divergence.
+//
+// Plusargs:
+//   +lockstep            enable the checker
+//   +lockstep_tol=N      cycles int_out may disagree with the model (default 4000)
+//   +lockstep_drives=N   NDRV the core was built with, 2 or 4 (default 2)
+//   +lockstep_fatal      exit on the first divergence, as a watchdog stall does
+#ifndef U765_LOCKSTEP_H
+#define U765_LOCKSTEP_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include "Vu765_test.h"
+#include "u765_plusargs.h"
+#include "u765_image.h"
+#include "u765_recorder.h"
+#include "u765_storage.h"
+#include "u765_model.h"
+
+class LockstepChecker {
+public:
+    bool enabled = false;
+    bool fatal = false;
+    uint64_t tol = 4000;
+    FILE *out = stdout;  // where the divergence is reported, NULL to only keep it
+    const FlightRecorder *recorder = NULL;
+    U765Model model;
+
+    bool diverged = false;
+    std::string first;        // the first divergence
+    uint64_t first_cycle = 0;
+    const char *stopped = NULL;  // why the comparison stopped without a divergence
+
+    // Statistics
+    uint64_t bytes_checked = 0, alts = 0, status_checked = 0;
+    uint64_t skews = 0, skew_total = 0, skew_max = 0;
+    uint64_t blocks_checked = 0;
+
+    void configure(const StorageModel &storage) {
+        enabled = plusarg_flag("lockstep");
+        fatal = plusarg_flag("lockstep_fatal");
+        tol = plusarg_int("lockstep_tol", tol);
+        model.drives = plusarg_int("lockstep_drives", 2) > 2 ? 4 : 2;
+        model.slack = tol;
+        // Request to the last byte of the block, plus the few cycles of the FSM around it
+        model.sd_cycles = storage.latency + storage.jitter / 2 + 512 * storage.byte_cycles + 18;
+    }
+
+    bool active() const { return enabled && !diverged && !stopped; }
+
+    // Status register read by the host, before a data access
+    void on_status(int v) {
+        status = v;
+        status_valid = true;
+    }
+
+    void on_write(uint64_t tick, uint8_t v, bool dma) {
+        if (!active()) return;
+        uint64_t t = tick / 2;
+        model.update(t);
+        U765Model::Phase p = model.s.phase;
+        if (dma || status_valid) {
+            bool exec = dma || (status & 0x20);
+            if (p == U765Model::RESULT || p == U765Model::EXEC_READ)
+                diverge(t, "byte 0x%02x written, the model is in the %s phase", v,
+                        U765Model::phase_name(p));
+            else if (exec != (p == U765Model::EXEC_WRITE) && (dma || model.s.ndma))
+                diverge(t, "byte 0x%02x written in the %s phase, the model is in the %s phase", v,
+                        exec ? "execution" : "command", U765Model::phase_name(p));
+            status_checked++;
+        }
+        status_valid = false;
+        if (diverged) return;
+        model.write(t, v);
+        bytes_checked++;
+        check_model(t);
+    }
+
+    void on_read(uint64_t tick, uint8_t v, bool dma) {
+        if (!active()) return;
+        uint64_t t = tick / 2;
+        bool checked = dma || status_valid;
+        bool exec = dma || (status_valid && (status & 0x20));
+        status_valid = false;
+        model.update(t);
+        U765Model::Phase p = model.s.phase;
+        if (checked && (dma || model.s.ndma) && exec != (p == U765Model::EXEC_READ)) {
+            diverge(t, "byte 0x%02x read in the %s phase, the model is in the %s phase", v,
+                    exec ? "execution" : "result", U765Model::phase_name(p));
+            return;
+        }
+        int index = model.s.result_pos;
+        int e = model.read(t);
+        if (!checked || e == v) {
+            if (checked) bytes_checked++;
+            check_model(t);
+            return;
+        }
+        if (p == U765Model::RESULT && model.try_alt(index, v, t)) {
+            alts++;
+            bytes_checked++;
+            return;
+        }
+        if (p == U765Model::RESULT)
+            diverge(t, "result byte %d 0x%02x, the model says 0x%02x", index, v, e & 0xff);
+        else if (e < 0)
+            diverge(t, "byte 0x%02x read, the model has none in the %s phase", v,
+                    U765Model::phase_name(p));
+        else
+            diverge(t, "data byte %u 0x%02x, the model says 0x%02x", model.s.done, v, e);
+    }
+
+    void on_tc(uint64_t tick) {
+        if (!active()) return;
+        model.tc(tick / 2);
+        status_valid = false;
+    }
+
+    // img_mounted pulse of drive d with img
+    void on_insert(Vu765_test *tb, uint64_t tick, int d, const DiskImage &img) {
+        if (!enabled || d >= model.drives) return;
+        model.mount(d, img.data, img.size, tb->img_wp >> d & 1, tick / 2);
+    }
+
+    void on_eject(int d) {
+        if (enabled && d < model.drives) model.eject(d);
+    }
+
+    // Blocks already in the overlays (a replayed journal) go to the model's images too
+    void load_overlays(const ImageServer &images) {
+        if (!enabled) return;
+        for (int d = 0; d < model.drives; d++) {
+            std::vector<uint8_t> &data = model.disk[d].data;
+            for (const auto &b : images.overlay[d].blocks) {
+                uint64_t off = (uint64_t)b.first * SD_BLOCK;
+                for (uint64_t i = 0; i < SD_BLOCK && off + i < data.size(); i++)
+                    data[off + i] = b.second[i];
+            }
+        }
+    }
+
+    // The model can't follow from here on
+    void suspend(const char *why) {
+        if (active()) stopped = why;
+    }
+
+    // Rising edge, after eval(): reset pulses, input pins and int_out
+    inline void sample(Vu765_test *tb, uint64_t tick) {
+        uint64_t t = tick / 2;
+        now = t;
+        if (reset_level && !tb->reset) {
+            model.reset(t);
+            status_valid = false;
+            mismatch_since = U765Model::NEVER;
+        }
+        reset_level = tb->reset;
+        if (!active() || tb->reset) return;
+        if (tb->ready != model.ready || tb->motor != model.motor ||
+            tb->available != model.available || tb->density != model.density ||
+            tb->fast != model.fast)
+            model.inputs(t, tb->ready, tb->motor, tb->available, tb->density, tb->fast);
+        model.update(t);
+        if (check_model(t)) return;
+
+        // Every byte of a non-DMA execution phase has its own interrupt, the model has none
+        if (model.pio_data() || (bool)tb->int_out == model.int_out(t)) {
+            if (mismatch_since != U765Model::NEVER) {
+                uint64_t skew = t - mismatch_since;
+                skews++;
+                skew_total += skew;
+                if (skew > skew_max) skew_max = skew;
+                mismatch_since = U765Model::NEVER;
+            }
+            return;
+        }
+        if (mismatch_since == U765Model::NEVER) mismatch_since = t;
+        else if (t - mismatch_since > tol)
+            diverge(mismatch_since, "int_out %d for %llu cycles, the model says %d", tb->int_out,
+                    (unsigned long long)(t - mismatch_since), !tb->int_out);
+    }
+
+    // Every block of the images the core sees (the image and its overlay) against the
+    // model's copy. Run at the end, with the core idle so its write-back is done
+    void verify_images(const ImageServer &images) {
+        if (!active()) return;
+        uint8_t tail[SD_BLOCK];
+        for (int d = 0; d < model.drives && !diverged; d++) {
+            const std::vector<uint8_t> &data = model.disk[d].data;
+            if (!images.drive[d] || data.size() != images.drive[d]->size) continue;
+            for (uint32_t lba = 0; (uint64_t)lba * SD_BLOCK < data.size(); lba++) {
+                const uint8_t *core = images.overlay[d].find(lba);
+                if (!core) core = images.drive[d]->block(lba, tail);
+                uint64_t off = (uint64_t)lba * SD_BLOCK;
+                size_t n = std::min<uint64_t>(SD_BLOCK, data.size() - off);
+                blocks_checked++;
+                for (size_t i = 0; i < n; i++) {
+                    if (core[i] == data[off + i]) continue;
+                    diverge(now, "drive %c: image byte 0x%llx 0x%02x, the model says 0x%02x",
+                            'A' + d, (unsigned long long)(off + i), core[i], data[off + i]);
+                    break;
+                }
+                if (diverged) break;
+            }
+        }
+    }
+
+    void report(FILE *f = stdout) const {
+        fprintf(f, "\n=== Lockstep model ===\n");
+        fprintf(f, "%llu commands, %llu bytes checked (%llu alternative answers), %llu phases\n",
+                (unsigned long long)model.commands, (unsigned long long)bytes_checked,
+                (unsigned long long)alts, (unsigned long long)status_checked);
+        fprintf(f, "int_out skews: %llu, avg %.1f max %llu cycles (tolerance %llu)\n",
+                (unsigned long long)skews, skews ? (double)skew_total / skews : 0.0,
+                (unsigned long long)skew_max, (unsigned long long)tol);
+        fprintf(f, "image blocks checked: %llu, result timeouts: %llu\n",
+                (unsigned long long)blocks_checked, (unsigned long long)model.timeouts);
+        if (diverged)
+            fprintf(f, "DIVERGED at cycle %llu: %s\n", (unsigned long long)first_cycle, first.c_str());
+        else if (stopped)
+            fprintf(f, "stopped: %s\n", stopped);
+        else
+            fprintf(f, "no divergence\n");
+    }
+
+private:
+    int status = 0;
+    bool status_valid = false;
+    bool reset_level = false;
+    uint64_t now = 0;  // cycle of the last sample
+    uint64_t mismatch_since = U765Model::NEVER;
+
+    // Stop on what the model doesn't cover. True if it did
+    bool check_model(uint64_t) {
+        if (!model.unmodelled) return false;
+        stopped = model.unmodelled;
+        return true;
+    }
+
+    void diverge(uint64_t t, const char *fmt, ...) __attribute__((format(printf, 3, 4))) {
+        char what[160];
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(what, sizeof(what), fmt, ap);
+        va_end(ap);
+        diverged = true;
+        first_cycle = t;
+        first = model.command_text() + ": " + what;
+        if (out) {
+            fprintf(out, "\n*** LOCKSTEP at cycle %llu: %s ***\n", (unsigned long long)t, first.c_str());
+            if (recorder) recorder->dump(out);
+        }
+        if (fatal) {
+            if (out) fprintf(out, "*** LOCKSTEP: aborting the run ***\n");
+            fflush(NULL);
+            exit(3);
+        }
+    }
+};
+
+#endif
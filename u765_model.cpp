@@ -0,0 +1,281 @@
+// Image corpus scanner on the behavioral model of the u765 core (u765_model.h).
+//
+// Reads every image the way a host would through the core: RECALIBRATE, then for every
+// cylinder a SEEK and, per head, READ ID and a READ DATA of each sector of the Track-Info
+// list. No Verilator and no clock, the model jumps from one event to the next, so a whole
+// corpus goes through in the time the verilated core takes for one disk. Per image it
+// reports the sectors and bytes read, the sectors that ended with an error, not found,
+// deleted or with weak copies, the clk_sys cycles the core would have needed and a sum of
+// the data, which stays the same as long as the core reads the image the same way.
+//
+//   u765_model <image.dsk> [image.dsk ...] +jobs=8 +fast=15 +report=scan.json
+//
+// Plusargs:
+//   +fast=N        fast port mask of the model (default 0)
+//   +density=N     density input of the drive, 1 = CF2DD (default 0)
+//   +sd_cycles=N   cycles of an SD block request (default 530)
+//   +jobs=N        worker threads (default: number of cores)
+//   +verbose       a line per track
+//   +report=file.json  also write the results as JSON
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+#include "u765_plusargs.h"
+#include "u765_model.h"
+
+struct ScanResult {
+    std::string image;
+    bool ok = false;
+    std::string error;
+    int tracks = 0, sides = 0;
+    uint64_t sectors = 0, bytes = 0;
+    uint64_t errors = 0, not_found = 0, deleted = 0, weak = 0;
+    uint64_t cycles = 0;
+    uint64_t sum = 0;
+    double wall = 0;
+};
+
+// The host side: bytes move as soon as the model takes them, a bus cycle apart
+class ModelHost {
+public:
+    U765Model m;
+    uint64_t t = 0;
+    uint64_t limit = 4000000;  // cycles a wait gives up after
+
+    void send(std::initializer_list<int> bytes) {
+        for (int b : bytes) {
+            step();
+            m.write(t, b);
+        }
+    }
+
+    // Next result or data byte, -1 if the model has none
+    int receive() {
+        step();
+        return m.read(t);
+    }
+
+    bool results(uint8_t *res, int n) {
+        for (int i = 0; i < n; i++) {
+            if (m.s.phase != U765Model::RESULT) return false;
+            int b = receive();
+            if (b < 0) return false;
+            res[i] = b;
+        }
+        return true;
+    }
+
+    // Wait for int_out, jumping to the events of the model
+    bool wait_int() {
+        uint64_t end = t + limit;
+        m.update(t);
+        while (!m.int_out(t)) {
+            uint64_t e = m.next_event(t);
+            if (e == U765Model::NEVER || e > end) return false;
+            t = e;
+            m.update(t);
+        }
+        return true;
+    }
+
+    // Seek interrupt and its SENSE INTERRUPT STATUS. False unless the seek ended well
+    bool seek_end(int cyl) {
+        if (!wait_int()) return false;
+        send({0x08});
+        uint8_t res[2];
+        return results(res, 2) && (res[0] & 0xf8) == 0x20 && res[1] == cyl;
+    }
+
+    // Execution phase of a read: every byte until the result phase. Returns the bytes
+    int read_exec(uint64_t &sum) {
+        int n = 0;
+        for (;;) {
+            step();
+            m.update(t);
+            if (m.s.phase != U765Model::EXEC_READ) break;
+            int b = m.read(t);
+            if (b < 0) break;
+            sum += b;
+            n++;
+        }
+        return n;
+    }
+
+private:
+    void step() { t = std::max(t + 4, m.ready_at()); }
+};
+
+static void scan_image(const char *path, ScanResult &r) {
+    auto start = std::chrono::steady_clock::now();
+    r.image = path;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        r.error = "can't open";
+        return;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + got);
+    fclose(f);
+
+    ModelHost host;
+    U765Model &m = host.m;
+    m.fast = plusarg_int("fast", 0) & 0xf;
+    m.density = plusarg_int("density", 0) & 1;
+    m.sd_cycles = plusarg_int("sd_cycles", m.sd_cycles);
+    m.ready = m.motor = m.available = 1;
+    bool verbose = plusarg_flag("verbose");
+
+    m.reset(0);
+    m.mount(0, data.data(), data.size(), false, 0);
+    if (!m.disk[0].ready) {
+        r.error = "not a DSK/EDSK image";
+        return;
+    }
+    r.tracks = m.disk[0].tracks;
+    r.sides = m.disk[0].sides ? 2 : 1;
+    bool dd = m.disk[0].dd;
+
+    host.send({0x07, 0x00});
+    if (!host.seek_end(0)) {
+        r.error = "recalibrate failed";
+        return;
+    }
+    for (int cyl = 0; cyl < r.tracks; cyl++) {
+        int seek = !dd && m.density ? cyl << 1 : cyl;
+        host.send({0x0f, 0x00, seek});
+        if (!host.seek_end(seek)) {
+            r.error = "seek to " + std::to_string(cyl) + " failed";
+            break;
+        }
+        for (int head = 0; head < r.sides; head++) {
+            uint64_t track_start = host.t;
+            uint8_t res[7];
+            host.send({0x4a, head << 2});
+            if (!host.wait_int() || !host.results(res, 7)) {
+                r.error = "READ ID stalled";
+                break;
+            }
+            std::vector<U765Model::Sector> list = m.track(0, cyl, head);
+            int errors = 0;
+            for (const U765Model::Sector &e : list) {
+                uint32_t len = 0x80 << (e.n & 8 ? 8 : e.n & 7);
+                if (e.size == 2 * len || e.size == 3 * len || e.size == 4 * len) r.weak++;
+                host.send({0x46, head << 2, e.c, e.h, e.r, e.n, e.r, 0x2a, 0xff});
+                r.bytes += host.read_exec(r.sum);
+                if (!host.wait_int() || !host.results(res, 7)) {
+                    r.error = "READ DATA stalled";
+                    break;
+                }
+                r.sectors++;
+                if ((res[0] & 0xc0) == 0) continue;
+                errors++;
+                r.errors++;
+                if (res[1] & 0x04) r.not_found++;
+                if (res[2] & 0x40) r.deleted++;
+            }
+            if (verbose)
+                printf("%s: track %d head %d: %zu sectors, %d errors, %llu cycles\n", path, cyl, head,
+                       list.size(), errors, (unsigned long long)(host.t - track_start));
+            if (!r.error.empty()) break;
+        }
+        if (!r.error.empty()) break;
+    }
+    r.cycles = host.t;
+    r.ok = r.error.empty();
+    r.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void write_json(const char *path, const std::vector<ScanResult> &results, double wall) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Can't create %s\n", path);
+        return;
+    }
+    fprintf(f, "{\n  \"wall\": %.3f,\n  \"results\": [\n", wall);
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScanResult &r = results[i];
+        fprintf(f, "    {\"image\": \"%s\", \"ok\": %s, \"error\": \"%s\", \"tracks\": %d, "
+                   "\"sides\": %d, \"sectors\": %llu, \"bytes\": %llu, \"errors\": %llu, "
+                   "\"not_found\": %llu, \"deleted\": %llu, \"weak\": %llu, \"cycles\": %llu, "
+                   "\"sum\": %llu, \"wall\": %.4f}%s\n",
+                r.image.c_str(), r.ok ? "true" : "false", r.error.c_str(), r.tracks, r.sides,
+                (unsigned long long)r.sectors, (unsigned long long)r.bytes,
+                (unsigned long long)r.errors, (unsigned long long)r.not_found,
+                (unsigned long long)r.deleted, (unsigned long long)r.weak,
+                (unsigned long long)r.cycles, (unsigned long long)r.sum, r.wall,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    printf("Report saved to %s\n", path);
+}
+
+int main(int argc, char **argv) {
+    std::vector<char *> args = plusargs_init(argc, argv);
+
+    if (args.size() < 2) {
+        printf("Usage: %s <image.dsk> [image.dsk ...]\n", args[0]);
+        printf("  +fast=N  fast port mask (default 0)\n");
+        printf("  +density=N  density input, 1 = CF2DD (default 0)\n");
+        printf("  +sd_cycles=N  cycles of an SD block request (default 530)\n");
+        printf("  +jobs=N  worker threads (default: cores)\n");
+        printf("  +verbose  a line per track\n");
+        printf("  +report=file.json  results as JSON\n");
+        return -1;
+    }
+
+    std::vector<ScanResult> results(args.size() - 1);
+    int workers = plusarg_int("jobs", std::thread::hardware_concurrency());
+    if (workers < 1) workers = 1;
+    if (workers > (int)results.size()) workers = results.size();
+
+    // Thread pool: every worker takes the next image until there are none left
+    std::atomic<size_t> next(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < results.size()) scan_image(args[i + 1], results[i]);
+        });
+    }
+    for (auto &t : pool) t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    uint64_t sectors = 0, bytes = 0, cycles = 0;
+    printf("\n%-24s %-4s %5s %7s %9s %6s %5s %5s %5s %10s %10s  %s\n", "image", "ok", "trk",
+           "sectors", "bytes", "errors", "nf", "del", "weak", "sim(s)", "sum", "error");
+    for (const ScanResult &r : results) {
+        const char *image = strrchr(r.image.c_str(), '/');
+        image = image ? image + 1 : r.image.c_str();
+        printf("%-24.24s %-4s %2dx%d %7llu %9llu %6llu %5llu %5llu %5llu %10.2f %10llu  %s\n", image,
+               r.ok ? "ok" : "FAIL", r.tracks, r.sides, (unsigned long long)r.sectors,
+               (unsigned long long)r.bytes, (unsigned long long)r.errors,
+               (unsigned long long)r.not_found, (unsigned long long)r.deleted,
+               (unsigned long long)r.weak, r.cycles / (U765Model::CYCLES * 1000.0),
+               (unsigned long long)r.sum, r.error.c_str());
+        if (!r.ok) failed++;
+        sectors += r.sectors;
+        bytes += r.bytes;
+        cycles += r.cycles;
+    }
+    printf("\n%zu images, %d failed, %llu sectors, %llu bytes, %.2f s simulated in %.3f s wall "
+           "(%.0f sectors/s)\n", results.size(), failed, (unsigned long long)sectors,
+           (unsigned long long)bytes, cycles / (U765Model::CYCLES * 1000.0), wall,
+           wall > 0 ? sectors / wall : 0.0);
+
+    std::string report = plusarg_str("report", "");
+    if (!report.empty()) write_json(report.c_str(), results, wall);
+
+    return failed ? 1 : 0;
+}
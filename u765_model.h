@@ -0,0 +1,1290 @@
+// Behavioral reference model of the u765 core.
+//
+// A plain C++ model of what the core does at the command level: the uPD765 command set
+// the core implements (READ/WRITE DATA and their deleted variants, READ TRACK, READ ID,
+// FORMAT, SCAN EQ/LE/HE, SEEK, RECALIBRATE, SENSE INTERRUPT/DRIVE STATUS, SPECIFY), the
+// DSK/EDSK Track-Info and sector lists, weak sectors and the drive mechanics (stepping,
+// head load, rotation with the core's track geometry). It keeps the core's own quirks,
+// the stale status registers after TC, the head flip of MT, the SCAN compare that takes
+// one byte more, the seek interrupts held while another drive works, so any difference
+// from the verilated core is drift in the implementation (indexes, caches, prefetch,
+// write-back), not in the FDC behaviour.
+//
+// The model knows no clock. Every call takes the clk_sys cycle it happens at and the
+// model works out what the core did until then: a seek ends, a sector reaches the head,
+// the result interrupt goes up. Timing is cycle-approximate, SD requests cost sd_cycles
+// each and the small FSM steps are estimated, so it is compared with a tolerance (see
+// u765_lockstep.h). Without a host clock, ready_at() says when the next byte may move,
+// which is how the corpus scanner (u765_model.cpp) drives it.
+//
+// Decisions that depend on a cycle close to a boundary, the drive a SENSE INTERRUPT
+// reports when a seek ends right then or the sector READ ID finds at a sector start, keep
+// the other answer in alt, and try_alt() switches to it if that is what the core said.
+//
+// The parameters are the defaults u765_test builds the core with: CYCLES=100, 300 rpm.
+// U765Sim stops the lockstep comparison when the core says it was built with others.
+#ifndef U765_MODEL_H
+#define U765_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class U765Model {
+public:
+    static constexpr uint32_t CYCLES = 100;
+    static constexpr uint32_t RPM = 300;
+    static constexpr uint32_t ROT_CYCLES = CYCLES * 60000 / RPM;  // cycles per revolution
+    static constexpr uint32_t TRACK_UNITS = 3750000 / RPM;        // byte times per revolution
+    static constexpr uint32_t TRACK_PRE_BYTES = 146;
+    static constexpr uint32_t SECTOR_OVERHEAD = 62;
+    static constexpr uint32_t STEP_UNIT = CYCLES * 2;
+    static constexpr uint32_t IDX_SECTORS = 32;
+    static constexpr uint32_t RESULT_TIMEOUT = 1000;  // result phase without a read, then reset
+    static constexpr uint64_t NEVER = ~0ULL;
+
+    enum Phase { IDLE, COMMAND, EXEC_READ, EXEC_WRITE, RESULT };
+
+    enum Op {
+        OP_NONE, OP_READ, OP_READ_DEL, OP_WRITE, OP_WRITE_DEL, OP_READ_TRACK, OP_READ_ID,
+        OP_FORMAT, OP_SCAN_EQ, OP_SCAN_LE, OP_SCAN_HE, OP_RECAL, OP_SENSE_INT, OP_SPECIFY,
+        OP_SENSE_DRIVE, OP_SEEK, OP_INVALID
+    };
+
+    // One entry of a sector list, as the core reads it
+    struct Sector {
+        uint8_t c, h, r, n, st1, st2;
+        uint32_t size;    // bytes of data in the image, every copy of a weak sector
+        uint64_t offset;  // file offset of the data
+    };
+
+    // Mechanics of one drive
+    struct Mech {
+        uint8_t pcn = 0, ncn = 0, from = 0;
+        bool seeking = false;
+        uint64_t seek_start = 0, seek_end = 0, step = 0;
+        bool held = false;        // seek over, interrupt held while another drive works
+        uint64_t held_from = 0;
+        uint64_t int_at = NEVER;  // interrupt pending from this cycle
+        bool dirty = true;        // Track-Info to load again
+        bool head_loaded = false;
+        uint64_t unload_at = NEVER;  // HUT after the last execution phase, NEVER while in one
+        uint8_t next_weak = 0;
+        uint8_t scan_mode = 0;
+        bool indexed[2] = {false, false};  // sector list of the head indexed (first 32 entries)
+        uint8_t map[2][256];               // sector index by R, 0x20 = repeated R, stale entries kept
+        uint8_t sectors[2] = {0, 0};
+        uint32_t pitch[2] = {0, 0}, pre[2] = {0, 0};
+        // rotation: cycles the disk turned, up to spun_at
+        uint64_t spun = 0, spun_at = 0;
+        bool paused = false;  // the transfer of the sector under the head stops the disk
+        // fast rotation puts the sector under the head at once, until the index hole
+        bool ov[2] = {false, false};
+        uint64_t ov_rev[2] = {0, 0};
+        uint32_t ov_unit[2] = {0, 0};
+        uint32_t ov_k[2] = {0, 0};
+    };
+
+    // Everything but the image data. Plain, so an alternative answer is a copy
+    struct State {
+        Phase phase = IDLE;
+        Op op = OP_NONE;
+        uint8_t cmd[9];
+        int cmd_len = 0, cmd_need = 0;
+        bool busy = false;  // the core left PHASE_COMMAND for this command
+        uint64_t command_since = 0;  // back to PHASE_COMMAND
+        uint64_t ds0_since = 0;
+        uint8_t ds0 = 0, hds = 0;
+        uint8_t c = 0, h = 0, r = 0, n = 0, eot = 0, dtl = 0, stp = 1, sc = 0;
+        bool mt = false, sk = false, rtrack = false, write = false, deleted = false;
+        bool bc = false, exm = false, scan_match = false;
+        uint8_t status[3] = {0, 0, 0};
+        uint8_t sec_c = 0, sec_h = 0, sec_r = 0, sec_n = 0, sec_st1 = 0, sec_st2 = 0;
+        uint8_t srt = 4, hut = 0, hlt = 0;
+        bool ndma = true;
+        uint8_t sense_drive = 0;
+        // sector moving
+        uint32_t cur = 0;  // position in the sector list, from 1
+        uint64_t pos = 0;
+        uint32_t size = 0, btr = 0, done = 0;
+        uint64_t eos_at = NEVER;  // the core handles the end of the sector here
+        // results
+        uint8_t result[7];
+        int result_len = 0, result_pos = 0;
+        bool timed_result = false;  // READ_RESULTS state, with its read timeout
+        uint64_t result_deadline = NEVER;
+        uint64_t ready_at = 0;
+        Mech mech[4];
+    };
+
+    // An image as the header scan of the core sees it
+    struct Disk {
+        std::vector<uint8_t> data;
+        bool mounted = false, ready = false, wp = false, edsk = false, sides = false, dd = false;
+        uint8_t tracks = 0;
+        uint16_t offsets[512];  // Track-Info of track*2+head in 256 byte units, 0 = none
+    };
+
+    State s;
+    State alt;
+    bool has_alt = false;
+    Disk disk[4];
+    int drives = 2;  // NDRV of the core: 2, or 4 with DRIVES > 2
+
+    // Inputs
+    uint8_t ready = 0, motor = 0, available = 0, density = 0, fast = 0;
+
+    uint32_t sd_cycles = 530;  // one SD block request, from sd_rd to the last byte
+    uint64_t slack = 0;        // window of the ambiguous decisions, cycles
+    const char *unmodelled = NULL;  // the run left what the model covers
+
+    // Statistics
+    uint64_t commands = 0, sectors = 0, bytes_read = 0, bytes_written = 0, sd_requests = 0;
+    uint64_t timeouts = 0;  // result phases the core gave up on
+
+    // Pulse of the reset input, over at t
+    void reset(uint64_t t) {
+        s.phase = IDLE;
+        s.op = OP_NONE;
+        s.busy = false;
+        s.command_since = t;
+        s.status[0] = s.status[1] = s.status[2] = 0;
+        s.srt = 4;
+        s.hut = 0;
+        s.hlt = 0;
+        s.ndma = true;
+        s.exm = false;
+        s.eos_at = NEVER;
+        s.result_deadline = NEVER;
+        s.stp = 1;
+        for (int d = 0; d < 4; d++) {
+            Mech &m = s.mech[d];
+            m.pcn = m.ncn = 0;
+            m.seeking = m.held = false;
+            m.int_at = NEVER;
+            m.dirty = true;
+            m.head_loaded = false;
+            m.scan_mode = 0;
+            m.paused = false;
+        }
+        has_alt = false;
+    }
+
+    // img_mounted of drive d with the image data at t. The header scan is immediate
+    void mount(int d, const uint8_t *data, size_t size, bool wp, uint64_t t) {
+        Disk &dk = disk[d];
+        Mech &m = s.mech[d];
+        dk.data.assign(data, data + size);
+        dk.mounted = size != 0;
+        dk.wp = wp;
+        dk.dd = size > 250000;
+        dk.ready = false;
+        spin(d, t);
+        m.seeking = m.held = false;
+        m.head_loaded = false;
+        m.next_weak = 0;
+        m.indexed[0] = m.indexed[1] = false;
+        m.ov[0] = m.ov[1] = false;
+        if (!size) return;
+
+        uint8_t hdr[512] = {0};
+        memcpy(hdr, data, std::min<size_t>(size, 512));
+        if (hdr[0] == 'E') dk.edsk = true;
+        else if (hdr[0] == 'M') dk.edsk = false;
+        else return;
+        dk.tracks = hdr[0x30];
+        dk.sides = hdr[0x31] >> 1 & 1;
+        uint16_t offset = 1;
+        uint32_t entry = 0;
+        for (int a = 0x34; a < 512 && (entry >> 1 & 0xff) != dk.tracks; a++) {
+            if (dk.edsk) {
+                dk.offsets[entry & 511] = hdr[a] ? offset : 0;
+                offset += hdr[a];
+            } else {
+                dk.offsets[entry & 511] = offset;
+                offset += hdr[0x33];
+            }
+            entry += dk.sides ? 1 : 2;
+        }
+        dk.ready = true;
+        m.dirty = true;
+    }
+
+    // The image of drive d is gone. The core keeps what its header scan found, reads and
+    // Track-Info loads get zeros from the SD side and writes go nowhere
+    void eject(int d) { disk[d].data.clear(); }
+
+    U765Model() {
+        for (int d = 0; d < 4; d++) memset(disk[d].offsets, 0, sizeof(disk[d].offsets));
+        memset(s.cmd, 0, sizeof(s.cmd));
+        memset(s.result, 0, sizeof(s.result));
+        for (int d = 0; d < 4; d++) memset(s.mech[d].map, 0, sizeof(s.mech[d].map));
+    }
+
+    // Drive mask of the unit select bits
+    uint8_t dmask() const { return drives > 2 ? 3 : 1; }
+
+    // New levels of the drive inputs at t. The disks turned with the old motor bits until t
+    void inputs(uint64_t t, uint8_t rdy, uint8_t mot, uint8_t avail, uint8_t dens, uint8_t fst) {
+        if (mot != motor)
+            for (int d = 0; d < 4; d++) spin(d, t);
+        ready = rdy;
+        motor = mot;
+        available = avail;
+        density = dens;
+        fast = fst;
+    }
+
+    // Bring the mechanics up to t: seeks that ended, held interrupts, the end of a sector
+    // and the result phase timeout
+    void update(uint64_t t) {
+        if (s.eos_at <= t) {
+            uint64_t at = s.eos_at;
+            s.eos_at = NEVER;
+            sector_end(at);
+        }
+        for (int d = 0; d < drives; d++) {
+            Mech &m = s.mech[d];
+            if (m.seeking && t >= m.seek_end) {
+                m.pcn = m.ncn;
+                m.seeking = false;
+                m.held = true;
+                m.held_from = m.seek_end;
+            }
+            if (m.held) {
+                if (d == s.ds0) release(m, std::max(m.held_from, s.ds0_since));
+                else if (!s.busy) release(m, std::max(m.held_from, s.command_since));
+            }
+        }
+        if (s.phase == RESULT && s.timed_result && t > s.result_deadline)
+            emergency_reset(s.result_deadline);
+    }
+
+    // int_out at t
+    bool int_out(uint64_t t) const {
+        for (int d = 0; d < drives; d++)
+            if (s.mech[d].int_at <= t) return true;
+        return false;
+    }
+
+    // The execution phase moves data byte by byte in non-DMA mode, each with its interrupt
+    bool pio_data() const { return s.ndma && (s.phase == EXEC_READ || s.phase == EXEC_WRITE); }
+
+    // Earliest cycle the next data or result byte can move
+    uint64_t ready_at() const { return s.ready_at; }
+
+    // First cycle after t something happens without the host: a seek ends, an interrupt
+    // goes up, a sector is over. NEVER if nothing will
+    uint64_t next_event(uint64_t t) const {
+        uint64_t e = s.eos_at > t ? s.eos_at : t + 1;
+        for (int d = 0; d < drives; d++) {
+            const Mech &m = s.mech[d];
+            if (m.seeking) e = std::min(e, std::max(m.seek_end, t + 1));
+            if (m.int_at > t) e = std::min(e, m.int_at);
+        }
+        return e;
+    }
+
+    // Host write on the data register (or a DMA write) at t
+    void write(uint64_t t, uint8_t v) {
+        update(t);
+        switch (s.phase) {
+        case IDLE: start(t, v); break;
+        case COMMAND: param(t, v); break;
+        case EXEC_WRITE: exec_write(t, v); break;
+        default: break;  // the core ignores it
+        }
+    }
+
+    // Host read of the data register (or a DMA read) at t. -1 if the model can't tell
+    int read(uint64_t t) {
+        update(t);
+        switch (s.phase) {
+        case IDLE: return 0xff;
+        case EXEC_READ: return exec_read(t);
+        case RESULT: return result_read(t);
+        default: return -1;
+        }
+    }
+
+    // Rising edge of tc at t
+    void tc(uint64_t t) {
+        update(t);
+        if (!s.exm) return;
+        s.eos_at = NEVER;
+        resume(s.ds0, t);
+        switch (s.op) {
+        case OP_SCAN_EQ:
+        case OP_SCAN_LE:
+        case OP_SCAN_HE:
+        case OP_READ:
+        case OP_READ_DEL:
+        case OP_FORMAT:
+        case OP_WRITE: s.mech[s.ds0].int_at = t; break;
+        default: s.mech[s.ds0].int_at = NEVER; break;
+        }
+        results(t);
+    }
+
+    // Make the alternative answer the current one if it gives got as result byte index,
+    // read by the host at t
+    bool try_alt(int index, uint8_t got, uint64_t t) {
+        if (!has_alt || index >= alt.result_len || alt.result[index] != got) return false;
+        s = alt;
+        has_alt = false;
+        if (s.timed_result && index > 0) s.mech[s.ds0].int_at = NEVER;
+        s.result_pos = index;
+        take_result(t);
+        return true;
+    }
+
+    // Cylinder under the head of drive d at t
+    uint8_t pcn(int d, uint64_t t) const {
+        const Mech &m = s.mech[d];
+        if (!m.seeking) return m.pcn;
+        int total = abs((int)m.ncn - (int)m.from);
+        int steps = t < m.seek_start ? 0 : (fast & 1) ? total :
+                    std::min<uint64_t>(total, 1 + (t - m.seek_start) / m.step);
+        return m.ncn > m.from ? m.from + steps : m.from - steps;
+    }
+
+    // Sector list of a track as the core reads it from the Track-Info block. Empty if the
+    // image has no such track
+    std::vector<Sector> track(int d, int cyl, int head) const {
+        std::vector<Sector> list;
+        const Disk &dk = disk[d];
+        uint16_t off = dk.offsets[(cyl * 2 + head) & 511];
+        if (!dk.ready || !off) return list;
+        int total = byte(d, (uint64_t)off * 256 + 0x15);
+        uint64_t pos = ((uint64_t)off + 1) * 256;
+        for (int k = 0; k < total; k++) {
+            Sector e = entry(d, off, k);
+            e.offset = pos;
+            pos += e.size;
+            list.push_back(e);
+        }
+        return list;
+    }
+
+    // Name and bytes of the current command, for reports
+    std::string command_text() const {
+        static const char *names[] = {
+            "-", "READ DATA", "READ DELETED DATA", "WRITE DATA", "WRITE DELETED DATA",
+            "READ TRACK", "READ ID", "FORMAT TRACK", "SCAN EQUAL", "SCAN LOW OR EQUAL",
+            "SCAN HIGH OR EQUAL", "RECALIBRATE", "SENSE INTERRUPT STATUS", "SPECIFY",
+            "SENSE DRIVE STATUS", "SEEK", "INVALID"};
+        std::string text = names[s.op];
+        char hex[4];
+        for (int i = 0; i < s.cmd_len; i++) {
+            snprintf(hex, sizeof(hex), " %02x", s.cmd[i]);
+            text += hex;
+        }
+        return text;
+    }
+
+    static const char *phase_name(Phase p) {
+        static const char *names[] = {"idle", "command", "execution (read)", "execution (write)",
+                                      "result"};
+        return names[p];
+    }
+
+private:
+    static int params(Op op) {
+        switch (op) {
+        case OP_READ:
+        case OP_READ_DEL:
+        case OP_WRITE:
+        case OP_WRITE_DEL:
+        case OP_READ_TRACK:
+        case OP_SCAN_EQ:
+        case OP_SCAN_LE:
+        case OP_SCAN_HE: return 8;
+        case OP_FORMAT: return 5;
+        case OP_SPECIFY:
+        case OP_SEEK: return 2;
+        case OP_READ_ID:
+        case OP_RECAL:
+        case OP_SENSE_DRIVE: return 1;
+        default: return 0;
+        }
+    }
+
+    // Opcode decode, in the casex order of the core
+    static Op decode(uint8_t v) {
+        if ((v & 0x1f) == 0x06) return OP_READ;
+        if ((v & 0x1f) == 0x0c) return OP_READ_DEL;
+        if ((v & 0x3f) == 0x05) return OP_WRITE;
+        if ((v & 0x3f) == 0x09) return OP_WRITE_DEL;
+        if ((v & 0x9f) == 0x02) return OP_READ_TRACK;
+        if ((v & 0xbf) == 0x0a) return OP_READ_ID;
+        if ((v & 0xbf) == 0x0d) return OP_FORMAT;
+        switch (v) {
+        case 0x11: return OP_SCAN_EQ;
+        case 0x19: return OP_SCAN_LE;
+        case 0x1d: return OP_SCAN_HE;
+        case 0x07: return OP_RECAL;
+        case 0x08: return OP_SENSE_INT;
+        case 0x03: return OP_SPECIFY;
+        case 0x04: return OP_SENSE_DRIVE;
+        case 0x0f: return OP_SEEK;
+        default: return OP_INVALID;
+        }
+    }
+
+    static bool is_scan(Op op) { return op == OP_SCAN_EQ || op == OP_SCAN_LE || op == OP_SCAN_HE; }
+
+    uint8_t byte(int d, uint64_t offset) const {
+        const Disk &dk = disk[d];
+        return offset < dk.data.size() ? dk.data[offset] : 0;
+    }
+
+    // Entry k of the sector list of the Track-Info block at off. The list is read from the
+    // 512 byte block that holds the Track-Info, the address wrapping inside it as in the core
+    Sector entry(int d, uint16_t off, int k) const {
+        uint64_t lba = (uint64_t)(off >> 1) * 512;
+        uint32_t a = ((off & 1) << 8) + 0x18 + 8 * k;
+        uint8_t e[8];
+        for (int i = 0; i < 8; i++) e[i] = byte(d, lba + ((a + i) & 511));
+        Sector sec;
+        sec.c = e[0];
+        sec.h = e[1];
+        sec.r = e[2];
+        sec.n = e[3];
+        sec.st1 = e[4];
+        sec.st2 = e[5];
+        sec.size = disk[d].edsk ? (e[6] | e[7] << 8) : (0x80 << (byte(d, (uint64_t)off * 256 + 0x14) & 7)) & 0xffff;
+        sec.offset = 0;
+        return sec;
+    }
+
+    // ---- commands ----
+
+    void start(uint64_t t, uint8_t v) {
+        Op op = decode(v);
+        s.op = op;
+        s.mt = v >> 7 & 1;
+        s.sk = v >> 5 & 1;
+        s.cmd[0] = v;
+        s.cmd_len = 1;
+        s.cmd_need = 1 + params(op);
+        s.result_pos = 0;
+        has_alt = false;
+        commands++;
+        Mech &m = s.mech[s.ds0];
+        switch (op) {
+        case OP_READ:
+        case OP_READ_DEL:
+        case OP_WRITE:
+        case OP_WRITE_DEL:
+        case OP_READ_TRACK:
+            s.rtrack = op == OP_READ_TRACK;
+            s.write = op == OP_WRITE || op == OP_WRITE_DEL;
+            s.deleted = op == OP_READ_DEL || op == OP_WRITE_DEL;
+            m.scan_mode = 0;
+            break;
+        case OP_SCAN_EQ:
+        case OP_SCAN_LE:
+        case OP_SCAN_HE:
+            m.scan_mode = op == OP_SCAN_EQ ? 1 : op == OP_SCAN_LE ? 2 : 3;
+            s.scan_match = false;
+            s.rtrack = s.write = s.deleted = false;
+            break;
+        case OP_INVALID:
+            s.status[0] = 0x80;
+            s.result[0] = 0x80;
+            s.result_len = 1;
+            s.timed_result = false;
+            s.phase = RESULT;
+            s.ready_at = t + 2;
+            return;
+        case OP_SENSE_INT:
+            s.result_len = 0;  // worked out on the first read
+            s.timed_result = false;
+            s.phase = RESULT;
+            s.ready_at = t + 2;
+            return;
+        default: break;
+        }
+        s.phase = COMMAND;
+        s.ready_at = t + 2;
+    }
+
+    void param(uint64_t t, uint8_t v) {
+        s.cmd[s.cmd_len++] = v;
+        int i = s.cmd_len - 1;
+        s.ready_at = t + 2;
+        switch (s.op) {
+        case OP_READ:
+        case OP_READ_DEL:
+        case OP_WRITE:
+        case OP_WRITE_DEL:
+        case OP_READ_TRACK:
+        case OP_SCAN_EQ:
+        case OP_SCAN_LE:
+        case OP_SCAN_HE:
+            setup(t, i, v);
+            if (i == 8) validate(t + 1);
+            break;
+        case OP_READ_ID: read_id(t, v); break;
+        case OP_FORMAT:
+            if (i == 1) {
+                select(t, v & dmask());
+                clear_int(v & dmask(), t);
+            } else if (i == 2) s.n = v;
+            else if (i == 3) s.sc = v;
+            else if (i == 5) {
+                s.exm = true;
+                s.busy = true;
+                head_up(s.ds0, t);
+                s.phase = EXEC_WRITE;
+                s.done = 0;
+                if (!s.sc) end(t + 1, 0, 0, 0);
+            }
+            break;
+        case OP_RECAL: {
+            int d = v & dmask();
+            select(t, d);
+            s.mech[d].int_at = NEVER;
+            s.mech[d].ncn = 0;
+            seek(d, t);
+            s.phase = IDLE;
+            break;
+        }
+        case OP_SEEK:
+            if (i == 1) {
+                int d = v & dmask();
+                select(t, d);
+                s.hds = disk[d].dd ? v >> 2 & 1 : 0;
+                s.mech[d].int_at = NEVER;
+            } else {
+                int d = s.ds0;
+                Mech &m = s.mech[d];
+                bool half = !disk[d].dd && (density >> d & 1);
+                uint8_t ncn = half ? v >> 1 : v;
+                m.ncn = ncn;
+                if (((motor >> d & 1) && (ready >> d & 1) && disk[d].ready && ncn < disk[d].tracks) || !v)
+                    seek(d, t);
+                else
+                    m.int_at = t + 1;
+                s.phase = IDLE;
+            }
+            break;
+        case OP_SPECIFY:
+            if (i == 1) {
+                s.srt = v >> 4;
+                s.hut = v & 15;
+            } else {
+                s.hlt = v >> 1;
+                s.ndma = v & 1;
+                s.mech[s.ds0].int_at = t + 1;
+                s.phase = IDLE;
+            }
+            break;
+        case OP_SENSE_DRIVE: {
+            int d = v & dmask();
+            select(t, d);
+            s.hds = disk[d].dd ? v >> 2 & 1 : 0;
+            s.phase = RESULT;
+            s.result_len = 0;
+            s.timed_result = false;
+            break;
+        }
+        default: break;
+        }
+    }
+
+    void select(uint64_t t, int d) {
+        if (d != s.ds0) s.ds0_since = t;
+        s.ds0 = d;
+    }
+
+    // Parameter i of the common read/write/scan setup
+    void setup(uint64_t t, int i, uint8_t v) {
+        switch (i) {
+        case 1: {
+            int d = v & dmask();
+            select(t, d);
+            clear_int(d, t);
+            s.hds = disk[d].dd ? v >> 2 & 1 : 0;
+            break;
+        }
+        case 2: s.c = v; break;
+        case 3: s.h = disk[s.ds0].dd ? v : 0; break;
+        case 4: s.r = v; break;
+        case 5: s.n = v; break;
+        case 6: s.eot = v; break;
+        case 7: break;
+        case 8:
+            if (s.mech[s.ds0].scan_mode) s.stp = v & 3;
+            else s.dtl = v;
+            break;
+        }
+    }
+
+    void validate(uint64_t t) {
+        int d = s.ds0;
+        s.busy = true;
+        if (!(motor >> d & 1) || !(ready >> d & 1)) {
+            end(t, 0x40, 0x05, 0);
+        } else if (s.hds && !disk[d].sides) {
+            s.hds = 0;
+            end(t, 0x48, 0, 0);
+        } else if (s.mech[d].scan_mode) {
+            scan_start(t + 1);
+        } else if (is_scan(s.op)) {
+            // SCAN decoded on another drive than it selects: the core runs it as a READ
+            unmodelled = "SCAN with the scan mode of another drive";
+            end(t, 0, 0, 0);
+        } else {
+            rw_start(t + 1);
+        }
+    }
+
+    void rw_start(uint64_t t) {
+        int d = s.ds0;
+        head_up(d, t);
+        s.phase = s.write ? EXEC_WRITE : EXEC_READ;
+        if (s.write && disk[d].wp) {
+            end(t, 0x40, 0x02, 0);
+            return;
+        }
+        t += reload(t);
+        t += head_load(t);
+        if (s.rtrack) s.r = 1;
+        s.bc = true;
+        s.scan_match = false;
+        rw_search(t + 2);
+    }
+
+    // From the sector search on (EXEC2), until a sector moves data or the command ends
+    void rw_search(uint64_t t) {
+        int d = s.ds0;
+        Mech &m = s.mech[d];
+        for (int guard = 0; guard < 1024; guard++) {
+            int k = find(t);
+            if (k < 0) {
+                end(t, s.rtrack ? 0 : 0x40, s.rtrack ? 0 : 0x04,
+                    s.rtrack || !s.bc ? 0 : (s.sec_c == 0xff ? 0x02 : 0x10));
+                return;
+            }
+            t += 4;
+            bool dam = s.deleted ^ (s.sec_st2 >> 6 & 1);
+            if (s.sk && !s.rtrack && dam) {
+                if (!rw_next(t)) return;
+                continue;
+            }
+            s.btr = s.n ? 0x80 << (s.n & 8 ? 8 : s.n & 7) : s.dtl;
+            if (fast & 2) {
+                uint64_t u = units(d, t);
+                m.ov[s.hds] = true;
+                m.ov_rev[s.hds] = u / TRACK_UNITS;
+                m.ov_unit[s.hds] = u % TRACK_UNITS;
+                m.ov_k[s.hds] = k;
+            } else {
+                t = wait_sector(d, s.hds, k, t);
+            }
+            s.exm = true;
+            pause(d, t);
+            weak(d);
+            s.done = 0;
+            sectors++;
+            sd_requests++;
+            s.ready_at = t + 2 + sd_cycles;
+            if (s.btr) return;
+            resume(d, s.ready_at);
+            if (!rw_next(s.ready_at + 2)) return;
+            t = s.ready_at + 3;
+        }
+        unmodelled = "sector search that never ends";
+    }
+
+    // Copy of a weak sector this read gets: the sector data holds 2, 3 or 4 copies
+    void weak(int d) {
+        Mech &m = s.mech[d];
+        uint32_t w = 0;
+        for (;;) {
+            uint32_t b = s.btr & 0xffff;
+            bool copies = disk[d].edsk && b && (s.size == 2 * b || s.size == 3 * b || s.size == 4 * b);
+            if (!copies) {
+                m.next_weak = 0;
+                return;
+            }
+            if (w != m.next_weak) {
+                s.pos += b;
+                s.size = (s.size - b) & 0xffff;
+                w = (w + 1) & 7;
+                continue;
+            }
+            m.next_weak = (m.next_weak + 1) & 7;
+            return;
+        }
+    }
+
+    // Sector search on the track under the head: the index of the head when it is
+    // loaded, the whole list otherwise. Sets the sector registers, -1 if not found
+    int find(uint64_t &t) {
+        int d = s.ds0;
+        Mech &m = s.mech[d];
+        const Disk &dk = disk[d];
+        uint16_t off = dk.offsets[(pcn(d, t) * 2 + s.hds) & 511];
+        int total = m.sectors[s.hds];
+        if (!off) return -1;
+        auto take = [&](int k) {
+            Sector e = entry(d, off, k);
+            s.sec_c = e.c;
+            s.sec_h = e.h;
+            s.sec_r = e.r;
+            s.sec_n = e.n;
+            s.sec_st1 = e.st1;
+            s.sec_st2 = e.st2;
+            return e;
+        };
+        auto matches = [&](const Sector &e) {
+            return e.c == s.c && e.h == s.h && e.r == s.r && (e.n == s.n || !s.n);
+        };
+        if (m.indexed[s.hds]) {
+            int k = s.rtrack ? (uint8_t)(s.r - 1) : m.map[s.hds][s.r];
+            if (k < total && k < (int)IDX_SECTORS) {  // a repeated R is >= 0x20
+                Sector e = entry(d, off, k);
+                if (s.rtrack || matches(e)) {
+                    take(k);
+                    locate(d, off, k, e);
+                    t += 6;
+                    return k;
+                }
+            }
+        }
+        for (int k = 0; k < total; k++) {
+            t += 16;
+            Sector e = take(k);
+            if (s.rtrack ? (uint8_t)(k + 1) == s.r : matches(e)) {
+                locate(d, off, k, e);
+                return k;
+            }
+            if (e.c == s.c) s.bc = false;
+        }
+        return -1;
+    }
+
+    // Data offset and size of entry k
+    void locate(int d, uint16_t off, int k, const Sector &e) {
+        uint64_t pos = ((uint64_t)off + 1) * 256;
+        for (int j = 0; j < k; j++) pos += entry(d, off, j).size;
+        s.cur = k + 1;
+        s.pos = pos;
+        s.size = e.size;
+    }
+
+    // After a sector: the end of the command or the next sector. False if it ended
+    bool rw_next(uint64_t t) {
+        Disk &dk = disk[s.ds0];
+        bool dam = s.deleted ^ (s.sec_st2 >> 6 & 1);
+        if (!s.rtrack && !(s.sk && dam) && (((s.sec_st1 & 0x20) && (s.sec_st2 & 0x20)) || dam)) {
+            end(t, 0x40, s.sec_st1, s.sec_st2 | (s.deleted ? 0x40 : 0));
+            return false;
+        }
+        if ((s.rtrack ? (uint8_t)s.cur : s.sec_r) == s.eot) {
+            end(t, 0, 0, dam ? 0x40 : 0);
+            return false;
+        }
+        bool old_hds = s.hds;
+        if (s.mt && dk.sides) {
+            s.hds ^= 1;
+            s.h = ~s.h;
+        }
+        if (!s.mt || old_hds || !dk.sides) s.r++;
+        return true;
+    }
+
+    uint8_t exec_read(uint64_t t) {
+        uint8_t v = byte(s.ds0, s.pos + std::min(s.done, s.size));
+        data_step(t);
+        bytes_read++;
+        return v;
+    }
+
+    void exec_write(uint64_t t, uint8_t v) {
+        if (is_scan(s.op)) {
+            scan_byte(t, v);
+            return;
+        }
+        if (s.op == OP_FORMAT) {
+            format_byte(t, v);
+            return;
+        }
+        Disk &dk = disk[s.ds0];
+        uint64_t off = s.pos + std::min(s.done, s.size);
+        if (off < dk.data.size()) dk.data[off] = v;
+        data_step(t);
+        bytes_written++;
+    }
+
+    void data_step(uint64_t t) {
+        s.done++;
+        uint64_t next = s.pos + std::min(s.done, s.size);
+        s.ready_at = t + 2;
+        if (s.done < s.size && !(next & 511)) {
+            s.ready_at += sd_cycles;
+            sd_requests++;
+        }
+        if (s.done >= s.btr) s.eos_at = t + 2;
+    }
+
+    // EXEC8 after the last byte of a sector, unless tc came first
+    void sector_end(uint64_t t) {
+        if (s.op == OP_FORMAT) return;
+        resume(s.ds0, t);
+        if (rw_next(t)) rw_search(t + 1);
+    }
+
+    // ---- SCAN ----
+
+    void scan_start(uint64_t t) {
+        int d = s.ds0;
+        Mech &m = s.mech[d];
+        head_up(d, t);
+        s.phase = EXEC_WRITE;
+        s.bc = true;
+        s.scan_match = false;
+        m.dirty = true;
+        if (m.seeking) {
+            m.from = s.c;
+            m.seek_start = t;
+        }
+        m.pcn = s.c;
+        t += reload(t);
+        scan_search(t + 1);
+    }
+
+    void scan_search(uint64_t t) {
+        int d = s.ds0;
+        uint16_t off = disk[d].offsets[(pcn(d, t) * 2 + s.hds) & 511];
+        int total = s.mech[d].sectors[s.hds];
+        for (int k = 0; off && k < total; k++) {
+            t += 16;
+            Sector e = entry(d, off, k);
+            s.sec_c = e.c;
+            s.sec_h = e.h;
+            s.sec_r = e.r;
+            s.sec_n = e.n;
+            s.sec_st1 = e.st1;
+            s.sec_st2 = e.st2;
+            if (e.c == s.c && e.r == s.r && e.h == s.h && (e.n == s.n || !s.n)) {
+                locate(d, off, k, e);
+                s.btr = s.n ? 0x80 << (s.n & 8 ? 8 : s.n & 7) : s.dtl;
+                s.done = 0;
+                sectors++;
+                sd_requests++;
+                s.ready_at = t + 2 + sd_cycles;
+                return;
+            }
+            if (e.c == s.c) s.bc = false;
+        }
+        end(t, 0x40, 0x04, 0);
+    }
+
+    // One host byte compared with the sector. The match flag is registered, so the byte
+    // after the first match is still taken
+    void scan_byte(uint64_t t, uint8_t v) {
+        uint8_t sb = byte(s.ds0, s.pos + s.done);
+        bool was = s.scan_match;
+        uint32_t left = (s.btr - s.done) & 0xffff;
+        int mode = s.mech[s.ds0].scan_mode;
+        if ((mode == 1 && sb == v) || (mode == 2 && sb <= v) || (mode == 3 && sb >= v))
+            s.scan_match = true;
+        s.done++;
+        s.ready_at = t + 2;
+        if (!((s.pos + s.done) & 511)) s.ready_at += sd_cycles;
+        if (!was && left > 1) return;
+        if (s.scan_match) {
+            end(t + 2, 0, 0, mode == 1 ? 0x10 : 0x08);
+        } else if (s.r < s.eot) {
+            s.r += s.stp >= 2 ? s.stp : 1;
+            s.scan_match = false;
+            scan_search(t + 3);
+        } else {
+            end(t + 2, 0, 0, 0);
+        }
+    }
+
+    // FORMAT TRACK: four ID bytes per sector, the media is left alone
+    void format_byte(uint64_t t, uint8_t v) {
+        switch (s.done++ & 3) {
+        case 0: s.c = v; break;
+        case 1: s.h = disk[s.ds0].dd ? v : 0; break;
+        case 2: s.r = v; break;
+        case 3:
+            s.n = v;
+            s.sc--;
+            s.r++;
+            if (!s.sc) end(t + 2, 0, 0, 0);
+            break;
+        }
+        s.ready_at = t + 2;
+    }
+
+    // ---- READ ID ----
+
+    void read_id(uint64_t t, uint8_t v) {
+        int d = v & dmask();
+        select(t, d);
+        clear_int(d, t);
+        s.busy = true;
+        if (!(motor >> d & 1) || !(ready >> d & 1) || !disk[d].ready) {
+            end(t + 1, 0x40, 0x05, 0);
+            return;
+        }
+        if ((v & 4) && !disk[d].sides) {
+            end(t + 1, 0x48, 0, 0);
+            return;
+        }
+        s.hds = disk[d].dd ? v >> 2 & 1 : 0;
+        t += 1;
+        t += reload(t);
+        t += head_load(t);
+        t += 2;
+        uint16_t off = disk[d].offsets[(pcn(d, t) * 2 + s.hds) & 511];
+        if (!off) {
+            end(t, 0x40, 0x05, 0);
+            return;
+        }
+        uint64_t at;
+        int k = next_sector(d, s.hds, t, at);
+        id_result(d, off, k, at);
+        // a sector start within slack of t: the core may have seen the neighbour
+        if (slack && !(fast & 2) && at - t < slack) {
+            uint64_t at2;
+            int k2 = next_sector(d, s.hds, at + 1, at2);
+            if (k2 != k) {
+                State keep = s;
+                id_result(d, off, k2, at2);
+                alt = s;
+                s = keep;
+                has_alt = true;
+            }
+        }
+    }
+
+    void id_result(int d, uint16_t off, int k, uint64_t at) {
+        // the core reads the entry at the head position, 8 bit address wrap included
+        uint64_t lba = (uint64_t)(off >> 1) * 512;
+        uint32_t a = ((off & 1) << 8) + ((0x18 + (k << 3)) & 0xff);
+        s.sec_c = byte(d, lba + a);
+        s.sec_h = byte(d, lba + a + 1);
+        s.sec_r = byte(d, lba + a + 2);
+        s.sec_n = byte(d, lba + a + 3);
+        end(at + 8, 0, 0, 0);
+    }
+
+    // ---- results and interrupts ----
+
+    // Result phase with fresh status registers, interrupt at t
+    void end(uint64_t t, uint8_t st0, uint8_t st1, uint8_t st2) {
+        s.status[0] = st0;
+        s.status[1] = st1;
+        s.status[2] = st2;
+        s.mech[s.ds0].int_at = t;
+        s.eos_at = NEVER;
+        resume(s.ds0, t);
+        results(t);
+    }
+
+    // Result bytes from the status registers and the sector registers
+    void results(uint64_t t) {
+        Mech &m = s.mech[s.ds0];
+        if (m.head_loaded && (m.unload_at == NEVER || s.phase == EXEC_READ || s.phase == EXEC_WRITE))
+            m.unload_at = t + unload_cycles();
+        s.exm = false;
+        s.busy = true;
+        s.phase = RESULT;
+        s.result[0] = (s.status[0] & 0xf8) | s.hds << 2 | s.ds0;
+        s.result[1] = s.status[1];
+        s.result[2] = s.status[2];
+        s.result[3] = s.sec_c;
+        s.result[4] = s.sec_h;
+        s.result[5] = s.sec_r;
+        s.result[6] = s.sec_n;
+        s.result_len = 7;
+        s.result_pos = 0;
+        s.timed_result = true;
+        s.result_deadline = t + RESULT_TIMEOUT + 1 + slack;
+        s.ready_at = t + 1;
+    }
+
+    int result_read(uint64_t t) {
+        if (s.result_pos == 0 && s.op == OP_SENSE_INT) sense_int(t);
+        if (s.result_pos == 0 && s.op == OP_SENSE_DRIVE) sense_drive();
+        return take_result(t);
+    }
+
+    // The host takes the next result byte
+    uint8_t take_result(uint64_t t) {
+        int i = s.result_pos++;
+        uint8_t v = s.result[i];
+        if (s.timed_result && i == 0) s.mech[s.ds0].int_at = NEVER;
+        if (s.op == OP_SENSE_INT && i == 1) s.mech[s.sense_drive].int_at = NEVER;
+        if (s.timed_result) s.result_deadline = t + RESULT_TIMEOUT + 1;
+        s.ready_at = t + 2;
+        if (s.result_pos < s.result_len) return v;
+        s.phase = IDLE;
+        s.timed_result = false;
+        s.result_deadline = NEVER;
+        if (s.busy) s.command_since = t;
+        s.busy = false;
+        return v;
+    }
+
+    // SENSE INTERRUPT STATUS: the drives in turn, starting after the last one reported
+    void sense_int(uint64_t t) {
+        sense_result(t);
+        if (!slack) return;
+        // a seek that ends within slack of t, or has just ended, may go either way
+        int best = -1;
+        uint64_t dist = slack;
+        for (int d = 0; d < drives; d++) {
+            const Mech &m = s.mech[d];
+            uint64_t e = m.seeking ? m.seek_end : m.held ? NEVER : m.int_at;
+            if (e == NEVER) continue;
+            uint64_t delta = e > t ? e - t : t - e;
+            if (delta < dist) {
+                dist = delta;
+                best = d;
+            }
+        }
+        if (best < 0) return;
+        State keep = s;
+        Mech &m = s.mech[best];
+        if (m.seeking) {
+            m.pcn = m.ncn;
+            m.seeking = false;
+            m.int_at = t;
+        } else if (m.int_at <= t) {
+            m.int_at = t + 1;
+        } else {
+            m.int_at = t;
+        }
+        sense_result(t);
+        if (s.result_len != keep.result_len || memcmp(s.result, keep.result, keep.result_len)) {
+            alt = s;
+            has_alt = true;
+        }
+        s = keep;
+    }
+
+    void sense_result(uint64_t t) {
+        int found = -1;
+        for (int k = 1; k <= drives; k++) {
+            int d = (s.sense_drive + k) & (drives - 1);
+            if (s.mech[d].int_at <= t) {
+                found = d;
+                break;
+            }
+        }
+        if (found < 0) {
+            s.result[0] = 0x80;
+            s.result_len = 1;
+            return;
+        }
+        const Mech &m = s.mech[found];
+        uint8_t p = pcn(found, t);
+        s.result[0] = (m.ncn == p && disk[found].ready ? 0x20 : 0xe8) | found;
+        s.result[1] = !disk[found].dd && (density >> found & 1) ? p << 1 : p;
+        s.result_len = 2;
+        s.sense_drive = found;
+    }
+
+    void sense_drive() {
+        int d = s.ds0;
+        bool r = ready >> d & 1;
+        s.result[0] = (r && disk[d].wp) << 6 | ((motor & available) >> d & 1) << 5 |
+                      (r && !s.mech[d].pcn) << 4 | (r && disk[d].sides) << 3 | (r && s.hds) << 2 | d;
+        s.result_len = 1;
+    }
+
+    // The transfers, READ ID and FORMAT only clear the interrupt of the drive they select.
+    // SPECIFY, SENSE DRIVE STATUS and an invalid command leave the interrupts alone
+    void clear_int(int d, uint64_t t) {
+        if (s.mech[d].int_at <= t + 1) s.mech[d].int_at = NEVER;
+    }
+
+    void release(Mech &m, uint64_t at) {
+        m.held = false;
+        m.int_at = at;
+    }
+
+    // Nobody read the results in time: the core goes through its reset state, which only
+    // takes the selected drive out of scan mode
+    void emergency_reset(uint64_t t) {
+        uint8_t modes[4];
+        for (int d = 0; d < 4; d++) modes[d] = s.mech[d].scan_mode;
+        modes[s.ds0] = 0;
+        reset(t);
+        for (int d = 0; d < 4; d++) s.mech[d].scan_mode = modes[d];
+        timeouts++;
+    }
+
+    // ---- mechanics ----
+
+    void seek(int d, uint64_t t) {
+        Mech &m = s.mech[d];
+        m.from = pcn(d, t);
+        int total = abs((int)m.ncn - (int)m.from);
+        m.seeking = true;
+        m.held = false;
+        m.seek_start = t + 1;
+        m.step = 1 + (16 - s.srt) * (STEP_UNIT + 1);
+        if (total) m.dirty = true;
+        m.seek_end = m.seek_start + (!total ? 0 : (fast & 1) ? 1 : total * m.step) + 1;
+    }
+
+    // Track-Info of the cylinder under the head, if a seek or a mount made it stale.
+    // Returns the cycles it takes
+    uint64_t reload(uint64_t t) {
+        int d = s.ds0;
+        Mech &m = s.mech[d];
+        Disk &dk = disk[d];
+        if (!dk.ready || !m.dirty) return 1;
+        uint64_t cost = 2;
+        m.next_weak = 0;
+        m.indexed[0] = m.indexed[1] = false;
+        uint8_t cyl = pcn(d, t);
+        for (int h = 0; h <= (int)dk.sides; h++) {
+            uint16_t off = dk.offsets[(cyl * 2 + h) & 511];
+            if (!off) break;
+            uint8_t n = byte(d, (uint64_t)off * 256 + 0x15);
+            uint32_t size = 0x80 << (byte(d, (uint64_t)off * 256 + 0x14) & 7);
+            uint32_t pitch = (SECTOR_OVERHEAD + size + byte(d, (uint64_t)off * 256 + 0x16)) & 0xffff;
+            uint32_t track = TRACK_PRE_BYTES + n * pitch;
+            uint32_t pre;
+            if (track * 2 <= TRACK_UNITS) {
+                pitch = (pitch << 1) & 0xffff;
+                pre = TRACK_PRE_BYTES * 2;
+            } else {
+                pre = TRACK_PRE_BYTES;
+                if (n && track > TRACK_UNITS) pitch = (TRACK_UNITS - TRACK_PRE_BYTES) / n;
+            }
+            m.sectors[h] = n;
+            m.pitch[h] = pitch;
+            m.pre[h] = pre;
+            m.ov[h] = false;
+            bool seen[256] = {false};
+            for (uint32_t k = 0; k < n && k < IDX_SECTORS; k++) {
+                uint8_t r = entry(d, off, k).r;
+                m.map[h][r] = seen[r] ? 0x20 | k : k;
+                seen[r] = true;
+            }
+            m.indexed[h] = true;
+            cost += sd_cycles + 2 * (3 + 8 * std::min<uint32_t>(n, IDX_SECTORS));
+            sd_requests++;
+        }
+        m.dirty = false;
+        return cost;
+    }
+
+    uint64_t head_load(uint64_t t) {
+        Mech &m = s.mech[s.ds0];
+        uint64_t cost = 1;
+        if (!head_up(s.ds0, t) && !(fast & 4) && s.hlt) cost += (uint64_t)s.hlt * 2 * (CYCLES + 1);
+        m.head_loaded = true;
+        m.unload_at = NEVER;
+        return cost;
+    }
+
+    // The head of drive d lifts HUT after its execution phase. True if it is still loaded at t
+    bool head_up(int d, uint64_t t) {
+        Mech &m = s.mech[d];
+        if (m.head_loaded && t >= m.unload_at) m.head_loaded = false;
+        return m.head_loaded;
+    }
+
+    // HUT in 32 ms units (0 = 16), counted on the core's millisecond ticks, so to within one
+    uint64_t unload_cycles() const {
+        return (uint64_t)((s.hut ? s.hut : 16) * 32 + 1) * (CYCLES + 1);
+    }
+
+    // Rotation: the disk of drive d turned while its motor was on, but not while the
+    // sector under the head of ds0 moves data
+    void spin(int d, uint64_t t) {
+        Mech &m = s.mech[d];
+        if (t <= m.spun_at) return;
+        m.spun = spun(d, t);
+        m.spun_at = t;
+    }
+
+    uint64_t spun(int d, uint64_t t) const {
+        const Mech &m = s.mech[d];
+        bool turning = (motor >> d & 1) && !m.paused && t > m.spun_at;
+        return m.spun + (turning ? t - m.spun_at : 0);
+    }
+
+    void pause(int d, uint64_t t) {
+        spin(d, t);
+        s.mech[d].paused = true;
+    }
+
+    void resume(int d, uint64_t t) {
+        Mech &m = s.mech[d];
+        if (!m.paused) return;
+        if (t > m.spun_at) m.spun_at = t;
+        m.paused = false;
+    }
+
+    // Byte times the disk of drive d turned by t
+    uint64_t units(int d, uint64_t t) const { return spun(d, t) * TRACK_UNITS / ROT_CYCLES; }
+
+    // Cycle the disk of drive d reaches unit u, from t
+    uint64_t cycle_at(int d, uint64_t u, uint64_t t) const {
+        uint64_t need = (u * ROT_CYCLES + TRACK_UNITS - 1) / TRACK_UNITS;
+        uint64_t now = spun(d, t);
+        return t + (need > now ? need - now : 0);
+    }
+
+    // Start of sector k of head h in unit of the revolution, TRACK_UNITS if past the end
+    uint32_t sector_start(const Mech &m, int h, uint32_t k, uint64_t rev) const {
+        if (m.ov[h] && m.ov_rev[h] == rev) {
+            if (k < m.ov_k[h]) return TRACK_UNITS;
+            uint64_t a = m.ov_unit[h] + (uint64_t)(k - m.ov_k[h]) * m.pitch[h];
+            return a < TRACK_UNITS ? a : TRACK_UNITS;
+        }
+        uint64_t a = m.pre[h] + (uint64_t)k * m.pitch[h];
+        return a < TRACK_UNITS ? a : TRACK_UNITS;
+    }
+
+    // Cycle sector k of head h reaches the head, from t
+    uint64_t wait_sector(int d, int h, int k, uint64_t t) const {
+        const Mech &m = s.mech[d];
+        if (!(motor >> d & 1)) return t;
+        uint64_t u = units(d, t);
+        uint64_t rev = u / TRACK_UNITS;
+        uint32_t a = u % TRACK_UNITS;
+        uint32_t start = sector_start(m, h, k, rev);
+        if (start < TRACK_UNITS && start >= a) return cycle_at(d, rev * TRACK_UNITS + start, t);
+        start = sector_start(m, h, k, rev + 1);
+        return cycle_at(d, (rev + 1) * TRACK_UNITS + std::min<uint32_t>(start, TRACK_UNITS - 1), t);
+    }
+
+    // Next sector to reach the head of h and the cycle it does; with fast rotation the
+    // one the head position points to, at once
+    int next_sector(int d, int h, uint64_t t, uint64_t &at) const {
+        const Mech &m = s.mech[d];
+        uint32_t n = std::max<uint32_t>(1, m.sectors[h]);
+        uint64_t u = units(d, t);
+        uint64_t rev = u / TRACK_UNITS;
+        uint32_t a = u % TRACK_UNITS;
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t start = sector_start(m, h, k, rev);
+            if (start < TRACK_UNITS && start >= a) {
+                at = (fast & 2) ? t : cycle_at(d, rev * TRACK_UNITS + start, t);
+                return k;
+            }
+        }
+        at = (fast & 2) ? t : cycle_at(d, (rev + 1) * TRACK_UNITS + m.pre[h], t);
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+// Runtime options for the testbenches, passed as Verilator style plusargs (+name=value).
+// Positional arguments keep working as before; plusargs can go anywhere on the command line.
+#ifndef U765_PLUSARGS_H
+#define U765_PLUSARGS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static std::vector<std::string> plusargs_list;
+
+// Keep the plusargs and return argv without them, so argv[1], argv[2]... keep their
+// positional meaning
+static inline std::vector<char *> plusargs_init(int argc, char **argv) {
+    std::vector<char *> args;
+    plusargs_list.clear();
+    for (int i = 0; i < argc; i++) {
+        if (i > 0 && argv[i][0] == '+') plusargs_list.push_back(argv[i] + 1);
+        else args.push_back(argv[i]);
+    }
+    return args;
+}
+
+// Value of +name=value, or NULL if the plusarg was not given. A bare +name returns ""
+static inline const char *plusarg(const char *name) {
+    size_t len = strlen(name);
+    const char *found = NULL;
+    for (const std::string &a : plusargs_list) {  // the last one wins
+        if (a.compare(0, len, name)) continue;
+        if (a.size() == len) found = "";
+        else if (a[len] == '=') found = a.c_str() + len + 1;
+    }
+    return found;
+}
+
+static inline bool plusarg_flag(const char *name) {
+    const char *v = plusarg(name);
+    return v && strcmp(v, "0");
+}
+
+static inline long plusarg_int(const char *name, long def) {
+    const char *v = plusarg(name);
+    return (v && *v) ? strtol(v, NULL, 0) : def;
+}
+
+static inline std::string plusarg_str(const char *name, const char *def) {
+    const char *v = plusarg(name);
+    return v ? std::string(v) : std::string(def);
+}
+
+#endif
@@ -0,0 +1,388 @@
+// Per-command latency and FSM state residency profilers for the u765 testbenches.
+//
+// Follows every command through the host side of the bus, the way a driver sees it, and
+// times its phase boundaries in simulated cycles: first command byte, last command byte,
+// execution start (first status read with EXM, or first DMA byte), first data byte, the int_out edge that ends
+// the command and the last result byte. The intervals go into per opcode log2 histograms.
+// Boundaries seen through status reads are only as precise as the polling (2 cycles).
+//
+// StateProfiler samples fsm_state and old_state (the command being run) on every clk_sys
+// cycle and keeps, per state_t value, the cycles spent in it, the visits and the longest
+// visit, plus the transition counts and the cycles of every state under every command.
+//
+// Plusargs:
+//   +profile          print the per opcode latency report at the end of the run
+//   +profile_csv=f    also write every command with its raw boundaries (in ticks) to f
+//   +profile_khz=N    cycles per ms of the core (default CYCLES of the core, see U765Sim)
+//   +state_profile    print the state residency report at the end of the run
+//   +state_top=N      transitions and command/state pairs listed (default 30)
+#ifndef U765_PROFILE_H
+#define U765_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Vu765_test.h"
+#include "u765_plusargs.h"
+#include "u765_states.h"
+
+enum prof_phase {
+    PROF_COMMAND,  // first command byte -> last command byte
+    PROF_TO_EXEC,  // last command byte -> EXM
+    PROF_TO_DATA,  // EXM -> first data byte
+    PROF_EXEC,     // EXM -> int_out at the end of the execution phase
+    PROF_TO_INT,   // last command byte -> int_out (SEEK, RECALIBRATE, READ ID...)
+    PROF_RESULT,   // int_out, or last command byte without one -> last result byte
+    PROF_TOTAL,    // first command byte -> end of the command
+    PROF_PHASES
+};
+
+static const char *const prof_phase_names[PROF_PHASES] = {
+    "command", "to exec", "to data", "exec", "to int", "result", "total",
+};
+
+// Command and result bytes of every opcode (low 5 bits), opcode included. 0 = invalid
+struct ProfOpcode {
+    const char *name;
+    uint8_t cmd_bytes, result_bytes;
+};
+
+static const ProfOpcode prof_opcodes[32] = {
+    {}, {}, {"READ TRACK", 9, 7}, {"SPECIFY", 3, 0},
+    {"SENSE DRIVE", 2, 1}, {"WRITE DATA", 9, 7}, {"READ DATA", 9, 7}, {"RECALIBRATE", 2, 0},
+    {"SENSE INT", 1, 2}, {"WRITE DELETED", 9, 7}, {"READ ID", 2, 7}, {},
+    {"READ DELETED", 9, 7}, {"FORMAT TRACK", 6, 7}, {}, {"SEEK", 3, 0},
+    {}, {"SCAN EQUAL", 9, 7}, {}, {},
+    {}, {}, {}, {},
+    {}, {"SCAN LOW/EQ", 9, 7}, {}, {},
+    {}, {"SCAN HIGH/EQ", 9, 7}, {}, {},
+};
+
+// Count, range and log2 histogram of one interval, in cycles
+struct ProfStat {
+    uint64_t n = 0, min = 0, max = 0, sum = 0;
+    uint64_t buckets[48] = {0};
+
+    void add(uint64_t cycles) {
+        if (!n || cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+        n++;
+        sum += cycles;
+        int b = 0;
+        while (b < 46 && (cycles >> b) > 1) b++;  // the last bucket takes the rest
+        buckets[cycles ? b + 1 : 0]++;
+    }
+};
+
+class CommandProfiler {
+public:
+    bool enabled = false;
+    int khz = 0;  // cycles per ms
+    std::string csv_file;
+    uint64_t commands = 0;
+    uint64_t aborted = 0;  // a new command started before the previous one ended
+
+    // cycles: CYCLES of the core, the default of +profile_khz
+    void configure(int cycles) {
+        enabled = plusarg_flag("profile");
+        csv_file = plusarg_str("profile_csv", "");
+        khz = plusarg_int("profile_khz", cycles);
+        if (khz <= 0) khz = cycles;
+        if (!csv_file.empty()) {
+            enabled = true;
+            csv = fopen(csv_file.c_str(), "w");
+            if (csv) fprintf(csv, "opcode,name,first,cmd_end,exec,data,int,done\n");
+        }
+    }
+
+    ~CommandProfiler() {
+        if (csv) fclose(csv);
+    }
+
+    // Bus hooks, called by U765Sim with the tick at the end of the access
+    void on_status(uint64_t tick, int status) {
+        if (!enabled) return;
+        last_status = status;
+        if (cur.state == CMD_WAIT && (status & 0x20) && !cur.exec) cur.exec = tick;
+        // Back to idle after a short result phase (SENSE INT without an interrupt)
+        if (cur.state == CMD_WAIT && cur.results && (status & 0xf0) == 0x80) finish(cur.last_result);
+    }
+
+    void on_write(uint64_t tick, int byte) {
+        if (!enabled) return;
+        if (cur.state == CMD_WAIT && (last_status & 0x20)) {
+            if (!cur.data) cur.data = tick;
+            return;
+        }
+        if (cur.state != CMD_PARAMS) start(tick, byte);
+        if (++cur.params >= cur.op->cmd_bytes) {
+            cur.cmd_end = tick;
+            cur.state = CMD_WAIT;
+            if (cur.opcode == 0x07 || cur.opcode == 0x0f) park_seek();
+            else if (!cur.op->result_bytes) finish(tick);
+        }
+    }
+
+    void on_read(uint64_t tick, int byte) {
+        if (!enabled || cur.state != CMD_WAIT) return;
+        if (last_status & 0x20) {
+            if (!cur.data) cur.data = tick;
+            return;
+        }
+        cur.last_result = tick;
+        if (++cur.results >= cur.op->result_bytes) finish(tick);
+    }
+
+    // DMA byte: no status reads, the first one also marks the execution start
+    void on_dma(uint64_t tick) {
+        if (!enabled || cur.state != CMD_WAIT) return;
+        if (!cur.exec) cur.exec = tick;
+        if (!cur.data) cur.data = tick;
+    }
+
+    // Rising edge of int_out. Execution phases without DMA raise it for every byte too,
+    // the last edge before the result phase is the one that counts
+    void on_interrupt(uint64_t tick) {
+        if (!enabled) return;
+        if (cur.state == CMD_WAIT && !cur.results) cur.irq = tick;
+        else if (seeks_pending) {
+            Cmd s = seeks[0];
+            for (int i = 1; i < seeks_pending; i++) seeks[i - 1] = seeks[i];
+            seeks_pending--;
+            s.irq = tick;
+            record(s, tick);
+        }
+    }
+
+    // Forget the command in flight, for a checkpoint restore
+    void resync() {
+        cur = Cmd();
+        seeks_pending = 0;
+        last_status = 0;
+    }
+
+    double us(double cycles) const { return cycles * 1000.0 / khz; }
+
+    void report(FILE *f = stdout) const {
+        fprintf(f, "\n=== Command latency (cycles, us at %d cycles/ms) ===\n", khz);
+        fprintf(f, "%llu commands, %llu aborted\n", (unsigned long long)commands,
+                (unsigned long long)aborted);
+        for (int op = 0; op < 33; op++) {
+            const ProfStat &total = stats[op][PROF_TOTAL];
+            if (!total.n) continue;
+            fprintf(f, "\n%s (%llu)\n", op < 32 ? prof_opcodes[op].name : "INVALID",
+                    (unsigned long long)total.n);
+            fprintf(f, "  %-8s %8s %12s %12s %12s %12s\n", "phase", "n", "min", "mean", "max",
+                    "mean(us)");
+            for (int p = 0; p < PROF_PHASES; p++) {
+                const ProfStat &s = stats[op][p];
+                if (!s.n) continue;
+                double mean = (double)s.sum / s.n;
+                fprintf(f, "  %-8s %8llu %12llu %12.1f %12llu %12.1f\n", prof_phase_names[p],
+                        (unsigned long long)s.n, (unsigned long long)s.min, mean,
+                        (unsigned long long)s.max, us(mean));
+            }
+            fprintf(f, "  total histogram:\n");
+            for (int b = 0; b < 48; b++) {
+                if (!total.buckets[b]) continue;
+                uint64_t lo = b ? 1ull << (b - 1) : 0;
+                int bar = (int)(total.buckets[b] * 40 / total.n);
+                fprintf(f, "    >= %10llu cycles (%10.1f us) %8llu %.*s\n", (unsigned long long)lo,
+                        us(lo), (unsigned long long)total.buckets[b], bar ? bar : 1,
+                        "########################################");
+            }
+        }
+    }
+
+    // Interval stats of an opcode, the invalid ones all go to index 32
+    const ProfStat &stat(int opcode, prof_phase p) const { return stats[opcode][p]; }
+
+private:
+    enum cmd_state { CMD_IDLE, CMD_PARAMS, CMD_WAIT };
+
+    struct Cmd {
+        cmd_state state = CMD_IDLE;
+        int opcode = 0;  // stats index
+        const ProfOpcode *op = NULL;
+        int params = 0, results = 0;
+        uint64_t first = 0, cmd_end = 0, exec = 0, data = 0, irq = 0, last_result = 0;
+    };
+
+    static constexpr ProfOpcode invalid_op = {"INVALID", 1, 1};
+
+    Cmd cur;
+    Cmd seeks[8];  // SEEK and RECALIBRATE waiting for their interrupt
+    int seeks_pending = 0;
+    int last_status = 0;
+    FILE *csv = NULL;
+    ProfStat stats[33][PROF_PHASES];
+
+    void start(uint64_t tick, int byte) {
+        if (cur.state != CMD_IDLE) aborted++;
+        cur = Cmd();
+        cur.state = CMD_PARAMS;
+        cur.first = tick;
+        int op = byte & 0x1f;
+        if (prof_opcodes[op].cmd_bytes) {
+            cur.opcode = op;
+            cur.op = &prof_opcodes[op];
+        } else {
+            cur.opcode = 32;
+            cur.op = &invalid_op;
+        }
+    }
+
+    // The interrupt of a SEEK or RECALIBRATE may come after other commands
+    void park_seek() {
+        if (seeks_pending == 8) {
+            for (int i = 1; i < 8; i++) seeks[i - 1] = seeks[i];
+            seeks_pending--;
+            aborted++;
+        }
+        seeks[seeks_pending++] = cur;
+        cur = Cmd();
+    }
+
+    void finish(uint64_t tick) {
+        record(cur, tick);
+        cur = Cmd();
+    }
+
+    // Ticks to cycles, two ticks per clk_sys cycle
+    void add(const Cmd &c, prof_phase p, uint64_t from, uint64_t to) {
+        if (from && to >= from) stats[c.opcode][p].add((to - from) / 2);
+    }
+
+    void record(const Cmd &c, uint64_t done) {
+        commands++;
+        add(c, PROF_COMMAND, c.first, c.cmd_end);
+        add(c, PROF_TO_EXEC, c.cmd_end, c.exec);
+        if (c.exec) add(c, PROF_TO_DATA, c.exec, c.data);
+        if (c.exec) add(c, PROF_EXEC, c.exec, c.irq);
+        else add(c, PROF_TO_INT, c.cmd_end, c.irq);
+        if (c.op->result_bytes) add(c, PROF_RESULT, c.irq ? c.irq : c.cmd_end, done);
+        add(c, PROF_TOTAL, c.first, done);
+        if (csv)
+            fprintf(csv, "0x%02x,%s,%llu,%llu,%llu,%llu,%llu,%llu\n", c.opcode,
+                    c.op->name, (unsigned long long)c.first, (unsigned long long)c.cmd_end,
+                    (unsigned long long)c.exec, (unsigned long long)c.data,
+                    (unsigned long long)c.irq, (unsigned long long)done);
+    }
+};
+
+class StateProfiler {
+public:
+    bool enabled = false;
+    int top = 30;
+    uint64_t cycles = 0;  // cycles sampled
+
+    void configure() {
+        enabled = plusarg_flag("state_profile");
+        top = plusarg_int("state_top", top);
+    }
+
+    // Once per clk_sys cycle, on the rising edge
+    inline void sample(Vu765_test *tb, uint64_t tick) {
+        if (!enabled) return;
+        int s = state_index(tb->fsm_state);
+        int cmd = state_index(tb->old_state);
+        cycles++;
+        per_command[cmd][s]++;
+        if (s == state && dwell) {
+            dwell++;
+            return;
+        }
+        if (dwell) {
+            end_visit(tick);
+            transitions[state][s]++;
+        }
+        state = s;
+        dwell = 1;
+    }
+
+    // Take the current state as the start of a visit, without a transition. After a restore
+    void resync(Vu765_test *tb) {
+        state = state_index(tb->fsm_state);
+        dwell = 0;
+    }
+
+    void report(FILE *f, double khz) {
+        if (dwell) end_visit(0);  // the visit in progress counts as it is
+        dwell = 0;
+        if (!cycles) return;
+
+        fprintf(f, "\n=== FSM state residency (%llu cycles) ===\n", (unsigned long long)cycles);
+        fprintf(f, "%-34s %12s %6s %9s %10s %12s %12s\n", "state", "cycles", "%", "visits",
+                "mean", "longest", "ended at");
+        std::vector<int> order;
+        for (int i = 0; i <= U765_STATE_COUNT; i++)
+            if (residency[i].cycles) order.push_back(i);
+        std::sort(order.begin(), order.end(),
+                  [this](int a, int b) { return residency[a].cycles > residency[b].cycles; });
+        for (int i : order) {
+            const Residency &r = residency[i];
+            fprintf(f, "%-34s %12llu %6.2f %9llu %10.1f %12llu %12llu\n", name(i),
+                    (unsigned long long)r.cycles, 100.0 * r.cycles / cycles,
+                    (unsigned long long)r.visits, (double)r.cycles / r.visits,
+                    (unsigned long long)r.longest, (unsigned long long)r.longest_tick);
+        }
+        fprintf(f, "longest visit in us: ");
+        for (size_t i = 0; i < order.size() && i < 5; i++)
+            fprintf(f, "%s%s %.1f", i ? ", " : "", name(order[i]) + 8,
+                    residency[order[i]].longest * 1000.0 / khz);
+        fprintf(f, "\n");
+
+        struct Pair {
+            int a, b;
+            uint64_t n;
+        };
+        std::vector<Pair> pairs;
+        for (int a = 0; a <= U765_STATE_COUNT; a++)
+            for (int b = 0; b <= U765_STATE_COUNT; b++)
+                if (transitions[a][b]) pairs.push_back({a, b, transitions[a][b]});
+        std::sort(pairs.begin(), pairs.end(), [](const Pair &x, const Pair &y) { return x.n > y.n; });
+        fprintf(f, "\nTransitions (%zu distinct, top %d)\n", pairs.size(), top);
+        for (size_t i = 0; i < pairs.size() && (int)i < top; i++)
+            fprintf(f, "  %-34s -> %-34s %10llu\n", name(pairs[i].a), name(pairs[i].b),
+                    (unsigned long long)pairs[i].n);
+
+        pairs.clear();
+        for (int a = 0; a <= U765_STATE_COUNT; a++)
+            for (int b = 0; b <= U765_STATE_COUNT; b++)
+                if (per_command[a][b]) pairs.push_back({a, b, per_command[a][b]});
+        std::sort(pairs.begin(), pairs.end(), [](const Pair &x, const Pair &y) { return x.n > y.n; });
+        fprintf(f, "\nCycles per command (old_state) and state, top %d\n", top);
+        for (size_t i = 0; i < pairs.size() && (int)i < top; i++)
+            fprintf(f, "  %-34s %-34s %12llu %6.2f%%\n", name(pairs[i].a), name(pairs[i].b),
+                    (unsigned long long)pairs[i].n, 100.0 * pairs[i].n / cycles);
+    }
+
+private:
+    struct Residency {
+        uint64_t cycles = 0, visits = 0, longest = 0, longest_tick = 0;
+    };
+
+    // Index U765_STATE_COUNT collects any value outside the enum
+    Residency residency[U765_STATE_COUNT + 1];
+    uint64_t transitions[U765_STATE_COUNT + 1][U765_STATE_COUNT + 1] = {};
+    uint64_t per_command[U765_STATE_COUNT + 1][U765_STATE_COUNT + 1] = {};
+    int state = 0;
+    uint64_t dwell = 0;  // cycles of the current visit
+
+    static int state_index(int s) { return s < U765_STATE_COUNT ? s : U765_STATE_COUNT; }
+    static const char *name(int s) { return s < U765_STATE_COUNT ? u765_state_names[s] : "?"; }
+
+    void end_visit(uint64_t tick) {
+        Residency &r = residency[state];
+        r.cycles += dwell;
+        r.visits++;
+        if (dwell > r.longest) {
+            r.longest = dwell;
+            r.longest_tick = tick;
+        }
+    }
+};
+
+#endif
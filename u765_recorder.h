@@ -0,0 +1,200 @@
+// Flight recorder and hang watchdog for the u765 testbenches.
+//
+// Bus transactions, interrupts, SD requests and state changes are kept as fixed size
+// binary records in a ring buffer. Nothing is formatted while the simulation runs; the
+// ring is only decoded on demand or when the watchdog sees a stall.
+//
+// Plusargs:
+//   +rec_size=N      ring capacity in records, rounded up to a power of two (default 65536)
+//   +rec_dump=N      records decoded on a dump (default 256, 0 = all)
+//   +rec_file=f      also save the raw ring to f on a dump
+//   +rec_exit        decode the recorder at the end of the run
+//   +wd_ticks=N      ticks without FSM or data progress that count as a stall (default 2000000)
+//   +wd_abort=0      keep running after a stall dump (default: exit), U765Sim polls give up
+#ifndef U765_RECORDER_H
+#define U765_RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "Vu765_test.h"
+#include "u765_plusargs.h"
+#include "u765_states.h"
+
+enum rec_type {
+    REC_STATUS_RD,  // a: main status register
+    REC_DATA_RD,    // a: data byte read by the host
+    REC_DATA_WR,    // a: data byte written by the host
+    REC_INT,        // a: new int_out level
+    REC_SD_RD,      // a: sd_rd mask, arg: lba
+    REC_SD_WR,      // a: sd_wr mask, arg: lba
+    REC_STATE,      // a: new fsm_state, b: previous one
+    REC_CMD,        // a: new old_state (command), b: previous one
+    REC_MARK,       // a, b, arg: free use by the test
+};
+
+struct RecEntry {
+    uint64_t tick;
+    uint32_t arg;
+    uint8_t type, a, b, pad;
+};
+
+class FlightRecorder {
+public:
+    uint64_t count = 0;       // records ever logged
+    uint64_t last_progress = 0;  // tick of the last data byte or FSM state change
+    int dump_records = 256;
+    std::string file;
+
+    void configure() {
+        size_t n = 1;
+        size_t want = plusarg_int("rec_size", 65536);
+        while (n < want) n <<= 1;
+        ring.assign(n, RecEntry());
+        mask = n - 1;
+        dump_records = plusarg_int("rec_dump", dump_records);
+        file = plusarg_str("rec_file", "");
+    }
+
+    inline void log(rec_type type, uint64_t tick, uint8_t a, uint8_t b = 0, uint32_t arg = 0) {
+        if (ring.empty()) return;
+        RecEntry &e = ring[count++ & mask];
+        e.tick = tick;
+        e.arg = arg;
+        e.type = type;
+        e.a = a;
+        e.b = b;
+        if (type == REC_DATA_RD || type == REC_DATA_WR || type == REC_STATE) last_progress = tick;
+    }
+
+    // Edge detection on the core outputs. Called on the rising edge, after eval()
+    inline void sample(Vu765_test *tb, uint64_t tick) {
+        if (tb->int_out != int_out) log(REC_INT, tick, tb->int_out);
+        if (tb->sd_rd != sd_rd && tb->sd_rd) log(REC_SD_RD, tick, tb->sd_rd, 0, tb->sd_lba);
+        if (tb->sd_wr != sd_wr && tb->sd_wr) log(REC_SD_WR, tick, tb->sd_wr, 0, tb->sd_lba);
+        if (tb->fsm_state != fsm_state) log(REC_STATE, tick, tb->fsm_state, fsm_state);
+        if (tb->old_state != old_state) log(REC_CMD, tick, tb->old_state, old_state);
+        int_out = tb->int_out;
+        sd_rd = tb->sd_rd;
+        sd_wr = tb->sd_wr;
+        fsm_state = tb->fsm_state;
+        old_state = tb->old_state;
+    }
+
+    // Take the current outputs as the reference for the edge detection, without logging,
+    // and count tick as progress. Used after a checkpoint restore
+    void resync(Vu765_test *tb, uint64_t tick) {
+        int_out = tb->int_out;
+        sd_rd = tb->sd_rd;
+        sd_wr = tb->sd_wr;
+        fsm_state = tb->fsm_state;
+        old_state = tb->old_state;
+        last_progress = tick;
+    }
+
+    static void decode(FILE *f, const RecEntry &e) {
+        fprintf(f, "%12llu ", (unsigned long long)e.tick);
+        switch (e.type) {
+        case REC_STATUS_RD:
+            fprintf(f, "STATUS  0x%02x [%s%s%s%s%s%s]\n", e.a, e.a & 0x80 ? " RQM" : "",
+                    e.a & 0x40 ? " DIO" : "", e.a & 0x20 ? " EXM" : "", e.a & 0x10 ? " CB" : "",
+                    e.a & 0x02 ? " D1B" : "", e.a & 0x01 ? " D0B" : "");
+            break;
+        case REC_DATA_RD: fprintf(f, "RD      0x%02x\n", e.a); break;
+        case REC_DATA_WR: fprintf(f, "WR      0x%02x\n", e.a); break;
+        case REC_INT: fprintf(f, "INT     %s\n", e.a ? "rise" : "fall"); break;
+        case REC_SD_RD: fprintf(f, "SD_RD   drive mask %d lba %u\n", e.a, e.arg); break;
+        case REC_SD_WR: fprintf(f, "SD_WR   drive mask %d lba %u\n", e.a, e.arg); break;
+        case REC_STATE:
+            fprintf(f, "STATE   %s <- %s\n", u765_state_name(e.a), u765_state_name(e.b));
+            break;
+        case REC_CMD:
+            fprintf(f, "CMD     %s <- %s\n", u765_state_name(e.a), u765_state_name(e.b));
+            break;
+        default: fprintf(f, "MARK    %d %d %u\n", e.a, e.b, e.arg); break;
+        }
+    }
+
+    // Decode the last n records (0 = the whole ring)
+    void dump(FILE *f, size_t n) const {
+        size_t held = count < ring.size() ? count : ring.size();
+        if (!n || n > held) n = held;
+        fprintf(f, "--- flight recorder: last %zu of %llu records ---\n", n,
+                (unsigned long long)count);
+        for (uint64_t i = count - n; i < count; i++) decode(f, ring[i & mask]);
+        fprintf(f, "--- end of flight recorder ---\n");
+    }
+
+    // Raw ring, oldest record first
+    bool save(const char *path) const {
+        FILE *f = fopen(path, "wb");
+        if (!f) return false;
+        size_t held = count < ring.size() ? count : ring.size();
+        for (uint64_t i = count - held; i < count; i++) fwrite(&ring[i & mask], sizeof(RecEntry), 1, f);
+        return !fclose(f);
+    }
+
+    void dump(FILE *f = stdout) const {
+        dump(f, dump_records);
+        if (!file.empty() && save(file.c_str())) printf("Flight recorder saved to %s\n", file.c_str());
+    }
+
+private:
+    std::vector<RecEntry> ring;
+    size_t mask = 0;
+    uint8_t int_out = 0, sd_rd = 0, sd_wr = 0, fsm_state = 0, old_state = 0;
+};
+
+// Detects the EMERGENCY RESET path of COMMAND_READ_RESULTS and stalls (no FSM state change
+// and no data byte for wd_ticks), and dumps the flight recorder when it happens.
+class Watchdog {
+public:
+    uint64_t limit = 2000000;
+    bool abort_on_stall = true;
+    bool stalled = false;  // a stall was seen, bus polls give up
+    FILE *out = stdout;    // where trips are reported, NULL to only count them
+    int trips = 0;
+
+    void configure() {
+        limit = plusarg_int("wd_ticks", limit);
+        abort_on_stall = plusarg_int("wd_abort", 1) != 0;
+    }
+
+    // Called on the rising edge, after FlightRecorder::sample()
+    inline void check(Vu765_test *tb, const FlightRecorder &rec, uint64_t tick) {
+        if (tb->fsm_state == U765_COMMAND_RESET && !in_reset) {
+            trip(rec, tick, "EMERGENCY RESET (result_read_timeout)", false);
+        }
+        in_reset = tb->fsm_state == U765_COMMAND_RESET;
+
+        if (tick - rec.last_progress > limit && rec.last_progress != stalled_at) {
+            stalled_at = rec.last_progress;
+            stalled = true;
+            char why[96];
+            snprintf(why, sizeof(why), "stall, %s for %llu ticks", u765_state_name(tb->fsm_state),
+                     (unsigned long long)(tick - rec.last_progress));
+            trip(rec, tick, why, abort_on_stall);
+        }
+    }
+
+private:
+    bool in_reset = false;
+    uint64_t stalled_at = ~0ull;
+
+    void trip(const FlightRecorder &rec, uint64_t tick, const char *why, bool fatal) {
+        trips++;
+        if (out) {
+            fprintf(out, "\n*** WATCHDOG at tick %llu: %s ***\n", (unsigned long long)tick, why);
+            rec.dump(out);
+        }
+        if (fatal) {
+            if (out) fprintf(out, "*** WATCHDOG: aborting the run ***\n");
+            fflush(NULL);
+            exit(3);
+        }
+    }
+};
+
+#endif
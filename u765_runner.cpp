@@ -0,0 +1,224 @@
+// Parallel scenario runner for the u765 core.
+//
+// Runs the matrix images x scenarios x fast modes on a pool of worker threads, each job on
+// its own U765Sim (model, context, SD server, recorder), and merges the per-job results
+// into one report. Images are mapped once and shared by every job that uses them.
+//
+//   u765_runner <image.dsk> [image.dsk ...] +scenarios=boot,write +fast=0,15 +jobs=8
+//
+// Plusargs:
+//   +scenarios=a,b,...  scenarios to run (default all, see u765_scenarios.h)
+//   +fast=0,15          fast port masks to run every scenario with (default 0)
+//   +jobs=N             worker threads (default: number of cores)
+//   +report=file.json   also write the merged report as JSON
+//   +sweep_tracks       a line per track of the sweep scenario (default: flagged ones only)
+// The trace, recorder, watchdog and SD timing plusargs apply to every job; traces go to
+// <scenario>.<job>.fst, +bus_rec captures to <file>.<job> and a watchdog stall fails the job
+// instead of the run. +script=f with the script scenario replays a script or capture.
+// The sweep scenario also gets sectors per second of simulated and of wall time and the
+// per-track latency, so +scenarios=sweep over a corpus is the throughput benchmark.
+// With +lockstep a divergence from the behavioral model fails the job (u765_lockstep.h).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Vu765_test.h"
+#include "verilated.h"
+#include "u765_plusargs.h"
+#include "u765_sim.h"
+#include "u765_scenarios.h"
+
+double sc_time_stamp() {
+    return 0;
+}
+
+struct Job {
+    const Scenario *scenario;
+    const char *image;
+    int fast;
+};
+
+static void run_job(const Job &job, int index, ScenarioResult &r) {
+    auto start = std::chrono::steady_clock::now();
+    std::string trace_file = std::string(job.scenario->name) + "." + std::to_string(index) + ".fst";
+
+    U765Sim sim(trace_file.c_str());
+    sim.verbose = false;
+    sim.images.verbose = false;
+    sim.watchdog.abort_on_stall = false;
+    sim.watchdog.out = NULL;
+    sim.lockstep.out = NULL;
+    sim.lockstep.fatal = false;
+    if (sim.capture.enabled()) sim.capture.path += "." + std::to_string(index);
+    run_scenario(sim, *job.scenario, job.image, job.fast, r);
+
+    r.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// s as the inside of a JSON string
+static std::string json_escape(const std::string &s) {
+    std::string out;
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+static void write_json(const char *path, const std::vector<ScenarioResult> &results, int jobs,
+                       double wall) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Can't create %s\n", path);
+        return;
+    }
+    fprintf(f, "{\n  \"jobs\": %d,\n  \"wall\": %.3f,\n  \"results\": [\n", jobs, wall);
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScenarioResult &r = results[i];
+        fprintf(f, "    {\"scenario\": \"%s\", \"image\": \"%s\", \"fast\": %d, \"ok\": %s, "
+                   "\"error\": \"%s\", \"ticks\": %llu, \"wall\": %.3f, \"bytes\": %llu, "
+                   "\"sum\": %ld, \"st0\": %d, \"st1\": %d, \"st2\": %d, \"sd_reads\": %llu, "
+                   "\"sd_writes\": %llu, \"sd_saved\": %llu, \"sd_wait_avg\": %.1f, "
+                   "\"sd_wait_max\": %llu, \"wd_trips\": %d, \"sectors\": %llu, \"tracks\": [",
+                json_escape(r.scenario).c_str(), json_escape(r.image).c_str(), r.fast,
+                r.ok ? "true" : "false", json_escape(r.error).c_str(), (unsigned long long)r.ticks, r.wall,
+                (unsigned long long)r.bytes, r.sum, r.st[0], r.st[1], r.st[2],
+                (unsigned long long)r.sd_reads, (unsigned long long)r.sd_writes,
+                (unsigned long long)r.sd_saved, r.sd_wait_avg,
+                (unsigned long long)r.sd_wait_max, r.wd_trips, (unsigned long long)r.sectors);
+        for (size_t k = 0; k < r.tracks.size(); k++) {
+            const SweepTrack &t = r.tracks[k];
+            fprintf(f, "%s{\"cyl\": %d, \"head\": %d, \"sectors\": %d, \"cycles\": %llu, \"flag\": \"%s\"}",
+                    k ? ", " : "", t.cyl, t.head, t.sectors, (unsigned long long)t.cycles,
+                    json_escape(t.flag).c_str());
+        }
+        fprintf(f, "]}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    printf("Report saved to %s\n", path);
+}
+
+// Sweep jobs: sectors per second of simulated and of wall time (prologue included) and the
+// track latency. Flagged tracks always get their own line, every track with all_tracks
+static void print_sweep(const std::vector<ScenarioResult> &results, double wall, bool all_tracks) {
+    uint64_t sectors = 0;
+    double simulated = 0;
+    bool header = false;
+    for (const ScenarioResult &r : results) {
+        if (r.tracks.empty()) continue;
+        if (!header) {
+            printf("\n%-24s %4s %7s %9s %10s %8s %10s %9s %9s %7s\n", "sweep", "fast", "sectors",
+                   "sim(s)", "sim sec/s", "wall(s)", "wall sec/s", "trk avg", "trk max", "flagged");
+            header = true;
+        }
+        const char *image = strrchr(r.image.c_str(), '/');
+        image = image ? image + 1 : r.image.c_str();
+        double ms = r.khz;  // cycles per ms
+        double sim_s = r.ticks / 2 / (ms * 1000);
+        uint64_t total = 0, max = 0;
+        int flagged = 0;
+        for (const SweepTrack &t : r.tracks) {
+            total += t.cycles;
+            max = std::max(max, t.cycles);
+            if (!t.flag.empty()) flagged++;
+        }
+        printf("%-24.24s %4d %7llu %9.2f %10.1f %8.2f %10.1f %7.1fms %7.1fms %7d\n", image, r.fast,
+               (unsigned long long)r.sectors, sim_s, sim_s > 0 ? r.sectors / sim_s : 0.0, r.wall,
+               r.wall > 0 ? r.sectors / r.wall : 0.0, total / ms / r.tracks.size(), max / ms,
+               flagged);
+        for (const SweepTrack &t : r.tracks)
+            if (all_tracks || !t.flag.empty())
+                printf("    track %2d/%d: %3d sectors %8.1f ms  %s\n", t.cyl, t.head, t.sectors,
+                       t.cycles / ms, t.flag.c_str());
+        sectors += r.sectors;
+        simulated += sim_s;
+    }
+    if (header)
+        printf("%llu sectors, %.2f s simulated (%.1f sectors/s), %.2f s wall (%.1f sectors/s)\n",
+               (unsigned long long)sectors, simulated, simulated > 0 ? sectors / simulated : 0.0,
+               wall, wall > 0 ? sectors / wall : 0.0);
+}
+
+int main(int argc, char **argv) {
+    Verilated::commandArgs(argc, argv);
+    std::vector<char *> args = plusargs_init(argc, argv);
+
+    if (args.size() < 2) {
+        printf("Usage: %s <image.dsk> [image.dsk ...]\n", args[0]);
+        printf("  +scenarios=a,b,...  default all:");
+        for (auto &s : u765_scenarios) printf(" %s", s.name);
+        printf("\n  +fast=0,15  fast port masks (default 0)\n");
+        printf("  +jobs=N  worker threads (default: cores)\n");
+        printf("  +report=file.json  merged report as JSON\n");
+        printf("  +sweep_tracks  a line per track of the sweep scenario\n");
+        return -1;
+    }
+
+    // Build the matrix
+    std::vector<const Scenario *> scenarios;
+    if (!parse_scenario_list(plusarg_str("scenarios", "all"), scenarios)) return -1;
+    std::vector<int> fast_modes = parse_int_list(plusarg_str("fast", "0"));
+    if (fast_modes.empty()) fast_modes.push_back(0);
+
+    std::vector<Job> jobs;
+    for (size_t i = 1; i < args.size(); i++)
+        for (const Scenario *s : scenarios)
+            for (int fast : fast_modes) jobs.push_back({s, args[i], fast & U765_FAST_ALL});
+
+    int workers = plusarg_int("jobs", std::thread::hardware_concurrency());
+    if (workers < 1) workers = 1;
+    if (workers > (int)jobs.size()) workers = jobs.size();
+    printf("Running %zu jobs on %d threads\n", jobs.size(), workers);
+
+    // Thread pool: every worker takes the next job until there are none left
+    std::vector<ScenarioResult> results(jobs.size());
+    std::atomic<size_t> next(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < jobs.size()) run_job(jobs[i], i, results[i]);
+        });
+    }
+    for (auto &t : pool) t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Merged report, in matrix order
+    int failed = 0;
+    double cpu = 0;
+    printf("\n%-11s %-24s %4s %-4s %12s %8s %8s %4s %4s %4s  %s\n", "scenario", "image", "fast",
+           "ok", "ticks", "wall(s)", "bytes", "ST0", "ST1", "ST2", "error");
+    for (const ScenarioResult &r : results) {
+        const char *image = strrchr(r.image.c_str(), '/');
+        image = image ? image + 1 : r.image.c_str();
+        printf("%-11s %-24.24s %4d %-4s %12llu %8.2f %8llu  %02x  %02x  %02x  %s\n",
+               r.scenario.c_str(), image, r.fast, r.ok ? "ok" : "FAIL",
+               (unsigned long long)r.ticks, r.wall, (unsigned long long)r.bytes, r.st[0], r.st[1],
+               r.st[2], r.error.c_str());
+        if (!r.ok) failed++;
+        cpu += r.wall;
+    }
+    printf("\n%zu jobs, %d failed, %.2f s wall, %.2f s of simulation (x%.1f)\n", results.size(),
+           failed, wall, cpu, wall > 0 ? cpu / wall : 0.0);
+    print_sweep(results, wall, plusarg_flag("sweep_tracks"));
+
+    std::string report = plusarg_str("report", "");
+    if (!report.empty()) write_json(report.c_str(), results, workers, wall);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,647 @@
+// Quiet, self-checking scenarios on top of U765Sim, shared by the runner and the benchmark.
+//
+// Each scenario starts from fdc_prologue() (reset, mount on drive A:, drive signals set as
+// in u765_tb) and fills a ScenarioResult instead of printing. The command sequences are
+// the ones of the testbenches: pcw_boot_sequence() reads, the write test on cylinder 1,
+// SCAN EQUAL against the data just read. The _dma ones switch to DMA with SPECIFY ND=0 and
+// move the data with the drq/dack agent of U765Sim. sweep reads every sector of any image
+// and checks it against the file, the throughput benchmark over an image corpus.
+#ifndef U765_SCENARIOS_H
+#define U765_SCENARIOS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "u765_sim.h"
+#include "u765_model.h"
+#include "u765_script.h"
+
+// One track of the sweep scenario
+struct SweepTrack {
+    int cyl = 0, head = 0;
+    int sectors = 0;      // sectors read
+    uint64_t cycles = 0;  // from READ ID to the last result byte of the track
+    std::string flag;     // why the track is flagged, empty if it read fine
+};
+
+struct ScenarioResult {
+    std::string scenario;
+    std::string image;
+    int fast = 0;
+    bool ok = false;
+    std::string error;       // first check that failed
+    uint64_t ticks = 0;
+    double wall = 0;         // seconds
+    uint64_t bytes = 0;      // data bytes moved in execution phases
+    long sum = 0;            // sum of the bytes read
+    uint8_t st[7] = {0};     // result phase of the last command
+    uint64_t sd_reads = 0;
+    uint64_t sd_writes = 0;
+    uint64_t sd_saved = 0;   // SD writes merged by the core's write-back buffer
+    double sd_wait_avg = 0;  // cycles from an SD request to its first byte (storage model)
+    uint64_t sd_wait_max = 0;
+    int wd_trips = 0;
+    int khz = 0;             // cycles per ms of the core, for the simulated time
+    uint64_t sectors = 0;    // sectors read (sweep)
+    std::vector<SweepTrack> tracks;  // sweep only
+};
+
+static inline bool scenario_fail(ScenarioResult &r, const char *why) {
+    if (r.error.empty()) r.error = why;
+    r.ok = false;
+    return false;
+}
+
+// Reset the core with the given fast knobs and mount image on drive A:
+static inline bool fdc_prologue(U765Sim &sim, const char *image, int fast, ScenarioResult &r) {
+    sim.tb->ce = 1;
+    sim.tb->nWR = 1;
+    sim.tb->nRD = 1;
+    sim.tb->fast = fast;
+    if (!sim.reset(2)) return scenario_fail(r, "not ready after reset");
+    if (!sim.mount(image, 0)) return scenario_fail(r, "can't open image");
+    sim.tb->motor = 1;
+    sim.tb->ready = 1;
+    sim.tb->available = 1;
+    sim.tb->density = 1;
+    return true;
+}
+
+// Wait for the interrupt at the end of a seek or recalibrate
+static inline void fdc_wait_int(U765Sim &sim) {
+    sim.wait_int();
+}
+
+// SENSE INTERRUPT STATUS, only if an interrupt is pending
+static inline bool fdc_sense(U765Sim &sim, ScenarioResult &r) {
+    if (!sim.int_out_active) return true;
+    return sim.command({0x08}) && sim.results(r.st, 2);
+}
+
+static inline bool fdc_recalibrate(U765Sim &sim, ScenarioResult &r) {
+    if (!sim.command({0x07, 0x00})) return scenario_fail(r, "RECALIBRATE stalled");
+    fdc_wait_int(sim);
+    if (!fdc_sense(sim, r)) return scenario_fail(r, "SENSE INTERRUPT stalled");
+    return true;
+}
+
+static inline bool fdc_seek(U765Sim &sim, int ncn, ScenarioResult &r) {
+    if (!sim.command({0x0f, 0x00, ncn})) return scenario_fail(r, "SEEK stalled");
+    fdc_wait_int(sim);
+    if (!fdc_sense(sim, r)) return scenario_fail(r, "SENSE INTERRUPT stalled");
+    return true;
+}
+
+// SPECIFY with the PCW step rate and head times; nd selects non-DMA (1) or DMA (0)
+static inline bool fdc_specify(U765Sim &sim, bool nd, ScenarioResult &r) {
+    if (!sim.command({0x03, 0xdf, 0x02 | (nd ? 1 : 0)})) return scenario_fail(r, "SPECIFY stalled");
+    // the core raises int_out after SPECIFY, clear it
+    sim.wait_int(16);
+    if (!fdc_sense(sim, r)) return scenario_fail(r, "SENSE INTERRUPT stalled");
+    return true;
+}
+
+// READ DATA in DMA mode. With count, tc ends the transfer on the count-th byte
+static inline int fdc_read_dma(U765Sim &sim, int c, int h, int rec, int n, int eot, int gpl,
+                               int dtl, uint8_t *buf, int max, ScenarioResult &r, int count = 0) {
+    long sum;
+    if (!sim.command({0x06, h << 2, c, h, rec, n, eot, gpl, dtl})) return -1;
+    int got = sim.dma_read(buf, max, &sum, count);
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += got;
+    r.sum += sum;
+    return got;
+}
+
+// WRITE DATA in DMA mode, tc on the last byte
+static inline int fdc_write_dma(U765Sim &sim, int c, int h, int rec, int n, int eot, int gpl,
+                                int dtl, const uint8_t *buf, ScenarioResult &r) {
+    if (!sim.command({0x05, h << 2, c, h, rec, n, eot, gpl, dtl})) return -1;
+    int got = sim.dma_write(buf, (eot - rec + 1) * (128 << n));
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += got;
+    return got;
+}
+
+// READ DATA of sectors r..eot. Returns the bytes read, -1 if the FDC stalled
+static inline int fdc_read(U765Sim &sim, int c, int h, int rec, int n, int eot, int gpl, int dtl,
+                           uint8_t *buf, int max, ScenarioResult &r) {
+    long sum;
+    if (!sim.command({0x06, h << 2, c, h, rec, n, eot, gpl, dtl})) return -1;
+    int count = sim.read_exec(buf, max, &sum);
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += count;
+    r.sum += sum;
+    return count;
+}
+
+// WRITE DATA of sectors r..eot, all 128 << n bytes. Returns the bytes taken, -1 on a stall
+static inline int fdc_write(U765Sim &sim, int c, int h, int rec, int n, int eot, int gpl, int dtl,
+                            const uint8_t *buf, ScenarioResult &r) {
+    if (!sim.command({0x05, h << 2, c, h, rec, n, eot, gpl, dtl})) return -1;
+    int count = sim.write_exec(buf, (eot - rec + 1) * (128 << n));
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += count;
+    return count;
+}
+
+// SCAN EQUAL/LOW OR EQUAL/HIGH OR EQUAL (opcode 0x11/0x19/0x1d) of one sector against data
+static inline int fdc_scan(U765Sim &sim, int op, int c, int h, int rec, int n, int eot, int gpl,
+                           int stp, const uint8_t *data, ScenarioResult &r) {
+    if (!sim.command({op, h << 2, c, h, rec, n, eot, gpl, stp})) return -1;
+    int count = sim.write_exec(data, 128 << n);
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += count;
+    return count;
+}
+
+// Only the prologue: reset, mount and header scan
+static inline bool scenario_mount(U765Sim &sim, ScenarioResult &r) {
+    return true;
+}
+
+// Disk swap on both drives back to back: the second header scan queues behind the first
+static inline bool scenario_mount_ab(U765Sim &sim, ScenarioResult &r) {
+    if (!sim.insert(r.image.c_str(), 0) || !sim.insert(r.image.c_str(), 1))
+        return scenario_fail(r, "can't open image");
+    sim.wait(2);
+    if (sim.wait_status(0x80, 0x80) < 0) return scenario_fail(r, "header scan timed out");
+    return true;
+}
+
+static inline bool scenario_recal(U765Sim &sim, ScenarioResult &r) {
+    if (!fdc_recalibrate(sim, r)) return false;
+    if ((r.st[0] & 0xf8) != 0x20 || r.st[1] != 0) return scenario_fail(r, "recalibrate didn't reach track 0");
+    return true;
+}
+
+// The reads of pcw_boot_sequence(): boot sector, CCP, BDOS, BIOS and configuration
+static inline bool scenario_boot(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[32768];
+    static const int reads[][4] = {
+        // c, r, eot, ncn to seek first (-1 = stay)
+        {0, 0x01, 0xff, -1}, {1, 0x01, 0x09, 1}, {1, 0x0a, 0x12, -1}, {1, 0x13, 0x1a, -1},
+        {2, 0x01, 0x05, 2},
+    };
+
+    if (!fdc_recalibrate(sim, r)) return false;
+    for (auto &rd : reads) {
+        if (rd[3] >= 0 && !fdc_seek(sim, rd[3], r)) return false;
+        if (fdc_read(sim, rd[0], 0, rd[1], 2, rd[2], 0x2a, 0xff, buf, sizeof(buf), r) < 0)
+            return scenario_fail(r, "READ DATA stalled");
+    }
+    if (!r.bytes) return scenario_fail(r, "no data read");
+    return true;
+}
+
+// The 9 sectors of track 0 in one READ DATA
+static inline bool scenario_read_track(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[9 * 512];
+    if (!fdc_recalibrate(sim, r)) return false;
+    int n = fdc_read(sim, 0, 0, 1, 2, 9, 0x2a, 0xff, buf, sizeof(buf), r);
+    if (n < 0) return scenario_fail(r, "READ DATA stalled");
+    if (n != (int)sizeof(buf)) return scenario_fail(r, "short track read");
+    return true;
+}
+
+// WRITE DATA of cylinder 1 (ncn 2 with density=1), then read back sector 1
+static inline bool scenario_write(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t pattern[9 * 512];
+    static thread_local uint8_t buf[512];
+    long expected = 0;
+    for (int i = 0; i < (int)sizeof(pattern); i++) pattern[i] = (i * 7 + i / 512) & 0xff;
+    for (int i = 0; i < 512; i++) expected += pattern[i];
+
+    if (!fdc_recalibrate(sim, r) || !fdc_seek(sim, 2, r)) return false;
+    int n = fdc_write(sim, 1, 0, 1, 2, 9, 0x2a, 0xff, pattern, r);
+    if (n < 0) return scenario_fail(r, "WRITE DATA stalled");
+    if (n != (int)sizeof(pattern)) return scenario_fail(r, "short track write");
+    r.sum = 0;
+    if (fdc_read(sim, 1, 0, 1, 2, 1, 0x2a, 0xff, buf, sizeof(buf), r) != 512)
+        return scenario_fail(r, "read back failed");
+    if (r.sum != expected || memcmp(buf, pattern, 512)) return scenario_fail(r, "read back mismatch");
+    return true;
+}
+
+// SCAN EQUAL of sector 1 of cylinder 1 against its own data: must hit
+static inline bool scenario_scan_equal(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[512];
+    if (!fdc_recalibrate(sim, r) || !fdc_seek(sim, 2, r)) return false;
+    if (fdc_read(sim, 1, 0, 1, 2, 1, 0x2a, 0xff, buf, sizeof(buf), r) != 512)
+        return scenario_fail(r, "READ DATA failed");
+    if (fdc_scan(sim, 0x11, 1, 0, 1, 2, 1, 0x2a, 1, buf, r) < 0) return scenario_fail(r, "SCAN stalled");
+    if ((r.st[2] & 0x0c) != 0x08) return scenario_fail(r, "SCAN EQUAL didn't hit");
+    return true;
+}
+
+// SEEK on drive B overlapped with a SENSE DRIVE STATUS, a FORMAT TRACK and a READ DATA of
+// track 0 on drive A. B stays busy (D1B) while it steps and its seek interrupt waits for
+// the read to finish; with fast seeks it is already pending and must survive all three
+static inline bool scenario_overlap_seek(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[9 * 512];
+    if (!sim.mount(r.image.c_str(), 1)) return scenario_fail(r, "can't mount drive B");
+    sim.tb->motor = 3;
+    sim.tb->ready = 3;
+    sim.tb->available = 3;
+    sim.tb->density = 3;
+    if (!fdc_recalibrate(sim, r)) return false;
+    if (!sim.command({0x07, 0x01})) return scenario_fail(r, "RECALIBRATE stalled");
+    fdc_wait_int(sim);
+    if (!fdc_sense(sim, r)) return scenario_fail(r, "SENSE INTERRUPT stalled");
+
+    if (!sim.command({0x0f, 0x01, 20})) return scenario_fail(r, "SEEK stalled");
+    // with fast seeks B is already there, no busy bit to see
+    if (!(r.fast & U765_FAST_SEEK) && !(sim.readstatus() & 0x02)) return scenario_fail(r, "D1B not set during the seek");
+    // commands on A may not take the seek interrupt of B
+    if (!sim.command({0x04, 0x00}) || !sim.results(r.st, 1))
+        return scenario_fail(r, "SENSE DRIVE STATUS stalled");
+    if ((r.st[0] & 0x13) != 0x10) return scenario_fail(r, "wrong drive status of drive A");
+    static const uint8_t ids[9 * 4] = {0, 0, 1, 2, 0, 0, 2, 2, 0, 0, 3, 2, 0, 0, 4, 2, 0, 0, 5, 2,
+                                       0, 0, 6, 2, 0, 0, 7, 2, 0, 0, 8, 2, 0, 0, 9, 2};
+    if (!sim.command({0x4d, 0x00, 2, 9, 0x52, 0xe5}) ||
+        sim.write_exec(ids, sizeof(ids)) != (int)sizeof(ids) || !sim.results(r.st, 7))
+        return scenario_fail(r, "FORMAT TRACK stalled");
+    if (r.st[0] & 0xc0) return scenario_fail(r, "FORMAT TRACK failed");
+    int n = fdc_read(sim, 0, 0, 1, 2, 9, 0x2a, 0xff, buf, sizeof(buf), r);
+    if (n < 0) return scenario_fail(r, "READ DATA stalled");
+    if (n != (int)sizeof(buf)) return scenario_fail(r, "short track read");
+    if (r.st[0] & 0xc0) return scenario_fail(r, "abnormal termination");
+
+    if (!sim.wait_int()) return scenario_fail(r, "no seek interrupt from drive B");
+    if (!sim.command({0x08}) || !sim.results(r.st, 2)) return scenario_fail(r, "SENSE INTERRUPT stalled");
+    if (r.st[0] != 0x21 || r.st[1] != 20) return scenario_fail(r, "wrong seek end on drive B");
+    return true;
+}
+
+// The track read of read_track through DMA, then sector 1 again with tc after 512 bytes
+static inline bool scenario_read_track_dma(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[9 * 512];
+    static thread_local uint8_t sector[512];
+    if (!fdc_specify(sim, false, r) || !fdc_recalibrate(sim, r)) return false;
+    int n = fdc_read_dma(sim, 0, 0, 1, 2, 9, 0x2a, 0xff, buf, sizeof(buf), r);
+    if (n < 0) return scenario_fail(r, "READ DATA stalled");
+    if (n != (int)sizeof(buf)) return scenario_fail(r, "short track read");
+    if (r.st[0] & 0xc0) return scenario_fail(r, "abnormal termination");
+    n = fdc_read_dma(sim, 0, 0, 1, 2, 9, 0x2a, 0xff, sector, sizeof(sector), r, 512);
+    if (n != 512) return scenario_fail(r, "tc didn't end the read");
+    if (memcmp(sector, buf, 512)) return scenario_fail(r, "DMA reads differ");
+    return true;
+}
+
+// The write scenario through DMA
+static inline bool scenario_write_dma(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t pattern[9 * 512];
+    static thread_local uint8_t buf[512];
+    for (int i = 0; i < (int)sizeof(pattern); i++) pattern[i] = (i * 13 + i / 512) & 0xff;
+
+    if (!fdc_specify(sim, false, r) || !fdc_recalibrate(sim, r) || !fdc_seek(sim, 2, r)) return false;
+    int n = fdc_write_dma(sim, 1, 0, 1, 2, 9, 0x2a, 0xff, pattern, r);
+    if (n < 0) return scenario_fail(r, "WRITE DATA stalled");
+    if (n != (int)sizeof(pattern)) return scenario_fail(r, "short track write");
+    if (fdc_read_dma(sim, 1, 0, 1, 2, 1, 0x2a, 0xff, buf, sizeof(buf), r, 512) != 512)
+        return scenario_fail(r, "read back failed");
+    if (memcmp(buf, pattern, 512)) return scenario_fail(r, "read back mismatch");
+    return true;
+}
+
+// READ ID back to back on track 0: the IDs come in disk order, one sector pitch apart, and
+// the first ID comes round again after one revolution (CYCLES and RPM of the core)
+static inline bool scenario_rotation(U765Sim &sim, ScenarioResult &r) {
+    const uint64_t rev_ticks = 2ULL * sim.cycles * 60000 / sim.rpm;
+    if (!fdc_recalibrate(sim, r)) return false;
+    if (!sim.command({0x4a, 0x00}) || !sim.results(r.st, 7)) return scenario_fail(r, "READ ID stalled");
+    int first = r.st[5];
+    uint64_t start = sim.tickcount;
+    for (int i = 0; i < 64; i++) {
+        if (!sim.command({0x4a, 0x00}) || !sim.results(r.st, 7))
+            return scenario_fail(r, "READ ID stalled");
+        if (r.st[0] & 0xc0) return scenario_fail(r, "READ ID failed");
+        if (r.st[5] != first) continue;
+        if (r.fast & U765_FAST_ROTATION) return true;  // no rotational latency to measure
+        uint64_t rev = sim.tickcount - start;
+        if (rev < rev_ticks * 95 / 100 || rev > rev_ticks * 105 / 100)
+            return scenario_fail(r, "revolution time off");
+        return true;
+    }
+    return scenario_fail(r, "first ID never came round again");
+}
+
+// One track EDSK with the sector IDs 1, 2, 3, 2, 4 (N=2), the data of the k-th sector
+// filled with 0x10 + k, in a temporary file. Empty path if it can't be written
+static inline std::string write_dup_id_image() {
+    static const uint8_t ids[] = {1, 2, 3, 2, 4};
+    const int n = sizeof(ids);
+    std::vector<uint8_t> img(256 + 256 + n * 512, 0);
+    memcpy(img.data(), "EXTENDED CPC DSK File\r\nDisk-Info\r\n", 34);
+    img[0x30] = 1;                         // tracks
+    img[0x31] = 1;                         // sides
+    img[0x34] = (256 + n * 512) >> 8;      // size of track 0
+    uint8_t *ti = img.data() + 256;
+    memcpy(ti, "Track-Info\r\n", 12);
+    ti[0x14] = 2;
+    ti[0x15] = n;
+    ti[0x16] = 0x2a;
+    ti[0x17] = 0xe5;
+    for (int k = 0; k < n; k++) {
+        uint8_t *e = ti + 0x18 + k * 8;
+        e[2] = ids[k];
+        e[3] = 2;
+        e[7] = 512 >> 8;
+        memset(ti + 256 + k * 512, 0x10 + k, 512);
+    }
+    char path[] = "/tmp/u765_dup_id.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return "";
+    bool ok = write(fd, img.data(), img.size()) == (ssize_t)img.size();
+    close(fd);
+    if (!ok) unlink(path);
+    return ok ? path : "";
+}
+
+// READ DATA of a repeated sector ID: the first sector with it answers, as the linear scan
+// always did, through the sector index as well as after it
+static inline bool scenario_dup_id(U765Sim &sim, ScenarioResult &r) {
+    static thread_local uint8_t buf[512];
+    static const int reads[][2] = {{2, 0x11}, {4, 0x14}, {2, 0x11}, {3, 0x12}};  // R, fill
+    std::string path = write_dup_id_image();
+    if (path.empty()) return scenario_fail(r, "can't write the duplicate ID image");
+    bool mounted = sim.mount(path.c_str(), 0);
+    unlink(path.c_str());  // the mapping stays
+    if (!mounted) return scenario_fail(r, "can't mount the duplicate ID image");
+    if (!fdc_recalibrate(sim, r)) return false;
+    for (auto &rd : reads) {
+        if (fdc_read(sim, 0, 0, rd[0], 2, rd[0], 0x2a, 0xff, buf, sizeof(buf), r) != 512)
+            return scenario_fail(r, "READ DATA failed");
+        if (r.st[0] & 0xc0) return scenario_fail(r, "abnormal termination");
+        for (int i = 0; i < 512; i++)
+            if (buf[i] != rd[1]) return scenario_fail(r, "wrong sector for a repeated ID");
+    }
+    return true;
+}
+
+// WRITE DATA of the first sector of track 0, and a new image inserted in drive A before the
+// results are read: the sector still in the write-back buffer goes to the old image, the
+// new one is only taken after that and gets nothing
+static inline bool scenario_swap(U765Sim &sim, ScenarioResult &r) {
+    if (!fdc_recalibrate(sim, r)) return false;
+    if (!sim.command({0x4a, 0x00}) || !sim.results(r.st, 7)) return scenario_fail(r, "READ ID stalled");
+    if (r.st[0] & 0xc0) return scenario_fail(r, "READ ID failed");
+    int c = r.st[3], h = r.st[4], rec = r.st[5], n = std::min<int>(r.st[6], 6);
+    std::vector<uint8_t> pattern(128 << n);
+    for (size_t i = 0; i < pattern.size(); i++) pattern[i] = (i * 7 + 0x35) & 0xff;
+    std::shared_ptr<DiskImage> old = sim.images.drive[0];
+
+    if (!sim.command({0x05, 0x00, c, h, rec, n, rec, 0x2a, 0xff})) return scenario_fail(r, "WRITE DATA stalled");
+    if (sim.write_exec(pattern.data(), pattern.size()) != (int)pattern.size())
+        return scenario_fail(r, "short sector write");
+    if (!sim.insert(r.image.c_str(), 0)) return scenario_fail(r, "can't insert the new image");
+    if (!sim.results(r.st, 7)) return scenario_fail(r, "WRITE DATA stalled");
+    if (r.st[0] & 0xc0) return scenario_fail(r, "abnormal termination");
+    r.bytes += pattern.size();
+    sim.wait(2);
+    if (sim.wait_status(0x80, 0x80) < 0) return scenario_fail(r, "new image not scanned");
+    if (sim.images.pending[0] || sim.images.drive[0] == old) return scenario_fail(r, "new image not taken");
+    if (!sim.images.overlay[0].blocks.empty()) return scenario_fail(r, "the new image was written");
+
+    // the old image as the SD card has it now
+    std::vector<uint8_t> data(old->data, old->data + old->size);
+    for (auto &b : sim.images.retired[0].blocks) {
+        uint64_t off = (uint64_t)b.first * SD_BLOCK;
+        for (uint64_t i = 0; i < SD_BLOCK && off + i < data.size(); i++) data[off + i] = b.second[i];
+    }
+    if (std::search(data.begin(), data.end(), pattern.begin(), pattern.end()) == data.end())
+        return scenario_fail(r, "the sector written before the swap is lost");
+    return true;
+}
+
+// The script of +script (u765_script.h), a +bus_rec capture replays the same way. Without
+// one there is nothing to run and it passes, so "all" keeps working
+static inline bool scenario_script(U765Sim &sim, ScenarioResult &r) {
+    std::string path = plusarg_str("script", "");
+    if (path.empty()) return true;
+    ScriptRunner script(sim, r.image);
+    script.configure();
+    bool ok = script.run_file(path);
+    r.bytes += script.bytes;
+    r.sum += script.sum;
+    memcpy(r.st, script.res, sizeof(r.st));
+    if (!ok) return scenario_fail(r, script.error.c_str());
+    return true;
+}
+
+// READ DATA of sectors e.r..eot of the track under the head, with the IDs of e. Returns the
+// bytes read, -1 on a stall
+static inline int sweep_read(U765Sim &sim, int head, const U765Model::Sector &e, int eot,
+                             std::vector<uint8_t> &buf, ScenarioResult &r) {
+    long sum;
+    if (!sim.command({0x06, head << 2, e.c, e.h, e.r, e.n, eot, 0x2a, 0xff})) return -1;
+    int count = sim.read_exec(buf.data(), buf.size(), &sum);
+    if (!sim.results(r.st, 7)) return -1;
+    r.bytes += count;
+    r.sum += sum;
+    return count;
+}
+
+// A sector the core reads as the image has it: no error flags, one copy, the IDs of its
+// track and an R no other sector of the list has
+static inline bool sweep_plain(const std::vector<U765Model::Sector> &list, size_t i, int cyl, int head) {
+    const U765Model::Sector &e = list[i];
+    if (e.st1 || e.st2 || e.n > 6 || e.size != (uint32_t)(0x80 << e.n) || e.c != cyl || e.h != head)
+        return false;
+    for (size_t j = 0; j < list.size(); j++)
+        if (j != i && list[j].r == e.r) return false;
+    return true;
+}
+
+// One track of the sweep: READ ID, then the plain sectors by runs of consecutive R, a
+// multi-sector READ DATA each, and the others one by one. Flags the track on a failed
+// READ ID, a short or abnormal read, data that differs from the image or a result phase
+// timeout. False on a stall
+static inline bool sweep_track(U765Sim &sim, const U765Model &info, SweepTrack &t, ScenarioResult &r) {
+    std::vector<U765Model::Sector> list = info.track(0, t.cyl, t.head);
+    const uint8_t *image = sim.images.drive[0]->data;
+    int trips = sim.watchdog.trips;
+    uint64_t start = sim.tickcount;
+
+    if (!sim.command({0x4a, t.head << 2}) || !sim.results(r.st, 7)) return false;
+    bool found = false;
+    for (const U765Model::Sector &e : list)
+        found |= e.c == r.st[3] && e.h == r.st[4] && e.r == r.st[5] && e.n == r.st[6];
+    if (!list.empty() && ((r.st[0] & 0xc0) || !found)) t.flag = "READ ID failed";
+
+    std::vector<size_t> plain, other;
+    for (size_t i = 0; i < list.size(); i++)
+        (sweep_plain(list, i, t.cyl, t.head) ? plain : other).push_back(i);
+    std::sort(plain.begin(), plain.end(), [&](size_t a, size_t b) { return list[a].r < list[b].r; });
+
+    std::vector<uint8_t> buf;
+    for (size_t i = 0; i < plain.size();) {
+        const U765Model::Sector &first = list[plain[i]];
+        size_t n = 1;
+        while (i + n < plain.size() && list[plain[i + n]].r == first.r + n && list[plain[i + n]].n == first.n)
+            n++;
+        uint32_t len = 0x80 << first.n;
+        buf.assign(n * len, 0);
+        int got = sweep_read(sim, t.head, first, first.r + n - 1, buf, r);
+        if (got < 0) return false;
+        t.sectors += n;
+        if (t.flag.empty() && ((r.st[0] & 0xc0) || got != (int)(n * len))) {
+            char why[64];
+            snprintf(why, sizeof(why), "READ DATA R=%02x..%02x: ST0=%02x ST1=%02x ST2=%02x, %d bytes",
+                     first.r, (int)(first.r + n - 1), r.st[0], r.st[1], r.st[2], got);
+            t.flag = why;
+        }
+        for (size_t k = 0; k < n && t.flag.empty(); k++) {
+            const U765Model::Sector &e = list[plain[i + k]];
+            if (memcmp(buf.data() + k * len, image + e.offset, len)) {
+                char why[48];
+                snprintf(why, sizeof(why), "data of R=%02x differs from the image", e.r);
+                t.flag = why;
+            }
+        }
+        i += n;
+    }
+
+    // Error flags, weak copies, duplicate or foreign IDs: read, but only the stall counts
+    buf.assign(65536, 0);
+    for (size_t i : other) {
+        if (sweep_read(sim, t.head, list[i], list[i].r, buf, r) < 0) return false;
+        t.sectors++;
+    }
+
+    if (sim.watchdog.trips != trips && t.flag.empty()) t.flag = "result phase timeout";
+    t.cycles = (sim.tickcount - start) / 2;
+    return true;
+}
+
+// Every track and side of the image: READ ID and READ DATA of every sector of the
+// Track-Info lists, checked against the file. A wait of more than +sweep_timeout cycles
+// (default 320000, 16 revolutions) is a stall: the track is flagged, the core reset and
+// recalibrated, and the sweep goes on. Fails if any track was flagged
+static inline bool scenario_sweep(U765Sim &sim, ScenarioResult &r) {
+    U765Model info;  // the image as the header scan of the core sees it
+    const DiskImage &img = *sim.images.drive[0];
+    info.mount(0, img.data, img.size, false, 0);
+    if (!info.disk[0].ready) return scenario_fail(r, "not a DSK/EDSK image");
+    bool half = !info.disk[0].dd && (sim.tb->density & 1);
+    int sides = info.disk[0].sides ? 2 : 1;
+
+    uint64_t timeout = sim.timeout;
+    sim.timeout = plusarg_int("sweep_timeout", 320000);
+    bool ok = fdc_recalibrate(sim, r);
+    for (int cyl = 0; ok && cyl < info.disk[0].tracks; cyl++) {
+        int ncn = half ? cyl << 1 : cyl;
+        bool moved = fdc_seek(sim, ncn, r) && r.st[1] == ncn;
+        for (int head = 0; ok && head < sides; head++) {
+            SweepTrack t;
+            t.cyl = cyl;
+            t.head = head;
+            bool stalled = moved && !sweep_track(sim, info, t, r);
+            if (!moved) t.flag = "SEEK failed";
+            else if (stalled) t.flag = "stalled";
+            r.sectors += t.sectors;
+            r.tracks.push_back(t);
+            if (stalled || !moved) {
+                if (sim.watchdog.stalled) ok = scenario_fail(r, "watchdog stall");
+                else ok = sim.reset(10) && fdc_recalibrate(sim, r);
+                if (!moved) break;
+            }
+        }
+    }
+    sim.timeout = timeout;
+    if (!ok) return scenario_fail(r, "core didn't recover from a stall");
+
+    int flagged = 0;
+    const SweepTrack *first = NULL;
+    for (const SweepTrack &t : r.tracks) {
+        if (t.flag.empty()) continue;
+        if (!first) first = &t;
+        flagged++;
+    }
+    if (!first) return true;
+    char why[128];
+    snprintf(why, sizeof(why), "%d track(s) flagged, first %d/%d: %s", flagged, first->cyl,
+             first->head, first->flag.c_str());
+    return scenario_fail(r, why);
+}
+
+struct Scenario {
+    const char *name;
+    bool (*run)(U765Sim &sim, ScenarioResult &r);
+    const char *desc;
+};
+
+static const Scenario u765_scenarios[] = {
+    {"mount", scenario_mount, "reset, mount and header scan"},
+    {"mount_ab", scenario_mount_ab, "swap the images of both drives at once"},
+    {"recal", scenario_recal, "RECALIBRATE + SENSE INTERRUPT"},
+    {"boot", scenario_boot, "pcw_boot_sequence() reads"},
+    {"read_track", scenario_read_track, "READ DATA of a whole track"},
+    {"write", scenario_write, "WRITE DATA of a track and read back"},
+    {"scan_equal", scenario_scan_equal, "SCAN EQUAL hit on a sector"},
+    {"read_track_dma", scenario_read_track_dma, "READ DATA of a whole track through DMA"},
+    {"write_dma", scenario_write_dma, "WRITE DATA of a track through DMA and read back"},
+    {"overlap_seek", scenario_overlap_seek, "SEEK on drive B during commands on drive A"},
+    {"rotation", scenario_rotation, "READ ID for a whole revolution of track 0"},
+    {"dup_id", scenario_dup_id, "READ DATA of a repeated sector ID: the first one answers"},
+    {"swap", scenario_swap, "WRITE DATA, then a new image before the results: the data is kept"},
+    {"script", scenario_script, "the script or bus capture of +script"},
+    {"sweep", scenario_sweep, "READ ID and READ DATA of every sector of the image"},
+};
+
+static inline const Scenario *find_scenario(const std::string &name) {
+    for (auto &s : u765_scenarios)
+        if (name == s.name) return &s;
+    return NULL;
+}
+
+// Comma separated scenario names ("all" for every one). False on an unknown name
+static inline bool parse_scenario_list(const std::string &list, std::vector<const Scenario *> &out) {
+    if (list == "all") {
+        for (auto &s : u765_scenarios) out.push_back(&s);
+        return true;
+    }
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(pos, end - pos);
+        if (!name.empty()) {
+            const Scenario *s = find_scenario(name);
+            if (!s) {
+                printf("Unknown scenario %s\n", name.c_str());
+                return false;
+            }
+            out.push_back(s);
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+
+// Run one scenario on a fresh context: prologue, scenario, counters
+static inline void run_scenario(U765Sim &sim, const Scenario &s, const char *image, int fast,
+                                ScenarioResult &r) {
+    r.scenario = s.name;
+    r.image = image;
+    r.fast = fast;
+    r.ok = fdc_prologue(sim, image, fast, r) && s.run(sim, r);
+    if (sim.watchdog.stalled) scenario_fail(r, "watchdog stall");
+    sim.lockstep.verify_images(sim.images);
+    if (sim.lockstep.diverged) scenario_fail(r, ("lockstep: " + sim.lockstep.first).c_str());
+    r.ticks = sim.tickcount;
+    r.sd_reads = sim.images.blocks_read;
+    r.sd_writes = sim.images.blocks_written();
+    r.sd_saved = sim.tb->sd_writes_saved;
+    r.sd_wait_avg = sim.images.storage.wait_avg();
+    r.sd_wait_max = sim.images.storage.wait_max;
+    r.wd_trips = sim.watchdog.trips;
+    r.khz = sim.profiler.khz;
+}
+
+#endif
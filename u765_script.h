@@ -0,0 +1,388 @@
+// Scenario scripts for the u765 testbenches.
+//
+// A script is a text file with one statement per line, run by a ScriptRunner on a U765Sim.
+// '#' starts a comment, numbers are C style (0x1f, 31) and $image stands for the image the
+// harness was given. A statement may start with an @cycle stamp, the clk_sys cycle it ended
+// on in a bus capture (u765_bus.h); stamps are ignored, so a capture replays as fast as the
+// core answers, unless +script_timing keeps the spacing between them.
+//
+// Drives
+//   reset [CYCLES]                 reset pulse, then wait for RQM
+//   mount D PATH | insert D PATH   insert an image in drive D, waiting for its header scan or not
+//   unmount D                      eject the image of D and drop its ready line
+//   pins ready=M motor=M available=M density=M fast=F   any of them, drive masks
+// Commands: the name, optionally with .mt .mf .sk, and the parameter bytes in datasheet
+// order. The execution phase goes by PIO, or by DMA after a SPECIFY with ND=0, and the
+// result phase is read into the result bytes the checks look at
+//   specify SRT_HUT HLT_ND         sense             version
+//   recalibrate US                 seek HD_US NCN    sense_drive HD_US    read_id HD_US
+//   read, read_deleted, read_track, write, write_deleted, scan_eq, scan_le, scan_he:
+//                                  HD_US C H R N EOT GPL DTL|STP [tc=N]  (tc: DMA reads only)
+//   format HD_US N SC GPL D        the C H R N of every sector come from data
+//   cmd B...                       raw command phase, then exec and results by hand:
+//   exec read | exec write         results N
+// Data of write, format and scan
+//   data B...  |  data fill B LEN  |  data pattern MUL LEN  (byte i = (i*MUL + i/512) & 0xff)
+//   data read                      the bytes of the last read execution phase
+// Waits
+//   wait CYCLES | wait int [CYCLES] | wait drq | wait status V [MASK]
+// Checks, the script stops at the first one that fails
+//   expect st0=V[/MASK] st1= st2= c= h= r= n= pcn= st3= rN=    result bytes
+//   expect bytes=N sum=N           last execution phase
+//   expect status=V[/MASK] int=0|1
+//   print TEXT
+// Bus cycles, as written by +bus_rec
+//   status V                       wait until RQM/DIO/EXM read as in V if V has RQM, else
+//                                  read the status once (a poll that hadn't finished)
+//   wr B | rd [B]                  data register cycles, rd checks B
+//   dma_rd [B] [tc] | dma_wr B [tc]   DMA cycles once drq is up
+//
+// Example, the first reads of the PCW boot:
+//   recalibrate 0
+//   wait int
+//   sense
+//   expect st0=0x20/0xf8 pcn=0
+//   read.mf 0 0 0 1 2 9 0x2a 0xff
+//   expect st0=0/0xc0 bytes=4608
+//
+// Plusargs:
+//   +script=file     script run by test mode 4 of u765_tb and by the script scenario
+//   +script_timing   wait for the @cycle stamps instead of running at full speed
+#ifndef U765_SCRIPT_H
+#define U765_SCRIPT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "u765_plusargs.h"
+#include "u765_sim.h"
+
+struct ScriptCommand {
+    const char *name;
+    int opcode;
+    int params;
+    int results;
+    char exec;  // 'r' read phase, 'w' write phase (write, format, scan), 0 none
+};
+
+static const ScriptCommand script_commands[] = {
+    {"read_track", 0x02, 8, 7, 'r'},    {"specify", 0x03, 2, 0, 0},
+    {"sense_drive", 0x04, 1, 1, 0},     {"write", 0x05, 8, 7, 'w'},
+    {"read", 0x06, 8, 7, 'r'},          {"recalibrate", 0x07, 1, 0, 0},
+    {"sense", 0x08, 0, 2, 0},           {"write_deleted", 0x09, 8, 7, 'w'},
+    {"read_id", 0x0a, 1, 7, 0},         {"read_deleted", 0x0c, 8, 7, 'r'},
+    {"format", 0x0d, 5, 7, 'w'},        {"seek", 0x0f, 2, 0, 0},
+    {"version", 0x10, 0, 1, 0},         {"scan_eq", 0x11, 8, 7, 'w'},
+    {"scan_le", 0x19, 8, 7, 'w'},       {"scan_he", 0x1d, 8, 7, 'w'},
+};
+
+class ScriptRunner {
+public:
+    std::string image;          // $image
+    bool timing = false;        // +script_timing
+    bool dma = false;           // execution phases by DMA
+    std::string error;          // file:line: why, of the statement that failed
+    uint8_t res[16] = {0};      // last result phase
+    int nres = 0;
+    std::vector<uint8_t> data;  // written by write, format and scan
+    std::vector<uint8_t> last;  // read by the last read execution phase
+    long sum = 0;               // of last
+    int count = 0;              // bytes of the last execution phase
+    uint64_t bytes = 0;         // bytes of every execution phase
+    uint64_t statements = 0;
+    uint64_t commands = 0;
+
+    ScriptRunner(U765Sim &sim, const std::string &image) : image(image), sim(sim) {}
+
+    void configure() { timing = plusarg_flag("script_timing"); }
+
+    bool run_file(const std::string &path) {
+        FILE *f = fopen(path.c_str(), "r");
+        if (!f) {
+            error = path + ": can't open";
+            return false;
+        }
+        char line[4096];
+        int n = 0;
+        bool ok = true;
+        stamped = false;
+        while (ok && fgets(line, sizeof(line), f)) {
+            n++;
+            if (!(ok = run_line(line))) error = path + ":" + std::to_string(n) + ": " + error;
+        }
+        fclose(f);
+        return ok;
+    }
+
+    // One statement. False, with the reason in error, if it failed
+    bool run_line(const char *line) {
+        std::vector<std::string> tok;
+        const char *p = line;
+        while (*p && *p != '#') {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+            const char *start = p;
+            while (*p && *p != '#' && !strchr(" \t\r\n", *p)) p++;
+            if (p > start) tok.push_back(std::string(start, p));
+        }
+        if (!tok.empty() && tok[0][0] == '@') {
+            stamp(strtoull(tok[0].c_str() + 1, NULL, 0));
+            tok.erase(tok.begin());
+        }
+        if (tok.empty()) return true;
+        for (std::string &t : tok)
+            if (t == "$image") t = image;
+        statements++;
+        return statement(tok);
+    }
+
+private:
+    U765Sim &sim;
+    bool stamped = false;
+    uint64_t offset = 0;  // our cycle minus the stamp of the capture
+
+    bool fail(const std::string &why) {
+        error = why;
+        return false;
+    }
+
+    static bool number(const std::string &s, long &v) {
+        char *end;
+        v = strtol(s.c_str(), &end, 0);
+        return !s.empty() && !*end;
+    }
+
+    // The first stamp lines the capture up with the current cycle, the next ones wait
+    void stamp(uint64_t cycle) {
+        uint64_t now = sim.tickcount / 2;
+        if (!stamped) {
+            stamped = true;
+            offset = now - cycle;
+        } else if (timing && cycle + offset > now) {
+            sim.wait(cycle + offset - now);
+        }
+    }
+
+    bool statement(const std::vector<std::string> &tok) {
+        const std::string &op = tok[0];
+        std::vector<long> v;  // the numeric arguments, in order
+        for (size_t i = 1; i < tok.size(); i++) {
+            long n;
+            if (number(tok[i], n)) v.push_back(n);
+        }
+
+        if (op == "reset") return sim.reset(v.empty() ? 10 : v[0]) || fail("not ready after reset");
+        if (op == "mount" || op == "insert") {
+            if (tok.size() != 3 || v.size() != 1) return fail(op + " needs a drive and an image");
+            bool ok = op == "mount" ? sim.mount(tok[2].c_str(), v[0]) : sim.insert(tok[2].c_str(), v[0]);
+            return ok || fail("can't mount " + tok[2]);
+        }
+        if (op == "unmount") {
+            if (v.size() != 1 || v[0] < 0 || v[0] >= U765_DRIVES) return fail("unmount needs a drive");
+            sim.images.eject(v[0]);
+            sim.lockstep.on_eject(v[0]);
+            sim.tb->ready &= ~(1 << v[0]);
+            return true;
+        }
+        if (op == "pins") return pins(tok);
+        if (op == "cmd") {
+            for (long b : v)
+                if (!sim.sendbyte(b)) return fail("command phase stalled");
+            commands++;
+            return true;
+        }
+        if (op == "exec") {
+            if (tok.size() < 2) return fail("exec read or exec write");
+            return execution(tok[1] == "write" ? 'w' : 'r', 0);
+        }
+        if (op == "results") {
+            nres = v.empty() ? 7 : std::min<long>(v[0], sizeof(res));
+            return sim.results(res, nres) || fail("result phase stalled");
+        }
+        if (op == "data") return data_statement(tok, v);
+        if (op == "wait") return wait(tok, v);
+        if (op == "expect") return expect(tok);
+        if (op == "print") {
+            for (size_t i = 1; i < tok.size(); i++) printf("%s%s", tok[i].c_str(), i + 1 < tok.size() ? " " : "\n");
+            return true;
+        }
+        if (op == "status") {
+            if (v.empty()) return fail("status needs a value");
+            if (!(v[0] & 0x80)) {
+                sim.readstatus();
+                return true;
+            }
+            return sim.wait_status(0xe0, v[0] & 0xe0) >= 0 || fail("status never reached " + tok[1]);
+        }
+        if (op == "wr") {
+            if (v.empty()) return fail("wr needs a byte");
+            sim.buswrite(v[0]);
+            return true;
+        }
+        if (op == "rd") {
+            int b = sim.busread();
+            return v.empty() || b == v[0] || fail(mismatch("rd", b, v[0]));
+        }
+        if (op == "dma_rd" || op == "dma_wr") {
+            bool read = op == "dma_rd";
+            bool tc = tok.back() == "tc";
+            if (!read && v.empty()) return fail("dma_wr needs a byte");
+            if (!sim.wait_drq()) return fail("no drq");
+            int b = sim.dma_cycle(read, read ? 0 : v[0], tc);
+            return !read || v.empty() || b == v[0] || fail(mismatch("dma_rd", b, v[0]));
+        }
+        return command(tok, v);
+    }
+
+    static std::string mismatch(const char *what, int got, long want) {
+        char s[64];
+        snprintf(s, sizeof(s), "%s 0x%02x, expected 0x%02lx", what, got, want);
+        return s;
+    }
+
+    // Named command: name[.mt][.mf][.sk] and its parameters
+    bool command(const std::vector<std::string> &tok, const std::vector<long> &v) {
+        std::string name = tok[0];
+        int flags = 0;
+        size_t dot;
+        while ((dot = name.rfind('.')) != std::string::npos) {
+            std::string m = name.substr(dot + 1);
+            if (m == "mt") flags |= 0x80;
+            else if (m == "mf") flags |= 0x40;
+            else if (m == "sk") flags |= 0x20;
+            else return fail("unknown modifier ." + m);
+            name.erase(dot);
+        }
+        const ScriptCommand *c = NULL;
+        for (auto &sc : script_commands)
+            if (name == sc.name) c = &sc;
+        if (!c) return fail("unknown statement " + tok[0]);
+
+        long tc = 0;
+        std::vector<int> bytes{c->opcode | flags};
+        for (size_t i = 1; i < tok.size(); i++) {
+            long n;
+            if (!tok[i].compare(0, 3, "tc=") && number(tok[i].substr(3), n)) tc = n;
+            else if (number(tok[i], n)) bytes.push_back(n);
+            else return fail("bad parameter " + tok[i]);
+        }
+        if ((int)bytes.size() != c->params + 1)
+            return fail(name + " takes " + std::to_string(c->params) + " parameters");
+
+        for (int b : bytes)
+            if (!sim.sendbyte(b)) return fail(name + ": command phase stalled");
+        commands++;
+        if (c->opcode == 0x03) dma = !(bytes[2] & 1);
+        if (c->exec && !execution(c->exec, tc)) return false;
+        nres = c->results;
+        if (nres && !sim.results(res, nres)) return fail(name + ": result phase stalled");
+        return true;
+    }
+
+    bool execution(char kind, int tc) {
+        if (kind == 'r') {
+            last.resize(65536);
+            count = dma ? sim.dma_read(last.data(), last.size(), &sum, tc)
+                        : sim.read_exec(last.data(), last.size(), &sum);
+            last.resize(std::min<size_t>(count, last.size()));
+        } else {
+            count = dma ? sim.dma_write(data.data(), data.size()) : sim.write_exec(data.data(), data.size());
+        }
+        bytes += count;
+        return !sim.watchdog.stalled || fail("execution phase stalled");
+    }
+
+    bool data_statement(const std::vector<std::string> &tok, const std::vector<long> &v) {
+        std::string kind = tok.size() > 1 ? tok[1] : "";
+        if (kind == "read") {
+            data = last;
+        } else if (kind == "fill" || kind == "pattern") {
+            if (v.size() != 2) return fail("data " + kind + " needs two values");
+            data.resize(v[1]);
+            for (long i = 0; i < v[1]; i++)
+                data[i] = kind == "fill" ? v[0] : (i * v[0] + i / 512) & 0xff;
+        } else {
+            if (v.size() + 1 != tok.size()) return fail("bad data byte");
+            data.assign(v.begin(), v.end());
+        }
+        return true;
+    }
+
+    bool wait(const std::vector<std::string> &tok, const std::vector<long> &v) {
+        std::string what = tok.size() > 1 ? tok[1] : "";
+        if (what == "int") return sim.wait_int(v.empty() ? 0 : v[0]) || fail("no interrupt");
+        if (what == "drq") return sim.wait_drq() || fail("no drq");
+        if (what == "status") {
+            if (v.empty()) return fail("wait status needs a value");
+            return sim.wait_status(v.size() > 1 ? v[1] : 0xff, v[0]) >= 0 || fail("status never reached " + tok[2]);
+        }
+        if (v.size() != 1) return fail("wait what?");
+        sim.wait(v[0]);
+        return true;
+    }
+
+    bool pins(const std::vector<std::string> &tok) {
+        for (size_t i = 1; i < tok.size(); i++) {
+            size_t eq = tok[i].find('=');
+            long n;
+            if (eq == std::string::npos || !number(tok[i].substr(eq + 1), n)) return fail("bad pin " + tok[i]);
+            std::string pin = tok[i].substr(0, eq);
+            if (pin == "ready") sim.tb->ready = n;
+            else if (pin == "motor") sim.tb->motor = n;
+            else if (pin == "available") sim.tb->available = n;
+            else if (pin == "density") sim.tb->density = n;
+            else if (pin == "fast") sim.tb->fast = n;
+            else return fail("unknown pin " + pin);
+        }
+        return true;
+    }
+
+    // name=value[/mask] checks
+    bool expect(const std::vector<std::string> &tok) {
+        static const struct {
+            const char *name;
+            int index;
+        } names[] = {{"st0", 0}, {"st1", 1}, {"st2", 2}, {"c", 3}, {"h", 4},
+                     {"r", 5},   {"n", 6},   {"pcn", 1}, {"st3", 0}};
+        for (size_t i = 1; i < tok.size(); i++) {
+            size_t eq = tok[i].find('='), slash = tok[i].find('/');
+            std::string name = tok[i].substr(0, eq);
+            long want, mask = -1;
+            if (eq == std::string::npos || !number(tok[i].substr(eq + 1, slash - eq - 1), want) ||
+                (slash != std::string::npos && !number(tok[i].substr(slash + 1), mask)))
+                return fail("bad check " + tok[i]);
+
+            long got;
+            int index = -1;
+            for (auto &n : names)
+                if (name == n.name) index = n.index;
+            if (name.size() > 1 && name[0] == 'r' && isdigit(name[1])) index = atoi(name.c_str() + 1);
+            if (index >= 0) {
+                if (index >= nres) return fail(name + ": no such result byte");
+                got = res[index];
+            } else if (name == "bytes") {
+                got = count;
+            } else if (name == "sum") {
+                got = sum;
+            } else if (name == "status") {
+                got = sim.readstatus();
+            } else if (name == "int") {
+                got = sim.int_out_active;
+            } else {
+                return fail("unknown check " + name);
+            }
+            if ((got & mask) != (want & mask)) {
+                char s[96];
+                snprintf(s, sizeof(s), "%s is 0x%02lx, expected 0x%02lx", name.c_str(), got & mask, want & mask);
+                return fail(s);
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,478 @@
+// Per-instance simulation context for the u765 testbenches.
+//
+// Everything one simulation needs lives in a U765Sim: its own VerilatedContext and model,
+// the trace window, the SD image server, the flight recorder, watchdog and profilers, the
+// tick counter and the host side signals. Nothing is shared between instances but the
+// image mappings, so several of them can run at once, one per thread (see u765_runner.cpp).
+//
+// The bus cycles are the ones the testbenches always used: 4 ticks per register access.
+// Waits for RQM/DIO watch the status register the core drives on dout while a0 is low,
+// and waits for an interrupt watch int_out, so no bus cycle is spent polling; +poll brings
+// back the status register reads. A wait gives up, returning -1 or false, on +drv_timeout
+// or once the watchdog has declared a stall. After a SPECIFY with ND=0 the execution phases
+// go through dma_read()/dma_write() instead, which only wait on drq.
+//
+// Plusargs: +verbose, +poll, +drv_timeout=N (cycles, default 4000000). The SD timing of the
+// image server comes from the +sd_* plusargs of u765_storage.h, and +bus_rec captures the
+// host side of the run as a replayable script (u765_bus.h). With +lockstep every bus
+// transaction also goes to the behavioral model, which checks the core (u765_lockstep.h).
+#ifndef U765_SIM_H
+#define U765_SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <initializer_list>
+#include "Vu765_test.h"
+#include "verilated.h"
+#include "u765_plusargs.h"
+#include "u765_trace.h"
+#include "u765_image.h"
+#include "u765_recorder.h"
+#include "u765_profile.h"
+#include "u765_checkpoint.h"
+#include "u765_bus.h"
+#include "u765_lockstep.h"
+
+// Bits of the fast port (see u765.sv): each one gives up a piece of timing accuracy
+enum u765_fast {
+    U765_FAST_SEEK = 0x01,       // no head stepping
+    U765_FAST_ROTATION = 0x02,   // no rotational latency
+    U765_FAST_HEAD_LOAD = 0x04,  // no head load delay
+    U765_FAST_SD_WAIT = 0x08,    // no ack settle delay
+    U765_FAST_ALL = 0x0f,
+};
+
+// Report which timings the fast knobs give up
+static inline void report_fast_mode(int mode) {
+    printf("Turbo mode: 0x%x\n", mode);
+    printf("  seek     : %s\n", (mode & U765_FAST_SEEK) ? "turbo (no head stepping)" : "accurate");
+    printf("  rotation : %s\n", (mode & U765_FAST_ROTATION) ? "turbo (no rotational latency)" : "accurate");
+    printf("  head load: %s\n", (mode & U765_FAST_HEAD_LOAD) ? "turbo (no HLT delay)" : "accurate");
+    printf("  SD wait  : %s\n", (mode & U765_FAST_SD_WAIT) ? "turbo (no ack settle delay)" : "accurate");
+}
+
+class U765Sim {
+public:
+    VerilatedContext *context = NULL;
+    Vu765_test *tb = NULL;
+    TraceWindow trace;
+    ImageServer images;
+    FlightRecorder recorder;
+    Watchdog watchdog;
+    CommandProfiler profiler;
+    StateProfiler states;
+    BusCapture capture;
+    LockstepChecker lockstep;
+    uint64_t tickcount = 0;
+    bool tc_active = false;
+    bool int_out_active = false;
+    bool int_out_previous = false;
+    bool verbose = false;  // +verbose: print every status poll and data byte (slow)
+    bool polling = false;  // +poll: wait for RQM with status register reads, as before
+    uint64_t timeout = 4000000;  // +drv_timeout: cycles a wait gives up after
+    int last_status = 0;   // status register seen by the last wait
+    uint64_t mount_cycles = 0;  // clk_sys cycles from the last mount pulse to RQM
+    uint32_t cycles = 0;  // CYCLES of the core: cycles per ms
+    uint32_t rpm = 0;     // RPM of the core
+
+    // Called on every rising edge of int_out, before the eval() of that tick
+    void (*on_interrupt)(U765Sim &sim) = NULL;
+
+    // Read the plusargs of the trace, recorder and watchdog and create the model.
+    // trace_file is the default for +trace_file
+    explicit U765Sim(const char *trace_file) {
+        context = new VerilatedContext;
+        trace.configure(trace_file, context);
+        recorder.configure();
+        watchdog.configure();
+        states.configure();
+        images.storage.configure();
+        capture.configure();
+        lockstep.configure(images.storage);
+        lockstep.recorder = &recorder;
+        verbose = plusarg_flag("verbose");
+        polling = plusarg_flag("poll");
+        timeout = plusarg_int("drv_timeout", timeout);
+        images.verbose = verbose;
+        tb = new Vu765_test(context);
+        trace.attach(tb);
+        // CYCLES and RPM the core was built with, constant outputs of u765_test
+        tb->eval();
+        cycles = tb->core_cycles;
+        rpm = tb->core_rpm;
+        profiler.configure(cycles);
+        if (cycles != U765Model::CYCLES || rpm != U765Model::RPM)
+            lockstep.suspend("the core was built with other CYCLES/RPM than the model");
+    }
+
+    ~U765Sim() {
+        trace.close();
+        delete tb;
+        delete context;
+    }
+
+    U765Sim(const U765Sim &) = delete;
+    U765Sim &operator=(const U765Sim &) = delete;
+
+    // Basic clock cycle
+    inline void tick(int c) {
+        tb->clk_sys = c;
+        tb->tc = tc_active ? 1 : 0;
+
+        int_out_previous = int_out_active;
+        int_out_active = tb->int_out;
+        if (!int_out_previous && int_out_active) {
+            profiler.on_interrupt(tickcount);
+            if (on_interrupt) on_interrupt(*this);
+        }
+
+        tb->eval();
+        trace.dump(tb, tickcount++);
+
+        if (c) {
+            images.clock(tb);
+            recorder.sample(tb, tickcount);
+            states.sample(tb, tickcount);
+            watchdog.check(tb, recorder, tickcount);
+            if (lockstep.enabled) lockstep.sample(tb, tickcount);
+        }
+    }
+
+    void wait(int t) {
+        for (int i = 0; i < t; i++) {
+            tick(1);
+            tick(0);
+        }
+    }
+
+    // Read the main status register
+    int readstatus() {
+        int dout;
+
+        tb->a0 = 0;
+        tick(1);
+        tick(0);
+        tb->nRD = 0;
+        tb->nWR = 1;
+        tick(1);
+        tick(0);
+        tick(1);
+        tick(0);
+        dout = tb->dout;
+        tb->nRD = 1;
+        tick(1);
+        tick(0);
+        recorder.log(REC_STATUS_RD, tickcount, dout);
+        profiler.on_status(tickcount, dout);
+        capture.status(tb, tickcount, dout);
+        lockstep.on_status(dout);
+        if (!verbose) return dout;
+
+        // Interpret status register bits
+        printf("READ STATUS = 0x%02x [ ", dout);
+        if (dout & 0x80) printf("RQM ");
+        if (dout & 0x40) printf("DIO ");
+        if (dout & 0x20) printf("EXM ");
+        if (dout & 0x10) printf("CB ");
+        if (dout & 0x08) printf("D3B ");
+        if (dout & 0x04) printf("D2B ");
+        if (dout & 0x02) printf("D1B ");
+        if (dout & 0x01) printf("D0B ");
+        printf("]\n");
+
+        return dout;
+    }
+
+    // Write cycle on the data register, without waiting for RQM
+    void buswrite(int byte) {
+        tb->a0 = 1;
+        tick(1);
+        tick(0);
+        tb->nRD = 1;
+        tb->nWR = 0;
+        tb->din = byte;
+        tick(1);
+        tick(0);
+        tick(1);
+        tick(0);
+        tb->nWR = 1;
+        tick(1);
+        tick(0);
+        recorder.log(REC_DATA_WR, tickcount, byte);
+        profiler.on_write(tickcount, byte);
+        capture.log(tb, tickcount, "wr 0x%02x", byte);
+        lockstep.on_write(tickcount, byte, false);
+    }
+
+    // Read cycle on the data register, without waiting for RQM. Without setup, a0 and nRD
+    // change on the same tick, as the execution phase loops always did
+    int busread(bool setup = true) {
+        int byte;
+
+        tb->a0 = 1;
+        if (setup) {
+            tick(1);
+            tick(0);
+        }
+        tb->nRD = 0;
+        tb->nWR = 1;
+        tick(1);
+        tick(0);
+        tick(1);
+        tick(0);
+        byte = tb->dout;
+        tb->nRD = 1;
+        tick(1);
+        tick(0);
+        recorder.log(REC_DATA_RD, tickcount, byte);
+        profiler.on_read(tickcount, byte);
+        capture.log(tb, tickcount, "rd 0x%02x", byte);
+        lockstep.on_read(tickcount, byte, false);
+        return byte;
+    }
+
+    // Wait until (status & mask) == value, max cycles at most (0 = +drv_timeout). Returns
+    // the status, or -1 on a timeout or a watchdog stall
+    int wait_status(int mask, int value, uint64_t max = 0) {
+        uint64_t limit = tickcount + 2 * (max ? max : timeout);
+        if (polling) {
+            while (((last_status = readstatus()) & mask) != value) {
+                if (watchdog.stalled || tickcount >= limit) return -1;
+            }
+            return last_status;
+        }
+        // The status register is on dout whenever a0 is low, no read strobe needed
+        tb->a0 = 0;
+        tb->eval();
+        while (((last_status = tb->dout) & mask) != value) {
+            if (watchdog.stalled || tickcount >= limit) return -1;
+            tick(1);
+            tick(0);
+        }
+        profiler.on_status(tickcount, last_status);
+        capture.status(tb, tickcount, last_status);
+        lockstep.on_status(last_status);
+        if (verbose) printf("STATUS = 0x%02x\n", last_status);
+        return last_status;
+    }
+
+    int poll(int mask, int value) {
+        return wait_status(mask, value);
+    }
+
+    // Wait for int_out, max cycles at most (0 = +drv_timeout). False on a timeout or stall
+    bool wait_int(uint64_t max = 0) {
+        uint64_t limit = tickcount + 2 * (max ? max : timeout);
+        while (!int_out_active) {
+            if (watchdog.stalled || tickcount >= limit) return false;
+            tick(1);
+            tick(0);
+        }
+        capture.log(tb, tickcount, "wait int");
+        return true;
+    }
+
+    // Pulse reset and wait until the core is ready for a command. Mounted images are
+    // scanned again, RQM drops a couple of cycles after reset and comes back when done
+    bool reset(int cycles = 10) {
+        capture.log(tb, tickcount, "reset %d", cycles);
+        tb->reset = 1;
+        wait(cycles);
+        tb->reset = 0;
+        wait(2);
+        return wait_status(0x80, 0x80) >= 0;
+    }
+
+    // Send a byte to the controller once it is ready to take it
+    bool sendbyte(int byte) {
+        if (poll(0xcf, 0x80) < 0) return false;
+        buswrite(byte);
+        return true;
+    }
+
+    // Read a byte from the controller once it is ready to give it, -1 on a stall
+    int readbyte() {
+        if (poll(0xcf, 0xc0) < 0) return -1;
+        int byte = busread();
+        if (verbose) printf("READ DATA = 0x%02x\n", byte);
+        return byte;
+    }
+
+    // Command phase: opcode and parameters
+    bool command(std::initializer_list<int> bytes) {
+        for (int b : bytes)
+            if (!sendbyte(b)) return false;
+        return true;
+    }
+
+    // Result phase: n bytes into res
+    bool results(uint8_t *res, int n) {
+        for (int i = 0; i < n; i++) {
+            int b = readbyte();
+            if (b < 0) return false;
+            res[i] = b;
+        }
+        return true;
+    }
+
+    // Execution phase of a read type command, until the controller leaves it. Bytes go to
+    // buf while they fit; returns how many were read, their sum in *sum
+    int read_exec(uint8_t *buf, int max, long *sum = NULL) {
+        int status, count = 0;
+        long chksum = 0;
+
+        while (true) {
+            if ((status = poll(0xcf, 0xc0)) < 0) break;
+            if ((status & 0x20) != 0x20) break;
+            int byte = busread(false);
+            if (count < max) buf[count] = byte;
+            chksum += byte;
+            count++;
+        }
+        if (sum) *sum = chksum;
+        return count;
+    }
+
+    // Execution phase of a write type command. Returns the bytes taken, fewer than len if
+    // the controller goes to the result phase early
+    int write_exec(const uint8_t *buf, int len) {
+        int status;
+
+        for (int i = 0; i < len; i++) {
+            if ((status = poll(0x80, 0x80)) < 0) return i;
+            if (status & 0x40) return i;
+            buswrite(buf[i]);
+        }
+        return len;
+    }
+
+    // One DMA cycle: dack with the read or write strobe, a0 don't care. With last, tc goes
+    // up as the cycle ends and down one clock later, closing the execution phase
+    int dma_cycle(bool read, int byte, bool last) {
+        tb->dack = 1;
+        if (read) {
+            tb->nRD = 0;
+            tb->nWR = 1;
+        } else {
+            tb->nRD = 1;
+            tb->nWR = 0;
+            tb->din = byte;
+        }
+        tick(1);
+        tick(0);
+        tick(1);
+        tick(0);
+        if (read) byte = tb->dout;
+        tb->nRD = 1;
+        tb->nWR = 1;
+        tb->dack = 0;
+        tc_active = last;
+        tick(1);
+        tick(0);
+        tc_active = false;
+        recorder.log(read ? REC_DATA_RD : REC_DATA_WR, tickcount, byte);
+        profiler.on_dma(tickcount);
+        capture.log(tb, tickcount, "%s 0x%02x%s", read ? "dma_rd" : "dma_wr", byte, last ? " tc" : "");
+        if (read) lockstep.on_read(tickcount, byte, true);
+        else lockstep.on_write(tickcount, byte, true);
+        if (last) lockstep.on_tc(tickcount);
+        return byte;
+    }
+
+    // Wait for drq, max cycles at most (0 = +drv_timeout). False once the command is over
+    // (int_out for the result phase), on a timeout or a stall
+    bool wait_drq(uint64_t max = 0) {
+        uint64_t limit = tickcount + 2 * (max ? max : timeout);
+        while (!tb->drq) {
+            if (tb->int_out || watchdog.stalled || tickcount >= limit) return false;
+            tick(1);
+            tick(0);
+        }
+        return true;
+    }
+
+    // DMA execution phase of a read type command. Stops on the result phase interrupt or,
+    // with a count, raises tc on the count-th byte. Returns the bytes read
+    int dma_read(uint8_t *buf, int max, long *sum = NULL, int count = 0) {
+        int n = 0;
+        long chksum = 0;
+
+        while (wait_drq()) {
+            bool last = count && n + 1 == count;
+            int byte = dma_cycle(true, 0, last);
+            if (n < max) buf[n] = byte;
+            chksum += byte;
+            n++;
+            if (last) break;
+        }
+        if (sum) *sum = chksum;
+        return n;
+    }
+
+    // DMA execution phase of a write type command (WRITE DATA, SCAN). tc goes with the last
+    // byte of buf. Returns the bytes taken, fewer if the controller ended the phase first
+    int dma_write(const uint8_t *buf, int len, bool tc_last = true) {
+        for (int i = 0; i < len; i++) {
+            if (!wait_drq()) return i;
+            dma_cycle(false, buf[i], tc_last && i + 1 == len);
+        }
+        return len;
+    }
+
+    // Insert an image in drive dno, write protected with wp, and wait for the core to scan
+    // it. False if the image can't be opened or the scan times out
+    bool mount(const char *path, int dno, bool wp = false) {
+        uint64_t start = tickcount;
+        if (!insert(path, dno, wp)) return false;
+        // RQM stays low while the core scans the image header
+        wait(2);
+        bool ok = wait_status(0x80, 0x80) >= 0;
+        mount_cycles = (tickcount - start) / 2;
+        if (verbose) printf("Mount: drive %d ready in %llu cycles\n", dno, (unsigned long long)mount_cycles);
+        return ok;
+    }
+
+    // Insert an image in drive dno without waiting for the header scan, so several
+    // drives can be swapped back to back. img_wp of the drive is set from wp, the core
+    // latches it with the mount. False if the image can't be opened
+    bool insert(const char *path, int dno, bool wp = false) {
+        std::shared_ptr<DiskImage> img = DiskImage::open(path);
+        if (!img) return false;
+        tb->img_wp = (tb->img_wp & ~(1 << dno)) | (wp ? 1 << dno : 0);
+        images.insert(dno, img, tb->prepare >> dno & 1);
+        lockstep.on_insert(tb, tickcount, dno, *img);
+        capture.log(tb, tickcount, "insert %d %s", dno, path);
+        tb->img_size = img->size;
+        tb->img_mounted = 1 << dno;
+        tick(1);
+        tick(0);
+        tb->img_mounted = 0;
+        return true;
+    }
+
+    // Checkpoint of the context (the model goes separately, see Checkpointer)
+    void save(VerilatedSerialize &os) const {
+        ckpt_put(os, tickcount);
+        ckpt_put(os, tc_active);
+        ckpt_put(os, int_out_active);
+        ckpt_put(os, int_out_previous);
+        images.save(os);
+    }
+
+    // Must run after the model was restored, the edge detectors resync to it
+    bool restore(VerilatedDeserialize &is) {
+        ckpt_get(is, tickcount);
+        ckpt_get(is, tc_active);
+        ckpt_get(is, int_out_active);
+        ckpt_get(is, int_out_previous);
+        bool ok = images.restore(is);
+        recorder.resync(tb, tickcount);
+        trace.resync(tb);
+        profiler.resync();
+        states.resync(tb);
+        lockstep.suspend("checkpoint restored");
+        return ok;
+    }
+};
+
+#endif
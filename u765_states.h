@@ -0,0 +1,178 @@
+// Mirror of the state_t enum in u765.sv, as seen on the old_state and fsm_state ports.
+// Keep it in the same order as the Verilog enum.
+#ifndef U765_STATES_H
+#define U765_STATES_H
+
+#include <stdlib.h>
+#include <string.h>
+
+enum u765_state {
+    U765_COMMAND_IDLE = 0x00,
+    U765_COMMAND_READ_TRACK = 0x01,
+    U765_COMMAND_WRITE_DELETED_DATA = 0x02,
+    U765_COMMAND_WRITE_DATA = 0x03,
+    U765_COMMAND_READ_DELETED_DATA = 0x04,
+    U765_COMMAND_READ_DATA = 0x05,
+    U765_COMMAND_RW_DATA_EXEC = 0x06,
+    U765_COMMAND_RW_DATA_EXEC1 = 0x07,
+    U765_COMMAND_RW_DATA_EXEC2 = 0x08,
+    U765_COMMAND_RW_DATA_EXEC3 = 0x09,
+    U765_COMMAND_RW_DATA_EXEC4 = 0x0a,
+    U765_COMMAND_RW_DATA_EXEC5 = 0x0b,
+    U765_COMMAND_RW_DATA_WAIT_SECTOR = 0x0c,
+    U765_COMMAND_RW_DATA_EXEC_WEAK = 0x0d,
+    U765_COMMAND_RW_DATA_EXEC6 = 0x0e,
+    U765_COMMAND_RW_DATA_EXEC7 = 0x0f,
+    U765_COMMAND_RW_DATA_EXEC8 = 0x10,
+    U765_COMMAND_RW_DATA_SCAN_COMPARE = 0x11,
+    U765_COMMAND_READ_ID = 0x12,
+    U765_COMMAND_READ_ID1 = 0x13,
+    U765_COMMAND_READ_ID2 = 0x14,
+    U765_COMMAND_READ_ID_EXEC1 = 0x15,
+    U765_COMMAND_READ_ID_WAIT_SECTOR = 0x16,
+    U765_COMMAND_READ_ID_EXEC2 = 0x17,
+    U765_COMMAND_FORMAT_TRACK = 0x18,
+    U765_COMMAND_FORMAT_TRACK1 = 0x19,
+    U765_COMMAND_FORMAT_TRACK2 = 0x1a,
+    U765_COMMAND_FORMAT_TRACK3 = 0x1b,
+    U765_COMMAND_FORMAT_TRACK4 = 0x1c,
+    U765_COMMAND_FORMAT_TRACK5 = 0x1d,
+    U765_COMMAND_FORMAT_TRACK6 = 0x1e,
+    U765_COMMAND_FORMAT_TRACK7 = 0x1f,
+    U765_COMMAND_FORMAT_TRACK8 = 0x20,
+    U765_COMMAND_SCAN_EQUAL = 0x21,
+    U765_COMMAND_SCAN_LOW_OR_EQUAL = 0x22,
+    U765_COMMAND_SCAN_HIGH_OR_EQUAL = 0x23,
+    U765_COMMAND_RECALIBRATE = 0x24,
+    U765_COMMAND_SENSE_INTERRUPT_STATUS = 0x25,
+    U765_COMMAND_SENSE_INTERRUPT_STATUS1 = 0x26,
+    U765_COMMAND_SENSE_INTERRUPT_STATUS2 = 0x27,
+    U765_COMMAND_SPECIFY = 0x28,
+    U765_COMMAND_SPECIFY_WR = 0x29,
+    U765_COMMAND_SENSE_DRIVE_STATUS = 0x2a,
+    U765_COMMAND_SENSE_DRIVE_STATUS_RD = 0x2b,
+    U765_COMMAND_SEEK = 0x2c,
+    U765_COMMAND_SEEK_EXEC1 = 0x2d,
+    U765_COMMAND_SETUP = 0x2e,
+    U765_COMMAND_READ_RESULTS = 0x2f,
+    U765_COMMAND_INVALID = 0x30,
+    U765_COMMAND_INVALID1 = 0x31,
+    U765_COMMAND_RELOAD_TRACKINFO = 0x32,
+    U765_COMMAND_RELOAD_TRACKINFO1 = 0x33,
+    U765_COMMAND_RELOAD_TRACKINFO2 = 0x34,
+    U765_COMMAND_RELOAD_TRACKINFO3 = 0x35,
+    U765_COMMAND_SCAN_SETUP = 0x36,
+    U765_COMMAND_SETUP_VALIDATION = 0x37,
+    U765_COMMAND_RESET = 0x38,
+    U765_COMMAND_SCAN_EXEC1 = 0x39,
+    U765_COMMAND_SCAN_EXEC2 = 0x3a,
+    U765_COMMAND_SCAN_EXEC3 = 0x3b,
+    U765_COMMAND_SCAN_EXEC4 = 0x3c,
+    U765_COMMAND_SCAN_READ_SECTOR = 0x3d,
+    U765_COMMAND_SCAN_COMPARE = 0x3e,
+    U765_COMMAND_SCAN_NEXT = 0x3f,
+    U765_COMMAND_TRACK_PREFETCH = 0x40,
+    U765_COMMAND_TRACK_PREFETCH1 = 0x41,
+    U765_COMMAND_TRACK_PREFETCH2 = 0x42,
+    U765_COMMAND_RELOAD_TRACKINFO_INDEX = 0x43,
+    U765_COMMAND_RW_DATA_LOOKUP = 0x44,
+    U765_COMMAND_RW_DATA_LOOKUP1 = 0x45,
+    U765_COMMAND_WB_FLUSH = 0x46,
+    U765_COMMAND_WB_FLUSH1 = 0x47,
+    U765_COMMAND_FAKE = 0x48,
+    U765_STATE_COUNT
+};
+
+static const char *const u765_state_names[U765_STATE_COUNT] = {
+    "COMMAND_IDLE",
+    "COMMAND_READ_TRACK",
+    "COMMAND_WRITE_DELETED_DATA",
+    "COMMAND_WRITE_DATA",
+    "COMMAND_READ_DELETED_DATA",
+    "COMMAND_READ_DATA",
+    "COMMAND_RW_DATA_EXEC",
+    "COMMAND_RW_DATA_EXEC1",
+    "COMMAND_RW_DATA_EXEC2",
+    "COMMAND_RW_DATA_EXEC3",
+    "COMMAND_RW_DATA_EXEC4",
+    "COMMAND_RW_DATA_EXEC5",
+    "COMMAND_RW_DATA_WAIT_SECTOR",
+    "COMMAND_RW_DATA_EXEC_WEAK",
+    "COMMAND_RW_DATA_EXEC6",
+    "COMMAND_RW_DATA_EXEC7",
+    "COMMAND_RW_DATA_EXEC8",
+    "COMMAND_RW_DATA_SCAN_COMPARE",
+    "COMMAND_READ_ID",
+    "COMMAND_READ_ID1",
+    "COMMAND_READ_ID2",
+    "COMMAND_READ_ID_EXEC1",
+    "COMMAND_READ_ID_WAIT_SECTOR",
+    "COMMAND_READ_ID_EXEC2",
+    "COMMAND_FORMAT_TRACK",
+    "COMMAND_FORMAT_TRACK1",
+    "COMMAND_FORMAT_TRACK2",
+    "COMMAND_FORMAT_TRACK3",
+    "COMMAND_FORMAT_TRACK4",
+    "COMMAND_FORMAT_TRACK5",
+    "COMMAND_FORMAT_TRACK6",
+    "COMMAND_FORMAT_TRACK7",
+    "COMMAND_FORMAT_TRACK8",
+    "COMMAND_SCAN_EQUAL",
+    "COMMAND_SCAN_LOW_OR_EQUAL",
+    "COMMAND_SCAN_HIGH_OR_EQUAL",
+    "COMMAND_RECALIBRATE",
+    "COMMAND_SENSE_INTERRUPT_STATUS",
+    "COMMAND_SENSE_INTERRUPT_STATUS1",
+    "COMMAND_SENSE_INTERRUPT_STATUS2",
+    "COMMAND_SPECIFY",
+    "COMMAND_SPECIFY_WR",
+    "COMMAND_SENSE_DRIVE_STATUS",
+    "COMMAND_SENSE_DRIVE_STATUS_RD",
+    "COMMAND_SEEK",
+    "COMMAND_SEEK_EXEC1",
+    "COMMAND_SETUP",
+    "COMMAND_READ_RESULTS",
+    "COMMAND_INVALID",
+    "COMMAND_INVALID1",
+    "COMMAND_RELOAD_TRACKINFO",
+    "COMMAND_RELOAD_TRACKINFO1",
+    "COMMAND_RELOAD_TRACKINFO2",
+    "COMMAND_RELOAD_TRACKINFO3",
+    "COMMAND_SCAN_SETUP",
+    "COMMAND_SETUP_VALIDATION",
+    "COMMAND_RESET",
+    "COMMAND_SCAN_EXEC1",
+    "COMMAND_SCAN_EXEC2",
+    "COMMAND_SCAN_EXEC3",
+    "COMMAND_SCAN_EXEC4",
+    "COMMAND_SCAN_READ_SECTOR",
+    "COMMAND_SCAN_COMPARE",
+    "COMMAND_SCAN_NEXT",
+    "COMMAND_TRACK_PREFETCH",
+    "COMMAND_TRACK_PREFETCH1",
+    "COMMAND_TRACK_PREFETCH2",
+    "COMMAND_RELOAD_TRACKINFO_INDEX",
+    "COMMAND_RW_DATA_LOOKUP",
+    "COMMAND_RW_DATA_LOOKUP1",
+    "COMMAND_WB_FLUSH",
+    "COMMAND_WB_FLUSH1",
+    "COMMAND_FAKE",
+};
+
+// Name of a state, or "?" when out of range
+static inline const char *u765_state_name(int state) {
+    return (state >= 0 && state < U765_STATE_COUNT) ? u765_state_names[state] : "?";
+}
+
+// Accepts a name (COMMAND_READ_RESULTS or READ_RESULTS) or a number; -1 if invalid
+static inline int u765_state_parse(const char *s) {
+    if (!s || !*s) return -1;
+    for (int i = 0; i < U765_STATE_COUNT; i++) {
+        if (!strcmp(s, u765_state_names[i]) || !strcmp(s, u765_state_names[i] + 8)) return i;
+    }
+    char *end;
+    long v = strtol(s, &end, 0);
+    return (*end || v < 0 || v >= U765_STATE_COUNT) ? -1 : (int)v;
+}
+
+#endif
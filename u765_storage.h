@@ -0,0 +1,218 @@
+// Virtual SD timing model for the u765 testbenches.
+//
+// The ImageServer asks a StorageModel when every sd_rd/sd_wr request may start and how fast
+// its 512 bytes move. A request is queued in pending when the core raises sd_rd or sd_wr, and
+// becomes ready after its latency: the base latency, a uniform jitter and, for a share of the
+// requests, the extra latency of a slow one (an erase, a busy card, the HPS side scheduling
+// something else). Ready requests are served in arrival order, one at a time, with a byte
+// every byte_cycles clk_sys cycles. Meanwhile the core waits in sd_busy with the request
+// held, as it does behind a real SD/HPS bridge. The defaults (no latency, a byte per cycle)
+// are the ideal server the testbenches always had. Jitter and slow requests come from a
+// seeded xorshift, so a run can be repeated.
+//
+// Served requests go to done, the last `history` of them, with their issue, ready, start and
+// end cycles. report() prints the latency and throughput the core saw and both queues.
+//
+// Plusargs:
+//   +sd_latency=N      cycles from the request to its first byte (default 0)
+//   +sd_byte_cycles=N  cycles per byte, 1 moves a block in 512 cycles (default 1)
+//   +sd_jitter=N       extra latency, uniform in 0..N cycles (default 0)
+//   +sd_slow_pct=P     percent of the requests that are slow (default 0)
+//   +sd_slow=N         extra latency of a slow request (default 100000)
+//   +sd_seed=N         seed of the jitter and slow request draws (default 1)
+//   +sd_history=N      completed requests kept in done (default 32)
+//   +sd_report         print the storage report at the end of the run
+#ifndef U765_STORAGE_H
+#define U765_STORAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include "verilated_save.h"
+#include "u765_plusargs.h"
+#include "u765_checkpoint.h"
+
+struct SdRequest {
+    uint64_t issued = 0;   // cycle sd_rd/sd_wr was seen
+    uint64_t ready = 0;    // cycle the first byte may move
+    uint64_t started = 0;  // cycle it was taken from pending
+    uint64_t done = 0;     // cycle of the last byte
+    uint32_t lba = 0;
+    uint8_t drive = 0;
+    bool write = false;
+    bool slow = false;
+};
+
+class StorageModel {
+public:
+    uint32_t latency = 0;
+    uint32_t byte_cycles = 1;
+    uint32_t jitter = 0;
+    uint32_t slow_pct = 0;
+    uint32_t slow_latency = 100000;
+    uint64_t seed = 1;
+    size_t history = 32;
+    bool enabled = false;  // +sd_report
+
+    std::deque<SdRequest> pending;  // issued, not served yet
+    std::deque<SdRequest> done;     // last served requests, oldest first
+    uint64_t cycle = 0;             // clk_sys cycles seen by the server
+
+    // Totals over every served request
+    uint64_t requests = 0;
+    uint64_t writes = 0;
+    uint64_t slow_requests = 0;
+    uint64_t wait_total = 0;  // issue -> first byte, what the core spends in sd_busy before data
+    uint64_t wait_max = 0;
+    uint64_t busy_total = 0;  // issue -> last byte
+    uint64_t busy_max = 0;
+    size_t depth_max = 0;
+
+    void configure() {
+        latency = plusarg_int("sd_latency", latency);
+        byte_cycles = plusarg_int("sd_byte_cycles", byte_cycles);
+        jitter = plusarg_int("sd_jitter", jitter);
+        slow_pct = plusarg_int("sd_slow_pct", slow_pct);
+        slow_latency = plusarg_int("sd_slow", slow_latency);
+        seed = plusarg_int("sd_seed", seed);
+        history = plusarg_int("sd_history", history);
+        enabled = plusarg_flag("sd_report");
+        if (byte_cycles < 1) byte_cycles = 1;
+        if (slow_pct > 100) slow_pct = 100;
+        rng = seed ? seed : 1;
+    }
+
+    bool ideal() const { return !latency && !jitter && !slow_pct && byte_cycles == 1; }
+
+    // Once per clk_sys cycle, before the server looks at the queue
+    inline void tick() { cycle++; }
+
+    // Queue a request the core just raised
+    void issue(int drive, uint32_t lba, bool write) {
+        SdRequest r;
+        r.issued = cycle;
+        r.lba = lba;
+        r.drive = drive;
+        r.write = write;
+        uint64_t extra = jitter ? next_random() % (jitter + 1) : 0;
+        if (slow_pct && next_random() % 100 < slow_pct) {
+            r.slow = true;
+            extra += slow_latency;
+        }
+        r.ready = cycle + latency + extra;
+        pending.push_back(r);
+        depth_max = std::max(depth_max, pending.size());
+    }
+
+    // Take the oldest request once its latency is over. Returns false if there is none
+    bool start(SdRequest &r) {
+        if (pending.empty() || pending.front().ready > cycle) return false;
+        pending.front().started = cycle;
+        current = pending.front();
+        pending.pop_front();
+        r = current;
+        return true;
+    }
+
+    // The last byte of the request taken by start() has moved
+    void complete() {
+        current.done = cycle;
+        uint64_t wait = current.started - current.issued;
+        uint64_t busy = current.done - current.issued;
+        requests++;
+        if (current.write) writes++;
+        if (current.slow) slow_requests++;
+        wait_total += wait;
+        wait_max = std::max(wait_max, wait);
+        busy_total += busy;
+        busy_max = std::max(busy_max, busy);
+        done.push_back(current);
+        while (done.size() > history) done.pop_front();
+    }
+
+    double wait_avg() const { return requests ? (double)wait_total / requests : 0; }
+    double busy_avg() const { return requests ? (double)busy_total / requests : 0; }
+
+    void report(FILE *f = stdout) const {
+        fprintf(f, "\n=== SD storage model ===\n");
+        fprintf(f, "latency %u, jitter %u, %u cycle(s)/byte, %u%% slow (+%u), seed %llu\n", latency,
+                jitter, byte_cycles, slow_pct, slow_latency, (unsigned long long)seed);
+        fprintf(f, "%llu requests (%llu writes, %llu slow), max queue depth %zu\n",
+                (unsigned long long)requests, (unsigned long long)writes,
+                (unsigned long long)slow_requests, depth_max);
+        fprintf(f, "wait to first byte: avg %.1f max %llu cycles\n", wait_avg(),
+                (unsigned long long)wait_max);
+        fprintf(f, "request to last byte: avg %.1f max %llu cycles, %.3f bytes/cycle\n", busy_avg(),
+                (unsigned long long)busy_max,
+                busy_total ? (double)requests * SD_BLOCK_BYTES / busy_total : 0.0);
+        fprintf(f, "pending: %zu\n", pending.size());
+        for (const SdRequest &r : pending) print(f, r);
+        fprintf(f, "last %zu completed:\n", done.size());
+        for (const SdRequest &r : done) print(f, r);
+    }
+
+    // Checkpoint the queue and the counters. The configuration comes from the plusargs
+    void save(VerilatedSerialize &os) const {
+        ckpt_put(os, cycle);
+        ckpt_put(os, rng);
+        ckpt_put(os, current);
+        ckpt_put(os, (uint32_t)pending.size());
+        for (const SdRequest &r : pending) ckpt_put(os, r);
+        ckpt_put(os, requests);
+        ckpt_put(os, writes);
+        ckpt_put(os, slow_requests);
+        ckpt_put(os, wait_total);
+        ckpt_put(os, wait_max);
+        ckpt_put(os, busy_total);
+        ckpt_put(os, busy_max);
+        ckpt_put(os, depth_max);
+    }
+
+    void restore(VerilatedDeserialize &is) {
+        uint32_t n;
+        ckpt_get(is, cycle);
+        ckpt_get(is, rng);
+        ckpt_get(is, current);
+        ckpt_get(is, n);
+        pending.clear();
+        done.clear();
+        while (n--) {
+            SdRequest r;
+            ckpt_get(is, r);
+            pending.push_back(r);
+        }
+        ckpt_get(is, requests);
+        ckpt_get(is, writes);
+        ckpt_get(is, slow_requests);
+        ckpt_get(is, wait_total);
+        ckpt_get(is, wait_max);
+        ckpt_get(is, busy_total);
+        ckpt_get(is, busy_max);
+        ckpt_get(is, depth_max);
+    }
+
+private:
+    static const int SD_BLOCK_BYTES = 512;
+    uint64_t rng = 1;
+    SdRequest current;  // being served
+
+    uint64_t next_random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+
+    static void print(FILE *f, const SdRequest &r) {
+        fprintf(f, "  %s %c: lba %u issued %llu ready %llu", r.write ? "wr" : "rd", 'A' + r.drive,
+                r.lba, (unsigned long long)r.issued, (unsigned long long)r.ready);
+        if (r.done)
+            fprintf(f, " start %llu done %llu (%llu)%s", (unsigned long long)r.started,
+                    (unsigned long long)r.done, (unsigned long long)(r.done - r.issued),
+                    r.slow ? " slow" : "");
+        fprintf(f, "\n");
+    }
+};
+
+#endif
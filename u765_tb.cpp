@@ -3,198 +3,107 @@
 #include <fstream>
 #include <iomanip>
 #include <vector>
+#include <deque>
 #include <string>
 #include "Vu765_test.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
+#include "u765_plusargs.h"
+#include "u765_sim.h"
+#include "u765_script.h"
 
 double sc_time_stamp() {
     return 0;
 }
 
-static Vu765_test *tb;
-static VerilatedVcdC *trace;
-static int tickcount;
-
-static unsigned char sdbuf[512];
-static FILE *edsk;
-static int reading;
-static int read_ptr;
+// Modelo, imágenes, trazas y contador de ticks: todo el estado de la simulación
+static U765Sim *sim;
+static Checkpointer checkpoints;
+static int warm_track = -1;  // ncn en el que warm_up() dejó la unidad A:, -1 = sin preparar
 static int fast_mode;
+static const char *image_path;  // imagen de A:, $image en los guiones
+static bool script_failed = false;
 
 
 // Estructura para almacenar información sobre las interrupciones
 struct InterruptInfo {
-    int timestamp;
+    uint64_t timestamp;
     int status;
-    std::string cause;
+    const char *cause;
     bool acknowledged;
 };
 
-// Registro de interrupciones para análisis posterior
-static std::vector<InterruptInfo> interrupt_log;
+// Registro de interrupciones para análisis posterior, sólo las INTERRUPT_LOG_MAX últimas
+#define INTERRUPT_LOG_MAX 256
+static std::deque<InterruptInfo> interrupt_log;
 
-// Agregamos flags para terminal count e interrupción
-static bool tc_active = false;
-static bool int_out_active = false;
-static bool int_out_previous = false;
+// Contadores de interrupciones (los flags de tc e int_out están en U765Sim)
 static int interrupt_count = 0;
 static int unacknowledged_interrupts = 0;
 
-// Función para leer un bloque de la imagen de disco
-int img_read(int sd_rd) {
-    if (!sd_rd) return 0;
-    printf("img_read: %02x lba: %d\n", sd_rd, tb->sd_lba);
-    int lba = tb->sd_lba;
-    fseek(edsk, lba << 9, SEEK_SET);
-    fread(&sdbuf, 512, 1, edsk);
-    reading = 1;
-    read_ptr = 0;
+// Causa probable de una interrupción según el registro de estado
+static const char *interrupt_cause(int status) {
+    //if (status == -1) return "Desconocida (a0 no es 0)";
+    if (status & 0x80) return "Comando completado";
+    if (status & 0x40) return "Ejecución de fase";
+    if (status & 0x20) return "Datos listos";
+    return "Desconocida";
 }
 
-// Ciclo de reloj básico
-void tick(int c) {
-    static int sd_rd = 0;
-    static int sd_wr = 0;
+// Flanco de subida en int_out (nueva interrupción), antes del eval() de ese tick
+static void log_interrupt(U765Sim &sim) {
     int status;
 
-    tb->clk_sys = c;
+    interrupt_count++;
+    unacknowledged_interrupts++;
     
-    // Añadimos manejo de señales tc e int_out
-    tb->tc = tc_active ? 1 : 0;
+    // Guardar información sobre esta interrupción
+    status = sim.tb->a0 == 0 ? sim.tb->dout : -1; // Solo es válido si a0=0
+    InterruptInfo info;
+    info.timestamp = sim.tickcount;
+    info.status = status;
+    info.acknowledged = false;
     
-    // Detectamos flancos de subida en int_out
-    int_out_previous = int_out_active;
-    int_out_active = tb->int_out;
+    // Intentar determinar la causa
+    info.cause = interrupt_cause(status);
     
-    if (!int_out_previous && int_out_active) {
-        // Flanco de subida en int_out (nueva interrupción)
-        interrupt_count++;
-        unacknowledged_interrupts++;
-        
-        // Guardar información sobre esta interrupción
-        status = tb->a0 == 0 ? tb->dout : -1; // Solo es válido si a0=0
-        InterruptInfo info;
-        info.timestamp = tickcount;
-        info.status = status;
-        info.acknowledged = false;
-        
-        // Intentar determinar la causa
-        //if (status != -1) {
-            if (status & 0x80) info.cause = "Comando completado";
-            else if (status & 0x40) info.cause = "Ejecución de fase";
-            else if (status & 0x20) info.cause = "Datos listos";
-            else info.cause = "Desconocida";
-        //} else {
-        //    info.cause = "Desconocida (a0 no es 0)";
-        //}
-        
-        interrupt_log.push_back(info);
-        
-        printf("--- NUEVA INTERRUPCIÓN [%d] en tick %d ---\n", interrupt_count, tickcount);
-        printf("Estado: %s (0x%02x)\n", info.cause.c_str(), status);
+    if (interrupt_log.size() == INTERRUPT_LOG_MAX) interrupt_log.pop_front();
+    interrupt_log.push_back(info);
+    
+    if (sim.verbose) {
+        printf("--- NUEVA INTERRUPCIÓN [%d] en tick %llu ---\n", interrupt_count,
+               (unsigned long long)sim.tickcount);
+        printf("Estado: %s (0x%02x)\n", info.cause, status);
         printf("Interrupciones sin reconocer: %d\n", unacknowledged_interrupts);
     }
-    
-    tb->eval();
-    trace->dump(tickcount++);
-
-    if (c) {
-        if (reading) {
-            tb->sd_ack = 1;
-            tb->sd_buff_wr = 1;
-            tb->sd_buff_dout = sdbuf[read_ptr];
-            tb->sd_buff_addr = read_ptr;
-            read_ptr++;
-            if (read_ptr == 512) reading = 0;
-        } else {
-            tb->sd_ack = 0;
-            tb->sd_buff_wr = 0;
-        }
+}
 
-        if (sd_rd != tb->sd_rd) img_read(tb->sd_rd);
-        sd_rd = tb->sd_rd;
-    }
+// Ciclos de bus del u765 (ver U765Sim)
+void tick(int c) {
+    sim->tick(c);
 }
 
 void wait(int t) {
-    for (int i=0; i<t; i++) {
-        tick(1);
-        tick(0);
-    }
+    sim->wait(t);
 }
 
 // Lee el registro de estado del u765
 int readstatus() {
-    int dout;
-
-    tb->a0 = 0;
-    tick(1);
-    tick(0);
-    tb->nRD = 0;
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    dout = tb->dout;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    
-    // Interpretar los bits del registro de estado
-    printf("READ STATUS = 0x%02x [ ", dout);
-    if (dout & 0x80) printf("RQM ");
-    if (dout & 0x40) printf("DIO ");
-    if (dout & 0x20) printf("EXM ");
-    if (dout & 0x10) printf("CB ");
-    if (dout & 0x08) printf("D3B ");
-    if (dout & 0x04) printf("D2B ");
-    if (dout & 0x02) printf("D1B ");
-    if (dout & 0x01) printf("D0B ");
-    printf("]\n");
-    
-    return dout;
+    return sim->readstatus();
 }
 
 // Envía un byte al controlador u765
 void sendbyte(int byte) {
-    while ((readstatus() & 0xcf) != 0x80) {};
-    tb->a0 = 1;
-    tick(1);
-    tick(0);
-    tb->nRD = 1;
-    tb->nWR = 0;
-    tb->din = byte;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
+    sim->sendbyte(byte);
+}
+
+// Ciclo de escritura en el registro de datos, sin esperar a RQM
+void buswrite(int byte) {
+    sim->buswrite(byte);
 }
 
 // Lee un byte del controlador u765
 int readbyte() {
-    int byte;
-
-    while ((readstatus() & 0xcf) != 0xc0) {};
-    tb->a0 = 1;
-    tick(1);
-    tick(0);
-    tb->nRD = 0;
-    tb->nWR = 1;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    byte = tb->dout;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    printf("READ DATA = 0x%02x\n", byte);
-    return byte;
+    return sim->readbyte();
 }
 
 // Lee el resultado de un comando
@@ -209,34 +118,20 @@ void read_result() {
     printf("N   = 0x%02x\n", readbyte());
 }
 
-// Lee datos de un sector
-void read_data() {
-    int status, byte;
-    int offs=0;
-    long chksum=0;
+// Lee datos de un sector, devuelve la suma de los bytes leídos
+long read_data() {
+    static uint8_t buf[32768];
+    long chksum;
+    int count = sim->read_exec(buf, sizeof(buf), &chksum);
 
-    while(true) {
-        while (((status=readstatus()) & 0xcf) != 0xc0) {};
-        if ((status & 0x20) != 0x20) {
-            printf("Data sum: %ld\n", chksum);
-            return;
+    if (sim->verbose) {
+        for (int offs = 0; offs < count && offs < (int)sizeof(buf); offs++) {
+            printf("%02x ", buf[offs]);
+            if (((offs + 1) % 16) == 0) printf("\n %03x ", offs + 1);
         }
-        tb->a0 = 1;
-        tb->nRD = 0;
-        tb->nWR = 1;
-        tick(1);
-        tick(0);
-        tick(1);
-        tick(0);
-        byte = tb->dout;
-        tb->nRD = 1;
-        tick(1);
-        tick(0);
-        chksum += byte;
-        printf("%02x ", byte);
-        offs++;
-        if ((offs%16)==0) printf("\n %03x ", offs);
     }
+    printf("Data bytes: %d, sum: %ld\n", count, chksum);
+    return chksum;
 }
 
 // Comandos FDC estándar
@@ -261,7 +156,7 @@ void cmd_read_id(int head) {
     read_result();
 }
 
-void cmd_read(int c, int h, int r, int n, int eot, int gpl, int dtl) {
+long cmd_read(int c, int h, int r, int n, int eot, int gpl, int dtl) {
     printf("=== READ ===\n");
     sendbyte(0x06);
     sendbyte(h << 2);
@@ -273,34 +168,108 @@ void cmd_read(int c, int h, int r, int n, int eot, int gpl, int dtl) {
     sendbyte(gpl);
     sendbyte(dtl);
 
-    read_data();
+    long chksum = read_data();
     read_result();
+    return chksum;
+}
+
+// Envía los datos de la fase de ejecución de WRITE DATA. Devuelve los bytes aceptados,
+// que son menos de len si el controlador pasa antes a la fase de resultados
+int write_data(const unsigned char *buf, int len) {
+    int written = sim->write_exec(buf, len);
+    if (written < len) printf("WRITE: fase de resultados tras %d de %d bytes\n", written, len);
+    return written;
+}
+
+// WRITE DATA de los sectores r..eot, todos de tamaño 128 << n
+int cmd_write(int c, int h, int r, int n, int eot, int gpl, int dtl, const unsigned char *buf) {
+    printf("=== WRITE ===\n");
+    sendbyte(0x05);
+    sendbyte(h << 2);
+    sendbyte(c);
+    sendbyte(h);
+    sendbyte(r);
+    sendbyte(n);
+    sendbyte(eot);
+    sendbyte(gpl);
+    sendbyte(dtl);
+
+    int written = write_data(buf, (eot - r + 1) * (128 << n));
+    read_result();
+    return written;
+}
+
+// SPECIFY con los tiempos del PCW; nd=false pasa la fase de ejecución a DMA (drq/dack)
+void cmd_specify(bool nd) {
+    printf("=== SPECIFY (%s) ===\n", nd ? "no DMA" : "DMA");
+    sendbyte(0x03);
+    sendbyte(0xdf);
+    sendbyte(0x02 | (nd ? 1 : 0));
+}
+
+// READ DATA en modo DMA: el agente DMA solo espera a drq, sin leer el estado. Con count,
+// tc termina la transferencia en el byte count
+long cmd_read_dma(int c, int h, int r, int n, int eot, int gpl, int dtl, int count, int *bytes) {
+    static uint8_t buf[32768];
+    long chksum;
+
+    printf("=== READ (DMA) ===\n");
+    sendbyte(0x06);
+    sendbyte(h << 2);
+    sendbyte(c);
+    sendbyte(h);
+    sendbyte(r);
+    sendbyte(n);
+    sendbyte(eot);
+    sendbyte(gpl);
+    sendbyte(dtl);
+
+    int got = sim->dma_read(buf, sizeof(buf), &chksum, count);
+    printf("Data bytes: %d, sum: %ld\n", got, chksum);
+    if (bytes) *bytes = got;
+    read_result();
+    return chksum;
 }
 
 // Nueva función para configurar Terminal Count
 void set_tc(bool active) {
-    tc_active = active;
+    sim->tc_active = active;
     printf("Setting TC to %s\n", active ? "ACTIVE" : "INACTIVE");
 }
 
 // Funciones para gestión de interrupciones
 bool check_int_out() {
-    return int_out_active;
+    return sim->int_out_active;
+}
+
+// Espera la interrupción de fin de seek/recalibrado vigilando int_out, sin ciclos de bus
+bool wait_interrupt() {
+    if (sim->wait_int()) return true;
+    printf("Tiempo agotado esperando la interrupción\n");
+    return false;
+}
+
+// Número de la interrupción en la posición i del registro (las más viejas se descartan)
+static int interrupt_number(size_t i) {
+    return interrupt_count - interrupt_log.size() + i + 1;
 }
 
 // Reconoce una interrupción pendiente
 void acknowledge_interrupt() {
     if (unacknowledged_interrupts > 0) {
-        // Buscamos la última interrupción no reconocida
-        for (int i = interrupt_log.size() - 1; i >= 0; i--) {
+        // Buscamos la última interrupción no reconocida. Si ya salió del registro
+        // se reconoce igualmente, el contador es lo que cuenta
+        int i;
+        for (i = interrupt_log.size() - 1; i >= 0; i--) {
             if (!interrupt_log[i].acknowledged) {
                 interrupt_log[i].acknowledged = true;
-                unacknowledged_interrupts--;
-                printf("Interrupción [%d] reconocida. Quedan %d sin reconocer.\n", 
-                       i + 1, unacknowledged_interrupts);
                 break;
             }
         }
+        unacknowledged_interrupts--;
+        if (sim->verbose)
+            printf("Interrupción [%d] reconocida. Quedan %d sin reconocer.\n",
+                   i < 0 ? 0 : interrupt_number(i), unacknowledged_interrupts);
     }
 }
 
@@ -322,16 +291,16 @@ void analyze_interrupts() {
     printf("Total de interrupciones: %d\n", interrupt_count);
     printf("Interrupciones sin reconocer: %d\n", unacknowledged_interrupts);
     
-    printf("\nRegistro de interrupciones:\n");
+    printf("\nRegistro de interrupciones (últimas %zu):\n", interrupt_log.size());
     printf("------------------------------------------\n");
     printf("| # | Timestamp | Estado  | Causa                | Reconocida |\n");
     printf("------------------------------------------\n");
     
     for (size_t i = 0; i < interrupt_log.size(); i++) {
         const InterruptInfo& info = interrupt_log[i];
-        printf("| %2zu | %9d | 0x%02x | %-20s | %-10s |\n", 
-               i + 1, info.timestamp, info.status, 
-               info.cause.c_str(), 
+        printf("| %2d | %9llu | 0x%02x | %-20s | %-10s |\n", 
+               interrupt_number(i), (unsigned long long)info.timestamp, info.status, 
+               info.cause, 
                info.acknowledged ? "Sí" : "No");
     }
     printf("------------------------------------------\n");
@@ -345,53 +314,100 @@ void analyze_interrupts() {
         printf("Interrupciones sin reconocer:\n");
         for (size_t i = 0; i < interrupt_log.size(); i++) {
             if (!interrupt_log[i].acknowledged) {
-                printf("  - Interrupción #%zu, causa: %s\n", 
-                       i + 1, interrupt_log[i].cause.c_str());
+                printf("  - Interrupción #%d, causa: %s\n", 
+                       interrupt_number(i), interrupt_log[i].cause);
             }
         }
     }
 }
 
 // Monta una imagen de disco
-void mount(FILE *edsk, int dno) {
-    int fsize;
+bool mount(const char *path, int dno) {
+    if (!sim->mount(path, dno)) {
+        printf("No se puede abrir %s.\n", path);
+        return false;
+    }
+    return true;
+}
 
-    fseek(edsk, 0, SEEK_END);
-    fsize = ftell(edsk);
-    tb->img_size = fsize;
-    tb->img_mounted = 1<<dno;
-    tick(1);
-    tick(0);
-    tb->img_mounted = 0;
-    wait(1000);
+// Estado del banco de pruebas que acompaña al modelo en un checkpoint
+static void save_harness(VerilatedSerialize &os) {
+    sim->save(os);
+    ckpt_put(os, interrupt_count);
+    ckpt_put(os, unacknowledged_interrupts);
+    ckpt_put(os, warm_track);
+    ckpt_put(os, fast_mode);
+    ckpt_put(os, (uint32_t)interrupt_log.size());
+    for (const InterruptInfo &info : interrupt_log) {
+        ckpt_put(os, info.timestamp);
+        ckpt_put(os, info.status);
+        ckpt_put(os, info.acknowledged);
+    }
+}
+
+static bool restore_harness(VerilatedDeserialize &is) {
+    uint32_t n;
+    bool ok = sim->restore(is);
+    ckpt_get(is, interrupt_count);
+    ckpt_get(is, unacknowledged_interrupts);
+    ckpt_get(is, warm_track);
+    ckpt_get(is, fast_mode);
+    ckpt_get(is, n);
+    interrupt_log.clear();
+    while (n--) {
+        InterruptInfo info;
+        ckpt_get(is, info.timestamp);
+        ckpt_get(is, info.status);
+        ckpt_get(is, info.acknowledged);
+        info.cause = interrupt_cause(info.status);
+        interrupt_log.push_back(info);
+    }
+    return ok;
+}
+
+// Prólogo común: recalibra la unidad A: y, si ncn > 0, la lleva a ese cilindro. Guarda
+// los checkpoints "mounted" (montada y recalibrada) y "track<ncn>" con +ckpt_save
+void warm_up(int ncn) {
+    printf("\n=== PREPARANDO LA UNIDAD A: ===\n");
+    cmd_recalibrate();
+    if (wait_interrupt()) cmd_sense_interrupt();
+    warm_track = 0;
+    checkpoints.save(sim->tb, "mounted");
+
+    if (ncn > 0) {
+        cmd_seek(ncn);
+        if (wait_interrupt()) cmd_sense_interrupt();
+        warm_track = ncn;
+        checkpoints.save(sim->tb, ("track" + std::to_string(ncn)).c_str());
+    }
 }
 
 // Secuencia de arranque del PCW basada en la ROM analizada
 void pcw_boot_sequence() {
     printf("\n=== INICIANDO SECUENCIA DE ARRANQUE PCW ===\n");
     
-    // Inicialización similar a la ROM PCW
-    tb->reset = 1;
-    wait(10);
-    tb->reset = 0;
-    wait(50);
+    if (warm_track == 0) {
+        // Restaurado o preparado por warm_up(): la unidad ya está recalibrada
+        printf("\n=== FASE 1: unidad ya recalibrada por warm_up() ===\n");
+    } else {
+        // Inicialización similar a la ROM PCW
+        sim->reset();
     
-    // Primera fase - Recalibración y configuración
-    printf("\n=== FASE 1: RECALIBRACIÓN Y CONFIGURACIÓN ===\n");
-    cmd_recalibrate();
-    wait(1000);
+        // Primera fase - Recalibración y configuración
+        printf("\n=== FASE 1: RECALIBRACIÓN Y CONFIGURACIÓN ===\n");
+        cmd_recalibrate();
     
-    // Comprobar interrupciones después de la recalibración
-    if (check_int_out()) {
-        printf("Interrupción detectada después de recalibrar.\n");
-        // Usar Sense Interrupt Status para reconocer interrupción
-        cmd_sense_interrupt();
+        // Esperar la interrupción de la recalibración
+        if (wait_interrupt()) {
+            printf("Interrupción detectada después de recalibrar.\n");
+            // Usar Sense Interrupt Status para reconocer interrupción
+            cmd_sense_interrupt();
+        }
     }
     
     // Segunda fase - Lectura del sector de arranque (Track 0, Sector 1)
     printf("\n=== FASE 2: LEYENDO SECTOR DE ARRANQUE ===\n");
     cmd_read(0, 0, 1, 2, 0xff, 0x2A, 0xff);
-    wait(100);
     
     // Comprobar interrupciones después de leer el sector de arranque
     if (check_int_out()) {
@@ -405,10 +421,9 @@ void pcw_boot_sequence() {
     
     // Buscar pista 1
     cmd_seek(1);
-    wait(500);
     
-    // Comprobar interrupciones después del seek
-    if (check_int_out()) {
+    // Esperar la interrupción del seek
+    if (wait_interrupt()) {
         printf("Interrupción detectada después de seek a pista 1.\n");
         // Usar Sense Interrupt Status para reconocer interrupción
         cmd_sense_interrupt();
@@ -418,7 +433,6 @@ void pcw_boot_sequence() {
     // Primero el CCP (Console Command Processor)
     printf("\n-- Leyendo CCP (Console Command Processor) --\n");
     cmd_read(1, 0, 0x01, 2, 0x09, 0x2A, 0xff);
-    wait(100);
     
     // Comprobar interrupciones después de leer CCP
     if (check_int_out()) {
@@ -429,7 +443,6 @@ void pcw_boot_sequence() {
     // Luego el BDOS (Basic Disk Operating System)
     printf("\n-- Leyendo BDOS (Basic Disk Operating System) --\n");
     cmd_read(1, 0, 0x0A, 2, 0x12, 0x2A, 0xff);
-    wait(100);
     
     // Comprobar interrupciones después de leer BDOS
     if (check_int_out()) {
@@ -439,7 +452,6 @@ void pcw_boot_sequence() {
     // Finalmente el BIOS (Basic Input/Output System)
     printf("\n-- Leyendo BIOS (Basic Input/Output System) --\n");
     cmd_read(1, 0, 0x13, 2, 0x1A, 0x2A, 0xff);
-    wait(100);
     
     // Comprobar interrupciones después de leer BIOS
     if (check_int_out()) {
@@ -449,10 +461,9 @@ void pcw_boot_sequence() {
     // Cuarta fase - Inicialización de sistema y configuración
     printf("\n=== FASE 4: CONFIGURACIÓN DEL SISTEMA ===\n");
     cmd_seek(2);
-    wait(500);
     
-    // Comprobar interrupciones después del seek
-    if (check_int_out()) {
+    // Esperar la interrupción del seek
+    if (wait_interrupt()) {
         printf("Interrupción detectada después de seek a pista 2.\n");
         // Usar Sense Interrupt Status para reconocer interrupción
         cmd_sense_interrupt();
@@ -460,7 +471,6 @@ void pcw_boot_sequence() {
     
     // Leer archivos de configuración (simulado)
     cmd_read(2, 0, 1, 2, 5, 0x2A, 0xff);
-    wait(100);
     
     // Comprobar interrupciones después de leer configuración
     if (check_int_out()) {
@@ -502,17 +512,16 @@ void pcw_boot_sequence() {
             wait(10);
             
             // Leer datos
-            tb->a0 = 1;
-            tb->nRD = 0;
+            sim->tb->a0 = 1;
+            sim->tb->nRD = 0;
             wait(5);
-            tb->nRD = 1;
+            sim->tb->nRD = 1;
             wait(5);
         }
     }
     
     // Intentar iniciar el prompt (simulado)
     printf("\n-- Intentando mostrar el prompt --\n");
-    wait(100);
     
     // Analizar el estado de las interrupciones
     analyze_interrupts();
@@ -525,24 +534,19 @@ void test_interrupciones() {
     printf("\n=== TEST ESPECÍFICO: MANEJO DE INTERRUPCIONES ===\n");
     
     // Inicialización básica
-    tb->reset = 1;
-    wait(10);
-    tb->reset = 0;
-    wait(50);
+    sim->reset();
     
     // Configuración de hardware
-    tb->motor = 1;
-    tb->ready = 1;
-    tb->available = 1;
-    tb->density = 1;
-    tb->fast = fast_mode;
-    wait(1000);
+    sim->tb->motor = 1;
+    sim->tb->ready = 1;
+    sim->tb->available = 1;
+    sim->tb->density = 1;
+    sim->tb->fast = fast_mode;
     
     // 1. Generar y verificar interrupción durante recalibrado
     printf("\n-- Test 1: Interrupción por recalibrado --\n");
     cmd_recalibrate();
-    wait(1000);
-    bool int_after_recal = check_int_out();
+    bool int_after_recal = wait_interrupt();
     printf("Interrupción detectada: %s\n", int_after_recal ? "SÍ" : "NO");
     
     // 2. Intentar varias formas de reconocer la interrupción
@@ -579,18 +583,17 @@ void test_interrupciones() {
     
     // Generar una secuencia de comandos que cause múltiples interrupciones
     cmd_recalibrate();
-    wait(500);
     
     // Verificar interrupción pero NO manejarla (simulando un bug)
-    bool int_after_cmd1 = check_int_out();
+    bool int_after_cmd1 = wait_interrupt();
     printf("Interrupción después de recalibrar: %s\n", int_after_cmd1 ? "SÍ" : "NO");
     //acknowledge_interrupt();
     
     // Ejecutar otro comando sin manejar la interrupción anterior
     cmd_seek(1);
-    wait(500);
     
-    // Verificar interrupciones
+    // Verificar interrupciones (la anterior sigue pendiente, se espera a que acabe el seek)
+    sim->wait_status(0x01, 0x00);
     bool int_after_cmd2 = check_int_out();
     printf("Interrupción después de seek: %s\n", int_after_cmd2 ? "SÍ" : "NO");
     
@@ -599,7 +602,6 @@ void test_interrupciones() {
     // Intentar leer en este estado (con interrupciones pendientes)
     printf("Intentando leer datos con interrupciones pendientes...\n");
     cmd_read(1, 0, 1, 2, 5, 0x2A, 0xff);
-    wait(100);
     
     // Verificar estado final
     bool int_final = check_int_out();
@@ -626,20 +628,19 @@ void test_interrupciones() {
     
     // Simular la secuencia del PCW (basada en la ROM)
     cmd_recalibrate();
-    wait(500);
     
     // Verificar si el PCW podría estar intentando una forma alternativa
     // de manejar las interrupciones basada en los puertos 0xF8/0xF7
-    if (check_int_out()) {
+    if (wait_interrupt()) {
         printf("Simulando manejo de interrupciones estilo PCW...\n");
         
         // Simular la secuencia vista en la ROM (update_config)
-        tb->a0 = 0;  // Dirección A0=0 (registro de estado)
+        sim->tb->a0 = 0;  // Dirección A0=0 (registro de estado)
         wait(5);
         
         // Simular comportamiento en port_config_loop de la ROM
         int status = readstatus();
-        printf("Verificando bit 5 (EXM): %s\n", (tb->int_out) ? "Activo" : "Inactivo");
+        printf("Verificando bit 5 (EXM): %s\n", (sim->tb->int_out) ? "Activo" : "Inactivo");
         
         // Verificar si la interrupción se borró con este método
         bool cleared_pcw = !check_int_out();
@@ -656,64 +657,118 @@ void test_interrupciones() {
     analyze_interrupts();
 }
 
-int main(int argc, char **argv) {
-    // Verificar argumentos de línea de comando
-    if (argc < 2) {
-        printf("Uso: %s <archivo.dsk> [test_mode] [fast_mode]\n", argv[0]);
-        printf("  test_mode: 0=boot completo, 1=test interrupciones\n");
-        printf("  fast_mode: 0=real, 1=fast\n");
-        return -1;
+// Test de escritura: WRITE DATA sobre el overlay copy-on-write de la imagen, comprobando
+// la relectura y que al descartar el overlay vuelven los datos originales
+void test_escritura() {
+    static unsigned char pattern[9 * 512];
+    int loops = plusarg_int("write_loops", 1);
+    long expected = 0;
+
+    printf("\n=== TEST DE ESCRITURA ===\n");
+    for (int i = 0; i < (int)sizeof(pattern); i++) pattern[i] = (i * 7 + i / 512) & 0xff;
+    for (int i = 0; i < 512; i++) expected += pattern[i];
+
+    // Con density=1 y una imagen CF2 el seek es de doble paso: el cilindro 1 es el ncn 2.
+    // Desde un checkpoint "track2" (+warm=2) la unidad ya está ahí
+    if (warm_track != 2) {
+        cmd_recalibrate();
+        if (wait_interrupt()) cmd_sense_interrupt();
+        cmd_seek(2);
+        if (wait_interrupt()) cmd_sense_interrupt();
     }
 
-    // Modo de prueba (0=boot normal, 1=test interrupciones)
-    int test_mode = (argc > 2) ? atoi(argv[2]) : 0;
-    fast_mode = (argc > 3) ? atoi(argv[3]) : 0;
-    // Inicializar disco de prueba
-    edsk = fopen(argv[1], "rb");
-    if (!edsk) {
-        printf("No se puede abrir %s.\n", argv[1]);
-        return -1;
+    long base_sum = cmd_read(1, 0, 1, 2, 1, 0x2A, 0xff);
+
+    for (int loop = 0; loop < loops; loop++) {
+        if (loop) {
+            // Reset instantáneo: se descartan los bloques escritos, la imagen no se copia
+            sim->images.reset_overlays();
+            long sum = cmd_read(1, 0, 1, 2, 1, 0x2A, 0xff);
+            printf("Lectura tras descartar el overlay: %s\n", sum == base_sum ? "OK" : "ERROR");
+        }
+
+        uint64_t start = sim->tickcount;
+        uint64_t blocks = sim->images.blocks_written();
+        int written = cmd_write(1, 0, 1, 2, 9, 0x2A, 0xff, pattern);
+        int ticks = sim->tickcount - start;
+        blocks = sim->images.blocks_written() - blocks;
+        printf("Escritura %d: %d bytes, %llu bloques SD en %d ticks (%.1f bytes/kticks)\n",
+               loop, written, (unsigned long long)blocks, ticks,
+               ticks ? written * 1000.0 / ticks : 0.0);
+
+        long sum = cmd_read(1, 0, 1, 2, 1, 0x2A, 0xff);
+        printf("Lectura tras escribir: %s\n", sum == expected ? "OK" : "ERROR");
     }
+}
 
-    // Inicializar variables de Verilator
-    Verilated::commandArgs(argc, argv);
-    Verilated::traceEverOn(true);
-    trace = new VerilatedVcdC;
-    tickcount = 0;
-
-    // Crear una instancia de nuestro módulo bajo prueba
-    tb = new Vu765_test;
-    tb->trace(trace, 99);
-    trace->open("pcw_u765.vcd");
-
-    // Configuración inicial
-    tb->reset = 1;
-    tb->ce = 1;
-    tb->nWR = 1;
-    tb->nRD = 1;
-    tick(1);
-    tick(0);
-    tick(1);
-    tick(0);
-    tb->reset = 0;
-
-    reading = 0;
-    mount(edsk, 0);
-
-    tb->motor = 1;
-    tb->ready = 1;
-    tb->available = 1;
-    tb->density = 1;
-
-    wait(1000);
-
-    // Ejecutar el test seleccionado
+// Test DMA: la pista 0 leída por E/S programada y por DMA, con su coste en ticks, y una
+// lectura DMA cortada por tc tras el primer sector
+void test_dma() {
+    printf("\n=== TEST DMA ===\n");
+    if (warm_track != 0) {
+        cmd_recalibrate();
+        if (wait_interrupt()) cmd_sense_interrupt();
+    }
+
+    uint64_t start = sim->tickcount;
+    long pio_sum = cmd_read(0, 0, 1, 2, 9, 0x2A, 0xff);
+    uint64_t pio_ticks = sim->tickcount - start;
+
+    // SPECIFY deja una interrupción pendiente
+    cmd_specify(false);
+    if (sim->wait_int(16)) cmd_sense_interrupt();
+
+    int bytes;
+    start = sim->tickcount;
+    long dma_sum = cmd_read_dma(0, 0, 1, 2, 9, 0x2A, 0xff, 0, &bytes);
+    uint64_t dma_ticks = sim->tickcount - start;
+
+    printf("PIO: %llu ticks, DMA: %llu ticks para %d bytes (%.1f%% del tiempo PIO)\n",
+           (unsigned long long)pio_ticks, (unsigned long long)dma_ticks, bytes,
+           pio_ticks ? dma_ticks * 100.0 / pio_ticks : 0.0);
+    printf("Suma PIO/DMA: %s\n", pio_sum == dma_sum ? "OK" : "ERROR");
+
+    cmd_read_dma(0, 0, 1, 2, 9, 0x2A, 0xff, 512, &bytes);
+    printf("Lectura cortada por tc: %s (%d bytes)\n", bytes == 512 ? "OK" : "ERROR", bytes);
+
+    cmd_specify(true);
+    if (sim->wait_int(16)) cmd_sense_interrupt();
+}
+
+// Guion de escenario de +script (ver u765_script.h); las capturas de +bus_rec se reproducen
+// igual, a toda velocidad o con +script_timing respetando sus ciclos
+void test_script() {
+    std::string path = plusarg_str("script", "");
+    if (path.empty()) {
+        printf("Falta +script=archivo\n");
+        script_failed = true;
+        return;
+    }
+    ScriptRunner script(*sim, image_path);
+    script.configure();
+    uint64_t start = sim->tickcount;
+    bool ok = script.run_file(path);
+    printf("Guion %s: %s, %llu sentencias, %llu comandos, %llu bytes, %llu ciclos\n", path.c_str(),
+           ok ? "OK" : "ERROR", (unsigned long long)script.statements, (unsigned long long)script.commands,
+           (unsigned long long)script.bytes, (unsigned long long)(sim->tickcount - start) / 2);
+    if (!ok) printf("  %s\n", script.error.c_str());
+    script_failed = !ok;
+}
+
+// Ejecuta el test seleccionado e imprime el resumen
+void run_test(int test_mode) {
     if (test_mode == 0) {
         // Ejecutar secuencia completa de arranque del PCW
         pcw_boot_sequence();
     } else if (test_mode == 1) {
         // Ejecutar test específico de interrupciones
         test_interrupciones();
+    } else if (test_mode == 2) {
+        test_escritura();
+    } else if (test_mode == 3) {
+        test_dma();
+    } else if (test_mode == 4) {
+        test_script();
     } else {
         printf("Modo de prueba no válido\n");
     }
@@ -721,12 +776,136 @@ int main(int argc, char **argv) {
     // Imprimir resumen final
     printf("\n=== RESUMEN FINAL DE LA PRUEBA ===\n");
     analyze_interrupts();
+    printf("Bloques SD: %llu leídos, %llu escritos\n", (unsigned long long)sim->images.blocks_read,
+           (unsigned long long)sim->images.blocks_written());
+    if (sim->watchdog.trips) printf("Vigilante: %d disparo(s)\n", sim->watchdog.trips);
+    if (plusarg_flag("rec_exit")) sim->recorder.dump();
+    if (sim->profiler.enabled) sim->profiler.report();
+    if (sim->states.enabled) sim->states.report(stdout, sim->profiler.khz);
+    if (sim->images.storage.enabled) sim->images.storage.report();
+    if (sim->lockstep.enabled) {
+        sim->lockstep.verify_images(sim->images);
+        sim->lockstep.report();
+    }
+}
+
+int main(int argc, char **argv) {
+    Verilated::commandArgs(argc, argv);
+    std::vector<char *> args = plusargs_init(argc, argv);
+    argc = args.size();
+    argv = args.data();
+
+    // Verificar argumentos de línea de comando
+    if (argc < 2) {
+        printf("Uso: %s <archivo.dsk> [test_mode] [fast_mode]\n", argv[0]);
+        printf("  test_mode: 0=boot completo, 1=test interrupciones, 2=test escritura,\n");
+        printf("             3=test DMA (PIO frente a DMA), 4=guion de +script\n");
+        printf("  fast_mode: máscara turbo, 0=real, 1=seek, 2=rotación, 4=carga de cabeza,\n");
+        printf("             8=espera SD, 15=todo\n");
+        printf("  +drive_b=imagen.dsk  monta otra imagen en la unidad B:\n");
+        printf("  +journal=f  +replay=f  +commit=f  diario, carga y volcado del overlay de A:\n");
+        printf("  +write_loops=N  repeticiones del test de escritura\n");
+        printf("  +trace=off|full|trig  captura de ondas FST (por defecto trig, ver u765_trace.h)\n");
+        printf("  +trig_state=S +trig_cmd=S +trig_int +trig_from=N +trig_to=M  disparadores\n");
+        printf("  +trace_pre=N  ticks previos al disparo, solo los puertos y en un .pre.vcd aparte;\n");
+        printf("             para ver las señales internas antes del evento usar +trig_from/+trig_to\n");
+        printf("  +verbose  imprime cada lectura de estado y cada byte\n");
+        printf("  +poll  espera RQM leyendo el registro de estado por el bus (driver antiguo)\n");
+        printf("  +drv_timeout=N  ciclos máximos de espera de RQM o de una interrupción\n");
+        printf("  +rec_size=N +rec_dump=N +rec_file=f +rec_exit  registro binario (u765_recorder.h)\n");
+        printf("  +wd_ticks=N +wd_abort=0  vigilante de cuelgues\n");
+        printf("  +profile +profile_csv=f +profile_khz=N  latencias por comando (u765_profile.h)\n");
+        printf("  +state_profile +state_top=N  tiempo en cada estado de la FSM y transiciones\n");
+        printf("  +warm=N  recalibra y lleva A: al cilindro N antes del test\n");
+        printf("  +ckpt_save=prefijo +ckpt_restore=f  checkpoints (u765_checkpoint.h)\n");
+        printf("  +fork=0,2,2 +fork_log=prefijo  un proceso por modo de prueba\n");
+        printf("  +script=f +script_timing  guion o captura para el modo 4 (u765_script.h)\n");
+        printf("  +bus_rec=f  captura las transacciones del bus como guion (u765_bus.h)\n");
+        printf("  +lockstep +lockstep_tol=N +lockstep_fatal  compara con el modelo (u765_lockstep.h)\n");
+        return -1;
+    }
+
+    // Modo de prueba (0=boot normal, 1=test interrupciones)
+    int test_mode = (argc > 2) ? atoi(argv[2]) : 0;
+    fast_mode = (argc > 3) ? (strtol(argv[3], NULL, 0) & U765_FAST_ALL) : 0;
+    image_path = argv[1];
+    // Crear el modelo bajo prueba con su contexto (lee los plusargs de trazas y registro)
+    sim = new U765Sim("pcw_u765.fst");
+    sim->on_interrupt = log_interrupt;
+    checkpoints.configure();
+    checkpoints.save_harness = save_harness;
+    checkpoints.restore_harness = restore_harness;
+
+    if (checkpoints.restoring()) {
+        // El checkpoint ya trae el reset, el montaje y la preparación de la unidad
+        if (!checkpoints.restore(sim->tb)) return -1;
+        if (argc > 3) sim->tb->fast = fast_mode;
+        else fast_mode = sim->tb->fast;
+        report_fast_mode(fast_mode);
+    } else {
+        // Configuración inicial
+        sim->tb->reset = 1;
+        sim->tb->ce = 1;
+        sim->tb->nWR = 1;
+        sim->tb->nRD = 1;
+        sim->tb->fast = fast_mode;
+        tick(1);
+        tick(0);
+        tick(1);
+        tick(0);
+        sim->tb->reset = 0;
+        report_fast_mode(fast_mode);
+
+        // Montar el disco de prueba en A: y, opcionalmente, otro en B: (+drive_b=imagen.dsk)
+        if (!mount(argv[1], 0)) return -1;
+        std::string drive_b = plusarg_str("drive_b", "");
+        if (!drive_b.empty() && !mount(drive_b.c_str(), 1)) return -1;
+
+        sim->tb->motor = sim->images.drive[1] ? 3 : 1;
+        sim->tb->ready = sim->images.drive[1] ? 3 : 1;
+        sim->tb->available = sim->images.drive[1] ? 3 : 1;
+        sim->tb->density = 1;
+
+        // +warm=N (o +ckpt_save) deja la unidad recalibrada y en el cilindro N
+        int warm = plusarg_int("warm", checkpoints.saving() ? 0 : -1);
+        if (warm >= 0) warm_up(warm);
+    }
+
+    // Las escrituras van a un overlay copy-on-write, la imagen no se modifica nunca
+    std::string replay = plusarg_str("replay", "");
+    if (!replay.empty() && !sim->images.overlay[0].replay_journal(replay.c_str()))
+        printf("No se puede cargar el diario %s\n", replay.c_str());
+    sim->lockstep.load_overlays(sim->images);
+    std::string journal = plusarg_str("journal", "");
+    if (!journal.empty() && !sim->images.overlay[0].open_journal(journal.c_str()))
+        printf("No se puede crear el diario %s\n", journal.c_str());
+
+    // +fork=0,2,2: cada modo de prueba en su propio proceso, todos desde el estado actual
+    std::vector<int> scenarios = parse_int_list(plusarg_str("fork", ""));
+    if (!scenarios.empty()) {
+        int failed = fork_scenarios(scenarios, [](int n, int mode) {
+            sim->trace.fork_child(n);
+            for (int i = 0; i < U765_DRIVES; i++) sim->images.overlay[i].close_journal();
+            run_test(mode);
+            delete sim;
+            return script_failed ? 1 : 0;
+        });
+        delete sim;
+        return failed ? 1 : 0;
+    }
+
+    run_test(test_mode);
+
+    std::string commit = plusarg_str("commit", "");
+    if (!commit.empty()) {
+        if (sim->images.overlay[0].commit(*sim->images.drive[0], commit.c_str()))
+            printf("Imagen con las escrituras guardada en %s\n", commit.c_str());
+        else
+            printf("No se puede guardar %s\n", commit.c_str());
+    }
     
     // Cerrar archivos y liberar recursos
-    fclose(edsk);
-    trace->close();
-    delete tb;
-    delete trace;
+    delete sim;
     
-    return 0;
+    return script_failed ? 1 : 0;
 }
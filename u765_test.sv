@@ -1,12 +1,23 @@
-module u765_test
+// CYCLES/RPM/TRACK_PREFETCH/TRACK_BUFFER_BITS/WRITE_BACK/DRIVES/TRACE_* go to the core, verilator -G
+// can override them. CYCLES and RPM are also on core_cycles/core_rpm for the testbenches
+module u765_test #(
+	parameter CYCLES = 100,
+	parameter RPM = 300,
+	parameter TRACK_PREFETCH = 0,
+	parameter TRACK_BUFFER_BITS = 13,
+	parameter WRITE_BACK = 1,
+	parameter DRIVES = 2,
+	parameter TRACE_LEVEL = 0,
+	parameter TRACE_MASK = 8'hff
+)
 (
 	input            clk_sys,   // sys clock
 	input            ce,        // chip enable
 	input            reset,	    // reset
-	input      [1:0] ready,     // disk is inserted in MiST(er)
-	input      [1:0] motor,     // drive motor
-	input      [1:0] available, // drive available (fake ready signal for SENSE DRIVE command)
-	input            fast,      // "Fast" mode - immediate seek and sector read/write
+	input      [DRIVES-1:0] ready,     // disk is inserted in MiST(er)
+	input      [DRIVES-1:0] motor,     // drive motor
+	input      [DRIVES-1:0] available, // drive available (fake ready signal for SENSE DRIVE command)
+	input      [3:0] fast,      // "Fast" mode knobs - seek, rotation, head load, SD wait
 	input            a0,
 	input            nRD,       // i/o read
 	input            nWR,       // i/o write
@@ -14,32 +25,50 @@ module u765_test
 	output     [7:0] dout,      // i/o data out
     
 	input            tc,
+	output           drq,       // DMA request
+	input            dack,      // DMA acknowledge
     output           activity_led,
-    input     [1:0]  density,
+    input     [DRIVES-1:0] density,
     output           int_out,
-	output           prepare,
-	input      [1:0] img_mounted, // signaling that new image has been mounted
-	input            img_wp,      // write protect. latched at img_mounted
+	output     [DRIVES-1:0] prepare,   // image ready, one per drive
+	input      [DRIVES-1:0] img_mounted, // signaling that new image has been mounted
+	input      [DRIVES-1:0] img_wp,  // write protect, one per drive. latched at img_mounted
 	input     [31:0] img_size,    // size of image in bytes
 	output reg[31:0] sd_lba,
-	output reg [1:0] sd_rd,
-	output reg [1:0] sd_wr,
-	input            sd_ack,
+	output reg [DRIVES-1:0] sd_rd,
+	output reg [DRIVES-1:0] sd_wr,
+	input      [DRIVES-1:0] sd_ack,     // one per drive
 	input      [8:0] sd_buff_addr,
 	input      [7:0] sd_buff_dout,
 	output     [7:0] sd_buff_din,
 	input            sd_buff_wr,
-        output     [7:0] old_state
+        output     [7:0] old_state,
+        output     [7:0] fsm_state,
+        output    [15:0] sd_writes_saved,
+        output    [19:0] core_cycles,  // CYCLES, cycles per ms
+        output    [15:0] core_rpm      // RPM
 );
 
-u765 #(100) u765 (
+assign core_cycles = 20'(CYCLES);
+assign core_rpm = 16'(RPM);
+
+u765 #(
+	.CYCLES(CYCLES),
+	.RPM(RPM),
+	.TRACK_PREFETCH(TRACK_PREFETCH),
+	.TRACK_BUFFER_BITS(TRACK_BUFFER_BITS),
+	.WRITE_BACK(WRITE_BACK),
+	.DRIVES(DRIVES),
+	.TRACE_LEVEL(TRACE_LEVEL),
+	.TRACE_MASK(TRACE_MASK)
+) u765 (
 	.clk_sys(clk_sys),
 	.ce(ce),
 	.reset(reset),
 	.ready(ready),
 	.motor(motor),
 	.available(available),
-	.fast(1'b0),
+	.fast(fast),
 	.a0(a0),
 	.nRD(nRD),
 	.nWR(nWR),
@@ -47,6 +76,8 @@ u765 #(100) u765 (
 	.dout(dout),
 	.int_out(int_out),
 	.tc(tc),
+	.drq(drq),
+	.dack(dack),
 	.activity_led(activity_led),
 	.density(density),
 	.prepare(prepare),
@@ -61,7 +92,9 @@ u765 #(100) u765 (
 	.sd_buff_dout(sd_buff_dout),
 	.sd_buff_din(sd_buff_din),
 	.sd_buff_wr(sd_buff_wr),
-        .old_state(old_state)
+        .old_state(old_state),
+        .fsm_state(fsm_state),
+        .sd_writes_saved(sd_writes_saved)
 );
 
 endmodule
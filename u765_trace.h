@@ -0,0 +1,277 @@
+// Triggered, windowed waveform capture for the u765 testbenches.
+//
+// Instead of dumping every tick into one growing file, the FST trace is only written
+// inside windows opened by runtime triggers. While no window is open, the top level
+// ports are kept in a small pre-trigger ring, which is written next to the FST as a
+// plain VCD when a window opens, so there is some history before the trigger.
+//
+// Limitation: the history is only the ports of TraceSample (bus, SD handshake, int_out,
+// tc and the two state outputs), not the internal signals, and it is a separate file,
+// <trace_file>.<window>.pre.vcd, on its own time axis next to the FST. An FST can't be
+// written backwards, so when the internals before an event matter, open the window
+// early with +trig_from/+trig_to (every signal goes to the FST for that tick range) or
+// use +trace=full.
+//
+// Plusargs:
+//   +trace=off|full|trig  off skips traceEverOn entirely, full dumps every tick (default trig)
+//   +trace_file=name.fst  output file
+//   +trig_state=S         fsm_state enters S (name like READ_RESULTS or number)
+//   +trig_cmd=S           old_state (last command) becomes S
+//   +trig_int             rising edge of int_out
+//   +trig_from=N +trig_to=M  capture the tick range [N, M]
+//   +trig_emergency=0     don't trigger on the EMERGENCY RESET (on by default)
+//   +trace_pre=N          pre-trigger ring depth in ticks, top level ports only (default 2000)
+//   +trace_post=N         ticks captured after the last trigger (default 20000)
+//   +trace_max=N          maximum number of windows (default 16)
+//
+// Built with -DU765_NO_TRACE (model verilated without --trace-fst) the window is always off.
+#ifndef U765_TRACE_H
+#define U765_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Vu765_test.h"
+#include "verilated.h"
+#ifdef U765_NO_TRACE
+// Stand-in for VerilatedFstC when the model has no trace support; never opened
+struct U765NullFst {
+    void open(const char *) {}
+    void dump(uint64_t) {}
+    void flush() {}
+    void close() {}
+};
+typedef U765NullFst U765Fst;
+#else
+#include "verilated_fst_c.h"
+typedef VerilatedFstC U765Fst;
+#endif
+#include "u765_plusargs.h"
+#include "u765_states.h"
+
+enum trace_mode { TRACE_OFF, TRACE_FULL, TRACE_TRIGGERED };
+
+// Top level ports as seen at one tick, for the pre-trigger ring
+struct TraceSample {
+    uint64_t tick;
+    uint32_t sd_lba;
+    uint8_t clk_sys, a0, nRD, nWR, din, dout, int_out, tc;
+    uint8_t sd_rd, sd_wr, sd_ack, old_state, fsm_state;
+};
+
+class TraceWindow {
+public:
+    trace_mode mode = TRACE_TRIGGERED;
+    std::string file;
+    int trig_state = -1;
+    int trig_cmd = -1;
+    bool trig_int = false;
+    bool trig_emergency = true;
+    int64_t trig_from = -1;
+    int64_t trig_to = -1;
+    int pre = 2000;
+    int post = 20000;
+    int max_windows = 16;
+
+    // Read the plusargs and enable tracing in the model's context. Call before creating
+    // the model
+    void configure(const char *default_file,
+                   VerilatedContext *context = Verilated::defaultContextp()) {
+        std::string m = plusarg_str("trace", "trig");
+        if (m == "off" || m == "0") mode = TRACE_OFF;
+        else if (m == "full" || m == "1") mode = TRACE_FULL;
+        else mode = TRACE_TRIGGERED;
+        file = plusarg_str("trace_file", default_file);
+        trig_state = u765_state_parse(plusarg("trig_state"));
+        trig_cmd = u765_state_parse(plusarg("trig_cmd"));
+        trig_int = plusarg_flag("trig_int");
+        trig_emergency = plusarg_int("trig_emergency", 1) != 0;
+        trig_from = plusarg_int("trig_from", -1);
+        trig_to = plusarg_int("trig_to", -1);
+        pre = plusarg_int("trace_pre", pre);
+        post = plusarg_int("trace_post", post);
+        max_windows = plusarg_int("trace_max", max_windows);
+#ifdef U765_NO_TRACE
+        mode = TRACE_OFF;
+#endif
+        if (mode != TRACE_OFF) context->traceEverOn(true);
+        if (pre > 0) ring.resize(pre);
+    }
+
+    // Hook the model into the trace. Call once after the model is created
+    void attach(Vu765_test *tb) {
+        if (mode == TRACE_OFF) return;
+#ifndef U765_NO_TRACE
+        fst = new U765Fst;
+        tb->trace(fst, 99);
+#endif
+        if (mode == TRACE_FULL) open_fst();
+    }
+
+    // Called after every eval()
+    inline void dump(Vu765_test *tb, uint64_t tick) {
+        if (mode == TRACE_OFF) return;
+        if (mode == TRACE_FULL) {
+            fst->dump(tick);
+            return;
+        }
+        triggered_dump(tb, tick);
+    }
+
+    void close() {
+        if (!fst) return;
+        if (opened) fst->close();
+        if (mode == TRACE_TRIGGERED) {
+            printf("Trace: %d window(s) captured", windows);
+            if (windows) printf(" in %s", file.c_str());
+            printf("\n");
+        }
+        delete fst;
+        fst = NULL;
+    }
+
+    // Take the current outputs as the previous values of the triggers. Used after a
+    // checkpoint restore, so the restored state doesn't look like a transition
+    void resync(Vu765_test *tb) {
+        prev_state = tb->fsm_state;
+        prev_cmd = tb->old_state;
+        prev_int = tb->int_out;
+        ring_fill = 0;
+    }
+
+    // In a forked child: windows go to <name>.<n>.fst. A file already opened by the parent
+    // can't be shared, so the child stops tracing instead
+    void fork_child(int n) {
+        if (mode == TRACE_OFF) return;
+        if (opened) {
+            mode = TRACE_OFF;
+            fst = NULL;  // the parent owns it
+            return;
+        }
+        size_t dot = file.rfind('.');
+        if (dot == std::string::npos) dot = file.size();
+        file.insert(dot, "." + std::to_string(n));
+    }
+
+    ~TraceWindow() { close(); }
+
+private:
+    U765Fst *fst = NULL;
+    bool opened = false;
+    bool capturing = false;
+    int remaining = 0;
+    int windows = 0;
+    std::vector<TraceSample> ring;
+    size_t ring_head = 0;
+    size_t ring_fill = 0;
+    uint8_t prev_state = 0, prev_cmd = 0, prev_int = 0;
+
+    void open_fst() {
+        if (opened) return;
+        fst->open(file.c_str());
+        opened = true;
+    }
+
+    bool check_triggers(Vu765_test *tb, uint64_t tick) {
+        bool fired = false;
+        if (trig_state >= 0 && tb->fsm_state == trig_state && prev_state != trig_state) fired = true;
+        if (trig_cmd >= 0 && tb->old_state == trig_cmd && prev_cmd != trig_cmd) fired = true;
+        if (trig_int && tb->int_out && !prev_int) fired = true;
+        if (trig_emergency && tb->fsm_state == U765_COMMAND_RESET && prev_state != U765_COMMAND_RESET)
+            fired = true;
+        if (trig_from >= 0 && tick == (uint64_t)trig_from) fired = true;
+        prev_state = tb->fsm_state;
+        prev_cmd = tb->old_state;
+        prev_int = tb->int_out;
+        return fired;
+    }
+
+    void triggered_dump(Vu765_test *tb, uint64_t tick) {
+        bool in_range = trig_from >= 0 && tick >= (uint64_t)trig_from &&
+                        (trig_to < 0 || tick <= (uint64_t)trig_to);
+
+        if (check_triggers(tb, tick)) {
+            if (!capturing && windows < max_windows) {
+                printf("Trace: trigger at tick %llu (fsm_state=%s), window %d\n",
+                       (unsigned long long)tick, u765_state_name(tb->fsm_state), windows);
+                write_pre_ring();
+                open_fst();
+                capturing = true;
+                windows++;
+            }
+            remaining = post;
+        }
+
+        if (capturing || (in_range && opened)) {
+            fst->dump(tick);
+            if (capturing && !in_range && --remaining <= 0) {
+                capturing = false;
+                fst->flush();
+            }
+        } else if (!ring.empty()) {
+            TraceSample &s = ring[ring_head];
+            s.tick = tick;
+            s.clk_sys = tb->clk_sys;
+            s.a0 = tb->a0;
+            s.nRD = tb->nRD;
+            s.nWR = tb->nWR;
+            s.din = tb->din;
+            s.dout = tb->dout;
+            s.int_out = tb->int_out;
+            s.tc = tb->tc;
+            s.sd_rd = tb->sd_rd;
+            s.sd_wr = tb->sd_wr;
+            s.sd_ack = tb->sd_ack;
+            s.sd_lba = tb->sd_lba;
+            s.old_state = tb->old_state;
+            s.fsm_state = tb->fsm_state;
+            ring_head = (ring_head + 1) % ring.size();
+            if (ring_fill < ring.size()) ring_fill++;
+        }
+    }
+
+    static void vcd_bits(FILE *f, uint32_t v, int width, const char *id) {
+        if (width == 1) {
+            fprintf(f, "%d%s\n", v & 1, id);
+            return;
+        }
+        fputc('b', f);
+        for (int i = width - 1; i >= 0; i--) fputc((v >> i) & 1 ? '1' : '0', f);
+        fprintf(f, " %s\n", id);
+    }
+
+    // The ring holds the ticks before the trigger, write them out as <file>.<window>.pre.vcd
+    void write_pre_ring() {
+        if (!ring_fill) return;
+        char name[512];
+        snprintf(name, sizeof(name), "%s.%d.pre.vcd", file.c_str(), windows);
+        FILE *f = fopen(name, "w");
+        if (!f) return;
+
+        static const struct { const char *name; int width; const char *id; } vars[] = {
+            {"clk_sys", 1, "!"}, {"a0", 1, "\""}, {"nRD", 1, "#"}, {"nWR", 1, "$"},
+            {"din", 8, "%"}, {"dout", 8, "&"}, {"int_out", 1, "'"}, {"tc", 1, "("},
+            {"sd_rd", 4, ")"}, {"sd_wr", 4, "*"}, {"sd_ack", 4, "+"}, {"sd_lba", 32, ","},
+            {"old_state", 8, "-"}, {"fsm_state", 8, "."},
+        };
+        fprintf(f, "$timescale 1ps $end\n$scope module u765_test $end\n");
+        for (auto &v : vars) fprintf(f, "$var wire %d %s %s $end\n", v.width, v.id, v.name);
+        fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+        size_t start = (ring_head + ring.size() - ring_fill) % ring.size();
+        for (size_t i = 0; i < ring_fill; i++) {
+            const TraceSample &s = ring[(start + i) % ring.size()];
+            fprintf(f, "#%llu\n", (unsigned long long)s.tick);
+            const uint32_t vals[] = {s.clk_sys, s.a0, s.nRD, s.nWR, s.din, s.dout, s.int_out,
+                                     s.tc, s.sd_rd, s.sd_wr, s.sd_ack, s.sd_lba, s.old_state,
+                                     s.fsm_state};
+            for (size_t j = 0; j < sizeof(vars) / sizeof(vars[0]); j++)
+                vcd_bits(f, vals[j], vars[j].width, vars[j].id);
+        }
+        fclose(f);
+        ring_fill = 0;
+    }
+};
+
+#endif